@@ -0,0 +1,52 @@
+# bin/bash
+
+# convenient script to test wfb_tx -> rocket_rx end to end without wifi cards, but with the real wifibroadcast path
+# (WBTransmitter FEC encode + injection, WBReceiver capture + FEC decode).
+# Two virtual radios (mac80211_hwsim) in monitor mode on the same channel act as air and ground card.
+# Unlike wfb_tx -l / rocket_rx -l (plain udp, no FEC) the simulated loss (netem on the air card) happens before the FEC decode.
+# Needs root. Run from the build directory, e.g. sudo ../hwsim_loopback.sh 10
+# Usage: hwsim_loopback.sh [simulated_loss_percentage] [FEC_PERCENTAGE]
+
+LOSS_PERCENTAGE=${1:-0}
+FEC_PERCENTAGE=${2:-50}
+CHANNEL=149
+
+set -e
+
+modprobe -r mac80211_hwsim || true
+modprobe mac80211_hwsim radios=2
+sleep 1
+
+# the two newest phys are the hwsim radios
+PHYS=$(ls /sys/class/ieee80211 | sort -V | tail -n 2)
+WLANS=()
+for phy in $PHYS; do
+  wlan=$(ls /sys/class/ieee80211/$phy/device/net | head -n 1)
+  ip link set $wlan down
+  iw dev $wlan set monitor otherbss
+  ip link set $wlan up
+  iw dev $wlan set channel $CHANNEL HT20
+  WLANS+=($wlan)
+done
+TX_WLAN=${WLANS[0]}
+RX_WLAN=${WLANS[1]}
+echo "air: $TX_WLAN ground: $RX_WLAN loss: $LOSS_PERCENTAGE% fec: $FEC_PERCENTAGE%"
+
+if [ "$LOSS_PERCENTAGE" -gt 0 ]; then
+  tc qdisc add dev $TX_WLAN root netem loss $LOSS_PERCENTAGE%
+fi
+
+cleanup() {
+  kill $RX_PID $TX_PID 2>/dev/null || true
+  modprobe -r mac80211_hwsim || true
+}
+trap cleanup EXIT
+
+# ground: FEC decode, frame reassembly, forward to udp 5600 (the decoder)
+./rocket_rx -u 5600 $RX_WLAN &
+RX_PID=$!
+# air: rtp from udp 5601 (e.g. gst-launch ... ! rtph265pay ! udpsink port=5601), FEC encode, inject
+./wfb_tx -u 5601 -k 0 -p $FEC_PERCENTAGE $TX_WLAN &
+TX_PID=$!
+
+wait $RX_PID $TX_PID
\ No newline at end of file
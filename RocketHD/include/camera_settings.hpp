@@ -0,0 +1,105 @@
+#ifndef CAMERA_SETTINGS_H_
+#define CAMERA_SETTINGS_H_
+
+#include <stdexcept>
+#include <string>
+
+// Where the frames come from. Everything except the camera is for development / benchmarking without the air unit
+// hardware.
+enum class CameraSource{
+  // mjpeg camera (device)
+  V4L2_MJPEG,
+  // gstreamer videotestsrc (test_pattern)
+  TEST_PATTERN,
+  // looped replay of a recorded file (file_path), see FileReplaySource
+  FILE_MJPEG,
+  FILE_H265
+};
+
+enum class VideoEncoder{
+  // rockchip hw encoder
+  MPP,
+  // software (x265enc), works everywhere but needs a lot of cpu
+  X265
+};
+
+inline std::string camera_source_to_string(CameraSource source){
+  switch (source) {
+    case CameraSource::V4L2_MJPEG:return "v4l2";
+    case CameraSource::TEST_PATTERN:return "test";
+    case CameraSource::FILE_MJPEG:return "file_mjpeg";
+    case CameraSource::FILE_H265:return "file_h265";
+  }
+  return "v4l2";
+}
+
+// Throws std::runtime_error if unknown
+inline CameraSource camera_source_from_string(const std::string& value){
+  for(auto source:{CameraSource::V4L2_MJPEG,CameraSource::TEST_PATTERN,CameraSource::FILE_MJPEG,CameraSource::FILE_H265}){
+    if(camera_source_to_string(source)==value){
+      return source;
+    }
+  }
+  throw std::runtime_error("unknown source (v4l2 / test / file_mjpeg / file_h265): "+value);
+}
+
+inline std::string video_encoder_to_string(VideoEncoder encoder){
+  return encoder==VideoEncoder::MPP ? "mpp" : "x265";
+}
+
+// Throws std::runtime_error if unknown
+inline VideoEncoder video_encoder_from_string(const std::string& value){
+  if(value=="mpp")return VideoEncoder::MPP;
+  if(value=="x265")return VideoEncoder::X265;
+  throw std::runtime_error("unknown encoder (mpp / x265): "+value);
+}
+
+// Everything that goes into the camera -> encoder -> rtp pipeline
+struct CameraSettings{
+  CameraSource source=CameraSource::V4L2_MJPEG;
+  std::string device="/dev/video0";
+  // videotestsrc pattern, e.g. smpte, ball, snow
+  std::string test_pattern="smpte";
+  // Raw mjpeg (concatenated jpegs, e.g. v4l2src ! filesink) or h265 annex b byte stream.
+  // Scaled to width x height and replayed at fps.
+  std::string file_path;
+  VideoEncoder encoder=VideoEncoder::MPP;
+  int width=1920;
+  int height=1080;
+  int fps=30;
+  int bitrate_kbits=8000;
+  // keyframe interval, in frames
+  int gop_size=30;
+  int rtp_mtu=1024;
+  // VPS / SPS / PPS are re-sent in front of a delta frame if the last ones are older than this (they come with every
+  // keyframe anyway), such that a receiver that joins late doesn't depend on the GOP. 0 disables it.
+  int parameter_set_interval_ms=1000;
+  // Convert the decoded frames to the encoder input format (NV12, padded) with Nv12ConvertStage instead of
+  // videoconvert / videobox
+  bool simd_convert=true;
+  // Simulcast: the camera is encoded a second time at a lower resolution / bitrate, WBLink switches between the two
+  // depending on the link (see SimulcastSelector)
+  bool simulcast_enable=false;
+  int simulcast_width=1280;
+  int simulcast_height=720;
+  int simulcast_bitrate_kbits=2000;
+};
+
+// Bitrate(s), keyframe interval and rtp mtu can be changed on a running pipeline, everything else requires a new
+// pipeline. x265enc only takes the keyframe interval when it is created.
+inline bool camera_settings_require_restart(const CameraSettings& current,const CameraSettings& next){
+  return current.source!=next.source || current.device!=next.device || current.test_pattern!=next.test_pattern ||
+         current.file_path!=next.file_path || current.encoder!=next.encoder ||
+         (next.encoder==VideoEncoder::X265 && current.gop_size!=next.gop_size) || current.width!=next.width || current.height!=next.height ||
+         current.fps!=next.fps || current.simd_convert!=next.simd_convert ||
+         current.simulcast_enable!=next.simulcast_enable || current.simulcast_width!=next.simulcast_width || current.simulcast_height!=next.simulcast_height;
+}
+
+// What the running pipeline takes without restart (see GStreamerStream::update_settings)
+inline bool camera_settings_changed_live(const CameraSettings& current,const CameraSettings& next){
+  return current.bitrate_kbits!=next.bitrate_kbits || current.gop_size!=next.gop_size ||
+         current.simulcast_bitrate_kbits!=next.simulcast_bitrate_kbits || current.rtp_mtu!=next.rtp_mtu ||
+         current.parameter_set_interval_ms!=next.parameter_set_interval_ms;
+}
+
+#endif  // CAMERA_SETTINGS_H_
@@ -0,0 +1,37 @@
+#ifndef CONTROL_SOCKET_H_
+#define CONTROL_SOCKET_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Local control interface: a unix domain (stream) socket, one request per line, the reply is written back
+// followed by an empty line. Clients are served one after another, e.g. "nc -U /tmp/rocket.sock".
+class ControlSocket{
+ public:
+  // Returns the reply to a request (without the trailing empty line)
+  typedef std::function<std::string(const std::string& request)> REQUEST_HANDLER;
+  // Throws std::runtime_error if the socket cannot be created
+  ControlSocket(std::string path,REQUEST_HANDLER handler);
+  ~ControlSocket();
+  ControlSocket(const ControlSocket&)=delete;
+  ControlSocket& operator=(const ControlSocket&)=delete;
+  /**
+   * Loop until stopBackground() is called.
+   * Blocks the calling thread.
+   */
+  void loopUntilStopped();
+  void runInBackground();
+  void stopBackground();
+ private:
+  const std::string m_path;
+  const REQUEST_HANDLER m_handler;
+  int m_listen_fd=-1;
+  std::atomic<bool> m_keep_looping=true;
+  std::unique_ptr<std::thread> m_background_thread;
+  void serve_client(int client_fd);
+};
+
+#endif  // CONTROL_SOCKET_H_
@@ -0,0 +1,50 @@
+#ifndef FILE_REPLAY_SOURCE_H_
+#define FILE_REPLAY_SOURCE_H_
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../lib/wifibroadcast/src/wifibroadcast-spdlog.h"
+
+// Replays a recorded file in a loop, as if it came from a camera: the frames are pushed into an appsrc
+// (is-live, do-timestamp) at a fixed frame rate.
+// The whole file is read into memory once, the pushed buffers point into it (no copy per frame) - recordings
+// for development are a few seconds, not hours.
+// Supported are raw mjpeg (concatenated jpegs, each starting with the SOI marker) and h265 annex b byte streams,
+// which are split into access units.
+class FileReplaySource{
+ public:
+  enum class Format{MJPEG,H265};
+  // Takes ownership of the reference to appsrc.
+  // Throws std::runtime_error if the file cannot be read or contains no frames.
+  FileReplaySource(std::shared_ptr<spdlog::logger> console,GstElement* appsrc,const std::string& path,Format format,int fps);
+  ~FileReplaySource();
+  FileReplaySource(const FileReplaySource&)=delete;
+  FileReplaySource& operator=(const FileReplaySource&)=delete;
+  void start();
+  void stop();
+  [[nodiscard]] std::size_t get_n_frames()const{return m_frames.size();}
+  // offset, size of each frame in data
+  static std::vector<std::pair<std::size_t,std::size_t>> split_mjpeg(const std::vector<uint8_t>& data);
+  static std::vector<std::pair<std::size_t,std::size_t>> split_h265(const std::vector<uint8_t>& data);
+ private:
+  void loop_push();
+ private:
+  std::shared_ptr<spdlog::logger> m_console;
+  GstElement* m_appsrc;
+  const int m_fps;
+  // shared with the pushed buffers, which might be released after this source is gone
+  std::shared_ptr<const std::vector<uint8_t>> m_data;
+  std::vector<std::pair<std::size_t,std::size_t>> m_frames;
+  std::atomic<bool> m_run{false};
+  std::unique_ptr<std::thread> m_thread;
+};
+
+#endif  // FILE_REPLAY_SOURCE_H_
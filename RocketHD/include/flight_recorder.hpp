@@ -0,0 +1,202 @@
+#ifndef FLIGHT_RECORDER_H_
+#define FLIGHT_RECORDER_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rocket_log.hpp"
+
+// Always-on recorder of compact binary events on the hot path (fragments, frames, queue / drop decisions,
+// pipeline changes), to diagnose ms-scale stalls after the fact - the spdlog output and the once per second
+// createDebug() don't have the resolution for that.
+// Every thread writes into its own ring buffer (no locks, no allocation, a few ns per event), the last
+// RING_SIZE events per thread are kept. The rings of all threads are written to a file on request
+// (SIGUSR1 or a watchdog restart, see FlightRecorderDumper), rocket_fr_decode turns that file into a timeline.
+namespace flight_recorder{
+
+enum class EventType : uint16_t{
+  NONE=0,
+  // a: stream index, b: size
+  FRAGMENT_PULLED,
+  // a: stream index, b: (n_fragments << 32) | n_bytes
+  FRAME_CLOSED,
+  // a: stream index, b: DropReason
+  FRAME_DROPPED,
+  // a: stream index, b: 1 if enqueued, 0 if not (inactive simulcast stream)
+  FRAME_TO_TX,
+  // a: n_fragments, b: n_bytes
+  TX_BLOCK_ENQUEUED,
+  // a: n_fragments, b: DropReason
+  TX_BLOCK_DROPPED,
+  // released by the pacer, a: n_fragments of the block, b: airtime in us
+  TX_BLOCK_RELEASED,
+  // a: 0, b: queue latency in us
+  TX_BLOCK_DONE,
+  // a: 0, b: conversion time in us
+  RAW_FRAME_CONVERTED,
+  // a: 0, b: DropReason
+  RAW_FRAME_DROPPED,
+  // a: stream index
+  KEYFRAME_REQUESTED,
+  // a: GstState (the one that was set)
+  PIPELINE_STATE,
+  // a: 0 failed, 1 swapped, 2 swapped without keyframe; b: gap in ms
+  PIPELINE_RECONFIGURED,
+  // the watchdog restarted the pipeline
+  PIPELINE_RESTART,
+  // a: mcs index, b: (fec_percentage << 32) | fec_block_length
+  LINK_ADAPTATION,
+  // a: stream index the simulcast selection switched to
+  SIMULCAST_SWITCH,
+  // a: DumpReason
+  DUMP_REQUESTED,
+};
+
+enum class DropReason : uint32_t{
+  // the tx queue has a max. n of blocks
+  QUEUE_FULL=0,
+  // see MemoryBudget
+  MEMORY_BUDGET,
+  // the frame is bigger than everything the stage may hold
+  TOO_BIG,
+  // decoder output the conversion doesn't support
+  UNSUPPORTED_FORMAT,
+};
+
+enum class DumpReason : uint32_t{
+  SIGNAL=0,
+  WATCHDOG_RESTART,
+};
+
+#pragma pack(push, 1)
+struct Event{
+  // steady clock
+  uint64_t timestamp_ns;
+  EventType type;
+  uint16_t reserved;
+  uint32_t a;
+  uint64_t b;
+};
+#pragma pack(pop)
+static_assert(sizeof(Event)==24);
+
+static constexpr std::size_t RING_SIZE=4096;
+
+// One event of a ring, a seqlock: the dump reads slots while the owning thread writes them, the fields are atomic
+// (no data race) and the sequence tells the reader whether it got the whole event it expected.
+struct EventSlot{
+  // 2*index+1 while the event with that index is written, 2*index+2 once it is complete
+  std::atomic<uint64_t> sequence{0};
+  std::array<std::atomic<uint64_t>,sizeof(Event)/sizeof(uint64_t)> words{};
+};
+static_assert(sizeof(Event)%sizeof(uint64_t)==0);
+
+// Single writer (the owning thread), read while being written during a dump
+struct ThreadRing{
+  std::array<EventSlot,RING_SIZE> events{};
+  // n of events ever written
+  std::atomic<uint64_t> write_index{0};
+  // linux thread id and name, from the thread that registered the ring
+  uint32_t tid=0;
+  char name[16]{};
+  // false once the thread exited, the ring (with its events) is reused by the next new thread
+  std::atomic<bool> in_use{false};
+};
+
+// Returns the ring of the calling thread, registering it on first use
+ThreadRing& get_thread_ring();
+
+static inline uint64_t now_ns(){
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Record an event. Lock free and wait free, can be called from any thread.
+static inline void record(EventType type,uint32_t a=0,uint64_t b=0){
+  thread_local ThreadRing* ring=&get_thread_ring();
+  const auto index=ring->write_index.load(std::memory_order_relaxed);
+  const Event event{now_ns(),type,0,a,b};
+  std::array<uint64_t,sizeof(Event)/sizeof(uint64_t)> words{};
+  std::memcpy(words.data(),&event,sizeof(Event));
+  auto& slot=ring->events[index%RING_SIZE];
+  slot.sequence.store(2*index+1,std::memory_order_relaxed);
+  // the words must not become visible before the sequence says the slot is being written
+  std::atomic_thread_fence(std::memory_order_release);
+  for(std::size_t i=0;i<words.size();i++){
+    slot.words[i].store(words[i],std::memory_order_relaxed);
+  }
+  slot.sequence.store(2*index+2,std::memory_order_release);
+  ring->write_index.store(index+1,std::memory_order_release);
+}
+
+static inline uint32_t to_u32(DropReason reason){
+  return static_cast<uint32_t>(reason);
+}
+
+// Writes the events of all threads to the given file. Throws std::runtime_error if the file cannot be written.
+void dump_to_file(const std::string& path);
+
+// File format: FileHeader, then for each thread a ThreadHeader followed by its events (oldest first)
+static constexpr uint32_t FILE_MAGIC=0x52464B52; // "RKFR"
+static constexpr uint32_t FILE_VERSION=1;
+#pragma pack(push, 1)
+struct FileHeader{
+  uint32_t magic;
+  uint32_t version;
+  // steady clock at the time of the dump, and the corresponding unix time, to map events to wall clock time
+  uint64_t dump_steady_ns;
+  uint64_t dump_unix_ns;
+  uint32_t n_threads;
+};
+struct ThreadHeader{
+  uint32_t tid;
+  char name[16];
+  uint32_t n_events;
+};
+#pragma pack(pop)
+
+struct ThreadEvents{
+  uint32_t tid;
+  std::string name;
+  std::vector<Event> events;
+};
+struct Dump{
+  FileHeader header;
+  std::vector<ThreadEvents> threads;
+};
+// Throws std::runtime_error if the file cannot be read or has the wrong format
+Dump read_file(const std::string& path);
+
+std::string event_type_to_string(EventType type);
+std::string drop_reason_to_string(uint32_t reason);
+// The arguments of the event, human readable
+std::string event_args_to_string(const Event& event);
+
+}
+
+// Dumps the flight recorder to <path_prefix>-<unix time>-<reason>.bin when SIGUSR1 is received, or request_dump()
+// is called. The dump is written by a background thread (a signal handler can't do that safely).
+// Only one instance per process.
+class FlightRecorderDumper{
+ public:
+  explicit FlightRecorderDumper(std::string path_prefix);
+  ~FlightRecorderDumper();
+  FlightRecorderDumper(const FlightRecorderDumper&)=delete;
+  FlightRecorderDumper& operator=(const FlightRecorderDumper&)=delete;
+  // Thread and async signal safe
+  static void request_dump(flight_recorder::DumpReason reason);
+ private:
+  void loop_dump();
+  std::shared_ptr<spdlog::logger> m_console;
+  const std::string m_path_prefix;
+  std::atomic<bool> m_run{true};
+  std::unique_ptr<std::thread> m_thread;
+};
+
+#endif  // FLIGHT_RECORDER_H_
@@ -0,0 +1,82 @@
+#ifndef FRAME_BLOCK_H_
+#define FRAME_BLOCK_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "memory_budget.hpp"
+
+// All the fragments (rtp packets) of one frame. Each fragment has its own buffer, which is handed to the wifibroadcast
+// transmitter as it is - a fragment is copied once, when it is pulled out of the encoder.
+// One buffer per fragment (and with it one allocation and one reference count per fragment) instead of one contiguous
+// buffer per frame is forced by WBTransmitter::try_enqueue_block(), which takes a std::shared_ptr<std::vector<uint8_t>>
+// per fragment - a slice of a frame buffer can't be handed out as a std::vector. The buffers are reused, so the
+// allocations only happen while the pool warms up.
+// Move only - a frame travels from the appsink thread via WBLink into the tx scheduler without any copies, and the
+// buffers are reused for the next frames once the transmitter is done with them (see FrameBlockPool).
+class FrameBlock{
+ public:
+  typedef std::shared_ptr<std::vector<uint8_t>> BUFFER;
+  struct Fragment{
+    const uint8_t* data;
+    std::size_t size;
+  };
+  FrameBlock()=default;
+  FrameBlock(FrameBlock&&) noexcept=default;
+  FrameBlock& operator=(FrameBlock&&) noexcept=default;
+  FrameBlock(const FrameBlock&)=delete;
+  FrameBlock& operator=(const FrameBlock&)=delete;
+  // Removes all fragments, but keeps their buffers for the next appends
+  void clear();
+  // Drops the kept buffers that are still used by someone else (e.g. the transmitter), such that the next appends
+  // don't have to skip them
+  void drop_shared_buffers();
+  // Appends a fragment of the given size and returns where to write it to.
+  // The returned pointer stays valid until clear().
+  uint8_t* append_fragment(std::size_t size);
+  void append_fragment(const uint8_t* data,std::size_t size);
+  [[nodiscard]] std::size_t n_fragments()const{return m_fragments.size();}
+  [[nodiscard]] bool empty()const{return m_fragments.empty();}
+  [[nodiscard]] std::size_t n_bytes()const{return m_n_bytes;}
+  // memory allocated by this block, including unused capacity and the kept buffers
+  [[nodiscard]] std::size_t n_allocated_bytes()const;
+  [[nodiscard]] Fragment get_fragment(std::size_t index)const{
+    const auto& buffer=*m_fragments[index];
+    return {buffer.data(),buffer.size()};
+  }
+  // For rewriting headers before the block is handed on
+  [[nodiscard]] uint8_t* get_fragment_data(std::size_t index){return m_fragments[index]->data();}
+  [[nodiscard]] Fragment back()const{return get_fragment(m_fragments.size()-1);}
+  // The buffers of fragments [begin,end), for the wifibroadcast transmitter. Not copied - the fragments must not be
+  // modified anymore.
+  [[nodiscard]] std::vector<BUFFER> to_shared_fragments(std::size_t begin,std::size_t end)const;
+ private:
+  std::vector<BUFFER> m_fragments;
+  std::size_t m_n_bytes=0;
+  // buffers of cleared fragments, for reuse
+  std::vector<BUFFER> m_free_buffers;
+};
+
+// Keeps the buffers of already transmitted frames around for reuse, such that there are no allocations per frame.
+// With a memory budget, pooled blocks are accounted as MemoryBudget::Stage::BLOCK_POOL and freed if they don't fit.
+// Thread safe.
+class FrameBlockPool{
+ public:
+  explicit FrameBlockPool(std::size_t max_n_pooled=8,std::shared_ptr<MemoryBudget> memory_budget=nullptr);
+  ~FrameBlockPool();
+  FrameBlockPool(const FrameBlockPool&)=delete;
+  FrameBlockPool& operator=(const FrameBlockPool&)=delete;
+  // Returns an empty frame block, with memory already allocated if possible
+  FrameBlock acquire();
+  void release(FrameBlock&& block);
+ private:
+  const std::size_t m_max_n_pooled;
+  const std::shared_ptr<MemoryBudget> m_memory_budget;
+  std::mutex m_mutex;
+  std::vector<FrameBlock> m_free_blocks;
+};
+
+#endif  // FRAME_BLOCK_H_
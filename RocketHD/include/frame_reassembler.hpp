@@ -0,0 +1,87 @@
+#ifndef FRAME_REASSEMBLER_H_
+#define FRAME_REASSEMBLER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Ground side: Takes the rtp packets that come out of the wb receiver (already FEC decoded, but there might still be
+// holes and - with multiple rx cards - reordering) and reassembles them into frames for the decoder.
+// Frames are identified by the rtp timestamp, the end of a frame by the rtp marker bit
+// (set by rtph264pay / rtph265pay on the last packet of an access unit).
+// A frame that is complete (all sequence numbers from the end of the previous frame up to the marker) is released
+// immediately, an incomplete frame is held for at most reorder_window before it is either forwarded or dropped.
+struct FrameReassemblerOptions{
+  // max time an incomplete frame is held back waiting for missing / reordered packets
+  std::chrono::milliseconds reorder_window{20};
+  // max n of frames held back at the same time, the oldest frame is released / dropped when exceeded
+  int max_pending_frames=8;
+  // If true, frames with missing packets are forwarded to the decoder once the window expired (the decoder
+  // might be able to conceal the error), otherwise they are dropped.
+  bool forward_incomplete_frames=true;
+};
+
+struct FrameReassemblerStats{
+  uint64_t n_packets=0;
+  uint64_t n_packets_invalid=0;
+  uint64_t n_packets_lost=0;
+  uint64_t n_packets_reordered=0;
+  uint64_t n_packets_duplicate=0;
+  // arrived after their frame was already released
+  uint64_t n_packets_late=0;
+  uint64_t n_frames_complete=0;
+  uint64_t n_frames_incomplete_forwarded=0;
+  uint64_t n_frames_dropped=0;
+  // time between the first packet of a frame arriving and the frame being released
+  std::chrono::nanoseconds frame_hold_time_avg{0};
+  std::chrono::nanoseconds frame_hold_time_max{0};
+};
+
+class FrameReassembler{
+ public:
+  typedef std::vector<std::shared_ptr<std::vector<uint8_t>>> FRAME_FRAGMENTS;
+  // called with all the packets of a frame in rtp sequence number order
+  typedef std::function<void(const FRAME_FRAGMENTS& frame_fragments,bool complete)> FRAME_CALLBACK;
+  // called with the packets that arrived of an incomplete frame that is dropped (see forward_incomplete_frames)
+  typedef std::function<void(const FRAME_FRAGMENTS& frame_fragments)> FRAME_DROPPED_CALLBACK;
+  FrameReassembler(FrameReassemblerOptions options,FRAME_CALLBACK cb,FRAME_DROPPED_CALLBACK dropped_cb=nullptr);
+  // thread safe, but the frame callback is called from the thread calling this method
+  void on_new_packet(const uint8_t *payload,std::size_t payloadSize);
+  // Call regularly (e.g. every ms) such that frames whose reorder window expired are released
+  // even if no new packets arrive.
+  void check_timeouts();
+  [[nodiscard]] FrameReassemblerStats get_stats();
+  [[nodiscard]] std::string createDebug();
+ private:
+  struct PendingFrame{
+    uint32_t rtp_timestamp;
+    std::chrono::steady_clock::time_point first_packet_arrival;
+    // sorted by (unwrapped) sequence number
+    std::vector<std::pair<uint64_t,std::shared_ptr<std::vector<uint8_t>>>> packets;
+    std::optional<uint64_t> marker_seq;
+    [[nodiscard]] uint64_t min_seq()const{return packets.front().first;}
+    [[nodiscard]] uint64_t max_seq()const{return packets.back().first;}
+  };
+  const FrameReassemblerOptions m_options;
+  const FRAME_CALLBACK m_cb;
+  const FRAME_DROPPED_CALLBACK m_dropped_cb;
+  std::mutex m_mutex;
+  // ordered by the sequence number of their first packet
+  std::vector<PendingFrame> m_pending_frames;
+  // unwrapped sequence number of the last packet of the last frame that was released
+  std::optional<uint64_t> m_last_released_seq;
+  std::optional<uint64_t> m_highest_seq;
+  FrameReassemblerStats m_stats;
+  std::chrono::nanoseconds m_frame_hold_time_sum{0};
+  uint64_t unwrap_seq(uint16_t seq);
+  [[nodiscard]] bool is_complete(const PendingFrame& frame)const;
+  void release_frames(std::chrono::steady_clock::time_point now);
+  void release_oldest_frame(std::chrono::steady_clock::time_point now,bool complete);
+};
+
+#endif  // FRAME_REASSEMBLER_H_
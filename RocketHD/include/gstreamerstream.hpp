@@ -4,12 +4,21 @@
 #include  <gst/gst.h>
 
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
 
 #include "../lib/wifibroadcast/src/WBTransmitter.h"
+#include "camera_settings.hpp"
+#include "file_replay_source.hpp"
+#include "frame_block.hpp"
+#include "memory_budget.hpp"
+#include "nv12_convert_stage.hpp"
+#include "parameter_set_cache.hpp"
 #include "wb_link.hpp"
 
 // Implementation of OHD CameraStream for pretty much everything, using
@@ -20,9 +29,28 @@
 // better fit your needs (see CameraStream.h)
 class GStreamerStream{
  public:
-  GStreamerStream(std::shared_ptr<WBLink> wb_link);
+  // All queues / buffers of the pipeline are bounded by memory_budget (see MemoryBudget), if none is given
+  // the default budget is used.
+  explicit GStreamerStream(std::shared_ptr<WBLink> wb_link,CameraSettings settings=CameraSettings{},
+                           std::shared_ptr<MemoryBudget> memory_budget=nullptr);
   ~GStreamerStream();
   void setup();
+  // Apply new settings, returns immediately.
+  // Bitrate / keyframe interval are changed on the running encoder, everything else builds a new pipeline in the
+  // background and switches to it at its first keyframe (see restart_after_new_setting).
+  void update_settings(const CameraSettings& settings);
+  [[nodiscard]] CameraSettings get_settings();
+  // With simulcast, stream 0 is the main (high rate) stream and stream 1 the low rate one
+  static constexpr int MAX_N_STREAMS=2;
+  // The encoder of the given stream produces a keyframe as soon as possible. Thread safe, doesn't block.
+  void request_keyframe(int stream_index);
+  // The VPS / SPS / PPS of the given stream are sent in front of its next frame (see H265ParameterSetCache).
+  // Thread safe, doesn't block.
+  void request_parameter_sets(int stream_index);
+  // Sees every output frame of all streams (e.g. rocket_e2e_bench), before it goes to the WBLink (if any). Called on
+  // the pull thread of the stream, capture_time_us is 0 if unknown. Set before setup().
+  using FRAME_OUTPUT_CB=std::function<void(const FrameBlock& frame,int stream_index,bool is_keyframe,uint64_t capture_time_us)>;
+  void set_frame_output_cb(FRAME_OUTPUT_CB cb);
  private:
   void stop_cleanup_restart();
   // Utils when settings are changed (most of them require a full restart of the pipeline)
@@ -37,30 +65,105 @@ class GStreamerStream{
   void stop();
   // Set gst state to GST_STATE_NULL and properly cleanup the pipeline.
   void cleanup_pipe();
+ private:
+  // One encoder output of a pipeline and the thread that pulls the rtp fragments out of it
+  struct EncodedStream{
+    int index=0;
+    GstElement *app_sink_element = nullptr;
+    GstElement *encoder_element = nullptr;
+    GstElement *payloader_element = nullptr;
+    bool pull_samples_run=false;
+    std::unique_ptr<std::thread> pull_samples_thread;
+    // fragments are appended to this block until the end of the frame is found
+    FrameBlock curr_frame;
+    bool curr_frame_is_keyframe=false;
+    // of the first fragment of the frame being assembled
+    uint64_t curr_frame_dts=GST_CLOCK_TIME_NONE;
+    // set if the frame being assembled didn't fit into the memory budget, until its last fragment
+    bool dropping_frame=false;
+    // rtp packets are at most this large (the mtu of the payloader), can be changed at run time
+    std::atomic<std::size_t> max_packet_size=0;
+    H265ParameterSetCache parameter_sets;
+    std::chrono::steady_clock::time_point last_parameter_sets_time{};
+    // n of parameter set packets inserted into the rtp stream so far, added to the sequence number of every packet
+    // of the payloader such that the sequence stays contiguous
+    uint16_t seq_offset=0;
+  };
+  // One parsed gstreamer pipeline, with one or (simulcast) two encoded streams.
+  // During a reconfiguration, there are two pipelines for a short amount of time.
+  struct Pipeline{
+    CameraSettings settings;
+    GstElement *gst_pipeline = nullptr;
+    std::vector<std::unique_ptr<EncodedStream>> streams;
+    // decoder -> encoder conversion, unless the settings use the gstreamer elements for that
+    std::unique_ptr<Nv12ConvertStage> convert_stage;
+    // feeds the pipeline if the source is a file
+    std::unique_ptr<FileReplaySource> file_source;
+    // all queue elements, their fill level is accounted as MemoryBudget::Stage::GST_QUEUES
+    std::vector<GstElement*> queues;
+    std::size_t accounted_queue_bytes=0;
+    std::chrono::steady_clock::time_point last_queue_accounting{};
+    // max-buffers of the appsinks, accounted as MemoryBudget::Stage::FRAME_ASSEMBLY while the pipeline exists
+    std::size_t accounted_appsink_bytes=0;
+  };
+  // Returns nullptr if the pipeline cannot be created
+  std::unique_ptr<Pipeline> create_pipeline(const CameraSettings& settings);
+  void start_pulling_samples(Pipeline& pipeline);
+  // Stops the pull thread, sets the pipeline to GST_STATE_NULL and frees it
+  void destroy_pipeline(std::unique_ptr<Pipeline> pipeline);
+  void apply_live_settings(Pipeline& pipeline,const CameraSettings& settings);
+  // The queues only report their fill level, polled by the pull thread of stream 0
+  void update_queue_accounting(Pipeline& pipeline);
+  // Drops the frame that is being assembled, if its next fragment doesn't fit into the memory budget
+  void drop_frame_over_budget(EncodedStream& stream,bool is_last_fragment_of_frame);
+  // Called with the first fragment of a frame, before it is appended. Inserts the cached parameter sets if they are
+  // due (interval / request) and the frame doesn't carry them already.
+  // Requests are only consumed by the output pipeline (is_output).
+  void maybe_insert_parameter_sets(EncodedStream& stream,const uint8_t* first_fragment,std::size_t size,int n_parameter_sets,
+                                   bool is_output);
  private:
   // We cannot create the debug state while performing a restart
   std::mutex m_pipeline_mutex;
-  // points to a running gst pipeline instance (unless in stopped & cleaned up state)
-  GstElement *m_gst_pipeline = nullptr;
-  // The pipeline that is started in the end
-  std::stringstream m_pipeline_content;
+  // the running pipeline (unless in stopped & cleaned up state)
+  std::unique_ptr<Pipeline> m_pipeline;
+  // a new pipeline is being built / waited for (see restart_after_new_setting), m_pipeline is still the old one
+  bool m_reconfiguring=false;
+  std::mutex m_settings_mutex;
+  CameraSettings m_settings;
   // To reduce the time on the param callback(s) - they need to return immediately to not block the param server
   void restart_async();
   std::mutex m_async_thread_mutex;
   std::unique_ptr<std::thread> m_async_thread =nullptr;
+  bool m_async_thread_running=false;
+  // set if the settings changed again while a restart is in progress
+  bool m_restart_requested=false;
   std::shared_ptr<spdlog::logger> m_console;
+  std::shared_ptr<MemoryBudget> m_memory_budget;
   std::chrono::steady_clock::time_point m_stream_creation_time=std::chrono::steady_clock::now();
  private:
   // The stuff here is to pull the data out of the gstreamer pipeline, such that we can forward it to the WB link
-  void on_new_rtp_frame_fragment(std::shared_ptr<std::vector<uint8_t>> fragment,uint64_t dts);
-  std::vector<std::shared_ptr<std::vector<uint8_t>>> m_frame_fragments;
-  void on_new_rtp_fragmented_frame(std::vector<std::shared_ptr<std::vector<uint8_t>>> frame_fragments);
+  void on_new_rtp_frame_fragment(Pipeline& pipeline,EncodedStream& stream,const uint8_t* data,std::size_t size,uint64_t dts);
+  void on_new_rtp_fragmented_frame(Pipeline& pipeline,EncodedStream& stream,FrameBlock&& frame,bool is_keyframe);
   // pull samples (fragments) out of the gstreamer pipeline
-  GstElement *m_app_sink_element = nullptr;
-  bool m_pull_samples_run=false;
-  std::unique_ptr<std::thread> m_pull_samples_thread;
-  void loop_pull_samples();
+  void loop_pull_samples(Pipeline& pipeline,EncodedStream& stream);
+  // consumed by the pull thread(s) of the given stream of the output pipeline - they own the appsink the event is sent
+  // to. During a reconfiguration the old pipeline would take requests meant for the new encoder.
+  std::array<std::atomic<bool>,MAX_N_STREAMS> m_keyframe_requested{};
+  std::array<std::atomic<bool>,MAX_N_STREAMS> m_parameter_sets_requested{};
+  // CameraSettings::parameter_set_interval_ms, read by the pull threads
+  std::atomic<int> m_parameter_set_interval_ms;
+  // Only frames of the output pipeline are forwarded. A pending pipeline becomes the output pipeline
+  // once it produced its first keyframe (of stream 0), such that the ground never sees a mix of the two pipelines.
+  std::mutex m_output_mutex;
+  std::condition_variable m_output_swapped_cv;
+  // written with m_output_mutex held, the pull threads read it without
+  std::atomic<Pipeline*> m_output_pipeline=nullptr;
+  Pipeline* m_pending_pipeline=nullptr;
+  std::chrono::steady_clock::time_point m_last_output_frame_time{};
+  // time between the last frame of the old and the first frame of the new pipeline, of the last reconfiguration
+  std::chrono::milliseconds m_last_reconfiguration_gap{0};
   std::shared_ptr<WBLink> m_wb_link;
+  FRAME_OUTPUT_CB m_frame_output_cb;
 };
 
 #endif
@@ -0,0 +1,82 @@
+#ifndef LATENCY_ESTIMATOR_H_
+#define LATENCY_ESTIMATOR_H_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+
+#include "latency_probe.hpp"
+
+struct LatencyProbeOptions{
+  // min. time between two probes, 0 means every transmitted frame
+  std::chrono::milliseconds probe_interval{50};
+  // The clock offset is taken from the echo with the smallest round trip time out of the last n echoes
+  // (the one that waited the least in any queue, in either direction)
+  int offset_window=32;
+  // Where the echoes come from - the link feedback path, see LinkAdaptationOptions
+  int feedback_radio_port=61;
+  int feedback_udp_port=-1;
+};
+
+struct LatencyStats{
+  // cumulative
+  uint64_t n_probes=0;
+  uint64_t n_echoes=0;
+  // ground clock - air clock, and its uncertainty (half the round trip time of the sample it was taken from)
+  std::optional<int64_t> clock_offset_us;
+  int64_t clock_offset_error_us=0;
+  // the following are since the last call of get_stats_and_reset()
+  // round trip time without the time the ground needed to echo
+  int64_t rtt_avg_us=0;
+  int64_t rtt_min_us=0;
+  // camera capture -> probe received by the ground unit (not available if the capture time is unknown)
+  int64_t capture_to_receive_avg_us=0;
+  int64_t capture_to_receive_max_us=0;
+  // frame closed (all fragments pulled out of the encoder) -> probe received by the ground unit
+  int64_t close_to_receive_avg_us=0;
+  int64_t close_to_receive_max_us=0;
+  // smoothed variation of close_to_receive from one probe to the next (rfc3550 style interarrival jitter)
+  int64_t jitter_us=0;
+};
+
+// Air unit side of the latency probes (see latency_probe.hpp):
+// creates the probes and estimates clock offset, latency and jitter from their echoes, ntp style:
+// air sends at t1, ground receives at t2 and echoes at t3, air receives the echo at t4 - then
+// rtt=(t4-t1)-(t3-t2) and offset=((t2-t1)+(t3-t4))/2, exact if both directions take the same time.
+// Not thread safe.
+class LatencyEstimator{
+ public:
+  explicit LatencyEstimator(LatencyProbeOptions options);
+  // Returns a probe if the probe interval elapsed. capture_us is the time the frame was captured (0 if unknown).
+  std::optional<latency_probe::LatencyProbeMessage> create_probe(int stream_index,uint64_t capture_us,uint64_t now_us=get_steady_us());
+  void on_echo(const latency_probe::LatencyProbeMessage& echo,uint64_t now_us=get_steady_us());
+  [[nodiscard]] const LatencyProbeOptions& get_options()const{return m_options;}
+  // The averages / max. values are reset on each call
+  [[nodiscard]] LatencyStats get_stats_and_reset();
+  [[nodiscard]] std::string createDebug();
+  static uint64_t get_steady_us(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+ private:
+  struct OffsetSample{
+    int64_t rtt_us;
+    int64_t offset_us;
+  };
+  const LatencyProbeOptions m_options;
+  uint32_t m_next_sequence=0;
+  std::optional<uint64_t> m_last_probe_us;
+  std::deque<OffsetSample> m_offset_samples;
+  std::optional<int64_t> m_last_close_to_receive_us;
+  LatencyStats m_stats;
+  int64_t m_rtt_sum_us=0;
+  int64_t m_capture_to_receive_sum_us=0;
+  int64_t m_close_to_receive_sum_us=0;
+  uint64_t m_n_interval_echoes=0;
+  uint64_t m_n_interval_capture_echoes=0;
+  // jitter in us * 16, to not lose precision in the smoothing
+  int64_t m_jitter_x16=0;
+};
+
+#endif  // LATENCY_ESTIMATOR_H_
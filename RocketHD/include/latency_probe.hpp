@@ -0,0 +1,79 @@
+#ifndef LATENCY_PROBE_H_
+#define LATENCY_PROBE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+// Timestamp probe the air unit appends to a video frame (as an extra packet of the same block, such that it sees
+// the same tx queue, pacing, FEC and reassembly as the frame). The ground unit fills in its receive / send time and
+// echoes it back over the link feedback path (see link_feedback.hpp), the air unit estimates the clock offset and
+// the latency from that (see LatencyEstimator).
+// All times are in us, each unit uses its own steady clock.
+namespace latency_probe{
+
+// little endian, the first byte on the wire is 0x50 - a rtp packet starts with version 2 (0x80..0xBF), such that a
+// receiver that doesn't know about probes counts them as invalid rtp packets instead of passing them to the decoder
+static constexpr uint32_t MAGIC=0x524B4C50; // "PLKR"
+static constexpr uint8_t VERSION=1;
+static_assert(((MAGIC & 0xFF)>>6)!=2);
+
+enum class Type : uint8_t{
+  // air -> ground, in the video stream
+  PROBE=0,
+  // ground -> air, via the feedback path
+  ECHO=1,
+};
+
+struct LatencyProbeMessage{
+  uint32_t magic=MAGIC;
+  uint8_t version=VERSION;
+  Type type=Type::PROBE;
+  uint8_t stream_index=0;
+  uint8_t reserved=0;
+  uint32_t sequence=0;
+  // air: when the camera captured the frame (0 if unknown), when the frame was closed and handed to the link,
+  // when the probe left the tx queue (written by stamp_tx_time)
+  uint64_t air_capture_us=0;
+  uint64_t air_send_us=0;
+  uint64_t air_tx_us=0;
+  // ground: when the probe came out of the wb receiver, when the echo was sent
+  uint64_t ground_receive_us=0;
+  uint64_t ground_send_us=0;
+}__attribute__((packed));
+static_assert(sizeof(LatencyProbeMessage)==52);
+
+inline std::vector<uint8_t> serialize(const LatencyProbeMessage& message){
+  std::vector<uint8_t> ret(sizeof(LatencyProbeMessage));
+  std::memcpy(ret.data(),&message,sizeof(LatencyProbeMessage));
+  return ret;
+}
+
+inline std::optional<LatencyProbeMessage> parse(const uint8_t *payload,std::size_t payloadSize){
+  if(payloadSize!=sizeof(LatencyProbeMessage)){
+    return std::nullopt;
+  }
+  LatencyProbeMessage ret;
+  std::memcpy(&ret,payload,sizeof(LatencyProbeMessage));
+  if(ret.magic!=MAGIC || ret.version!=VERSION){
+    return std::nullopt;
+  }
+  return ret;
+}
+
+// If the packet is a probe, writes the given time into it. Called right before the packet is handed to the
+// transmitter, the queueing before that would falsify the clock offset estimation.
+inline bool stamp_tx_time(std::vector<uint8_t>& packet,uint64_t tx_us){
+  auto message=parse(packet.data(),packet.size());
+  if(!message.has_value() || message->type!=Type::PROBE){
+    return false;
+  }
+  message->air_tx_us=tx_us;
+  std::memcpy(packet.data(),&message.value(),sizeof(LatencyProbeMessage));
+  return true;
+}
+
+}
+
+#endif  // LATENCY_PROBE_H_
@@ -0,0 +1,100 @@
+#ifndef LINK_ADAPTATION_H_
+#define LINK_ADAPTATION_H_
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "link_feedback.hpp"
+
+// Closed loop link adaptation on the air unit:
+// Uses the feedback reports from the ground (raw packet loss, FEC block stats, residual loss and rssi) to pick
+// the MCS index, FEC overhead and FEC block length that hit the target residual block loss with the least airtime.
+// Pure logic - applying the decision is up to the caller (see WBLink).
+struct LinkAdaptationOptions{
+  // Residual (after FEC) block loss we aim for
+  double target_block_loss=0.001;
+  int min_mcs_index=0;
+  int max_mcs_index=5;
+  int min_fec_percentage=10;
+  int max_fec_percentage=100;
+  int fec_percentage_step=5;
+  // Candidates for the FEC block length, 0 means variable (one block per frame)
+  std::vector<int> fec_block_lengths{0};
+  // Used for the calculation if the block length is variable, fragments per frame at our usual bitrate
+  int assumed_variable_block_length=32;
+  // A mcs index is only used if the rssi is at least this much above its rx sensitivity
+  int rssi_margin_db=8;
+  // Go up one mcs index only after that many consecutive reports that allow it
+  int n_good_reports_before_mcs_increase=10;
+  // If no report arrives for that long, fall back to the fallback settings - by default the configured ones
+  // (the initial settings, or what was last set manually, see set_configured())
+  std::chrono::milliseconds feedback_timeout{2000};
+  std::optional<int> fallback_mcs_index;
+  std::optional<int> fallback_fec_percentage;
+  // Where the feedback comes from - wifibroadcast on this radio port, or (for testing) this localhost UDP port if >=0
+  int feedback_radio_port=61;
+  int feedback_udp_port=-1;
+};
+
+struct LinkAdaptationDecision{
+  int mcs_index;
+  int fec_percentage;
+  int fec_block_length;
+  bool operator==(const LinkAdaptationDecision& other)const{
+    return mcs_index==other.mcs_index && fec_percentage==other.fec_percentage && fec_block_length==other.fec_block_length;
+  }
+  bool operator!=(const LinkAdaptationDecision& other)const{
+    return !(*this==other);
+  }
+};
+
+namespace link_adaptation{
+// Probability that a block of k data and m FEC fragments cannot be recovered
+// (more than m fragments lost), assuming independent packet loss with probability p.
+double probability_block_lost(int k,int m,double p);
+}
+
+class LinkAdaptationController{
+ public:
+  LinkAdaptationController(LinkAdaptationOptions options,LinkAdaptationDecision initial,int bandwidth_mhz);
+  // Returns the new settings if anything should be changed
+  std::optional<LinkAdaptationDecision> on_feedback(const link_feedback::LinkFeedbackMessage& message,
+                                                    std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now());
+  // Call regularly, returns the fallback settings once if the feedback timed out
+  std::optional<LinkAdaptationDecision> check_timeout(std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now());
+  [[nodiscard]] LinkAdaptationDecision get_current()const;
+  // The settings were changed manually (e.g. at run time via the control socket) - the next decisions start from
+  // them, and they become the fallback settings.
+  void set_configured(const LinkAdaptationDecision& configured);
+  [[nodiscard]] std::string createDebug()const;
+ private:
+  const LinkAdaptationOptions m_options;
+  const int m_bandwidth_mhz;
+  LinkAdaptationDecision m_configured;
+  LinkAdaptationDecision m_current;
+  std::optional<link_feedback::LinkFeedbackMessage> m_last_message;
+  std::chrono::steady_clock::time_point m_last_feedback_time;
+  bool m_timed_out=false;
+  // smoothed raw (before FEC) packet loss at the current mcs index
+  double m_packet_loss_estimate=0.1;
+  // Increased while the measured residual loss is above the target, decays otherwise
+  double m_safety_factor=1.5;
+  int m_n_good_reports=0;
+  // 0 if unknown (no rssi in the last report)
+  int8_t m_last_rssi=0;
+  uint64_t m_n_decisions=0;
+  [[nodiscard]] int get_mcs_index_for_rssi(int rssi_dbm)const;
+  struct FecSetting{
+    int fec_percentage;
+    int fec_block_length;
+    bool reaches_target;
+  };
+  // Smallest FEC overhead (and matching block length) that hits the target for the given packet loss,
+  // max FEC (and reaches_target=false) if the target cannot be reached even with that
+  [[nodiscard]] FecSetting find_cheapest_fec(double packet_loss)const;
+};
+
+#endif  // LINK_ADAPTATION_H_
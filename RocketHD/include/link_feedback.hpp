@@ -0,0 +1,94 @@
+#ifndef LINK_FEEDBACK_H_
+#define LINK_FEEDBACK_H_
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+// Report the ground unit sends back to the air unit (either via wifibroadcast on its own radio port
+// or, for testing, via plain UDP). All counters are cumulative since the start of the ground receiver,
+// such that a lost report doesn't falsify the statistics - the air unit works with the deltas.
+namespace link_feedback{
+
+static constexpr uint32_t MAGIC=0x524B4642; // "RKFB"
+static constexpr uint8_t VERSION=1;
+
+struct LinkFeedbackMessage{
+  uint32_t magic=MAGIC;
+  uint8_t version=VERSION;
+  // rssi of the best rx card, in dBm
+  int8_t rssi_dbm=0;
+  uint16_t reserved=0;
+  uint32_t sequence=0;
+  // ground unit time when the report was created
+  uint64_t timestamp_us=0;
+  // raw wifibroadcast packets (before FEC)
+  uint64_t n_packets_received=0;
+  uint64_t n_packets_lost=0;
+  // FEC blocks
+  uint64_t n_blocks_total=0;
+  uint64_t n_blocks_lost=0;
+  uint64_t n_blocks_recovered=0;
+  uint64_t n_fragments_recovered=0;
+  // rtp packets that are still missing after FEC (what the decoder sees)
+  uint64_t n_residual_packets=0;
+  uint64_t n_residual_packets_lost=0;
+}__attribute__((packed));
+static_assert(sizeof(LinkFeedbackMessage)==84);
+
+inline std::vector<uint8_t> serialize(const LinkFeedbackMessage& message){
+  std::vector<uint8_t> ret(sizeof(LinkFeedbackMessage));
+  std::memcpy(ret.data(),&message,sizeof(LinkFeedbackMessage));
+  return ret;
+}
+
+inline std::optional<LinkFeedbackMessage> parse(const uint8_t *payload,std::size_t payloadSize){
+  if(payloadSize!=sizeof(LinkFeedbackMessage)){
+    return std::nullopt;
+  }
+  LinkFeedbackMessage ret;
+  std::memcpy(&ret,payload,sizeof(LinkFeedbackMessage));
+  if(ret.magic!=MAGIC || ret.version!=VERSION){
+    return std::nullopt;
+  }
+  return ret;
+}
+
+// Sent by the ground unit (same path as the reports) when its decoder can't continue - it joined late, or lost a
+// frame. The air unit answers with the parameter sets / a keyframe of the stream it transmits.
+static constexpr uint32_t RECOVERY_REQUEST_MAGIC=0x524B5251; // "RKRQ"
+static constexpr uint8_t RECOVERY_FLAG_KEYFRAME=1<<0;
+static constexpr uint8_t RECOVERY_FLAG_PARAMETER_SETS=1<<1;
+
+struct RecoveryRequestMessage{
+  uint32_t magic=RECOVERY_REQUEST_MAGIC;
+  uint8_t version=VERSION;
+  // RECOVERY_FLAG_*
+  uint8_t flags=0;
+  uint16_t reserved=0;
+  uint32_t sequence=0;
+}__attribute__((packed));
+static_assert(sizeof(RecoveryRequestMessage)==12);
+
+inline std::vector<uint8_t> serialize(const RecoveryRequestMessage& message){
+  std::vector<uint8_t> ret(sizeof(RecoveryRequestMessage));
+  std::memcpy(ret.data(),&message,sizeof(RecoveryRequestMessage));
+  return ret;
+}
+
+inline std::optional<RecoveryRequestMessage> parse_recovery_request(const uint8_t *payload,std::size_t payloadSize){
+  if(payloadSize!=sizeof(RecoveryRequestMessage)){
+    return std::nullopt;
+  }
+  RecoveryRequestMessage ret;
+  std::memcpy(&ret,payload,sizeof(RecoveryRequestMessage));
+  if(ret.magic!=RECOVERY_REQUEST_MAGIC || ret.version!=VERSION){
+    return std::nullopt;
+  }
+  return ret;
+}
+
+}
+
+#endif  // LINK_FEEDBACK_H_
@@ -0,0 +1,65 @@
+#ifndef MEMORY_BUDGET_H_
+#define MEMORY_BUDGET_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The video path of the air unit holds frames in several places (gstreamer queues, the raw frames in flight to the
+// encoder, the encoded frame being assembled, the tx queue, recycled buffers). This is the one place where the bytes
+// held by each of them are accounted, and the limit they share - such that a long stall (e.g. the wifi card blocks)
+// ends with dropped frames instead of the air unit running out of memory.
+// Every stage gets a fixed share of the total budget. Drop policy when a stage is at its limit:
+// GST_QUEUES:     the queues are leaky, the oldest buffer is dropped (gstreamer does that, limits set by GStreamerStream)
+// RAW_FRAMES:     the new frame is dropped before conversion (the encoder is behind anyway)
+// FRAME_ASSEMBLY: the frame being assembled is dropped as a whole and a keyframe is requested. Half of the share is
+//                 reserved for the encoder appsinks (bounded by max-buffers, they drop their oldest packet)
+// TX_QUEUE:       the oldest blocks that have not been started are dropped until the new one fits, or the new one
+//                 if that isn't enough
+// BLOCK_POOL:     the buffer is freed instead of kept for reuse
+// Thread safe and lock free.
+class MemoryBudget{
+ public:
+  enum class Stage{
+    GST_QUEUES=0,
+    RAW_FRAMES,
+    FRAME_ASSEMBLY,
+    TX_QUEUE,
+    BLOCK_POOL,
+  };
+  static constexpr int N_STAGES=5;
+  static constexpr std::size_t DEFAULT_TOTAL_BYTES=96*1024*1024;
+  explicit MemoryBudget(std::size_t total_bytes=DEFAULT_TOTAL_BYTES);
+  MemoryBudget(const MemoryBudget&)=delete;
+  MemoryBudget& operator=(const MemoryBudget&)=delete;
+  [[nodiscard]] std::size_t get_total_limit()const{return m_total_limit;}
+  [[nodiscard]] std::size_t get_stage_limit(Stage stage)const;
+  // Accounts n_bytes to the stage if that doesn't exceed the stage limit or the total budget.
+  // Returns false (and counts a rejection) otherwise.
+  [[nodiscard]] bool try_acquire(Stage stage,std::size_t n_bytes);
+  // For stages that are bounded by someone else and only report what they hold (never fails)
+  void acquire(Stage stage,std::size_t n_bytes);
+  void release(Stage stage,std::size_t n_bytes);
+  [[nodiscard]] std::size_t get_held(Stage stage)const;
+  [[nodiscard]] std::size_t get_total_held()const{return m_total_held.load(std::memory_order_relaxed);}
+  // held / limit per stage, peak and n of rejections since the last call
+  std::string createDebug();
+  static std::string stage_to_string(Stage stage);
+ private:
+  struct StageAccount{
+    std::size_t limit=0;
+    std::atomic<std::size_t> held{0};
+    std::atomic<std::size_t> peak{0};
+    std::atomic<uint64_t> n_rejected{0};
+  };
+  StageAccount& get_account(Stage stage){return m_stages[static_cast<int>(stage)];}
+  const StageAccount& get_account(Stage stage)const{return m_stages[static_cast<int>(stage)];}
+  void update_peak(StageAccount& account,std::size_t held);
+  const std::size_t m_total_limit;
+  std::atomic<std::size_t> m_total_held{0};
+  std::array<StageAccount,N_STAGES> m_stages;
+};
+
+#endif  // MEMORY_BUDGET_H_
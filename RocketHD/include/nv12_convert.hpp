@@ -0,0 +1,47 @@
+#ifndef NV12_CONVERT_H_
+#define NV12_CONVERT_H_
+
+#include <cstdint>
+
+// Conversion of the decoded camera frames to NV12, the native input format of the hw encoder.
+// Vectorized with AVX2 / SSE2 / NEON (selected at compile time, see simd_name()), with a scalar fallback.
+// Rows are processed independently, strides can be anything.
+namespace nv12convert{
+
+struct Nv12Image{
+  uint8_t* y;
+  int y_stride;
+  uint8_t* uv;
+  int uv_stride;
+  // visible size, without padding rows
+  int width;
+  int height;
+};
+
+// Writes black into the rows [dst.height,padded_height) of both planes. Only needs to be done once per buffer.
+void fill_padding_rows(const Nv12Image& dst,int padded_height);
+
+// 4:2:0 planar (avdec_mjpeg output for 4:2:0 jpeg)
+void i420_to_nv12(const uint8_t* src_y,int src_y_stride,const uint8_t* src_u,int src_u_stride,
+                  const uint8_t* src_v,int src_v_stride,const Nv12Image& dst);
+// 4:2:2 planar (avdec_mjpeg output for 4:2:2 jpeg, which is what most usb cameras produce). Two chroma rows are averaged.
+void y42b_to_nv12(const uint8_t* src_y,int src_y_stride,const uint8_t* src_u,int src_u_stride,
+                  const uint8_t* src_v,int src_v_stride,const Nv12Image& dst);
+// 4:2:2 packed (raw camera output). Two chroma rows are averaged.
+void yuy2_to_nv12(const uint8_t* src,int src_stride,const Nv12Image& dst);
+
+// "avx2", "sse2", "neon" or "scalar"
+const char* simd_name();
+
+// Reference implementation, same results as the vectorized one (used by the benchmark)
+namespace scalar{
+void i420_to_nv12(const uint8_t* src_y,int src_y_stride,const uint8_t* src_u,int src_u_stride,
+                  const uint8_t* src_v,int src_v_stride,const Nv12Image& dst);
+void y42b_to_nv12(const uint8_t* src_y,int src_y_stride,const uint8_t* src_u,int src_u_stride,
+                  const uint8_t* src_v,int src_v_stride,const Nv12Image& dst);
+void yuy2_to_nv12(const uint8_t* src,int src_stride,const Nv12Image& dst);
+}
+
+}
+
+#endif  // NV12_CONVERT_H_
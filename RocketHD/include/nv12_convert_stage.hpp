@@ -0,0 +1,63 @@
+#ifndef NV12_CONVERT_STAGE_H_
+#define NV12_CONVERT_STAGE_H_
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../lib/wifibroadcast/src/wifibroadcast-spdlog.h"
+#include "memory_budget.hpp"
+#include "nv12_convert.hpp"
+
+class Nv12BufferPool;
+
+// Replaces "videoconvert ! video/x-raw,format=YUY2 ! videobox bottom=-8" between the mjpeg decoder and the encoder,
+// which was the biggest cpu consumer on the air unit (a generic conversion plus a full frame copy, just for padding).
+// Decoded frames are pulled out of an appsink, converted to NV12 (the native input format of the encoder, see
+// nv12convert) directly into pooled buffers and pushed into an appsrc that feeds the encoder.
+// The pooled buffers are already padded to the height the encoder wants - the padding rows are written once,
+// when a buffer is allocated, not per frame.
+// The buffers are accounted as MemoryBudget::Stage::RAW_FRAMES, frames are dropped if there is no free buffer and
+// the budget doesn't allow a new one.
+class Nv12ConvertStage{
+ public:
+  // Takes ownership of the references to raw_sink (appsink) and nv12_src (appsrc).
+  // The appsrc caps have to be NV12 width x padded_height.
+  Nv12ConvertStage(std::shared_ptr<spdlog::logger> console,GstElement* raw_sink,GstElement* nv12_src,
+                   int width,int height,int padded_height,std::shared_ptr<MemoryBudget> memory_budget=nullptr);
+  ~Nv12ConvertStage();
+  Nv12ConvertStage(const Nv12ConvertStage&)=delete;
+  Nv12ConvertStage& operator=(const Nv12ConvertStage&)=delete;
+  void start();
+  void stop();
+  // conversion time since the last call
+  std::string createDebug();
+ private:
+  void loop_convert();
+  void convert_and_push(GstSample* sample);
+  bool convert(const std::string& format,const uint8_t* data,std::size_t size,const nv12convert::Nv12Image& dst);
+  void warn_once(const std::string& message);
+ private:
+  std::shared_ptr<spdlog::logger> m_console;
+  GstElement* m_raw_sink;
+  GstElement* m_nv12_src;
+  const int m_width;
+  const int m_height;
+  const int m_padded_height;
+  std::shared_ptr<Nv12BufferPool> m_pool;
+  std::atomic<bool> m_run{false};
+  std::unique_ptr<std::thread> m_thread;
+  bool m_warned=false;
+  std::mutex m_stats_mutex;
+  int m_n_frames=0;
+  int m_n_dropped_frames=0;
+  std::chrono::nanoseconds m_convert_time_sum{0};
+  std::chrono::nanoseconds m_convert_time_max{0};
+};
+
+#endif  // NV12_CONVERT_STAGE_H_
@@ -0,0 +1,87 @@
+#ifndef PACKET_PACER_H_
+#define PACKET_PACER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../lib/wifibroadcast/src/WBTransmitter.h"
+#include "frame_block.hpp"
+
+// Token bucket in units of airtime: Instead of handing frames (+FEC) to the injector as fast as they come, which fills
+// the driver queue in bursts (e.g. a keyframe right behind the previous frame), frames are released in parts such that
+// video uses at most a given fraction of the airtime (which depends on the current MCS / bandwidth).
+// The granularity is limited by the WBTransmitter API: each hand over (try_enqueue_block) becomes its own FEC block(s),
+// and the packets of a FEC block are injected back to back - so a part is one or more whole FEC blocks, see
+// get_release_size(). Once a frame has waited max_added_delay, the rest of it is released at line rate instead
+// (at most one bucket of airtime ahead of what is already on air) - latency is more important than the airtime
+// share, but dumping the rest of a large frame at once would only move the queue into the driver, where telemetry
+// can't get past it anymore.
+// Thread safe.
+struct PacketPacerOptions{
+  // fraction of the airtime video may use on average
+  double max_airtime_utilization=0.6;
+  // max burst, in us of airtime
+  std::chrono::microseconds bucket_depth{3000};
+  std::chrono::milliseconds max_added_delay{8};
+  // With a variable FEC block length (one FEC block per hand over), frames are not split into parts shorter than this -
+  // a short FEC block needs more overhead for the same residual loss
+  int min_fragments_per_release=16;
+};
+
+class PacketPacer{
+ public:
+  // fec_block_length: fixed FEC block length of the transmitter, 0 if variable
+  PacketPacer(PacketPacerOptions options,RadiotapHeader::UserSelectableParams radiotap_params,int fec_percentage,int fec_block_length);
+  // Call when the MCS index / FEC overhead / FEC block length changes
+  void update_radiotap_params(RadiotapHeader::UserSelectableParams radiotap_params);
+  void update_fec_percentage(int fec_percentage);
+  void update_fec_block_length(int fec_block_length);
+  // How many of the fragments [begin,n_fragments) of a frame to hand to the transmitter at once: as many as fit into
+  // the bucket, rounded to whole FEC blocks with a fixed FEC block length (the same FEC blocks as if the frame was handed
+  // over at once), at least min_fragments_per_release with a variable one (and no shorter remainder).
+  [[nodiscard]] std::size_t get_release_size(const FrameBlock& block,std::size_t begin);
+  // Airtime (in us) fragments [begin,end) occupy, including their share of FEC packets
+  [[nodiscard]] uint32_t get_airtime_us(const FrameBlock& block,std::size_t begin,std::size_t end);
+  // Earliest time a part with the given airtime may be sent - from the tokens, or at line rate once its frame has
+  // waited max_added_delay since block_enqueue_time
+  [[nodiscard]] std::chrono::steady_clock::time_point get_release_time(uint32_t airtime_us,
+                                                                       std::chrono::steady_clock::time_point block_enqueue_time,
+                                                                       std::chrono::steady_clock::time_point now);
+  void on_block_sent(uint32_t airtime_us,std::chrono::steady_clock::time_point now);
+ private:
+  const PacketPacerOptions m_options;
+  std::mutex m_mutex;
+  RadiotapHeader::UserSelectableParams m_radiotap_params;
+  int m_fec_percentage;
+  int m_fec_block_length;
+  double m_tokens_us;
+  std::chrono::steady_clock::time_point m_last_refill;
+  // when everything released so far should be on air
+  std::chrono::steady_clock::time_point m_airtime_busy_until;
+  void refill(std::chrono::steady_clock::time_point now);
+  // Needs m_mutex
+  [[nodiscard]] uint32_t get_fragment_airtime_us(std::size_t size)const;
+};
+
+// Measures how bursty a stream is: peak bytes in any window of window_size vs. the mean over the measurement interval.
+// Not thread safe.
+class BurstinessMeter{
+ public:
+  explicit BurstinessMeter(std::chrono::microseconds window_size=std::chrono::milliseconds(1));
+  void add(std::size_t bytes,std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now());
+  // "peak Mbit/s (1ms window) mean Mbit/s, ratio", resets the measurement
+  [[nodiscard]] std::string get_summary_and_reset(std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now());
+ private:
+  const std::chrono::microseconds m_window_size;
+  std::chrono::steady_clock::time_point m_interval_start=std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point m_window_start=m_interval_start;
+  std::size_t m_curr_window_bytes=0;
+  std::size_t m_max_window_bytes=0;
+  std::size_t m_total_bytes=0;
+};
+
+#endif  // PACKET_PACER_H_
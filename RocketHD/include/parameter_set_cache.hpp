@@ -0,0 +1,31 @@
+#ifndef PARAMETER_SET_CACHE_H_
+#define PARAMETER_SET_CACHE_H_
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Latest VPS / SPS / PPS of one h265 encoder, taken from its rtp output. rtph265pay only sends them with keyframes
+// (config-interval=-1), with a long GOP a receiver that joins late or lost them would wait a whole GOP for them -
+// instead, they can be re-sent in front of any frame as one small rtp aggregation packet.
+class H265ParameterSetCache{
+ public:
+  // Returns the n of parameter sets in the packet (0 for almost all packets)
+  int on_rtp_packet(const uint8_t* payload,std::size_t payloadSize);
+  // All three have been seen
+  [[nodiscard]] bool is_complete()const;
+  // Aggregation packet with VPS, SPS and PPS. The rtp header is taken from rtp_packet (payload type, timestamp, ssrc,
+  // such that the packet belongs to the frame of rtp_packet), with the given sequence number and without the marker bit.
+  // nullopt if not complete or larger than max_size.
+  [[nodiscard]] std::optional<std::vector<uint8_t>> create_rtp_packet(const uint8_t* rtp_packet,std::size_t rtp_packet_size,
+                                                                      uint16_t seq,std::size_t max_size)const;
+  // how often a parameter set changed (e.g. a new encoder configuration)
+  [[nodiscard]] uint64_t get_n_updates()const{return m_n_updates;}
+ private:
+  // VPS, SPS, PPS, each with its 2 byte NALU header
+  std::array<std::vector<uint8_t>,3> m_parameter_sets;
+  uint64_t m_n_updates=0;
+};
+
+#endif  // PARAMETER_SET_CACHE_H_
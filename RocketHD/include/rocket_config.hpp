@@ -0,0 +1,58 @@
+#ifndef ROCKET_CONFIG_H_
+#define ROCKET_CONFIG_H_
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../lib/wifibroadcast/src/WBTransmitter.h"
+#include "camera_settings.hpp"
+#include "memory_budget.hpp"
+
+// Everything rocket (air unit) needs to start, loaded from a simple "key=value" file (# starts a comment).
+// Every key has an apply mode, such that changes at run time (see ControlSocket) only interrupt what they have to.
+struct RocketConfig{
+  TOptions options;
+  RadiotapHeader::UserSelectableParams radiotap_params;
+  CameraSettings camera;
+  bool enable_telemetry=true;
+  bool enable_link_adaptation=true;
+  // latency / clock offset measurement with probes the ground echoes back (see LatencyEstimator)
+  bool enable_latency_probes=false;
+  // the ground can request a keyframe / the parameter sets when its decoder lost sync (rocket_rx -F)
+  bool enable_recovery_requests=true;
+  // everything the video path may hold (see MemoryBudget)
+  int memory_budget_mb=static_cast<int>(MemoryBudget::DEFAULT_TOTAL_BYTES/(1024*1024));
+};
+
+namespace rocket_config{
+
+enum class ApplyMode{
+  // applied to the running link / encoder, video keeps flowing (mcs, fec, bitrate, gop, rtp mtu)
+  HOT,
+  // applied by building a new camera pipeline and switching to it at a keyframe (resolution, fps, ...)
+  PIPELINE_SWAP,
+  // only used after rocket has been restarted (wifi card, radio port, bandwidth, ...)
+  RESTART
+};
+std::string apply_mode_to_string(ApplyMode mode);
+
+// The values rocket used before there was a config file
+RocketConfig create_default();
+
+// Throws std::runtime_error on unknown keys / invalid values (with the line number)
+RocketConfig load_file(const std::string& path);
+void save_file(const RocketConfig& config,const std::string& path);
+// The config in the file format, with the apply mode of each key as a comment
+std::string to_string(const RocketConfig& config);
+
+// nullopt if there is no such key
+std::optional<ApplyMode> get_apply_mode(const std::string& key);
+std::vector<std::string> get_keys();
+// Throws std::runtime_error on unknown keys / invalid values
+void set_value(RocketConfig& config,const std::string& key,const std::string& value);
+std::string get_value(const RocketConfig& config,const std::string& key);
+
+}
+
+#endif  // ROCKET_CONFIG_H_
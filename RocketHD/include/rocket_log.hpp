@@ -0,0 +1,72 @@
+#ifndef ROCKET_LOG_H_
+#define ROCKET_LOG_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include "../lib/wifibroadcast/src/wifibroadcast-spdlog.h"
+
+// Logging off the video hot path:
+// - All loggers are asynchronous, a background thread does the (blocking) writes. If the queue is full, the oldest
+//   message is dropped instead of blocking the caller (a pull / tx thread must never wait for the terminal).
+// - ROCKET_LOG_RATE_LIMITED for call sites that can fire per packet / frame, with a summary of what was suppressed.
+// - Debug / trace calls on hot paths use SPDLOG_LOGGER_DEBUG / SPDLOG_LOGGER_TRACE, which are compiled out in release
+//   builds (SPDLOG_ACTIVE_LEVEL, see CMakeLists.txt).
+// The level is debug in debug builds and info in release builds, the environment variable ROCKET_LOG_LEVEL
+// (trace, debug, info, warn, err, critical, off) overrides it.
+namespace rocket_log{
+
+// Returns the logger with the given name, creates it (async) if it doesn't exist yet
+std::shared_ptr<spdlog::logger> create_or_get(const std::string& name);
+
+spdlog::level::level_enum get_default_level();
+
+// Writes out the queued messages and stops the background thread, call before exiting on an error
+void shutdown();
+
+// Allows one call per interval, thread safe and lock free
+class RateLimiter{
+ public:
+  explicit RateLimiter(std::chrono::milliseconds interval)
+  : m_interval_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count()){}
+  // If true, n_suppressed is the n of calls that were not allowed since the last allowed one
+  bool allow(uint64_t& n_suppressed){
+    const int64_t now=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t last=m_last_allowed_ns.load(std::memory_order_relaxed);
+    if(now-last<m_interval_ns || !m_last_allowed_ns.compare_exchange_strong(last,now,std::memory_order_relaxed)){
+      m_n_suppressed.fetch_add(1,std::memory_order_relaxed);
+      return false;
+    }
+    n_suppressed=m_n_suppressed.exchange(0,std::memory_order_relaxed);
+    return true;
+  }
+ private:
+  const int64_t m_interval_ns;
+  std::atomic<int64_t> m_last_allowed_ns{std::numeric_limits<int64_t>::min()/2};
+  std::atomic<uint64_t> m_n_suppressed{0};
+};
+
+}
+
+// Logs at most once per interval from this call site, e.g.
+// ROCKET_LOG_RATE_LIMITED(m_console,spdlog::level::warn,std::chrono::seconds(1),"Dropped frame {}",index);
+// The n of messages that were suppressed in between is logged with the next message that gets through.
+#define ROCKET_LOG_RATE_LIMITED(logger,level,interval,...) \
+  do{ \
+    if((logger)->should_log(level)){ \
+      static rocket_log::RateLimiter rocket_log_rate_limiter_{interval}; \
+      uint64_t rocket_log_n_suppressed_=0; \
+      if(rocket_log_rate_limiter_.allow(rocket_log_n_suppressed_)){ \
+        if(rocket_log_n_suppressed_>0){ \
+          (logger)->log(level,"{} similar messages suppressed ({}:{})",rocket_log_n_suppressed_,__FILE__,__LINE__); \
+        } \
+        (logger)->log(level,__VA_ARGS__); \
+      } \
+    } \
+  }while(0)
+
+#endif  // ROCKET_LOG_H_
@@ -6,6 +6,8 @@
 #define RTP_EOF_HELPER_H_
 
 #include <cstdint>
+#include <functional>
+#include <optional>
 
 namespace rtp_eof_helper{
 
@@ -18,6 +20,25 @@ bool h264_end_block(const uint8_t *payload, std::size_t payloadSize);
 bool h265_end_block(const uint8_t *payload, std::size_t payloadSize);
 bool mjpeg_end_block(const uint8_t *payload, std::size_t payloadSize);
 
+// returns true if this rtp h265 packet carries (the start of) an IRAP (IDR / CRA / BLA) NALU,
+// a decoder can start decoding at the frame this packet belongs to.
+bool h265_is_keyframe(const uint8_t *payload, std::size_t payloadSize);
+
+// calls cb for each VPS / SPS / PPS NALU (including its 2 byte NALU header) this rtp h265 packet carries - they come
+// as single NALU packets or in an aggregation packet, they are never fragmented with our MTUs.
+// returns the n of parameter sets found.
+int h265_for_each_parameter_set(const uint8_t *payload, std::size_t payloadSize,
+                                const std::function<void(uint8_t nalu_type,const uint8_t *nalu,std::size_t nalu_size)>& cb);
+
+// returns the NALU type of the (first) slice this rtp h265 packet carries - a single NALU packet, any fragment of a
+// fragmentation unit or a slice in an aggregation packet. nullopt if it doesn't carry one (e.g. parameter sets, SEI).
+std::optional<uint8_t> h265_get_slice_nalu_type(const uint8_t *payload, std::size_t payloadSize);
+
+// true for the sub-layer non-reference picture types (TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and the reserved even
+// types below 16). With a single temporal layer, no other picture is predicted from them - losing one doesn't
+// affect the following frames.
+bool h265_is_non_reference_nalu_type(uint8_t type);
+
 }
 
 #endif  // OPENHD_OPENHD_OHD_VIDEO_INC_RTP_EOF_HELPER_H_
@@ -0,0 +1,43 @@
+#ifndef RTP_STREAM_REWRITER_H_
+#define RTP_STREAM_REWRITER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#include "frame_block.hpp"
+
+// The video the air unit transmits comes from different rtp payloaders over time (the simulcast streams, the new
+// pipeline after a swap), each with its own random SSRC, sequence numbers and timestamps. The ground (FrameReassembler,
+// the decoder) would see a jump in all of them - e.g. the sequence number unwrap puts the new source far in the past
+// and drops all of its packets as late.
+// This rewrites all rtp packets to one stream of the link: one SSRC, and on a change of the source the sequence numbers
+// continue at the last one + 1, the timestamps by the elapsed time. Within a source, gaps (dropped frames) are kept.
+// Not thread safe.
+class RtpStreamRewriter{
+ public:
+  explicit RtpStreamRewriter(uint32_t ssrc);
+  // Rewrites all rtp packets of the frame in place. A source change is detected by the SSRC of the packets.
+  void rewrite_frame(FrameBlock& frame,std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now());
+  // Returns false (and leaves it untouched) if this is not an rtp packet
+  bool rewrite_packet(uint8_t* packet,std::size_t size,std::chrono::steady_clock::time_point now);
+  // The next packet starts a new source even if it has the same SSRC (e.g. a new pipeline)
+  void reset();
+  [[nodiscard]] uint32_t get_ssrc()const{return m_ssrc;}
+  // how often the source changed
+  [[nodiscard]] uint64_t get_n_source_changes()const{return m_n_source_changes;}
+ private:
+  const uint32_t m_ssrc;
+  // SSRC of the current source, nullopt until the first packet / after reset()
+  std::optional<uint32_t> m_source_ssrc;
+  // added to the sequence number / timestamp of the current source
+  uint16_t m_seq_offset=0;
+  uint32_t m_timestamp_offset=0;
+  // last packet we wrote
+  std::optional<uint16_t> m_last_seq;
+  uint32_t m_last_timestamp=0;
+  std::chrono::steady_clock::time_point m_last_packet_time{};
+  uint64_t m_n_source_changes=0;
+};
+
+#endif  // RTP_STREAM_REWRITER_H_
@@ -0,0 +1,133 @@
+#ifndef SHM_FRAME_RING_H_
+#define SHM_FRAME_RING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Single producer / single consumer ring buffer in POSIX shared memory (shm_open + mmap),
+// used to hand RTP fragments from an external encoder process to wfb_tx without going through
+// the UDP loopback (which costs 2 kernel crossings and 2 copies per packet).
+// Each slot holds exactly one fragment plus a small header that carries the frame boundary
+// (the producer knows where a frame ends, so the consumer doesn't need to parse the rtp stream).
+// The consumer sleeps on a futex in the shared header and is woken by the producer for every fragment (a syscall only
+// if it actually sleeps), such that a frame larger than the ring streams through it instead of being dropped.
+namespace shm_frame_ring{
+
+static constexpr uint32_t MAGIC=0x524B5348; // "RKSH"
+static constexpr uint32_t VERSION=1;
+// Needs to be >= the rtp mtu used by the encoder (rtph265pay mtu=1024 in rocket)
+static constexpr uint32_t DEFAULT_SLOT_PAYLOAD_SIZE=2048;
+static constexpr uint32_t DEFAULT_N_SLOTS=1024;
+
+static constexpr uint32_t FLAG_FRAME_END=1;
+
+struct SlotHeader{
+  uint32_t size;
+  uint32_t flags;
+  // incremented by the producer for every frame, used by the consumer to detect frames
+  // that were only partially written (producer dropped the rest of the frame since the ring was full)
+  uint64_t frame_id;
+};
+static_assert(sizeof(SlotHeader)==16);
+
+struct RingHeader{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_slots;
+  uint32_t slot_payload_size;
+  // written by the producer only
+  alignas(64) std::atomic<uint64_t> write_index;
+  std::atomic<uint64_t> count_dropped_fragments;
+  // written by the consumer only
+  alignas(64) std::atomic<uint64_t> read_index;
+  // futex the consumer sleeps on, incremented by the producer on every fragment
+  alignas(64) std::atomic<uint32_t> futex_word;
+  std::atomic<uint32_t> consumer_waiting;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free,"shared memory atomics need to be lock free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free,"shared memory atomics need to be lock free");
+
+inline std::size_t slot_stride(uint32_t slot_payload_size){
+  return sizeof(SlotHeader)+slot_payload_size;
+}
+inline std::size_t total_size(uint32_t n_slots,uint32_t slot_payload_size){
+  return sizeof(RingHeader)+n_slots*slot_stride(slot_payload_size);
+}
+
+}
+
+/**
+ * Writes fragments into the ring created by a ShmFrameRingConsumer (e.g. wfb_tx -s <name>).
+ * Throws std::runtime_error if the ring does not exist (yet).
+ */
+class ShmFrameRingProducer{
+ public:
+  explicit ShmFrameRingProducer(const std::string& name);
+  ~ShmFrameRingProducer();
+  ShmFrameRingProducer(const ShmFrameRingProducer&)=delete;
+  ShmFrameRingProducer& operator=(const ShmFrameRingProducer&)=delete;
+  /**
+   * Zero copy write - returns a pointer to the payload of the next free slot (at least max_fragment_size() bytes)
+   * or nullptr if the ring is full. The fragment becomes visible to the consumer on commit_fragment().
+   */
+  uint8_t* begin_fragment();
+  void commit_fragment(std::size_t size,bool end_of_frame);
+  // Convenience, copies the data into the next free slot. Returns false if the fragment was dropped.
+  bool write_fragment(const uint8_t* data,std::size_t size,bool end_of_frame);
+  [[nodiscard]] std::size_t max_fragment_size()const;
+  [[nodiscard]] uint64_t get_n_dropped_fragments()const;
+ private:
+  shm_frame_ring::RingHeader* m_header=nullptr;
+  uint8_t* m_slots=nullptr;
+  std::size_t m_mapped_size=0;
+  uint64_t m_curr_frame_id=0;
+  // once a fragment of a frame is dropped, the rest of this frame is dropped, too
+  bool m_dropping_curr_frame=false;
+  void wake_consumer();
+};
+
+/**
+ * Creates (and owns) the shared memory ring, consumes fragments in place.
+ * The data pointer given to the callback is only valid for the duration of the callback.
+ * The segment is writable by the producer process, so nothing read from it is trusted: the ring geometry is the one
+ * given to the constructor, and slots with an invalid size are dropped (see get_n_invalid_fragments()).
+ */
+class ShmFrameRingConsumer{
+ public:
+  typedef std::function<void(const uint8_t* payload,std::size_t payloadSize,bool end_of_frame,uint64_t frame_id)> FRAGMENT_CALLBACK;
+  ShmFrameRingConsumer(const std::string& name,FRAGMENT_CALLBACK cb,
+                       uint32_t n_slots=shm_frame_ring::DEFAULT_N_SLOTS,
+                       uint32_t slot_payload_size=shm_frame_ring::DEFAULT_SLOT_PAYLOAD_SIZE);
+  ~ShmFrameRingConsumer();
+  ShmFrameRingConsumer(const ShmFrameRingConsumer&)=delete;
+  ShmFrameRingConsumer& operator=(const ShmFrameRingConsumer&)=delete;
+  /**
+   * Loop until stopBackground() is called.
+   * Blocks the calling thread.
+   */
+  void loopUntilStopped();
+  void runInBackground();
+  void stopBackground();
+  [[nodiscard]] uint64_t get_n_dropped_fragments()const;
+  // slots with a size larger than the slot payload size, or a write index that is impossible, were dropped
+  [[nodiscard]] uint64_t get_n_invalid_fragments()const;
+ private:
+  const std::string m_name;
+  const FRAGMENT_CALLBACK m_cb;
+  const uint32_t m_n_slots;
+  const uint32_t m_slot_payload_size;
+  std::atomic<uint64_t> m_n_invalid_fragments=0;
+  shm_frame_ring::RingHeader* m_header=nullptr;
+  uint8_t* m_slots=nullptr;
+  std::size_t m_mapped_size=0;
+  std::atomic<bool> m_keep_looping=true;
+  std::unique_ptr<std::thread> m_background_thread;
+  // returns after either new data is available or a timeout
+  void wait_for_data();
+};
+
+#endif  // SHM_FRAME_RING_H_
@@ -0,0 +1,55 @@
+#ifndef SIMULCAST_SELECTOR_H_
+#define SIMULCAST_SELECTOR_H_
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Simulcast (air unit): the camera is encoded twice (high and low rate), this decides which of the two is transmitted.
+// Switching to an already running low rate encoder reacts much faster to a fading link than waiting for the rate
+// control of a single encoder. Goes to the low stream as soon as the high stream doesn't fit the link anymore
+// (airtime it needs at the current mcs / fec) or the tx queue builds up, goes back only after the link has been good
+// for a while.
+// Pure logic - the switch itself happens at the next keyframe of the selected stream (see WBLink).
+struct SimulcastSelectorOptions{
+  // max. fraction of the airtime the high stream may need (at the current mcs index, including FEC)
+  double max_airtime_utilization=0.6;
+  // to go back to the high stream, it needs to fit with this factor applied to max_airtime_utilization
+  double switch_up_margin=0.8;
+  // the tx queue is considered congested if the oldest video block waits longer than this, or blocks are dropped
+  std::chrono::milliseconds max_queue_delay{30};
+  // the link needs to be good for this long before going back to the high stream
+  std::chrono::milliseconds min_good_duration_before_switch_up{3000};
+  // how often the state is evaluated (airtime is measured over this interval)
+  std::chrono::milliseconds check_interval{100};
+};
+
+struct SimulcastLinkState{
+  // airtime the high stream needed during the last interval / interval duration
+  double high_stream_airtime_fraction=0;
+  std::chrono::nanoseconds video_queue_delay{0};
+  // cumulative
+  uint64_t n_video_blocks_dropped=0;
+};
+
+class SimulcastSelector{
+ public:
+  static constexpr int STREAM_HIGH=0;
+  static constexpr int STREAM_LOW=1;
+  explicit SimulcastSelector(SimulcastSelectorOptions options);
+  // Returns the stream that should be transmitted
+  int on_link_state(const SimulcastLinkState& state,std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now());
+  [[nodiscard]] int get_selected()const;
+  [[nodiscard]] const SimulcastSelectorOptions& get_options()const;
+  [[nodiscard]] std::string createDebug()const;
+ private:
+  const SimulcastSelectorOptions m_options;
+  int m_selected=STREAM_HIGH;
+  uint64_t m_last_n_video_blocks_dropped=0;
+  std::optional<std::chrono::steady_clock::time_point> m_good_since;
+  SimulcastLinkState m_last_state{};
+  uint64_t m_n_switches=0;
+};
+
+#endif  // SIMULCAST_SELECTOR_H_
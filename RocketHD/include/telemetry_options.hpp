@@ -0,0 +1,20 @@
+#ifndef TELEMETRY_OPTIONS_H_
+#define TELEMETRY_OPTIONS_H_
+
+#include <cstdint>
+
+// Bidirectional telemetry (e.g. MAVLink) between air and ground.
+// Locally, telemetry goes in and out via UDP (e.g. to / from mavlink-router), on the link each direction has its own radio port.
+// Shared by the air (WBLink) and ground (rocket_rx) side.
+struct TelemetryOptions{
+  uint8_t air_to_ground_radio_port=3;
+  uint8_t ground_to_air_radio_port=4;
+  // telemetry to send is read from this localhost UDP port
+  int udp_in_port=14550;
+  // received telemetry is forwarded to this localhost UDP port
+  int udp_out_port=14551;
+  // bounded, telemetry that cannot be sent in time is worthless
+  int max_queue_size=32;
+};
+
+#endif  // TELEMETRY_OPTIONS_H_
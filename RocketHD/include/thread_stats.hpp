@@ -0,0 +1,68 @@
+#ifndef THREAD_STATS_H_
+#define THREAD_STATS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Per thread cpu accounting of the own process, to see where the cpu time of the (4 core) air unit goes and to
+// confirm that an optimization actually freed cpu: cpu time, voluntary / involuntary context switches and,
+// if perf events are permitted (see /proc/sys/kernel/perf_event_paranoid), cycles and cache misses.
+// Everything comes from /proc/self/task, so it includes threads we didn't create (gstreamer streaming threads,
+// wifibroadcast threads). Threads are identified by their name - name the threads we create with set_current_thread_name().
+namespace thread_stats{
+
+// Truncated to the 15 characters linux allows
+void set_current_thread_name(const std::string& name);
+
+}
+
+struct ThreadCpuStats{
+  uint32_t tid=0;
+  std::string name;
+  // cpu time since the last sample, in percent of one core
+  double cpu_percent=0;
+  // since the last sample
+  uint64_t n_voluntary_switches=0;
+  uint64_t n_involuntary_switches=0;
+  // since the last sample, user space only. Not set if perf events are not available
+  std::optional<uint64_t> cycles;
+  std::optional<uint64_t> cache_misses;
+};
+
+class ThreadStatsSampler{
+ public:
+  explicit ThreadStatsSampler(bool enable_perf=true);
+  ~ThreadStatsSampler();
+  ThreadStatsSampler(const ThreadStatsSampler&)=delete;
+  ThreadStatsSampler& operator=(const ThreadStatsSampler&)=delete;
+  // All threads of the process, the values since the last call (a thread that is new since then has 0 for its
+  // first sample), sorted by cpu usage
+  std::vector<ThreadCpuStats> sample();
+  // One line per thread
+  [[nodiscard]] std::string to_string(const std::vector<ThreadCpuStats>& stats)const;
+  // to_string(sample())
+  std::string createDebug();
+ private:
+  struct ThreadState{
+    uint64_t cpu_ns=0;
+    uint64_t n_voluntary_switches=0;
+    uint64_t n_involuntary_switches=0;
+    int perf_cycles_fd=-1;
+    int perf_cache_misses_fd=-1;
+    uint64_t cycles=0;
+    uint64_t cache_misses=0;
+  };
+  bool m_perf_enabled;
+  // why perf events are not used, if they are not
+  std::string m_perf_error;
+  std::map<uint32_t,ThreadState> m_threads;
+  std::chrono::steady_clock::time_point m_last_sample_time;
+  void open_perf_counters(uint32_t tid,ThreadState& state);
+  static void close_perf_counters(ThreadState& state);
+};
+
+#endif  // THREAD_STATS_H_
@@ -0,0 +1,166 @@
+#ifndef TX_PRIORITY_SCHEDULER_H_
+#define TX_PRIORITY_SCHEDULER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flight_recorder.hpp"
+#include "frame_block.hpp"
+#include "memory_budget.hpp"
+#include "packet_pacer.hpp"
+
+// Everything the air unit transmits goes through one instance of this scheduler, such that
+// telemetry has strict priority over video: A telemetry packet is always handed to its transmitter before
+// the next video block, instead of queueing behind multi-ms video bursts.
+// Each transmitter has its own queue and thread though - with the injection counters of the transmitters, the
+// scheduler only hands the next video block to its transmitter once the previous one has been injected. Then the
+// scheduler queues are the only place where packets wait (a telemetry packet waits for at most the one video block
+// that is being injected), and the latency is measured up to the injection instead of up to the hand over.
+// Both queues are bounded, when full the oldest element is dropped (old telemetry / video is worthless).
+// Optionally, video is paced (see PacketPacer) - a frame is then handed over in parts of whole FEC blocks, each once
+// the pacer allows it and the previous part has been injected. While the scheduler waits for the next part to become
+// eligible, telemetry is still dispatched immediately. A frame whose first part has been handed over is never dropped.
+// With a memory budget, the video queue is also bounded by the bytes it holds (MemoryBudget::Stage::TX_QUEUE).
+struct TxPrioritySchedulerOptions{
+  int max_telemetry_queue_size=32;
+  int max_video_queue_size=4;
+  // With injection counters: how often they are polled while something is being injected, and how long to wait for
+  // an injection at most (injection errors, or a wrong estimate of the n of FEC packets).
+  // The transmitter cannot signal an injection - instead of polling at a fixed rate, the next poll is scheduled for
+  // when the pending video block should be done (from the measured time per injected packet), within
+  // [injection_poll_interval,max_injection_poll_interval]. Polls that show no progress double the interval.
+  std::chrono::microseconds injection_poll_interval{250};
+  std::chrono::microseconds max_injection_poll_interval{4000};
+  std::chrono::milliseconds max_injection_wait{20};
+};
+
+// Cumulative counters of a transmitter (e.g. from WBTransmitter::get_latest_stats())
+struct TxInjectionCounters{
+  uint64_t n_packets=0;
+  uint64_t n_bytes=0;
+};
+
+struct TxPrioritySchedulerStats{
+  uint64_t n_telemetry_packets=0;
+  uint64_t n_telemetry_packets_dropped=0;
+  uint64_t n_video_blocks=0;
+  uint64_t n_video_blocks_dropped=0;
+  // blocks / packets that were not (completely) injected within max_injection_wait
+  uint64_t n_injection_timeouts=0;
+  // time between enqueue and injection (without injection counters: handing the packet / block to its transmitter)
+  std::chrono::nanoseconds telemetry_latency_avg{0};
+  std::chrono::nanoseconds telemetry_latency_max{0};
+  std::chrono::nanoseconds video_latency_avg{0};
+  std::chrono::nanoseconds video_latency_max{0};
+};
+
+// Instantaneous state of the video queue, e.g. to detect that video is produced faster than it can be sent
+struct TxVideoQueueState{
+  // including the block that is currently dispatched
+  std::size_t n_queued_blocks=0;
+  // how long the oldest block has been waiting
+  std::chrono::nanoseconds head_delay{0};
+  // cumulative
+  uint64_t n_dropped_blocks=0;
+};
+
+class TxPriorityScheduler{
+ public:
+  typedef std::shared_ptr<std::vector<uint8_t>> TELEMETRY_PACKET;
+  typedef std::vector<std::shared_ptr<std::vector<uint8_t>>> VIDEO_FRAGMENTS;
+  typedef std::function<void(TELEMETRY_PACKET packet)> TELEMETRY_CALLBACK;
+  // returns the n of packets the transmitter injects for the fragments (including FEC), 0 if it didn't take them
+  typedef std::function<std::size_t(VIDEO_FRAGMENTS& fragments)> VIDEO_CALLBACK;
+  typedef std::function<TxInjectionCounters()> INJECTION_COUNTERS_CALLBACK;
+  // The callbacks are called from the scheduler thread, they should hand the data to the transmitter and return.
+  // The injection counters are optional, without them the scheduler can only order the hand over to the transmitters.
+  TxPriorityScheduler(TxPrioritySchedulerOptions options,TELEMETRY_CALLBACK telemetry_cb,VIDEO_CALLBACK video_cb,
+                      std::shared_ptr<PacketPacer> pacer=nullptr,std::shared_ptr<MemoryBudget> memory_budget=nullptr,
+                      INJECTION_COUNTERS_CALLBACK telemetry_counters_cb=nullptr,INJECTION_COUNTERS_CALLBACK video_counters_cb=nullptr);
+  ~TxPriorityScheduler();
+  TxPriorityScheduler(const TxPriorityScheduler&)=delete;
+  TxPriorityScheduler& operator=(const TxPriorityScheduler&)=delete;
+  void enqueue_telemetry(TELEMETRY_PACKET packet);
+  void enqueue_video(FrameBlock&& block);
+  // Blocks are recycled once they have been transmitted, use this to get an empty block for the next frame
+  FrameBlock acquire_video_block();
+  // For blocks that are not enqueued after all, such that their memory can be reused
+  void recycle_video_block(FrameBlock&& block);
+  [[nodiscard]] TxVideoQueueState get_video_queue_state();
+  // The max. values are reset on each call
+  [[nodiscard]] TxPrioritySchedulerStats get_stats_and_reset_max();
+  [[nodiscard]] std::string createDebug();
+ private:
+  template<class T>
+  struct QueueItem{
+    T data;
+    std::chrono::steady_clock::time_point enqueue_time;
+  };
+  // Handed to the transmitter, but not injected yet
+  struct PendingInjection{
+    // value of the injected packets counter once it is injected
+    uint64_t n_packets_target;
+    std::chrono::steady_clock::time_point enqueue_time;
+    std::chrono::steady_clock::time_point dispatch_time;
+    // video: the last part of its frame
+    bool end_of_block=true;
+  };
+  const TxPrioritySchedulerOptions m_options;
+  const TELEMETRY_CALLBACK m_telemetry_cb;
+  const VIDEO_CALLBACK m_video_cb;
+  const INJECTION_COUNTERS_CALLBACK m_telemetry_counters_cb;
+  const INJECTION_COUNTERS_CALLBACK m_video_counters_cb;
+  std::shared_ptr<PacketPacer> m_pacer;
+  std::shared_ptr<MemoryBudget> m_memory_budget;
+  // in: as enqueued, out: as injected (from the injection counters, if available)
+  BurstinessMeter m_video_in_burstiness;
+  BurstinessMeter m_video_out_burstiness;
+  std::optional<uint64_t> m_last_video_injected_bytes;
+  // for the poll interval - video packets injected at the last poll / dispatch, smoothed time per injected packet
+  uint64_t m_last_video_injected_packets=0;
+  std::chrono::steady_clock::time_point m_last_video_poll_time{};
+  double m_video_us_per_packet=0;
+  std::chrono::microseconds m_poll_interval;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<QueueItem<TELEMETRY_PACKET>> m_telemetry_queue;
+  std::deque<QueueItem<FrameBlock>> m_video_queue;
+  // fragments of the head of m_video_queue that have already been handed over (pacing)
+  std::size_t m_video_head_n_dispatched=0;
+  // only with injection counters - in order, and at most one video block
+  std::deque<PendingInjection> m_telemetry_injections;
+  std::optional<PendingInjection> m_video_injection;
+  FrameBlockPool m_video_block_pool;
+  bool m_run=true;
+  TxPrioritySchedulerStats m_stats;
+  std::chrono::nanoseconds m_telemetry_latency_sum{0};
+  std::chrono::nanoseconds m_video_latency_sum{0};
+  std::unique_ptr<std::thread> m_thread;
+  void loop_dispatch();
+  [[nodiscard]] bool can_dispatch_video()const;
+  // Reads the injection counters and completes what has been injected (or waited for too long)
+  void poll_injections(std::unique_lock<std::mutex>& lock);
+  // Needs m_mutex. Time until the pending video block should be injected, clamped to the poll interval limits
+  [[nodiscard]] std::chrono::microseconds get_expected_video_injection_time(uint64_t n_packets_injected)const;
+  void on_telemetry_done(std::chrono::nanoseconds latency);
+  void on_video_block_done(std::chrono::nanoseconds latency);
+  void dispatch_telemetry(std::unique_lock<std::mutex>& lock);
+  // With pacing, waits until the next block is eligible or telemetry arrives
+  void dispatch_video(std::unique_lock<std::mutex>& lock);
+  // Needs m_mutex. Drops the oldest queued block that hasn't been handed over partially, false if there is none
+  bool drop_oldest_video_block(flight_recorder::DropReason reason,std::vector<FrameBlock>& dropped);
+  // Needs m_mutex. Drops the oldest queued blocks until the new block fits into the budget, false if it doesn't fit anyway
+  bool make_room_in_budget(std::size_t n_bytes,std::vector<FrameBlock>& dropped);
+  void release_from_budget(const FrameBlock& block);
+};
+
+#endif  // TX_PRIORITY_SCHEDULER_H_
@@ -2,13 +2,35 @@
 #define STREAMS_H
 
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <mutex>
 #include <optional>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "../lib/wifibroadcast/src/UdpWBReceiver.hpp"
 #include "../lib/wifibroadcast/src/UdpWBTransmitter.hpp"
+#include "frame_block.hpp"
+#include "latency_estimator.hpp"
+#include "link_adaptation.hpp"
+#include "memory_budget.hpp"
+#include "rtp_stream_rewriter.hpp"
+#include "simulcast_selector.hpp"
+#include "telemetry_options.hpp"
+#include "tx_priority_scheduler.hpp"
+
+// Keyframe / parameter set requests from the ground unit (see link_feedback::RecoveryRequestMessage)
+struct RecoveryRequestOptions{
+  // a keyframe needs some time to arrive at the ground, the ground repeats its request until it did -
+  // requests within this interval after the last keyframe request are ignored
+  std::chrono::milliseconds min_keyframe_interval{300};
+  // Where the requests come from - the link feedback path, see LinkAdaptationOptions
+  int feedback_radio_port=61;
+  int feedback_udp_port=-1;
+};
 
 /**
  * This class takes a list of cards supporting monitor mode (only 1 card on air) and
@@ -26,13 +48,45 @@ class WBLink{
    * for transmission, only for receiving.
    * @param opt_action_handler global openhd action handler, optional (can be nullptr during testing of specific modules instead
    * of testing a complete running openhd instance)
+   * @param telemetry_options if set, the bidirectional telemetry link is started, too.
+   * @param memory_budget if set, the video tx queue is bounded by it (see MemoryBudget)
+   */
+  WBLink(RadiotapHeader::UserSelectableParams radioTapHeaderParams, TOptions options,
+         std::optional<TelemetryOptions> telemetry_options=std::nullopt,
+         std::shared_ptr<MemoryBudget> memory_budget=nullptr);
+  /**
+   * Loopback mode, to run the air unit video path on a machine without wifi cards (e.g. rocket_e2e_bench): the cards
+   * are not touched, the video blocks go out as plain udp packets (no FEC, no encryption, like wfb_tx -l) to
+   * localhost:loopback_udp_port, e.g. to rocket_rx -l. No telemetry, the feedback path needs a udp port.
    */
-  WBLink(RadiotapHeader::UserSelectableParams radioTapHeaderParams, TOptions options);
+  WBLink(RadiotapHeader::UserSelectableParams radioTapHeaderParams, TOptions options,int loopback_udp_port,
+         std::shared_ptr<MemoryBudget> memory_budget=nullptr);
   WBLink(const WBLink&)=delete;
   WBLink(const WBLink&&)=delete;
   ~WBLink();
   // Verbose string about the current state.
   [[nodiscard]] std::string createDebug()const;
+  // Start listening for feedback reports from the ground unit and automatically adjust the mcs index,
+  // video FEC percentage and video FEC block length from them (see LinkAdaptationController)
+  void enable_link_adaptation(LinkAdaptationOptions options);
+  // Run time changes (e.g. from the control socket). Return immediately and don't interrupt the video stream.
+  // If link adaptation is enabled, it continues from the new values and falls back to them if the feedback times out.
+  void update_mcs_index(int mcs_index);
+  void update_video_fec_percentage(int fec_percentage);
+  void update_video_fec_block_length(int block_length);
+  // Select between the high and the low rate stream of a simulcast camera pipeline (see SimulcastSelector).
+  // request_keyframe_cb is called with the stream to switch to, such that the switch doesn't have to wait for
+  // the next regular keyframe of that encoder.
+  void enable_simulcast(SimulcastSelectorOptions options,std::function<void(int stream_index)> request_keyframe_cb);
+  // Append a timestamp probe to transmitted frames and estimate clock offset / latency from the echoes the ground
+  // unit sends back over the feedback path (see LatencyEstimator). The results are part of createDebug().
+  // Shares the feedback receiver with link adaptation, if both are enabled the port of the first one is used.
+  void enable_latency_probes(LatencyProbeOptions options);
+  // Let the ground unit request a keyframe and / or the parameter sets of the transmitted stream over the feedback
+  // path (e.g. after it joined late or lost a frame), such that the GOP can be long. recovery_cb is called with the
+  // stream that is transmitted. Shares the feedback receiver like enable_latency_probes.
+  using RECOVERY_CB=std::function<void(int stream_index,bool keyframe,bool parameter_sets)>;
+  void enable_recovery_requests(RecoveryRequestOptions options,RECOVERY_CB recovery_cb);
  private:
   bool set_tx_power_rtl8812au(int tx_power_index_override);
   // set the tx power of all wifibroadcast cards. For rtl8812au, uses the tx power index
@@ -55,20 +109,89 @@ class WBLink{
   // set the right frequency, channel width and tx power. Cards need to be in monitor mode already !
   void configure_cards();
   // start telemetry and video rx/tx stream(s)
-  void configure_telemetry();
+  void configure_telemetry(const TelemetryOptions& telemetry_options);
   void configure_video();
   std::unique_ptr<WBTransmitter> create_wb_tx();
+  static TxInjectionCounters get_injection_counters(WBTransmitter& wb_tx);
+  // n of packets the video transmitter injects for a block of n_fragments, including FEC
+  [[nodiscard]] std::size_t get_n_video_packets(std::size_t n_fragments)const;
+  void on_telemetry_tx_packet(const uint8_t *payload,std::size_t payloadSize);
+  // Starts receiving the link feedback (reports and probe echoes), only once
+  void start_feedback_rx(int feedback_radio_port,int feedback_udp_port);
+  void on_link_feedback_packet(const uint8_t *payload,std::size_t payloadSize);
+  void apply_link_adaptation_decision(const LinkAdaptationDecision& decision);
+  void on_recovery_request(const link_feedback::RecoveryRequestMessage& request);
+  void loop_link_adaptation_timeout();
+  // Needs m_simulcast_mutex, returns the stream to request a keyframe from if the selection changed
+  std::optional<int> update_simulcast_selection(const FrameBlock& frame,int stream_index);
  public:
   // Called by the camera stream on the air unit only
   // transmit video data via wifibradcast
-  void transmit_video_data(std::vector<std::shared_ptr<std::vector<uint8_t>>> frame_fragments);
+  // Frames of all encoded streams arrive here, but only the active one is transmitted. Stream 0 is the main (high rate)
+  // stream, 1 the low rate simulcast stream. The active stream only changes at a keyframe of the new stream.
+  // capture_time_us: when the camera captured the frame (steady clock), 0 if unknown
+  void transmit_video_data(FrameBlock&& frame,int stream_index=0,bool is_keyframe=false,uint64_t capture_time_us=0);
+  // Call when the camera pipeline has been replaced - the new pipeline starts with a keyframe of stream 0
+  void reset_video_stream();
+  // Empty block (with memory of an already transmitted frame, if available) to assemble the next frame in
+  FrameBlock acquire_frame_block();
  private:
   RadiotapHeader::UserSelectableParams m_radioTapHeaderParams;
   const TOptions m_options;
   std::shared_ptr<spdlog::logger> m_console;
   // For video, on air there are only tx instances, on ground there are only rx instances.
+  // nullptr in loopback mode
   std::unique_ptr<WBTransmitter> m_wb_video_tx;
+  // loopback mode only, the video goes here instead, counted as injected once it was sent
+  std::unique_ptr<SocketHelper::UDPForwarder> m_video_loopback_out;
+  std::atomic<uint64_t> m_video_loopback_n_packets{0};
+  std::atomic<uint64_t> m_video_loopback_n_bytes{0};
+  // telemetry is bidirectional, on air tx: udp in -> wb, rx: wb -> udp out. Optional
+  std::unique_ptr<WBTransmitter> m_wb_tele_tx;
+  std::unique_ptr<WBReceiver> m_wb_tele_rx;
+  std::unique_ptr<std::thread> m_wb_tele_rx_thread;
+  std::unique_ptr<SocketHelper::UDPReceiver> m_tele_udp_in;
+  std::unique_ptr<SocketHelper::UDPForwarder> m_tele_udp_out;
+  // everything we transmit goes through the scheduler, such that telemetry has priority over video
+  std::unique_ptr<TxPriorityScheduler> m_tx_scheduler;
+  // spreads the video blocks over time according to the airtime they need with the current mcs index
+  std::shared_ptr<PacketPacer> m_video_pacer;
+  std::shared_ptr<MemoryBudget> m_memory_budget;
+  // read by the scheduler thread, changed at run time
+  std::atomic<int> m_video_fec_percentage;
   std::string m_device_name;
+  // Link adaptation (air unit), optional. The mutex also protects changing the mcs / fec at run time.
+  mutable std::mutex m_link_adaptation_mutex;
+  std::unique_ptr<LinkAdaptationController> m_link_adaptation;
+  // feedback receiver, for link adaptation and / or latency probe echoes
+  std::mutex m_feedback_rx_mutex;
+  std::unique_ptr<SocketHelper::UDPReceiver> m_link_feedback_udp_rx;
+  std::unique_ptr<WBReceiver> m_link_feedback_wb_rx;
+  std::unique_ptr<std::thread> m_link_feedback_wb_rx_thread;
+  std::atomic<bool> m_link_adaptation_run=false;
+  std::unique_ptr<std::thread> m_link_adaptation_timeout_thread;
+  // Simulcast (air unit), optional
+  mutable std::mutex m_simulcast_mutex;
+  std::unique_ptr<SimulcastSelector> m_simulcast_selector;
+  std::function<void(int stream_index)> m_request_keyframe_cb;
+  // all transmitted video leaves as one rtp stream, whichever encoder / pipeline it comes from. Protected by m_simulcast_mutex
+  RtpStreamRewriter m_rtp_rewriter;
+  // the stream that is transmitted, and the one to switch to at its next keyframe
+  int m_active_video_stream=0;
+  int m_wanted_video_stream=0;
+  // airtime the high stream needed since the last check
+  uint64_t m_high_stream_airtime_us=0;
+  std::chrono::steady_clock::time_point m_last_simulcast_check{};
+  // Latency probes (air unit), optional
+  mutable std::mutex m_latency_mutex;
+  std::unique_ptr<LatencyEstimator> m_latency_estimator;
+  // Recovery requests (air unit), optional
+  mutable std::mutex m_recovery_mutex;
+  std::optional<RecoveryRequestOptions> m_recovery_options;
+  RECOVERY_CB m_recovery_cb;
+  std::chrono::steady_clock::time_point m_last_recovery_keyframe{};
+  uint64_t m_n_recovery_requests=0;
+  uint64_t m_n_recovery_keyframes=0;
 };
 
 #endif
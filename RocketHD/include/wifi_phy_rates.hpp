@@ -0,0 +1,52 @@
+#ifndef WIFI_PHY_RATES_H_
+#define WIFI_PHY_RATES_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+// 802.11n (HT) single spatial stream MCS 0..7 data rates and typical receiver sensitivities.
+// Used to estimate the airtime of a packet / the usable throughput for a given RadiotapHeader::UserSelectableParams.
+namespace wifi::phyrates{
+
+static constexpr int MAX_MCS_INDEX=7;
+
+// in kbit/s, long guard interval
+static constexpr std::array<uint32_t,8> HT20_RATES_KBITS{6500,13000,19500,26000,39000,52000,58500,65000};
+static constexpr std::array<uint32_t,8> HT40_RATES_KBITS{13500,27000,40500,54000,81000,108000,121500,135000};
+// in dBm, 20MHz (40MHz is ~3dB worse)
+static constexpr std::array<int,8> HT20_RX_SENSITIVITY_DBM{-82,-79,-77,-74,-70,-66,-65,-64};
+
+// Every injected packet has some constant overhead on air (preamble, MAC header, no ACK since broadcast)
+static constexpr uint32_t PHY_PREAMBLE_US=40;
+static constexpr uint32_t MAC_OVERHEAD_BYTES=24+4+8;
+
+inline int clamp_mcs(int mcs_index){
+  return std::clamp(mcs_index,0,MAX_MCS_INDEX);
+}
+
+inline uint32_t get_rate_kbits(int mcs_index,int bandwidth_mhz,bool short_gi){
+  const auto mcs=clamp_mcs(mcs_index);
+  uint32_t rate=bandwidth_mhz==40 ? HT40_RATES_KBITS[mcs] : HT20_RATES_KBITS[mcs];
+  if(short_gi){
+    // 3.6us instead of 4us symbol duration
+    rate=rate*10/9;
+  }
+  return rate;
+}
+
+inline int get_rx_sensitivity_dbm(int mcs_index,int bandwidth_mhz){
+  const auto sensitivity=HT20_RX_SENSITIVITY_DBM[clamp_mcs(mcs_index)];
+  return bandwidth_mhz==40 ? sensitivity+3 : sensitivity;
+}
+
+// Time a packet with the given payload occupies the medium, in us
+inline uint32_t get_airtime_us(std::size_t payload_bytes,int mcs_index,int bandwidth_mhz,bool short_gi){
+  const uint64_t bits=(payload_bytes+MAC_OVERHEAD_BYTES)*8;
+  const uint64_t rate_kbits=get_rate_kbits(mcs_index,bandwidth_mhz,short_gi);
+  return PHY_PREAMBLE_US+static_cast<uint32_t>((bits*1000+rate_kbits-1)/rate_kbits);
+}
+
+}
+
+#endif  // WIFI_PHY_RATES_H_
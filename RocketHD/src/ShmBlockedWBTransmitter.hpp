@@ -0,0 +1,81 @@
+#ifndef SHM_BLOCKED_WB_TRANSMITTER_HPP
+#define SHM_BLOCKED_WB_TRANSMITTER_HPP
+
+#include "../lib/wifibroadcast/src/WBTransmitter.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "frame_block.hpp"
+#include "shm_frame_ring.hpp"
+
+/**
+ * Creates a WB Transmitter that gets its input data stream from a shared memory frame ring
+ * (see ShmFrameRingProducer for the encoder side). Compared to UDPBlockedWBTransmitter,
+ * the frame boundaries are given by the producer, so the rtp stream doesn't need to be parsed.
+ */
+class ShmBlockedWBTransmitter {
+ public:
+  ShmBlockedWBTransmitter(RadiotapHeader::UserSelectableParams radiotapHeaderParams,
+                          TOptions options1,
+                          const std::string &shm_name) {
+    options1.use_block_queue= true;
+    wbTransmitter = std::make_unique<WBTransmitter>(radiotapHeaderParams, std::move(options1));
+    shmConsumer = std::make_unique<ShmFrameRingConsumer>(shm_name,
+        [this](const uint8_t *payload,const std::size_t payloadSize,bool end_of_frame,uint64_t frame_id) {
+          on_new_fragment(payload,payloadSize,end_of_frame,frame_id);
+        });
+  }
+  /**
+   * Loop until an error occurs.
+   * Blocks the calling thread.
+   */
+  void loopUntilError() {
+    shmConsumer->loopUntilStopped();
+  }
+  /**
+   * Start looping in the background, creates a new thread.
+   */
+  void runInBackground() {
+    shmConsumer->runInBackground();
+  }
+  void stopBackground(){
+    shmConsumer->stopBackground();
+  }
+  WBTransmitter& get_wb_tx(){
+    return *wbTransmitter;
+  }
+  ShmFrameRingConsumer& get_shm_consumer(){
+    return *shmConsumer;
+  }
+ private:
+  std::unique_ptr<WBTransmitter> wbTransmitter;
+  std::unique_ptr<ShmFrameRingConsumer> shmConsumer;
+  // The slots go back to the producer right after the callback, but the WBTransmitter keeps (shared) ownership of the
+  // fragments until they are injected - this is the only copy on the air unit. The buffers are recycled once the
+  // transmitter is done with them, such that there are no allocations per fragment.
+  FrameBlockPool frame_pool{4};
+  FrameBlock curr_frame;
+  uint64_t curr_frame_id=0;
+  void on_new_fragment(const uint8_t *payload,const std::size_t payloadSize,bool end_of_frame,uint64_t frame_id){
+    if(frame_id!=curr_frame_id){
+      // The producer dropped the end of the previous frame (ring was full) - discard the incomplete frame
+      curr_frame.clear();
+      curr_frame_id=frame_id;
+    }
+    if(payloadSize>0){
+      curr_frame.append_fragment(payload,payloadSize);
+    }
+    if(end_of_frame){
+      if(!curr_frame.empty()){
+        wbTransmitter->try_enqueue_block(curr_frame.to_shared_fragments(0,curr_frame.n_fragments()), 128);
+      }
+      frame_pool.release(std::move(curr_frame));
+      curr_frame=frame_pool.acquire();
+      curr_frame_id++;
+    }
+  }
+};
+
+#endif //SHM_BLOCKED_WB_TRANSMITTER_HPP
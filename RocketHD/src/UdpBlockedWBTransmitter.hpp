@@ -15,6 +15,7 @@
 #include <list>
 
 #include "rtp_eof_helper.hpp"
+#include "thread_stats.hpp"
 
 /**
  * Creates a WB Transmitter that gets its input data stream from an UDP Port
@@ -46,6 +47,7 @@ class UDPBlockedWBTransmitter {
    * Start looping in the background, creates a new thread.
    */
   void runInBackground() {
+    m_name_rx_thread= true;
     udpReceiver->runInBackground();
   }
   void stopBackground(){
@@ -58,7 +60,14 @@ class UDPBlockedWBTransmitter {
   std::unique_ptr<WBTransmitter> wbTransmitter;
   std::unique_ptr<SocketHelper::UDPReceiver> udpReceiver;
   std::vector<std::shared_ptr<std::vector<uint8_t>>> frame_fragments;
+  // The receiver thread is created by the library, it is named on its first packet
+  // (but not the calling thread with loopUntilError(), that would rename the process)
+  bool m_name_rx_thread=false;
   void on_new_udp_packet(const uint8_t *payload,const std::size_t payloadSize){
+    if(m_name_rx_thread){
+      thread_stats::set_current_thread_name("udp_rx");
+      m_name_rx_thread=false;
+    }
     auto shared=std::make_shared<std::vector<uint8_t>>(payload,payload+payloadSize);
     frame_fragments.push_back(shared);
     if(rtp_eof_helper::h265_end_block(payload,payloadSize)){
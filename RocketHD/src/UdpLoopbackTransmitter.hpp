@@ -0,0 +1,107 @@
+#ifndef UDP_LOOPBACK_TRANSMITTER_HPP
+#define UDP_LOOPBACK_TRANSMITTER_HPP
+
+#include "../lib/wifibroadcast/src/HelperSources/SocketHelper.hpp"
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "rtp_eof_helper.hpp"
+#include "thread_stats.hpp"
+
+/**
+ * Stand-in for UDPBlockedWBTransmitter when there is no injection capable card (e.g. on a dev machine):
+ * Same input (rtp over udp, blocks found via rtp_eof_helper), but instead of injecting the blocks they are
+ * forwarded via UDP to localhost (e.g. to rocket_rx -l <port>), optionally with simulated packet loss and reordering.
+ * NOTE: There is no FEC on this path (neither WBTransmitter nor WBReceiver) - the simulated loss is what remains after
+ * FEC on a real link. To exercise the real FEC encode / decode without cards, use hwsim_loopback.sh (virtual radios).
+ */
+class UDPLoopbackTransmitter {
+ public:
+  UDPLoopbackTransmitter(const std::string &client_addr,
+                         int client_udp_port,
+                         int loopback_udp_port,
+                         int simulated_loss_percentage=0,
+                         int simulated_reorder_percentage=0)
+      : m_simulated_loss_percentage(simulated_loss_percentage),
+        m_simulated_reorder_percentage(simulated_reorder_percentage){
+    udpForwarder = std::make_unique<SocketHelper::UDPForwarder>(SocketHelper::ADDRESS_LOCALHOST,loopback_udp_port);
+    udpReceiver = std::make_unique<SocketHelper::UDPReceiver>(client_addr,
+        client_udp_port,
+        [this](const uint8_t *payload,
+               const std::size_t payloadSize) {
+          on_new_udp_packet(payload,payloadSize);
+        });
+  }
+  /**
+   * Loop until an error occurs.
+   * Blocks the calling thread.
+   */
+  void loopUntilError() {
+    udpReceiver->loopUntilError();
+  }
+  /**
+   * Start looping in the background, creates a new thread.
+   */
+  void runInBackground() {
+    m_name_rx_thread= true;
+    udpReceiver->runInBackground();
+  }
+  void stopBackground(){
+    udpReceiver->stopBackground();
+  }
+  std::string createDebugState()const{
+    std::stringstream ss;
+    ss<<"LoopbackTx: blocks:"<<m_n_blocks<<" packets:"<<m_n_packets<<" simulated lost:"<<m_n_packets_dropped
+       <<" reordered:"<<m_n_packets_reordered<<"\n";
+    return ss.str();
+  }
+ private:
+  const int m_simulated_loss_percentage;
+  const int m_simulated_reorder_percentage;
+  std::unique_ptr<SocketHelper::UDPForwarder> udpForwarder;
+  std::unique_ptr<SocketHelper::UDPReceiver> udpReceiver;
+  std::vector<std::shared_ptr<std::vector<uint8_t>>> frame_fragments;
+  std::mt19937 m_random{std::random_device{}()};
+  std::uniform_int_distribution<int> m_percentage{0,99};
+  std::atomic<uint64_t> m_n_blocks=0;
+  std::atomic<uint64_t> m_n_packets=0;
+  std::atomic<uint64_t> m_n_packets_dropped=0;
+  std::atomic<uint64_t> m_n_packets_reordered=0;
+  // The receiver thread is created by the library, it is named on its first packet
+  // (but not the calling thread with loopUntilError(), that would rename the process)
+  bool m_name_rx_thread=false;
+  void on_new_udp_packet(const uint8_t *payload,const std::size_t payloadSize){
+    if(m_name_rx_thread){
+      thread_stats::set_current_thread_name("udp_rx");
+      m_name_rx_thread=false;
+    }
+    auto shared=std::make_shared<std::vector<uint8_t>>(payload,payload+payloadSize);
+    frame_fragments.push_back(shared);
+    if(rtp_eof_helper::h265_end_block(payload,payloadSize)){
+      forward_block(frame_fragments);
+      frame_fragments.resize(0);
+    }
+  }
+  void forward_block(std::vector<std::shared_ptr<std::vector<uint8_t>>>& fragments){
+    m_n_blocks++;
+    for(std::size_t i=0;i<fragments.size();i++){
+      if(i+1<fragments.size() && m_percentage(m_random)<m_simulated_reorder_percentage){
+        std::swap(fragments[i],fragments[i+1]);
+        m_n_packets_reordered++;
+      }
+      m_n_packets++;
+      if(m_percentage(m_random)<m_simulated_loss_percentage){
+        m_n_packets_dropped++;
+        continue;
+      }
+      udpForwarder->forwardPacketViaUDP(fragments[i]->data(),fragments[i]->size());
+    }
+  }
+};
+
+#endif //UDP_LOOPBACK_TRANSMITTER_HPP
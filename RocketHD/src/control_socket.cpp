@@ -0,0 +1,111 @@
+#include "control_socket.hpp"
+#include "thread_stats.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+// timeout such that we can check m_keep_looping regularly
+static constexpr int POLL_TIMEOUT_MS=100;
+// a client that sends garbage without newlines is disconnected
+static constexpr std::size_t MAX_REQUEST_SIZE=4096;
+
+ControlSocket::ControlSocket(std::string path,REQUEST_HANDLER handler)
+: m_path(std::move(path)),m_handler(std::move(handler))
+{
+  sockaddr_un address{};
+  if(m_path.size()>=sizeof(address.sun_path)){
+    throw std::runtime_error("Control socket path too long: "+m_path);
+  }
+  m_listen_fd=socket(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0);
+  if(m_listen_fd<0){
+    throw std::runtime_error(std::string("Cannot create control socket: ")+strerror(errno));
+  }
+  // left over from a previous run
+  unlink(m_path.c_str());
+  address.sun_family=AF_UNIX;
+  std::strncpy(address.sun_path,m_path.c_str(),sizeof(address.sun_path)-1);
+  if(bind(m_listen_fd,reinterpret_cast<sockaddr*>(&address),sizeof(address))<0 || listen(m_listen_fd,4)<0){
+    const auto error=std::string(strerror(errno));
+    close(m_listen_fd);
+    throw std::runtime_error("Cannot bind control socket "+m_path+": "+error);
+  }
+}
+
+ControlSocket::~ControlSocket() {
+  stopBackground();
+  close(m_listen_fd);
+  unlink(m_path.c_str());
+}
+
+void ControlSocket::loopUntilStopped() {
+  while (m_keep_looping){
+    pollfd pfd{m_listen_fd,POLLIN,0};
+    if(poll(&pfd,1,POLL_TIMEOUT_MS)<=0){
+      continue;
+    }
+    const int client_fd=accept4(m_listen_fd,nullptr,nullptr,SOCK_CLOEXEC);
+    if(client_fd<0){
+      continue;
+    }
+    serve_client(client_fd);
+    close(client_fd);
+  }
+}
+
+void ControlSocket::serve_client(int client_fd) {
+  std::string buffer;
+  char read_buffer[512];
+  while (m_keep_looping){
+    pollfd pfd{client_fd,POLLIN,0};
+    if(poll(&pfd,1,POLL_TIMEOUT_MS)<=0){
+      continue;
+    }
+    const auto n_read=read(client_fd,read_buffer,sizeof(read_buffer));
+    if(n_read<=0){
+      // client closed the connection
+      return;
+    }
+    buffer.append(read_buffer,n_read);
+    std::size_t newline;
+    while ((newline=buffer.find('\n'))!=std::string::npos){
+      auto request=buffer.substr(0,newline);
+      buffer.erase(0,newline+1);
+      if(!request.empty() && request.back()=='\r'){
+        request.pop_back();
+      }
+      const auto reply=m_handler(request)+"\n\n";
+      if(send(client_fd,reply.data(),reply.size(),MSG_NOSIGNAL)!=static_cast<ssize_t>(reply.size())){
+        return;
+      }
+    }
+    if(buffer.size()>MAX_REQUEST_SIZE){
+      return;
+    }
+  }
+}
+
+void ControlSocket::runInBackground() {
+  if(m_background_thread){
+    return;
+  }
+  m_keep_looping= true;
+  m_background_thread=std::make_unique<std::thread>([this](){
+    thread_stats::set_current_thread_name("control");
+    loopUntilStopped();
+  });
+}
+
+void ControlSocket::stopBackground() {
+  m_keep_looping= false;
+  if(m_background_thread){
+    if(m_background_thread->joinable())m_background_thread->join();
+    m_background_thread=nullptr;
+  }
+}
@@ -0,0 +1,127 @@
+#include "file_replay_source.hpp"
+#include "thread_stats.hpp"
+
+#include <gst/app/gstappsrc.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+FileReplaySource::FileReplaySource(std::shared_ptr<spdlog::logger> console,GstElement* appsrc,const std::string& path,
+                                   Format format,int fps)
+    : m_console(std::move(console)),
+      m_appsrc(appsrc),
+      m_fps(std::max(fps,1)){
+  assert(m_appsrc);
+  std::ifstream file(path,std::ios::binary);
+  if(!file){
+    gst_object_unref(m_appsrc);
+    throw std::runtime_error("Cannot open "+path);
+  }
+  auto data=std::make_shared<std::vector<uint8_t>>(std::istreambuf_iterator<char>(file),std::istreambuf_iterator<char>());
+  m_frames=format==Format::MJPEG ? split_mjpeg(*data) : split_h265(*data);
+  m_data=std::move(data);
+  if(m_frames.empty()){
+    gst_object_unref(m_appsrc);
+    throw std::runtime_error("No frames in "+path);
+  }
+  m_console->debug("FileReplaySource {} frames ({} bytes) from {}",m_frames.size(),m_data->size(),path);
+}
+
+FileReplaySource::~FileReplaySource() {
+  stop();
+  gst_object_unref(m_appsrc);
+}
+
+void FileReplaySource::start() {
+  if(m_thread){
+    return;
+  }
+  m_run= true;
+  m_thread=std::make_unique<std::thread>(&FileReplaySource::loop_push, this);
+}
+
+void FileReplaySource::stop() {
+  m_run= false;
+  if(m_thread && m_thread->joinable()){
+    m_thread->join();
+  }
+  m_thread= nullptr;
+}
+
+std::vector<std::pair<std::size_t,std::size_t>> FileReplaySource::split_mjpeg(const std::vector<uint8_t>& data) {
+  // A frame starts with SOI (ff d8 ff), the SOI of the next frame ends it. Entropy coded data can't contain
+  // ff d8 (0xff is always followed by 0x00 or a restart marker there).
+  std::vector<std::size_t> starts;
+  for(std::size_t i=0;i+2<data.size();i++){
+    if(data[i]==0xff && data[i+1]==0xd8 && data[i+2]==0xff){
+      starts.push_back(i);
+    }
+  }
+  std::vector<std::pair<std::size_t,std::size_t>> ret;
+  for(std::size_t i=0;i<starts.size();i++){
+    const std::size_t end= i+1<starts.size() ? starts[i+1] : data.size();
+    ret.emplace_back(starts[i],end-starts[i]);
+  }
+  return ret;
+}
+
+std::vector<std::pair<std::size_t,std::size_t>> FileReplaySource::split_h265(const std::vector<uint8_t>& data) {
+  // Offset of each start code (00 00 01, a preceding 00 of a 4 byte start code belongs to the nalu)
+  std::vector<std::size_t> nalus;
+  for(std::size_t i=0;i+3<data.size();i++){
+    if(data[i]==0 && data[i+1]==0 && data[i+2]==1){
+      nalus.push_back(i>0 && data[i-1]==0 ? i-1 : i);
+      i+=2;
+    }
+  }
+  std::vector<std::pair<std::size_t,std::size_t>> ret;
+  std::size_t au_start=0;
+  bool au_has_vcl=false;
+  for(const auto nalu:nalus){
+    const std::size_t header=data[nalu]==0 && data[nalu+1]==0 && data[nalu+2]==0 ? nalu+4 : nalu+3;
+    if(header+2>=data.size()){
+      break;
+    }
+    const int type=(data[header]>>1) & 0x3f;
+    const bool is_vcl=type<32;
+    // first_slice_segment_in_pic_flag, the first bit after the 2 byte nalu header
+    const bool is_first_slice=is_vcl && (data[header+2] & 0x80);
+    // VPS, SPS, PPS, AUD, prefix SEI or the first slice of a picture start a new access unit
+    const bool starts_au=is_first_slice || (type>=32 && type<=35) || type==39;
+    if(starts_au && au_has_vcl){
+      ret.emplace_back(au_start,nalu-au_start);
+      au_start=nalu;
+      au_has_vcl=false;
+    }
+    au_has_vcl|=is_vcl;
+  }
+  if(au_has_vcl){
+    ret.emplace_back(au_start,data.size()-au_start);
+  }
+  return ret;
+}
+
+void FileReplaySource::loop_push() {
+  thread_stats::set_current_thread_name("file_replay");
+  const auto frame_interval=std::chrono::nanoseconds(1000000000/m_fps);
+  auto next_frame_time=std::chrono::steady_clock::now();
+  std::size_t index=0;
+  while (m_run){
+    std::this_thread::sleep_until(next_frame_time);
+    next_frame_time+=frame_interval;
+    const auto& [offset,size]=m_frames[index];
+    index=(index+1)%m_frames.size();
+    // the buffer keeps the file data alive, read only since it is shared by all loops
+    auto* data_ref=new std::shared_ptr<const std::vector<uint8_t>>(m_data);
+    GstBuffer* buffer=gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,const_cast<uint8_t*>(m_data->data()+offset),size,0,size,data_ref,
+                                                  [](gpointer user_data){
+                                                    delete static_cast<std::shared_ptr<const std::vector<uint8_t>>*>(user_data);
+                                                  });
+    // takes ownership of the buffer, timestamped by the appsrc (do-timestamp)
+    gst_app_src_push_buffer(GST_APP_SRC(m_appsrc),buffer);
+  }
+}
@@ -0,0 +1,324 @@
+#include "flight_recorder.hpp"
+#include "thread_stats.hpp"
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+namespace flight_recorder{
+
+namespace {
+
+// Rings of exited threads are kept (with their events) until this many rings exist, such that the events of
+// e.g. the pull threads of a pipeline that was just restarted are still in the next dump.
+static constexpr std::size_t MAX_N_RINGS=64;
+
+struct Registry{
+  std::mutex mutex;
+  // never freed, the rings are accessed without locks
+  std::vector<std::unique_ptr<ThreadRing>> rings;
+};
+
+Registry& get_registry(){
+  static Registry registry;
+  return registry;
+}
+
+// Reads the event with the given index. False if its slot doesn't hold it (not written yet, overwritten by a newer
+// event, or being written right now).
+bool read_event(const ThreadRing& ring,uint64_t index,Event& event){
+  const auto& slot=ring.events[index%RING_SIZE];
+  const auto sequence=slot.sequence.load(std::memory_order_acquire);
+  if(sequence!=2*index+2){
+    return false;
+  }
+  std::array<uint64_t,sizeof(Event)/sizeof(uint64_t)> words{};
+  for(std::size_t i=0;i<words.size();i++){
+    words[i]=slot.words[i].load(std::memory_order_relaxed);
+  }
+  // the words must be read before the sequence is checked again
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if(slot.sequence.load(std::memory_order_relaxed)!=sequence){
+    return false;
+  }
+  std::memcpy(&event,words.data(),sizeof(Event));
+  return true;
+}
+
+uint64_t get_last_timestamp(const ThreadRing& ring){
+  const auto write_index=ring.write_index.load(std::memory_order_acquire);
+  Event event{};
+  if(write_index==0 || !read_event(ring,write_index-1,event)){
+    return 0;
+  }
+  return event.timestamp_ns;
+}
+
+ThreadRing& register_thread(){
+  auto& registry=get_registry();
+  std::lock_guard<std::mutex> guard(registry.mutex);
+  ThreadRing* ring=nullptr;
+  if(registry.rings.size()>=MAX_N_RINGS){
+    // reuse the ring of the thread that exited longest ago
+    for(auto& candidate:registry.rings){
+      if(candidate->in_use.load(std::memory_order_relaxed)){
+        continue;
+      }
+      if(ring==nullptr || get_last_timestamp(*candidate)<get_last_timestamp(*ring)){
+        ring=candidate.get();
+      }
+    }
+  }
+  if(ring==nullptr){
+    registry.rings.push_back(std::make_unique<ThreadRing>());
+    ring=registry.rings.back().get();
+  }
+  ring->write_index.store(0,std::memory_order_relaxed);
+  ring->tid=static_cast<uint32_t>(syscall(SYS_gettid));
+  std::memset(ring->name,0,sizeof(ring->name));
+  pthread_getname_np(pthread_self(),ring->name,sizeof(ring->name));
+  ring->in_use.store(true,std::memory_order_relaxed);
+  return *ring;
+}
+
+// Marks the ring as free once its thread exits
+struct RingOwner{
+  ThreadRing& ring;
+  ~RingOwner(){
+    ring.in_use.store(false,std::memory_order_relaxed);
+  }
+};
+
+// The events of one ring, oldest first. The owning thread might write while we copy - events that were
+// overwritten (or are being written) during the copy are discarded.
+std::vector<Event> copy_events(const ThreadRing& ring){
+  const auto end=ring.write_index.load(std::memory_order_acquire);
+  const auto begin=end>RING_SIZE ? end-RING_SIZE : 0;
+  std::vector<Event> ret;
+  ret.reserve(end-begin);
+  for(auto i=begin;i<end;i++){
+    Event event{};
+    if(read_event(ring,i,event)){
+      ret.push_back(event);
+    }
+  }
+  return ret;
+}
+
+}
+
+ThreadRing& get_thread_ring() {
+  thread_local RingOwner owner{register_thread()};
+  return owner.ring;
+}
+
+void dump_to_file(const std::string& path) {
+  std::vector<std::pair<const ThreadRing*,std::vector<Event>>> threads;
+  {
+    auto& registry=get_registry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    for(const auto& ring:registry.rings){
+      threads.emplace_back(ring.get(),copy_events(*ring));
+    }
+  }
+  std::ofstream file(path,std::ios::binary|std::ios::trunc);
+  if(!file.is_open()){
+    throw std::runtime_error("Cannot write flight recorder dump "+path);
+  }
+  FileHeader header{};
+  header.magic=FILE_MAGIC;
+  header.version=FILE_VERSION;
+  header.dump_steady_ns=now_ns();
+  header.dump_unix_ns=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  header.n_threads=static_cast<uint32_t>(threads.size());
+  file.write(reinterpret_cast<const char*>(&header),sizeof(header));
+  for(const auto& [ring,events]:threads){
+    ThreadHeader thread_header{};
+    thread_header.tid=ring->tid;
+    std::memcpy(thread_header.name,ring->name,sizeof(thread_header.name));
+    thread_header.n_events=static_cast<uint32_t>(events.size());
+    file.write(reinterpret_cast<const char*>(&thread_header),sizeof(thread_header));
+    file.write(reinterpret_cast<const char*>(events.data()),static_cast<std::streamsize>(events.size()*sizeof(Event)));
+  }
+  if(!file.good()){
+    throw std::runtime_error("Cannot write flight recorder dump "+path);
+  }
+}
+
+Dump read_file(const std::string& path) {
+  std::ifstream file(path,std::ios::binary);
+  if(!file.is_open()){
+    throw std::runtime_error("Cannot open "+path);
+  }
+  Dump ret{};
+  if(!file.read(reinterpret_cast<char*>(&ret.header),sizeof(ret.header)) || ret.header.magic!=FILE_MAGIC){
+    throw std::runtime_error(path+" is not a flight recorder dump");
+  }
+  if(ret.header.version!=FILE_VERSION){
+    throw std::runtime_error(path+": unsupported version "+std::to_string(ret.header.version));
+  }
+  for(uint32_t i=0;i<ret.header.n_threads;i++){
+    ThreadHeader thread_header{};
+    if(!file.read(reinterpret_cast<char*>(&thread_header),sizeof(thread_header)) || thread_header.n_events>RING_SIZE){
+      throw std::runtime_error(path+": truncated or corrupt");
+    }
+    ThreadEvents thread{thread_header.tid,std::string(thread_header.name,strnlen(thread_header.name,sizeof(thread_header.name))),{}};
+    thread.events.resize(thread_header.n_events);
+    if(!file.read(reinterpret_cast<char*>(thread.events.data()),static_cast<std::streamsize>(thread.events.size()*sizeof(Event)))){
+      throw std::runtime_error(path+": truncated or corrupt");
+    }
+    ret.threads.push_back(std::move(thread));
+  }
+  return ret;
+}
+
+std::string event_type_to_string(EventType type) {
+  switch (type) {
+    case EventType::NONE:return "NONE";
+    case EventType::FRAGMENT_PULLED:return "FRAGMENT_PULLED";
+    case EventType::FRAME_CLOSED:return "FRAME_CLOSED";
+    case EventType::FRAME_DROPPED:return "FRAME_DROPPED";
+    case EventType::FRAME_TO_TX:return "FRAME_TO_TX";
+    case EventType::TX_BLOCK_ENQUEUED:return "TX_BLOCK_ENQUEUED";
+    case EventType::TX_BLOCK_DROPPED:return "TX_BLOCK_DROPPED";
+    case EventType::TX_BLOCK_RELEASED:return "TX_BLOCK_RELEASED";
+    case EventType::TX_BLOCK_DONE:return "TX_BLOCK_DONE";
+    case EventType::RAW_FRAME_CONVERTED:return "RAW_FRAME_CONVERTED";
+    case EventType::RAW_FRAME_DROPPED:return "RAW_FRAME_DROPPED";
+    case EventType::KEYFRAME_REQUESTED:return "KEYFRAME_REQUESTED";
+    case EventType::PIPELINE_STATE:return "PIPELINE_STATE";
+    case EventType::PIPELINE_RECONFIGURED:return "PIPELINE_RECONFIGURED";
+    case EventType::PIPELINE_RESTART:return "PIPELINE_RESTART";
+    case EventType::LINK_ADAPTATION:return "LINK_ADAPTATION";
+    case EventType::SIMULCAST_SWITCH:return "SIMULCAST_SWITCH";
+    case EventType::DUMP_REQUESTED:return "DUMP_REQUESTED";
+  }
+  return "UNKNOWN("+std::to_string(static_cast<int>(type))+")";
+}
+
+std::string drop_reason_to_string(uint32_t reason) {
+  switch (static_cast<DropReason>(reason)) {
+    case DropReason::QUEUE_FULL:return "queue_full";
+    case DropReason::MEMORY_BUDGET:return "memory_budget";
+    case DropReason::TOO_BIG:return "too_big";
+    case DropReason::UNSUPPORTED_FORMAT:return "unsupported_format";
+  }
+  return "unknown("+std::to_string(reason)+")";
+}
+
+std::string event_args_to_string(const Event& event) {
+  std::stringstream ss;
+  switch (event.type) {
+    case EventType::FRAGMENT_PULLED:
+      ss<<"stream:"<<event.a<<" size:"<<event.b;
+      break;
+    case EventType::FRAME_CLOSED:
+      ss<<"stream:"<<event.a<<" fragments:"<<(event.b>>32)<<" bytes:"<<(event.b & 0xFFFFFFFF);
+      break;
+    case EventType::FRAME_DROPPED:
+      ss<<"stream:"<<event.a<<" reason:"<<drop_reason_to_string(static_cast<uint32_t>(event.b));
+      break;
+    case EventType::FRAME_TO_TX:
+      ss<<"stream:"<<event.a<<(event.b ? " enqueued" : " inactive stream");
+      break;
+    case EventType::TX_BLOCK_ENQUEUED:
+      ss<<"fragments:"<<event.a<<" bytes:"<<event.b;
+      break;
+    case EventType::TX_BLOCK_DROPPED:
+      ss<<"fragments:"<<event.a<<" reason:"<<drop_reason_to_string(static_cast<uint32_t>(event.b));
+      break;
+    case EventType::TX_BLOCK_RELEASED:
+      ss<<"fragments:"<<event.a<<" airtime:"<<event.b<<"us";
+      break;
+    case EventType::TX_BLOCK_DONE:
+      ss<<"latency:"<<event.b<<"us";
+      break;
+    case EventType::RAW_FRAME_CONVERTED:
+      ss<<"time:"<<event.b<<"us";
+      break;
+    case EventType::RAW_FRAME_DROPPED:
+      ss<<"reason:"<<drop_reason_to_string(static_cast<uint32_t>(event.b));
+      break;
+    case EventType::KEYFRAME_REQUESTED:
+    case EventType::SIMULCAST_SWITCH:
+      ss<<"stream:"<<event.a;
+      break;
+    case EventType::PIPELINE_STATE:
+      ss<<"state:"<<event.a;
+      break;
+    case EventType::PIPELINE_RECONFIGURED:
+      ss<<(event.a==0 ? "failed" : event.a==1 ? "swapped" : "swapped without keyframe")<<" gap:"<<event.b<<"ms";
+      break;
+    case EventType::LINK_ADAPTATION:
+      ss<<"mcs:"<<event.a<<" fec:"<<(event.b>>32)<<"% k:"<<(event.b & 0xFFFFFFFF);
+      break;
+    case EventType::DUMP_REQUESTED:
+      ss<<(event.a==static_cast<uint32_t>(DumpReason::SIGNAL) ? "signal" : "watchdog restart");
+      break;
+    default:
+      ss<<"a:"<<event.a<<" b:"<<event.b;
+      break;
+  }
+  return ss.str();
+}
+
+}
+
+// -1: no dump requested, otherwise the DumpReason. Written from the signal handler.
+static std::atomic<int> requested_dump_reason{-1};
+static_assert(std::atomic<int>::is_always_lock_free);
+
+static void on_sigusr1(int){
+  FlightRecorderDumper::request_dump(flight_recorder::DumpReason::SIGNAL);
+}
+
+FlightRecorderDumper::FlightRecorderDumper(std::string path_prefix)
+: m_console(rocket_log::create_or_get("flight_recorder")),
+  m_path_prefix(std::move(path_prefix)){
+  struct sigaction action{};
+  action.sa_handler=on_sigusr1;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags=SA_RESTART;
+  if(sigaction(SIGUSR1,&action,nullptr)!=0){
+    throw std::runtime_error("Cannot install SIGUSR1 handler");
+  }
+  m_thread=std::make_unique<std::thread>(&FlightRecorderDumper::loop_dump, this);
+}
+
+FlightRecorderDumper::~FlightRecorderDumper() {
+  m_run= false;
+  if(m_thread->joinable())m_thread->join();
+  signal(SIGUSR1,SIG_DFL);
+}
+
+void FlightRecorderDumper::request_dump(flight_recorder::DumpReason reason) {
+  requested_dump_reason.store(static_cast<int>(reason));
+}
+
+void FlightRecorderDumper::loop_dump() {
+  thread_stats::set_current_thread_name("fr_dump");
+  while (m_run){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const int reason=requested_dump_reason.exchange(-1);
+    if(reason<0){
+      continue;
+    }
+    flight_recorder::record(flight_recorder::EventType::DUMP_REQUESTED,static_cast<uint32_t>(reason));
+    const auto unix_s=std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    const auto path=m_path_prefix+"-"+std::to_string(unix_s)+
+        (reason==static_cast<int>(flight_recorder::DumpReason::SIGNAL) ? "-signal" : "-watchdog")+".bin";
+    try{
+      flight_recorder::dump_to_file(path);
+      m_console->info("Flight recorder dumped to {}",path);
+    }catch (std::runtime_error& e){
+      m_console->error("{}",e.what());
+    }
+  }
+}
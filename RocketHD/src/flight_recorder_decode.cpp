@@ -0,0 +1,104 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "flight_recorder.hpp"
+
+// Turns a flight recorder dump (see flight_recorder.hpp) into a timeline:
+// The events of all threads merged and sorted by time, relative to the dump (negative ms, the last event is
+// closest to 0), with the thread that recorded them.
+// Gaps between two events of the same thread longer than -g ms are marked, to find the stall quickly.
+
+struct TimelineEntry{
+  flight_recorder::Event event;
+  const flight_recorder::ThreadEvents* thread;
+};
+
+int main(int argc, char *const *argv) {
+  int opt;
+  double window_ms=0;
+  double gap_ms=0;
+  bool per_thread_summary=false;
+  while ((opt = getopt(argc, argv, "w:g:s")) != -1) {
+    switch (opt) {
+      case 'w':window_ms = std::stod(optarg);
+        break;
+      case 'g':gap_ms = std::stod(optarg);
+        break;
+      case 's':per_thread_summary = true;
+        break;
+      default: /* '?' */
+      show_usage:
+        fprintf(stderr,
+                "Usage: %s [-w only the last window_ms before the dump] [-g mark gaps > gap_ms within a thread] [-s per thread summary] dump.bin\n",
+                argv[0]);
+        exit(1);
+    }
+  }
+  if (optind >= argc) {
+    goto show_usage;
+  }
+  flight_recorder::Dump dump;
+  try{
+    dump=flight_recorder::read_file(argv[optind]);
+  }catch (std::runtime_error& e){
+    fprintf(stderr,"%s\n",e.what());
+    return 1;
+  }
+  const auto dump_steady_ns=dump.header.dump_steady_ns;
+  const time_t dump_unix_s=static_cast<time_t>(dump.header.dump_unix_ns/1000000000ULL);
+  char time_str[64];
+  strftime(time_str,sizeof(time_str),"%Y-%m-%d %H:%M:%S",localtime(&dump_unix_s));
+  printf("Dump at %s, %d threads\n",time_str,static_cast<int>(dump.threads.size()));
+
+  std::vector<TimelineEntry> timeline;
+  for(const auto& thread:dump.threads){
+    for(const auto& event:thread.events){
+      const double ms_before_dump=static_cast<double>(dump_steady_ns-event.timestamp_ns)/1000000.0;
+      if(window_ms>0 && ms_before_dump>window_ms){
+        continue;
+      }
+      timeline.push_back({event,&thread});
+    }
+  }
+  std::stable_sort(timeline.begin(),timeline.end(),[](const TimelineEntry& lhs,const TimelineEntry& rhs){
+    return lhs.event.timestamp_ns<rhs.event.timestamp_ns;
+  });
+  if(per_thread_summary){
+    for(const auto& thread:dump.threads){
+      std::map<flight_recorder::EventType,int> counts;
+      for(const auto& event:thread.events){
+        counts[event.type]++;
+      }
+      printf("Thread %u %s: %d events\n",thread.tid,thread.name.c_str(),static_cast<int>(thread.events.size()));
+      for(const auto& [type,count]:counts){
+        printf("  %s: %d\n",flight_recorder::event_type_to_string(type).c_str(),count);
+      }
+    }
+  }
+  std::map<const flight_recorder::ThreadEvents*,uint64_t> last_event_per_thread;
+  for(const auto& entry:timeline){
+    const auto& event=entry.event;
+    if(gap_ms>0){
+      auto last=last_event_per_thread.find(entry.thread);
+      if(last!=last_event_per_thread.end()){
+        const double gap=static_cast<double>(event.timestamp_ns-last->second)/1000000.0;
+        if(gap>gap_ms){
+          printf("%12s  %-15s  --- gap of %.3fms ---\n","",entry.thread->name.c_str(),gap);
+        }
+      }
+      last_event_per_thread[entry.thread]=event.timestamp_ns;
+    }
+    const double ms=-static_cast<double>(dump_steady_ns-event.timestamp_ns)/1000000.0;
+    printf("%12.3f  %-15s  %-21s %s\n",ms,entry.thread->name.c_str(),
+           flight_recorder::event_type_to_string(event.type).c_str(),
+           flight_recorder::event_args_to_string(event).c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,111 @@
+#include "frame_block.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+
+void FrameBlock::clear() {
+  for(auto& buffer:m_fragments){
+    m_free_buffers.push_back(std::move(buffer));
+  }
+  m_fragments.resize(0);
+  m_n_bytes=0;
+}
+
+static bool is_exclusive(const FrameBlock::BUFFER& buffer){
+  if(buffer.use_count()!=1){
+    return false;
+  }
+  // the other owner(s) (transmitter thread) are done with the buffer
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return true;
+}
+
+void FrameBlock::drop_shared_buffers() {
+  m_free_buffers.erase(std::remove_if(m_free_buffers.begin(),m_free_buffers.end(),[](const BUFFER& buffer){
+    return !is_exclusive(buffer);
+  }),m_free_buffers.end());
+}
+
+uint8_t* FrameBlock::append_fragment(std::size_t size) {
+  BUFFER buffer;
+  while (!m_free_buffers.empty()){
+    buffer=std::move(m_free_buffers.back());
+    m_free_buffers.pop_back();
+    if(is_exclusive(buffer)){
+      break;
+    }
+    // still used by the transmitter, freed by it
+    buffer=nullptr;
+  }
+  if(!buffer){
+    buffer=std::make_shared<std::vector<uint8_t>>();
+  }
+  // resize on a vector with enough capacity doesn't allocate
+  buffer->resize(size);
+  m_n_bytes+=size;
+  m_fragments.push_back(std::move(buffer));
+  return m_fragments.back()->data();
+}
+
+void FrameBlock::append_fragment(const uint8_t* data,std::size_t size) {
+  std::memcpy(append_fragment(size),data,size);
+}
+
+std::size_t FrameBlock::n_allocated_bytes() const {
+  std::size_t ret=(m_fragments.capacity()+m_free_buffers.capacity())*sizeof(BUFFER);
+  for(const auto& buffer:m_fragments){
+    ret+=buffer->capacity();
+  }
+  for(const auto& buffer:m_free_buffers){
+    ret+=buffer->capacity();
+  }
+  return ret;
+}
+
+std::vector<FrameBlock::BUFFER> FrameBlock::to_shared_fragments(std::size_t begin,std::size_t end) const {
+  assert(begin<=end && end<=m_fragments.size());
+  return {m_fragments.begin()+static_cast<std::ptrdiff_t>(begin),m_fragments.begin()+static_cast<std::ptrdiff_t>(end)};
+}
+
+FrameBlockPool::FrameBlockPool(std::size_t max_n_pooled,std::shared_ptr<MemoryBudget> memory_budget)
+: m_max_n_pooled(max_n_pooled),
+  m_memory_budget(std::move(memory_budget)){
+}
+
+FrameBlockPool::~FrameBlockPool() {
+  if(m_memory_budget){
+    for(const auto& block:m_free_blocks){
+      m_memory_budget->release(MemoryBudget::Stage::BLOCK_POOL,block.n_allocated_bytes());
+    }
+  }
+}
+
+FrameBlock FrameBlockPool::acquire() {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  if(m_free_blocks.empty()){
+    return FrameBlock{};
+  }
+  auto ret=std::move(m_free_blocks.back());
+  m_free_blocks.pop_back();
+  if(m_memory_budget){
+    m_memory_budget->release(MemoryBudget::Stage::BLOCK_POOL,ret.n_allocated_bytes());
+  }
+  // by now, the transmitter is done with (almost) all of them
+  ret.drop_shared_buffers();
+  return ret;
+}
+
+void FrameBlockPool::release(FrameBlock&& block) {
+  block.clear();
+  std::lock_guard<std::mutex> guard(m_mutex);
+  if(m_free_blocks.size()>=m_max_n_pooled){
+    return;
+  }
+  if(m_memory_budget && !m_memory_budget->try_acquire(MemoryBudget::Stage::BLOCK_POOL,block.n_allocated_bytes())){
+    // freed when block goes out of scope
+    return;
+  }
+  m_free_blocks.push_back(std::move(block));
+}
@@ -0,0 +1,165 @@
+#include "frame_reassembler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+#include <utility>
+
+static constexpr auto RTP_HEADER_SIZE = 12;
+
+FrameReassembler::FrameReassembler(FrameReassemblerOptions options,FRAME_CALLBACK cb,FRAME_DROPPED_CALLBACK dropped_cb)
+: m_options(options),m_cb(std::move(cb)),m_dropped_cb(std::move(dropped_cb))
+{
+  assert(m_cb);
+  assert(m_options.max_pending_frames>0);
+}
+
+uint64_t FrameReassembler::unwrap_seq(uint16_t seq) {
+  if(!m_highest_seq.has_value()){
+    // start with some headroom, such that reordered packets before the first packet don't underflow
+    m_highest_seq=(static_cast<uint64_t>(1)<<32)+seq;
+    return m_highest_seq.value();
+  }
+  const auto highest=m_highest_seq.value();
+  const auto delta=static_cast<int16_t>(static_cast<uint16_t>(seq-static_cast<uint16_t>(highest)));
+  const uint64_t ret=highest+delta;
+  if(ret>highest){
+    m_highest_seq=ret;
+  }
+  return ret;
+}
+
+void FrameReassembler::on_new_packet(const uint8_t *payload,std::size_t payloadSize) {
+  const auto now=std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_stats.n_packets++;
+  if(payloadSize<RTP_HEADER_SIZE || (payload[0]>>6)!=2){
+    m_stats.n_packets_invalid++;
+    return;
+  }
+  const bool marker=(payload[1] & 0x80)!=0;
+  const uint16_t seq=(payload[2]<<8) | payload[3];
+  const uint32_t rtp_timestamp=(payload[4]<<24) | (payload[5]<<16) | (payload[6]<<8) | payload[7];
+  const auto highest_before=m_highest_seq;
+  const auto ext_seq=unwrap_seq(seq);
+  if(m_last_released_seq.has_value() && ext_seq<=m_last_released_seq.value()){
+    m_stats.n_packets_late++;
+    return;
+  }
+  if(highest_before.has_value() && ext_seq<highest_before.value()){
+    m_stats.n_packets_reordered++;
+  }
+  auto frame_it=std::find_if(m_pending_frames.begin(),m_pending_frames.end(),[rtp_timestamp](const PendingFrame& frame){
+    return frame.rtp_timestamp==rtp_timestamp;
+  });
+  if(frame_it==m_pending_frames.end()){
+    m_pending_frames.push_back(PendingFrame{rtp_timestamp,now,{},std::nullopt});
+    frame_it=m_pending_frames.end()-1;
+  }
+  auto& packets=frame_it->packets;
+  auto packet_it=std::lower_bound(packets.begin(),packets.end(),ext_seq,[](const auto& packet,uint64_t value){
+    return packet.first<value;
+  });
+  if(packet_it!=packets.end() && packet_it->first==ext_seq){
+    m_stats.n_packets_duplicate++;
+    return;
+  }
+  packets.insert(packet_it,std::make_pair(ext_seq,std::make_shared<std::vector<uint8_t>>(payload,payload+payloadSize)));
+  if(marker){
+    frame_it->marker_seq=ext_seq;
+  }
+  // a reordered packet can change the order of the frames
+  std::sort(m_pending_frames.begin(),m_pending_frames.end(),[](const PendingFrame& a,const PendingFrame& b){
+    return a.min_seq()<b.min_seq();
+  });
+  release_frames(now);
+}
+
+void FrameReassembler::check_timeouts() {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  release_frames(std::chrono::steady_clock::now());
+}
+
+bool FrameReassembler::is_complete(const PendingFrame& frame) const {
+  if(!frame.marker_seq.has_value()){
+    return false;
+  }
+  // Before the first frame has been released, we cannot know where a frame starts
+  const auto start=m_last_released_seq.has_value() ? m_last_released_seq.value()+1 : frame.min_seq();
+  const auto end=frame.marker_seq.value();
+  return frame.min_seq()==start && frame.packets.size()==(end-start+1);
+}
+
+void FrameReassembler::release_frames(std::chrono::steady_clock::time_point now) {
+  while (!m_pending_frames.empty()){
+    const auto& oldest=m_pending_frames.front();
+    if(is_complete(oldest)){
+      release_oldest_frame(now, true);
+      continue;
+    }
+    const bool window_expired=(now-oldest.first_packet_arrival)>=m_options.reorder_window;
+    if(window_expired || static_cast<int>(m_pending_frames.size())>m_options.max_pending_frames){
+      release_oldest_frame(now, false);
+      continue;
+    }
+    // Frames are released in order - everything after an incomplete frame has to wait
+    break;
+  }
+}
+
+void FrameReassembler::release_oldest_frame(std::chrono::steady_clock::time_point now,bool complete) {
+  assert(!m_pending_frames.empty());
+  auto frame=std::move(m_pending_frames.front());
+  m_pending_frames.erase(m_pending_frames.begin());
+  const auto start=m_last_released_seq.has_value() ? m_last_released_seq.value()+1 : frame.min_seq();
+  const auto end=frame.marker_seq.value_or(frame.max_seq());
+  const uint64_t n_expected=end>=start ? end-start+1 : 0;
+  if(n_expected>frame.packets.size()){
+    m_stats.n_packets_lost+=n_expected-frame.packets.size();
+  }
+  m_last_released_seq=std::max(end,m_last_released_seq.value_or(0));
+  const auto hold_time=now-frame.first_packet_arrival;
+  m_frame_hold_time_sum+=hold_time;
+  m_stats.frame_hold_time_max=std::max(m_stats.frame_hold_time_max,std::chrono::duration_cast<std::chrono::nanoseconds>(hold_time));
+  FRAME_FRAGMENTS frame_fragments;
+  frame_fragments.reserve(frame.packets.size());
+  for(auto& packet:frame.packets){
+    frame_fragments.push_back(std::move(packet.second));
+  }
+  if(!complete && !m_options.forward_incomplete_frames){
+    m_stats.n_frames_dropped++;
+    if(m_dropped_cb){
+      m_dropped_cb(frame_fragments);
+    }
+    return;
+  }
+  if(complete){
+    m_stats.n_frames_complete++;
+  }else{
+    m_stats.n_frames_incomplete_forwarded++;
+  }
+  m_cb(frame_fragments,complete);
+}
+
+FrameReassemblerStats FrameReassembler::get_stats() {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  auto ret=m_stats;
+  const auto n_frames=m_stats.n_frames_complete+m_stats.n_frames_incomplete_forwarded+m_stats.n_frames_dropped;
+  if(n_frames>0){
+    ret.frame_hold_time_avg=m_frame_hold_time_sum/n_frames;
+  }
+  return ret;
+}
+
+std::string FrameReassembler::createDebug() {
+  const auto stats=get_stats();
+  std::stringstream ss;
+  ss<<"FrameReassembler: packets:"<<stats.n_packets<<" lost:"<<stats.n_packets_lost
+     <<" reordered:"<<stats.n_packets_reordered<<" dup:"<<stats.n_packets_duplicate
+     <<" late:"<<stats.n_packets_late<<" invalid:"<<stats.n_packets_invalid
+     <<" frames complete:"<<stats.n_frames_complete<<" incomplete:"<<stats.n_frames_incomplete_forwarded
+     <<" dropped:"<<stats.n_frames_dropped
+     <<" hold avg:"<<std::chrono::duration_cast<std::chrono::microseconds>(stats.frame_hold_time_avg).count()<<"us"
+     <<" max:"<<std::chrono::duration_cast<std::chrono::microseconds>(stats.frame_hold_time_max).count()<<"us";
+  return ss.str();
+}
@@ -3,11 +3,17 @@
 #include <gst/gst.h>
 #include <unistd.h>
 
+#include <cstring>
 #include <regex>
 #include <vector>
 
+#include <gst/video/video.h>
+
+#include "flight_recorder.hpp"
 #include "gst_appsink_helper.hpp"
+#include "rocket_log.hpp"
 #include "rtp_eof_helper.hpp"
+#include "thread_stats.hpp"
 
 static std::string gst_state_change_return_to_string(GstStateChangeReturn & gst_state_change_return){
   return fmt::format("{}",gst_element_state_change_return_get_name(gst_state_change_return));
@@ -33,48 +39,284 @@ void GStreamerStream::initGstreamerOrThrow() {
   }
 }
 
-GStreamerStream::GStreamerStream(std::shared_ptr<WBLink> wb_link)
-: m_wb_link(std::move(wb_link))
+GStreamerStream::GStreamerStream(std::shared_ptr<WBLink> wb_link,CameraSettings settings,std::shared_ptr<MemoryBudget> memory_budget)
+: m_settings(std::move(settings)),
+  m_memory_budget(memory_budget ? std::move(memory_budget) : std::make_shared<MemoryBudget>()),
+  m_parameter_set_interval_ms(m_settings.parameter_set_interval_ms),
+  m_wb_link(std::move(wb_link))
 {
-  m_console=spdlog::stdout_color_mt("gstreamer");
-  m_console->set_level(spdlog::level::debug);
+  m_console=rocket_log::create_or_get("gstreamer");
   m_console->debug("GStreamerStream::GStreamerStream()");
   initGstreamerOrThrow();
   m_console->debug("GStreamerStream::GStreamerStream done");
 }
 
 GStreamerStream::~GStreamerStream() {
+  {
+    std::lock_guard<std::mutex> guard(m_async_thread_mutex);
+    m_restart_requested= false;
+  }
+  if(m_async_thread && m_async_thread->joinable())m_async_thread->join();
   // they are safe to call, regardless if we are already in cleaned up state or not
   GStreamerStream::stop();
   GStreamerStream::cleanup_pipe();
 }
 
+// the hw encoder wants the height to be a multiple of 16 (e.g. 1080 -> 1088)
+static int get_encoder_padding(VideoEncoder encoder,int height){
+  if(encoder!=VideoEncoder::MPP){
+    return 0;
+  }
+  return (16-height%16)%16;
+}
+
+// All queues of a pipeline are leaky and only bounded by their size in bytes, which is set once the pipeline
+// has been created (see create_pipeline). This gives them names to find them again.
+struct PipelineQueues{
+  int n_queues=0;
+  std::string create(){
+    return fmt::format("queue name=queue{} leaky=downstream max-size-buffers=0 max-size-time=0 ! ",n_queues++);
+  }
+};
+
+// padding: rows to add at the bottom (if the input isn't padded already)
+static std::string create_encoder_branch(PipelineQueues& queues,VideoEncoder encoder,int padding,int bitrate_kbits,int gop_size,
+                                         int rtp_mtu,const std::string& name_suffix){
+  std::stringstream ss;
+  if(padding>0){
+    ss << fmt::format("videobox bottom=-{} ! ",padding);
+  }
+  ss << queues.create();
+  if(encoder==VideoEncoder::MPP){
+    ss << fmt::format("mpph265enc name=encoder{} bps={} gop={} ! ",name_suffix,bitrate_kbits*1000,gop_size);
+  }else{
+    // x265enc doesn't take NV12 / YUY2
+    ss << "videoconvert ! video/x-raw,format=I420 ! ";
+    ss << fmt::format("x265enc name=encoder{} bitrate={} key-int-max={} speed-preset=ultrafast tune=zerolatency ! ",
+                      name_suffix,bitrate_kbits,gop_size);
+  }
+  ss << fmt::format("h265parse ! rtph265pay name=payloader{} config-interval=-1 mtu={} ! ",name_suffix,rtp_mtu);
+  // max-buffers is set once the pipeline has been created (see create_pipeline)
+  ss << fmt::format("appsink drop=true name=out_appsink{}",name_suffix);
+  return ss.str();
+}
+
+// Up to (and including) the decoder, the output is raw video at the configured resolution and frame rate
+static std::string create_source_string(const CameraSettings& settings,PipelineQueues& queues){
+  std::stringstream ss;
+  switch (settings.source) {
+    case CameraSource::V4L2_MJPEG:
+      ss << fmt::format("v4l2src device={} ! ",settings.device);
+      ss << fmt::format("image/jpeg,width={},height={},framerate={}/1 ! ",settings.width,settings.height,settings.fps);
+      ss << queues.create() << "avdec_mjpeg ! ";
+      break;
+    case CameraSource::TEST_PATTERN:
+      ss << fmt::format("videotestsrc is-live=true pattern={} ! ",settings.test_pattern);
+      ss << fmt::format("video/x-raw,format=I420,width={},height={},framerate={}/1 ! ",settings.width,settings.height,settings.fps);
+      ss << queues.create();
+      break;
+    case CameraSource::FILE_MJPEG:
+    case CameraSource::FILE_H265:{
+      // FileReplaySource pushes the frames of the file into file_appsrc
+      const bool is_mjpeg=settings.source==CameraSource::FILE_MJPEG;
+      ss << "appsrc name=file_appsrc is-live=true do-timestamp=true format=time caps=";
+      if(is_mjpeg){
+        ss << fmt::format("image/jpeg,framerate={}/1 ! ",settings.fps);
+      }else{
+        ss << fmt::format("video/x-h265,stream-format=byte-stream,alignment=au,framerate={}/1 ! ",settings.fps);
+      }
+      ss << queues.create();
+      ss << (is_mjpeg ? "jpegparse ! avdec_mjpeg ! " : "h265parse ! avdec_h265 ! ");
+      ss << fmt::format("videoscale ! video/x-raw,width={},height={} ! ",settings.width,settings.height);
+      break;
+    }
+  }
+  return ss.str();
+}
+
+static std::string create_pipeline_string(const CameraSettings& settings,PipelineQueues& queues){
+  std::stringstream ss;
+  ss << create_source_string(settings,queues);
+  // padding the input of the main encoder needs (0 if the frames are padded already)
+  int main_padding=get_encoder_padding(settings.encoder,settings.height);
+  if(settings.simd_convert){
+    // The decoded frames leave the pipeline through raw_appsink, Nv12ConvertStage converts them to NV12
+    // (with padding) and they come back through nv12_appsrc. The videoconvert is a passthrough unless the jpeg
+    // sampling results in a decoder output format the stage doesn't support.
+    ss << "videoconvert ! video/x-raw,format=(string){I420,Y42B,YUY2} ! ";
+    ss << "appsink drop=true max-buffers=2 sync=false name=raw_appsink ";
+    ss << fmt::format("appsrc name=nv12_appsrc is-live=true format=time caps=video/x-raw,format=NV12,width={},height={},framerate={}/1 ! ",
+                      settings.width,settings.height+main_padding,settings.fps);
+    main_padding=0;
+  }else{
+    ss << fmt::format("videoconvert ! video/x-raw,width={},height={},framerate={}/1,format=YUY2 ! ",
+                      settings.width,settings.height,settings.fps);
+  }
+  if(!settings.simulcast_enable){
+    ss << create_encoder_branch(queues,settings.encoder,main_padding,settings.bitrate_kbits,settings.gop_size,settings.rtp_mtu,"");
+    return ss.str();
+  }
+  // simulcast - the decoded camera frames go to both encoders
+  ss << "tee name=t ";
+  ss << "t. ! " << queues.create();
+  ss << create_encoder_branch(queues,settings.encoder,main_padding,settings.bitrate_kbits,settings.gop_size,settings.rtp_mtu,"") << " ";
+  ss << "t. ! " << queues.create();
+  if(settings.simd_convert && get_encoder_padding(settings.encoder,settings.height)>0){
+    // the padding rows are not part of the picture
+    ss << fmt::format("videocrop bottom={} ! ",get_encoder_padding(settings.encoder,settings.height));
+  }
+  ss << fmt::format("videoscale ! video/x-raw,width={},height={} ! ",settings.simulcast_width,settings.simulcast_height);
+  ss << create_encoder_branch(queues,settings.encoder,get_encoder_padding(settings.encoder,settings.simulcast_height),
+                              settings.simulcast_bitrate_kbits,settings.gop_size,settings.rtp_mtu,"_low");
+  return ss.str();
+}
+
+std::unique_ptr<GStreamerStream::Pipeline> GStreamerStream::create_pipeline(const CameraSettings& settings) {
+  PipelineQueues queues{};
+  const auto pipeline_content=create_pipeline_string(settings,queues);
+  m_console->debug("Creating pipeline:[{}]",pipeline_content);
+  GError *error = nullptr;
+  GstElement* gst_pipeline = gst_parse_launch(pipeline_content.c_str(), &error);
+  if (error) {
+    m_console->error( "Failed to create pipeline: {}",error->message);
+    g_error_free(error);
+    if(gst_pipeline)gst_object_unref(gst_pipeline);
+    return nullptr;
+  }
+  auto ret=std::make_unique<Pipeline>();
+  ret->settings=settings;
+  ret->gst_pipeline=gst_pipeline;
+  const int n_streams=settings.simulcast_enable ? 2 : 1;
+  for(int i=0;i<n_streams;i++){
+    const std::string name_suffix= i==0 ? "" : "_low";
+    auto stream=std::make_unique<EncodedStream>();
+    stream->index=i;
+    // we pull data out of the gst pipeline as cpu memory buffer(s) using the gstreamer "appsink" element
+    stream->app_sink_element=gst_bin_get_by_name(GST_BIN(gst_pipeline), ("out_appsink"+name_suffix).c_str());
+    assert(stream->app_sink_element);
+    // The appsink holds the rtp packets the pull thread hasn't taken yet (unbounded by default). It gets half of the
+    // frame assembly share, split between the two pipelines of a reconfiguration and their streams - accounted for
+    // the worst case (the mtu can be raised while running), and dropping the oldest packet once full.
+    const auto appsink_max_buffers=std::max<std::size_t>(m_memory_budget->get_stage_limit(MemoryBudget::Stage::FRAME_ASSEMBLY)/2/2/n_streams/FEC_MAX_PAYLOAD_SIZE,1);
+    g_object_set(G_OBJECT(stream->app_sink_element), "max-buffers", static_cast<guint>(appsink_max_buffers), nullptr);
+    m_memory_budget->acquire(MemoryBudget::Stage::FRAME_ASSEMBLY,appsink_max_buffers*FEC_MAX_PAYLOAD_SIZE);
+    ret->accounted_appsink_bytes+=appsink_max_buffers*FEC_MAX_PAYLOAD_SIZE;
+    // for changing bitrate / gop without a restart
+    stream->encoder_element=gst_bin_get_by_name(GST_BIN(gst_pipeline), ("encoder"+name_suffix).c_str());
+    // for changing the mtu without a restart
+    stream->payloader_element=gst_bin_get_by_name(GST_BIN(gst_pipeline), ("payloader"+name_suffix).c_str());
+    assert(stream->payloader_element);
+    stream->max_packet_size=settings.rtp_mtu;
+    if(m_wb_link){
+      stream->curr_frame=m_wb_link->acquire_frame_block();
+    }
+    ret->streams.push_back(std::move(stream));
+  }
+  if(settings.simd_convert){
+    GstElement* raw_sink=gst_bin_get_by_name(GST_BIN(gst_pipeline), "raw_appsink");
+    GstElement* nv12_src=gst_bin_get_by_name(GST_BIN(gst_pipeline), "nv12_appsrc");
+    assert(raw_sink && nv12_src);
+    ret->convert_stage=std::make_unique<Nv12ConvertStage>(m_console,raw_sink,nv12_src,settings.width,settings.height,
+                                                          settings.height+get_encoder_padding(settings.encoder,settings.height),
+                                                          m_memory_budget);
+  }
+  if(settings.source==CameraSource::FILE_MJPEG || settings.source==CameraSource::FILE_H265){
+    GstElement* file_src=gst_bin_get_by_name(GST_BIN(gst_pipeline), "file_appsrc");
+    assert(file_src);
+    const auto format=settings.source==CameraSource::FILE_MJPEG ? FileReplaySource::Format::MJPEG : FileReplaySource::Format::H265;
+    try{
+      ret->file_source=std::make_unique<FileReplaySource>(m_console,file_src,settings.file_path,format,settings.fps);
+    }catch (std::runtime_error& e){
+      m_console->error("Cannot replay file: {}",e.what());
+      destroy_pipeline(std::move(ret));
+      return nullptr;
+    }
+  }
+  // During a reconfiguration there are two pipelines, each of them gets half of the budget for queues.
+  // Leaky queues drop their oldest buffer once full.
+  const auto queue_max_bytes=m_memory_budget->get_stage_limit(MemoryBudget::Stage::GST_QUEUES)/2/std::max(queues.n_queues,1);
+  for(int i=0;i<queues.n_queues;i++){
+    GstElement* queue=gst_bin_get_by_name(GST_BIN(gst_pipeline), fmt::format("queue{}",i).c_str());
+    assert(queue);
+    g_object_set(G_OBJECT(queue), "max-size-bytes", static_cast<guint>(queue_max_bytes), nullptr);
+    ret->queues.push_back(queue);
+  }
+  return ret;
+}
+
+void GStreamerStream::start_pulling_samples(Pipeline& pipeline) {
+  if(pipeline.convert_stage){
+    pipeline.convert_stage->start();
+  }
+  if(pipeline.file_source){
+    pipeline.file_source->start();
+  }
+  for(auto& stream:pipeline.streams){
+    stream->pull_samples_run= true;
+    stream->pull_samples_thread=std::make_unique<std::thread>(&GStreamerStream::loop_pull_samples, this,
+                                                              std::ref(pipeline), std::ref(*stream));
+  }
+}
+
+void GStreamerStream::destroy_pipeline(std::unique_ptr<Pipeline> pipeline) {
+  for(auto& stream:pipeline->streams){
+    if(stream->pull_samples_thread){
+      m_console->debug("terminating appsink poll thread begin");
+      stream->pull_samples_run= false;
+      if(stream->pull_samples_thread->joinable())stream->pull_samples_thread->join();
+      stream->pull_samples_thread= nullptr;
+      m_console->debug("terminating appsink poll thread end");
+    }
+  }
+  if(pipeline->convert_stage){
+    pipeline->convert_stage->stop();
+  }
+  if(pipeline->file_source){
+    pipeline->file_source->stop();
+  }
+  // Jan 22: Confirmed this hangs quite a lot of pipeline(s) - removed for that reason
+  /*m_console->debug("send EOS begin");
+  // according to @Alex W we need a EOS signal here to properly shut down the pipeline
+  if(!gst_element_send_event (m_gst_pipeline, gst_event_new_eos())){
+    m_console->info("error gst_element_send_event eos"); // No idea what that means
+  }else{
+    m_console->info("success gst_element_send_event eos");
+  }*/
+  // TODO do we need to wait until the pipeline is actually in state NULL ?
+  auto res=gst_element_set_state(pipeline->gst_pipeline, GST_STATE_NULL);
+  flight_recorder::record(flight_recorder::EventType::PIPELINE_STATE,GST_STATE_NULL);
+  m_console->debug(gst_element_get_current_state_as_string(pipeline->gst_pipeline));
+  for(auto& stream:pipeline->streams){
+    gst_object_unref(stream->app_sink_element);
+    if(stream->encoder_element)gst_object_unref(stream->encoder_element);
+    gst_object_unref(stream->payloader_element);
+  }
+  pipeline->convert_stage= nullptr;
+  pipeline->file_source= nullptr;
+  for(auto* queue:pipeline->queues){
+    gst_object_unref(queue);
+  }
+  m_memory_budget->release(MemoryBudget::Stage::GST_QUEUES,pipeline->accounted_queue_bytes);
+  m_memory_budget->release(MemoryBudget::Stage::FRAME_ASSEMBLY,pipeline->accounted_appsink_bytes);
+  gst_object_unref (pipeline->gst_pipeline);
+}
+
 void GStreamerStream::setup() {
   m_console->debug("GStreamerStream::setup() begin");
-  m_pipeline_content.str("");
-  m_pipeline_content.clear();
-  m_pipeline_content << "v4l2src device=/dev/video0 ! "
-  "image/jpeg,width=1920,height=1080,framerate=30/1 ! "
-  "queue ! avdec_mjpeg ! videoconvert ! video/x-raw,width=1920,height=1080,framerate=30/1,format=YUY2 ! "
-  "videobox bottom=-8 ! queue ! mpph265enc bps=8000000 ! h265parse ! rtph265pay config-interval=-1 mtu=1024 ! "
-  "appsink drop=true name=out_appsink";
-  m_console->debug("Starting pipeline:[{}]",m_pipeline_content.str());
   // Protect against unwanted use - stop and free the pipeline first
-  assert(m_gst_pipeline == nullptr);
-  // Now start the (as a string) built pipeline
-  GError *error = nullptr;
-  m_gst_pipeline = gst_parse_launch(m_pipeline_content.str().c_str(), &error);
-  m_console->debug("GStreamerStream::setup() end");
+  assert(m_pipeline == nullptr);
+  m_pipeline=create_pipeline(get_settings());
   m_stream_creation_time=std::chrono::steady_clock::now();
-  if (error) {
-    m_console->error( "Failed to create pipeline: {}",error->message);
+  if(!m_pipeline){
     return;
   }
-  // we pull data out of the gst pipeline as cpu memory buffer(s) using the gstreamer "appsink" element
-  m_app_sink_element=gst_bin_get_by_name(GST_BIN(m_gst_pipeline), "out_appsink");
-  assert(m_app_sink_element);
-  m_pull_samples_run= true;
-  m_pull_samples_thread=std::make_unique<std::thread>(&GStreamerStream::loop_pull_samples, this);
+  {
+    std::lock_guard<std::mutex> guard(m_output_mutex);
+    m_output_pipeline=m_pipeline.get();
+    m_pending_pipeline=nullptr;
+  }
+  start_pulling_samples(*m_pipeline);
+  m_console->debug("GStreamerStream::setup() end");
 }
 
 void GStreamerStream::stop_cleanup_restart() {
@@ -84,75 +326,275 @@ void GStreamerStream::stop_cleanup_restart() {
   start();
 }
 
+CameraSettings GStreamerStream::get_settings() {
+  std::lock_guard<std::mutex> guard(m_settings_mutex);
+  return m_settings;
+}
+
+void GStreamerStream::update_settings(const CameraSettings& settings) {
+  {
+    std::lock_guard<std::mutex> guard(m_settings_mutex);
+    m_settings=settings;
+  }
+  m_parameter_set_interval_ms=settings.parameter_set_interval_ms;
+  // If no restart is in progress and only encoder settings changed, there is no need to go through the async thread
+  std::unique_lock<std::mutex> lock(m_pipeline_mutex, std::try_to_lock);
+  if(lock.owns_lock() && m_pipeline && !m_reconfiguring && !camera_settings_require_restart(m_pipeline->settings,settings)){
+    apply_live_settings(*m_pipeline,settings);
+    return;
+  }
+  if(lock.owns_lock()){
+    lock.unlock();
+  }
+  restart_async();
+}
+
+void GStreamerStream::apply_live_settings(Pipeline& pipeline,const CameraSettings& settings) {
+  for(auto& stream:pipeline.streams){
+    if(settings.rtp_mtu!=pipeline.settings.rtp_mtu){
+      // the payloader takes it for the next frame, inserted parameter sets are checked against it (pull thread)
+      g_object_set(G_OBJECT(stream->payloader_element), "mtu", static_cast<guint>(settings.rtp_mtu), nullptr);
+      stream->max_packet_size=settings.rtp_mtu;
+      m_console->debug("Changed rtp mtu of stream {} to {} without restart",stream->index,settings.rtp_mtu);
+    }
+    if(!stream->encoder_element){
+      m_console->warn("No encoder element, cannot change bitrate / gop");
+      continue;
+    }
+    const bool is_main=stream->index==0;
+    const int bitrate_kbits=is_main ? settings.bitrate_kbits : settings.simulcast_bitrate_kbits;
+    const int curr_bitrate_kbits=is_main ? pipeline.settings.bitrate_kbits : pipeline.settings.simulcast_bitrate_kbits;
+    if(pipeline.settings.encoder==VideoEncoder::X265){
+      // the gop of x265enc is fixed (see camera_settings_require_restart)
+      if(bitrate_kbits!=curr_bitrate_kbits){
+        g_object_set(G_OBJECT(stream->encoder_element), "bitrate", static_cast<guint>(bitrate_kbits), nullptr);
+      }
+      m_console->debug("Changed encoder {} bitrate:{}kbit/s without restart",stream->index,bitrate_kbits);
+      continue;
+    }
+    if(bitrate_kbits!=curr_bitrate_kbits){
+      g_object_set(G_OBJECT(stream->encoder_element), "bps", static_cast<guint>(bitrate_kbits*1000), nullptr);
+    }
+    if(settings.gop_size!=pipeline.settings.gop_size){
+      g_object_set(G_OBJECT(stream->encoder_element), "gop", static_cast<gint>(settings.gop_size), nullptr);
+    }
+    m_console->debug("Changed encoder {} bitrate:{}kbit/s gop:{} without restart",stream->index,bitrate_kbits,settings.gop_size);
+  }
+  pipeline.settings=settings;
+}
+
+void GStreamerStream::set_frame_output_cb(FRAME_OUTPUT_CB cb) {
+  m_frame_output_cb=std::move(cb);
+}
+
+void GStreamerStream::request_keyframe(int stream_index) {
+  if(stream_index<0 || stream_index>=MAX_N_STREAMS){
+    return;
+  }
+  m_keyframe_requested[stream_index]= true;
+  flight_recorder::record(flight_recorder::EventType::KEYFRAME_REQUESTED,stream_index);
+}
+
+void GStreamerStream::request_parameter_sets(int stream_index) {
+  if(stream_index<0 || stream_index>=MAX_N_STREAMS){
+    return;
+  }
+  m_parameter_sets_requested[stream_index]= true;
+}
+
+void GStreamerStream::restart_async() {
+  std::lock_guard<std::mutex> guard(m_async_thread_mutex);
+  m_restart_requested= true;
+  if(m_async_thread_running){
+    // picks up the new settings once the current restart is done
+    return;
+  }
+  if(m_async_thread && m_async_thread->joinable()){
+    m_async_thread->join();
+  }
+  m_async_thread_running= true;
+  m_async_thread=std::make_unique<std::thread>([this](){
+    while (true){
+      {
+        std::lock_guard<std::mutex> guard(m_async_thread_mutex);
+        if(!m_restart_requested){
+          m_async_thread_running= false;
+          return;
+        }
+        m_restart_requested= false;
+      }
+      restart_after_new_setting();
+    }
+  });
+}
+
+void GStreamerStream::restart_after_new_setting() {
+  const auto settings=get_settings();
+  // m_pipeline_mutex is only held to look at / replace m_pipeline - not while the new pipeline is created or while
+  // waiting for its first keyframe, such that debug / settings / the watchdog don't block for seconds.
+  // While m_reconfiguring is set, only this thread replaces m_pipeline.
+  GstElement* old_gst_pipeline;
+  CameraSettings old_settings;
+  {
+    std::lock_guard<std::mutex> guard(m_pipeline_mutex);
+    if(!m_pipeline){
+      // not running, the settings are used on the next setup()
+      return;
+    }
+    if(!camera_settings_require_restart(m_pipeline->settings,settings)){
+      apply_live_settings(*m_pipeline,settings);
+      return;
+    }
+    m_reconfiguring= true;
+    old_gst_pipeline=m_pipeline->gst_pipeline;
+    old_settings=m_pipeline->settings;
+  }
+  const auto begin=std::chrono::steady_clock::now();
+  // Creating the new pipeline (loading plugins, creating and linking the elements) is done while the
+  // old pipeline keeps streaming.
+  auto new_pipeline=create_pipeline(settings);
+  if(!new_pipeline){
+    m_console->warn("Cannot create pipeline with new settings, keeping the old one");
+    flight_recorder::record(flight_recorder::EventType::PIPELINE_RECONFIGURED,0);
+    std::lock_guard<std::mutex> guard(m_pipeline_mutex);
+    m_reconfiguring= false;
+    return;
+  }
+  // A v4l2 camera only streams to one pipeline at a time, the old pipeline has to stop capturing before the new one
+  // can start. Everything up to that is done while the old pipeline keeps streaming: READY opens the device and
+  // initializes the elements. The gap is only the capture restart (stream off / on) and the first encoded frame,
+  // instead of tearing down and building a whole pipeline in between (like stop_cleanup_restart).
+  const bool same_device=new_pipeline->settings.source==CameraSource::V4L2_MJPEG && old_settings.source==CameraSource::V4L2_MJPEG &&
+                         new_pipeline->settings.device==old_settings.device;
+  if(same_device){
+    gst_element_set_state(new_pipeline->gst_pipeline, GST_STATE_READY);
+    flight_recorder::record(flight_recorder::EventType::PIPELINE_STATE,GST_STATE_READY);
+    m_console->debug("New pipeline uses the same camera, stopping the old one");
+    gst_element_set_state(old_gst_pipeline, GST_STATE_NULL);
+    flight_recorder::record(flight_recorder::EventType::PIPELINE_STATE,GST_STATE_NULL);
+  }
+  {
+    std::lock_guard<std::mutex> output_guard(m_output_mutex);
+    m_pending_pipeline=new_pipeline.get();
+  }
+  start_pulling_samples(*new_pipeline);
+  // live source - no preroll in PAUSED, the new pipeline goes to PLAYING directly and its output is discarded
+  // until the first keyframe (see on_new_rtp_fragmented_frame)
+  gst_element_set_state(new_pipeline->gst_pipeline, GST_STATE_PLAYING);
+  flight_recorder::record(flight_recorder::EventType::PIPELINE_STATE,GST_STATE_PLAYING);
+  static constexpr auto SWAP_TIMEOUT=std::chrono::seconds(5);
+  bool swapped;
+  std::chrono::milliseconds gap{0};
+  {
+    std::unique_lock<std::mutex> output_lock(m_output_mutex);
+    Pipeline* new_pipeline_ptr=new_pipeline.get();
+    swapped=m_output_swapped_cv.wait_for(output_lock,SWAP_TIMEOUT,[this,new_pipeline_ptr](){
+      return m_output_pipeline==new_pipeline_ptr;
+    });
+    m_pending_pipeline=nullptr;
+    if(!swapped && same_device){
+      // the old pipeline is stopped already, there is nothing to go back to
+      m_output_pipeline=new_pipeline_ptr;
+    }
+    gap=m_last_reconfiguration_gap;
+  }
+  if(!swapped && !same_device){
+    m_console->warn("New pipeline didn't produce a keyframe after {}s, keeping the old one",SWAP_TIMEOUT.count());
+    destroy_pipeline(std::move(new_pipeline));
+    flight_recorder::record(flight_recorder::EventType::PIPELINE_RECONFIGURED,0);
+    std::lock_guard<std::mutex> guard(m_pipeline_mutex);
+    m_reconfiguring= false;
+    return;
+  }
+  flight_recorder::record(flight_recorder::EventType::PIPELINE_RECONFIGURED,swapped ? 1 : 2,gap.count());
+  std::unique_ptr<Pipeline> old_pipeline;
+  {
+    std::lock_guard<std::mutex> guard(m_pipeline_mutex);
+    old_pipeline=std::move(m_pipeline);
+    m_pipeline=std::move(new_pipeline);
+    m_stream_creation_time=std::chrono::steady_clock::now();
+    m_reconfiguring= false;
+  }
+  // its output is discarded already, joining its threads can take a while
+  destroy_pipeline(std::move(old_pipeline));
+  const auto elapsed_ms=std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-begin).count();
+  if(swapped){
+    m_console->info("Reconfigured pipeline in {}ms, video gap:{}ms",elapsed_ms,gap.count());
+  }else{
+    m_console->warn("Reconfigured pipeline in {}ms, but no keyframe yet",elapsed_ms);
+  }
+}
+
 std::string GStreamerStream::createDebug(){
-  // std::unique_lock<std::mutex> lock(m_pipeline_mutex, std::try_to_lock);
-  // if(!lock.owns_lock()){
-  //   // We can just discard statistics data during a re-start
-  //   return "GStreamerStream::No debug during restart\n";
-  // }
+  std::unique_lock<std::mutex> lock(m_pipeline_mutex, std::try_to_lock);
+  if(!lock.owns_lock()){
+    // We can just discard statistics data during a re-start
+    return "GStreamerStream::No debug during restart\n";
+  }
   std::stringstream ss;
+  if(!m_pipeline){
+    ss << "GStreamerStream no pipeline";
+    return ss.str();
+  }
   GstState state;
   GstState pending;
-  auto returnValue = gst_element_get_state(m_gst_pipeline, &state, &pending, 1000000000);
+  auto returnValue = gst_element_get_state(m_pipeline->gst_pipeline, &state, &pending, 1000000000);
   ss << "GStreamerStream State:"<< returnValue << "." << state << "." << pending << ".";
+  std::lock_guard<std::mutex> guard(m_output_mutex);
+  ss << " last reconfiguration gap:" << m_last_reconfiguration_gap.count() << "ms";
+  ss << "\n" << m_memory_budget->createDebug();
+  if(m_pipeline->convert_stage){
+    ss << " " << m_pipeline->convert_stage->createDebug();
+  }
   return ss.str();
 }
 
 void GStreamerStream::start() {
   m_console->debug("GStreamerStream::start()");
-  if(!m_gst_pipeline){
+  if(!m_pipeline){
     m_console->warn("gst_pipeline==null");
     return;
   }
-  gst_element_set_state(m_gst_pipeline, GST_STATE_PLAYING);
-  m_console->debug(gst_element_get_current_state_as_string(m_gst_pipeline));
+  gst_element_set_state(m_pipeline->gst_pipeline, GST_STATE_PLAYING);
+  flight_recorder::record(flight_recorder::EventType::PIPELINE_STATE,GST_STATE_PLAYING);
+  m_console->debug(gst_element_get_current_state_as_string(m_pipeline->gst_pipeline));
 }
 
 void GStreamerStream::stop() {
   m_console->debug("GStreamerStream::stop()");
-  if(!m_gst_pipeline){
+  if(!m_pipeline){
     m_console->debug("gst_pipeline==null");
     return;
   }
-  auto res=gst_element_set_state(m_gst_pipeline, GST_STATE_PAUSED);
-  m_console->debug(gst_element_get_current_state_as_string(m_gst_pipeline));
+  auto res=gst_element_set_state(m_pipeline->gst_pipeline, GST_STATE_PAUSED);
+  flight_recorder::record(flight_recorder::EventType::PIPELINE_STATE,GST_STATE_PAUSED);
+  m_console->debug(gst_element_get_current_state_as_string(m_pipeline->gst_pipeline));
 }
 
 void GStreamerStream::cleanup_pipe() {
   m_console->debug("GStreamerStream::cleanup_pipe() begin");
-  if(m_pull_samples_thread){
-    m_console->debug("terminating appsink poll thread begin");
-    m_pull_samples_run= false;
-    if(m_pull_samples_thread->joinable())m_pull_samples_thread->join();
-    m_pull_samples_thread= nullptr;
-    m_console->debug("terminating appsink poll thread end");
-  }
-  if(!m_gst_pipeline){
+  if(!m_pipeline){
     m_console->debug("gst_pipeline==null");
     return;
   }
-  // Jan 22: Confirmed this hangs quite a lot of pipeline(s) - removed for that reason
-  /*m_console->debug("send EOS begin");
-  // according to @Alex W we need a EOS signal here to properly shut down the pipeline
-  if(!gst_element_send_event (m_gst_pipeline, gst_event_new_eos())){
-    m_console->info("error gst_element_send_event eos"); // No idea what that means
-  }else{
-    m_console->info("success gst_element_send_event eos");
-  }*/
-  // TODO do we need to wait until the pipeline is actually in state NULL ?
-  auto res=gst_element_set_state(m_gst_pipeline, GST_STATE_NULL);
-  m_console->debug(gst_element_get_current_state_as_string(m_gst_pipeline));
-  gst_object_unref (m_gst_pipeline);
-  m_gst_pipeline =nullptr;
+  {
+    std::lock_guard<std::mutex> guard(m_output_mutex);
+    m_output_pipeline=nullptr;
+  }
+  destroy_pipeline(std::move(m_pipeline));
   m_console->debug("GStreamerStream::cleanup_pipe() end");
 }
 
 void GStreamerStream::restartIfStopped() {
   std::lock_guard<std::mutex> guard(m_pipeline_mutex);
-  if(!m_gst_pipeline){
+  if(!m_pipeline){
     m_console->debug("gst_pipeline==null");
     return;
   }
+  if(m_reconfiguring){
+    // the old pipeline might be stopped already (same camera), the reconfiguration has its own timeout
+    return;
+  }
   const auto elapsed_since_start=std::chrono::steady_clock::now()-m_stream_creation_time;
   if(elapsed_since_start<std::chrono::seconds(5)){
     // give the cam X seconds in the beginning to properly start before restarting
@@ -160,48 +602,201 @@ void GStreamerStream::restartIfStopped() {
   }
   GstState state;
   GstState pending;
-  auto returnValue = gst_element_get_state(m_gst_pipeline, &state, &pending, 1000000000); // timeout in ns
+  auto returnValue = gst_element_get_state(m_pipeline->gst_pipeline, &state, &pending, 1000000000); // timeout in ns
   if (returnValue == 0) {
     m_console->debug("Panic gstreamer pipeline state is not running, restarting camera stream");
     // We fully restart the whole pipeline, since some issues might not be fixable by just setting paused
     // This will also show up in QOpenHD (log level >= warn), but we are limited by the n of characters in mavlink
     m_console->warn("Restarting camera, check your parameters / connection");
+    flight_recorder::record(flight_recorder::EventType::PIPELINE_RESTART);
+    // what led to the stall is still in the flight recorder
+    FlightRecorderDumper::request_dump(flight_recorder::DumpReason::WATCHDOG_RESTART);
     stop_cleanup_restart();
     m_console->debug("Restarted");
   }
 }
 
-void GStreamerStream::on_new_rtp_fragmented_frame(std::vector<std::shared_ptr<std::vector<uint8_t>>> frame_fragments) {
-  //m_console->debug("Got frame with {} fragments",frame_fragments.size());
+// When the camera captured the frame, in us of the steady clock, 0 if unknown.
+// The clock of a live pipeline is the monotonic system clock, the same clock as std::chrono::steady_clock.
+static uint64_t get_capture_time_us(GstElement* gst_pipeline,uint64_t dts){
+  const GstClockTime base_time=gst_element_get_base_time(gst_pipeline);
+  if(!GST_CLOCK_TIME_IS_VALID(dts) || !GST_CLOCK_TIME_IS_VALID(base_time)){
+    return 0;
+  }
+  return (base_time+dts)/1000;
+}
+
+void GStreamerStream::on_new_rtp_fragmented_frame(Pipeline& pipeline,EncodedStream& stream,FrameBlock&& frame,bool is_keyframe) {
+  //m_console->debug("Got frame with {} fragments",frame.n_fragments());
+  const auto now=std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> guard(m_output_mutex);
+  bool swapped=false;
+  if(&pipeline==m_pending_pipeline && is_keyframe && stream.index==0){
+    if(m_output_pipeline!=nullptr){
+      m_last_reconfiguration_gap=std::chrono::duration_cast<std::chrono::milliseconds>(now-m_last_output_frame_time);
+    }
+    m_output_pipeline=m_pending_pipeline;
+    m_pending_pipeline=nullptr;
+    swapped=true;
+    m_output_swapped_cv.notify_all();
+  }
+  if(&pipeline!=m_output_pipeline){
+    // old pipeline after the swap, or new pipeline before its first keyframe
+    // (frame is stream.curr_frame - clearing it keeps its buffers for the next frame)
+    frame.clear();
+    return;
+  }
+  m_last_output_frame_time=now;
+  const auto capture_time_us=get_capture_time_us(pipeline.gst_pipeline,stream.curr_frame_dts);
+  if(m_frame_output_cb){
+    m_frame_output_cb(frame,stream.index,is_keyframe,capture_time_us);
+  }
   if(m_wb_link){
-    m_wb_link->transmit_video_data(frame_fragments);
+    if(swapped){
+      m_wb_link->reset_video_stream();
+    }
+    m_wb_link->transmit_video_data(std::move(frame),stream.index,is_keyframe,capture_time_us);
+    // recycled block of an already transmitted frame, if available
+    stream.curr_frame=m_wb_link->acquire_frame_block();
   }else{
-    m_console->debug("No transmit interface");
+    if(!m_frame_output_cb){
+      SPDLOG_LOGGER_DEBUG(m_console,"No transmit interface");
+    }
+    frame.clear();
   }
 }
 
-void GStreamerStream::on_new_rtp_frame_fragment(std::shared_ptr<std::vector<uint8_t>> fragment,uint64_t dts) {
-  m_frame_fragments.push_back(fragment);
+void GStreamerStream::on_new_rtp_frame_fragment(Pipeline& pipeline,EncodedStream& stream,const uint8_t* data,std::size_t size,uint64_t dts) {
+  flight_recorder::record(flight_recorder::EventType::FRAGMENT_PULLED,stream.index,size);
+  // a pending pipeline starts with a keyframe (and its parameter sets) anyways
+  const bool is_output=&pipeline==m_output_pipeline.load();
+  if(is_output && m_keyframe_requested[stream.index].exchange(false)){
+    // upstream event, travels from the appsink to the encoder
+    gst_element_send_event(stream.app_sink_element,gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE,TRUE,0));
+  }
+  // also of the frames that are dropped, they might be the only ones carrying new parameter sets
+  const int n_parameter_sets=stream.parameter_sets.on_rtp_packet(data,size);
   bool is_last_fragment_of_frame=false;
-  if(rtp_eof_helper::h265_end_block(fragment->data(),fragment->size())){
+  if(rtp_eof_helper::h265_end_block(data,size)){
     is_last_fragment_of_frame= true;
   }
-  if(m_frame_fragments.size()>1000){
+  if(stream.index==0 && is_last_fragment_of_frame){
+    update_queue_accounting(pipeline);
+  }
+  if(stream.dropping_frame){
+    stream.dropping_frame=!is_last_fragment_of_frame;
+    return;
+  }
+  if(!m_memory_budget->try_acquire(MemoryBudget::Stage::FRAME_ASSEMBLY,size)){
+    drop_frame_over_budget(stream,is_last_fragment_of_frame);
+    return;
+  }
+  if(stream.curr_frame.empty()){
+    stream.curr_frame_dts=dts;
+    maybe_insert_parameter_sets(stream,data,size,n_parameter_sets,is_output);
+  }
+  uint8_t* fragment=stream.curr_frame.append_fragment(size);
+  std::memcpy(fragment,data,size);
+  if(stream.seq_offset!=0 && size>=4){
+    const uint16_t seq=static_cast<uint16_t>(((fragment[2]<<8) | fragment[3])+stream.seq_offset);
+    fragment[2]=static_cast<uint8_t>(seq>>8);
+    fragment[3]=static_cast<uint8_t>(seq & 0xff);
+  }
+  if(rtp_eof_helper::h265_is_keyframe(data,size)){
+    stream.curr_frame_is_keyframe= true;
+  }
+  if(stream.curr_frame.n_fragments()>1000){
     // Most likely something wrong with the "find end of frame" workaround
-    m_console->debug("No end of frame found after 1000 fragments");
+    ROCKET_LOG_RATE_LIMITED(m_console,spdlog::level::warn,std::chrono::seconds(1),"No end of frame found after 1000 fragments");
     is_last_fragment_of_frame= true;
   }
   if(is_last_fragment_of_frame){
-    on_new_rtp_fragmented_frame(m_frame_fragments);
-    m_frame_fragments.resize(0);
+    m_memory_budget->release(MemoryBudget::Stage::FRAME_ASSEMBLY,stream.curr_frame.n_bytes());
+    const bool is_keyframe=stream.curr_frame_is_keyframe;
+    stream.curr_frame_is_keyframe= false;
+    flight_recorder::record(flight_recorder::EventType::FRAME_CLOSED,stream.index,
+                            (static_cast<uint64_t>(stream.curr_frame.n_fragments())<<32) | stream.curr_frame.n_bytes());
+    on_new_rtp_fragmented_frame(pipeline,stream,std::move(stream.curr_frame),is_keyframe);
   }
 }
 
-void GStreamerStream::loop_pull_samples() {
-  assert(m_app_sink_element);
-  auto cb=[this](std::shared_ptr<std::vector<uint8_t>> fragment,uint64_t dts){
-    on_new_rtp_frame_fragment(fragment,dts);
+void GStreamerStream::loop_pull_samples(Pipeline& pipeline,EncodedStream& stream) {
+  assert(stream.app_sink_element);
+  thread_stats::set_current_thread_name("pull"+std::to_string(stream.index));
+  auto cb=[this,&pipeline,&stream](const uint8_t* data,std::size_t size,uint64_t dts){
+    on_new_rtp_frame_fragment(pipeline,stream,data,size,dts);
   };
-  loop_pull_appsink_samples(m_pull_samples_run,m_app_sink_element,cb);
-  m_frame_fragments.resize(0);
+  loop_pull_appsink_samples(stream.pull_samples_run,stream.app_sink_element,cb);
+  m_memory_budget->release(MemoryBudget::Stage::FRAME_ASSEMBLY,stream.curr_frame.n_bytes());
+  stream.curr_frame.clear();
+  stream.curr_frame_is_keyframe= false;
+}
+
+void GStreamerStream::drop_frame_over_budget(EncodedStream& stream,bool is_last_fragment_of_frame) {
+  ROCKET_LOG_RATE_LIMITED(m_console,spdlog::level::warn,std::chrono::seconds(1),
+                          "Frame of stream {} exceeds the memory budget after {} fragments, dropping it",stream.index,
+                          stream.curr_frame.n_fragments());
+  flight_recorder::record(flight_recorder::EventType::FRAME_DROPPED,stream.index,flight_recorder::to_u32(flight_recorder::DropReason::MEMORY_BUDGET));
+  m_memory_budget->release(MemoryBudget::Stage::FRAME_ASSEMBLY,stream.curr_frame.n_bytes());
+  stream.curr_frame.clear();
+  stream.curr_frame_is_keyframe= false;
+  // the rest of the frame is skipped, and the ground needs a keyframe to recover from the missing frame
+  stream.dropping_frame=!is_last_fragment_of_frame;
+  request_keyframe(stream.index);
+}
+
+void GStreamerStream::maybe_insert_parameter_sets(EncodedStream& stream,const uint8_t* first_fragment,std::size_t size,
+                                                  int n_parameter_sets,bool is_output) {
+  const auto now=std::chrono::steady_clock::now();
+  if(n_parameter_sets>0){
+    // keyframe, rtph265pay sends them in front of it
+    stream.last_parameter_sets_time=now;
+    if(is_output){
+      m_parameter_sets_requested[stream.index]= false;
+    }
+    return;
+  }
+  const int interval_ms=m_parameter_set_interval_ms;
+  const bool interval_due=interval_ms>0 && now-stream.last_parameter_sets_time>=std::chrono::milliseconds(interval_ms);
+  const bool requested=is_output && m_parameter_sets_requested[stream.index];
+  if(!interval_due && !requested){
+    return;
+  }
+  if(size<4){
+    return;
+  }
+  // the inserted packet takes the sequence number of the first packet of the frame, the frame moves up by one
+  const uint16_t seq=static_cast<uint16_t>(((first_fragment[2]<<8) | first_fragment[3])+stream.seq_offset);
+  const auto packet=stream.parameter_sets.create_rtp_packet(first_fragment,size,seq,stream.max_packet_size);
+  if(!packet.has_value()){
+    // not seen yet (the first keyframe was dropped) or they don't fit into the mtu - the next keyframe has them
+    return;
+  }
+  if(!m_memory_budget->try_acquire(MemoryBudget::Stage::FRAME_ASSEMBLY,packet->size())){
+    return;
+  }
+  stream.curr_frame.append_fragment(packet->data(),packet->size());
+  stream.seq_offset++;
+  stream.last_parameter_sets_time=now;
+  if(is_output){
+    m_parameter_sets_requested[stream.index]= false;
+  }
+  SPDLOG_LOGGER_DEBUG(m_console,"Inserted parameter sets into stream {} ({} bytes)",stream.index,packet->size());
+}
+
+void GStreamerStream::update_queue_accounting(Pipeline& pipeline) {
+  const auto now=std::chrono::steady_clock::now();
+  if(now-pipeline.last_queue_accounting<std::chrono::milliseconds(100)){
+    return;
+  }
+  pipeline.last_queue_accounting=now;
+  std::size_t n_bytes=0;
+  for(auto* queue:pipeline.queues){
+    guint level=0;
+    g_object_get(G_OBJECT(queue), "current-level-bytes", &level, nullptr);
+    n_bytes+=level;
+  }
+  m_memory_budget->acquire(MemoryBudget::Stage::GST_QUEUES,n_bytes);
+  m_memory_budget->release(MemoryBudget::Stage::GST_QUEUES,pipeline.accounted_queue_bytes);
+  pipeline.accounted_queue_bytes=n_bytes;
 }
@@ -0,0 +1,122 @@
+#include "latency_estimator.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <sstream>
+
+LatencyEstimator::LatencyEstimator(LatencyProbeOptions options)
+: m_options(options)
+{
+  assert(m_options.offset_window>0);
+}
+
+std::optional<latency_probe::LatencyProbeMessage> LatencyEstimator::create_probe(int stream_index,uint64_t capture_us,uint64_t now_us) {
+  const auto interval_us=static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(m_options.probe_interval).count());
+  if(m_last_probe_us.has_value() && now_us-m_last_probe_us.value()<interval_us){
+    return std::nullopt;
+  }
+  m_last_probe_us=now_us;
+  latency_probe::LatencyProbeMessage probe{};
+  probe.type=latency_probe::Type::PROBE;
+  probe.stream_index=static_cast<uint8_t>(stream_index);
+  probe.sequence=m_next_sequence++;
+  probe.air_capture_us=capture_us;
+  probe.air_send_us=now_us;
+  m_stats.n_probes++;
+  return probe;
+}
+
+void LatencyEstimator::on_echo(const latency_probe::LatencyProbeMessage& echo,uint64_t now_us) {
+  if(echo.type!=latency_probe::Type::ECHO || echo.ground_send_us<echo.ground_receive_us){
+    return;
+  }
+  // fall back to the frame close time if the probe wasn't stamped by the transmit path
+  const auto t1=static_cast<int64_t>(echo.air_tx_us!=0 ? echo.air_tx_us : echo.air_send_us);
+  const auto t2=static_cast<int64_t>(echo.ground_receive_us);
+  const auto t3=static_cast<int64_t>(echo.ground_send_us);
+  const auto t4=static_cast<int64_t>(now_us);
+  if(t4<t1 || static_cast<int64_t>(echo.air_send_us)>t1){
+    return;
+  }
+  const int64_t rtt=(t4-t1)-(t3-t2);
+  if(rtt<0){
+    return;
+  }
+  m_stats.n_echoes++;
+  m_offset_samples.push_back({rtt,((t2-t1)+(t3-t4))/2});
+  while (static_cast<int>(m_offset_samples.size())>m_options.offset_window){
+    m_offset_samples.pop_front();
+  }
+  const auto best=std::min_element(m_offset_samples.begin(),m_offset_samples.end(),[](const OffsetSample& lhs,const OffsetSample& rhs){
+    return lhs.rtt_us<rhs.rtt_us;
+  });
+  m_stats.clock_offset_us=best->offset_us;
+  m_stats.clock_offset_error_us=best->rtt_us/2;
+  // when the ground received the probe, in air time
+  const int64_t receive_us=t2-best->offset_us;
+  const int64_t close_to_receive=receive_us-static_cast<int64_t>(echo.air_send_us);
+  if(m_last_close_to_receive_us.has_value()){
+    const int64_t d=std::abs(close_to_receive-m_last_close_to_receive_us.value());
+    m_jitter_x16+=d-(m_jitter_x16+8)/16;
+  }
+  m_last_close_to_receive_us=close_to_receive;
+  if(m_n_interval_echoes==0){
+    m_stats.rtt_min_us=rtt;
+    m_stats.close_to_receive_max_us=close_to_receive;
+  }
+  m_n_interval_echoes++;
+  m_rtt_sum_us+=rtt;
+  m_stats.rtt_min_us=std::min(m_stats.rtt_min_us,rtt);
+  m_close_to_receive_sum_us+=close_to_receive;
+  m_stats.close_to_receive_max_us=std::max(m_stats.close_to_receive_max_us,close_to_receive);
+  if(echo.air_capture_us!=0 && echo.air_capture_us<=echo.air_send_us){
+    const int64_t capture_to_receive=receive_us-static_cast<int64_t>(echo.air_capture_us);
+    if(m_n_interval_capture_echoes==0){
+      m_stats.capture_to_receive_max_us=capture_to_receive;
+    }
+    m_n_interval_capture_echoes++;
+    m_capture_to_receive_sum_us+=capture_to_receive;
+    m_stats.capture_to_receive_max_us=std::max(m_stats.capture_to_receive_max_us,capture_to_receive);
+  }
+}
+
+LatencyStats LatencyEstimator::get_stats_and_reset() {
+  auto ret=m_stats;
+  if(m_n_interval_echoes>0){
+    ret.rtt_avg_us=m_rtt_sum_us/static_cast<int64_t>(m_n_interval_echoes);
+    ret.close_to_receive_avg_us=m_close_to_receive_sum_us/static_cast<int64_t>(m_n_interval_echoes);
+  }
+  if(m_n_interval_capture_echoes>0){
+    ret.capture_to_receive_avg_us=m_capture_to_receive_sum_us/static_cast<int64_t>(m_n_interval_capture_echoes);
+  }
+  ret.jitter_us=m_jitter_x16/16;
+  m_n_interval_echoes=0;
+  m_n_interval_capture_echoes=0;
+  m_rtt_sum_us=0;
+  m_close_to_receive_sum_us=0;
+  m_capture_to_receive_sum_us=0;
+  m_stats.rtt_min_us=0;
+  m_stats.close_to_receive_max_us=0;
+  m_stats.capture_to_receive_max_us=0;
+  return ret;
+}
+
+std::string LatencyEstimator::createDebug() {
+  const bool has_capture_time=m_n_interval_capture_echoes>0;
+  const auto stats=get_stats_and_reset();
+  std::stringstream ss;
+  ss<<"Latency: probes:"<<stats.n_probes<<" echoes:"<<stats.n_echoes;
+  if(!stats.clock_offset_us.has_value()){
+    ss<<" (no echo yet)";
+    return ss.str();
+  }
+  ss<<" clock offset:"<<stats.clock_offset_us.value()<<"us +-"<<stats.clock_offset_error_us<<"us"
+     <<" rtt avg:"<<stats.rtt_avg_us<<"us min:"<<stats.rtt_min_us<<"us"
+     <<" close->rx avg:"<<stats.close_to_receive_avg_us<<"us max:"<<stats.close_to_receive_max_us<<"us";
+  if(has_capture_time){
+    ss<<" capture->rx avg:"<<stats.capture_to_receive_avg_us<<"us max:"<<stats.capture_to_receive_max_us<<"us";
+  }
+  ss<<" jitter:"<<stats.jitter_us<<"us";
+  return ss.str();
+}
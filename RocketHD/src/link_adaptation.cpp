@@ -0,0 +1,165 @@
+#include "link_adaptation.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <sstream>
+
+#include "wifi_phy_rates.hpp"
+
+double link_adaptation::probability_block_lost(int k,int m,double p) {
+  if(p<=0)return 0;
+  if(p>=1)return 1;
+  const int n=k+m;
+  // P(X<=m) with X ~ Binomial(n,p), pmf computed iteratively
+  double pmf=std::pow(1-p,n);
+  double cdf=pmf;
+  for(int i=0;i<m;i++){
+    pmf=pmf*(n-i)/(i+1)*p/(1-p);
+    cdf+=pmf;
+  }
+  return std::max(0.0,1.0-cdf);
+}
+
+LinkAdaptationController::LinkAdaptationController(LinkAdaptationOptions options,LinkAdaptationDecision initial,int bandwidth_mhz)
+: m_options(std::move(options)),
+  m_bandwidth_mhz(bandwidth_mhz),
+  m_configured(initial),
+  m_current(initial),
+  m_last_feedback_time(std::chrono::steady_clock::now())
+{
+  assert(!m_options.fec_block_lengths.empty());
+  assert(m_options.fec_percentage_step>0);
+}
+
+int LinkAdaptationController::get_mcs_index_for_rssi(int rssi_dbm) const {
+  int ret=m_options.min_mcs_index;
+  for(int mcs=m_options.min_mcs_index;mcs<=m_options.max_mcs_index;mcs++){
+    if(wifi::phyrates::get_rx_sensitivity_dbm(mcs,m_bandwidth_mhz)+m_options.rssi_margin_db<=rssi_dbm){
+      ret=mcs;
+    }
+  }
+  return ret;
+}
+
+LinkAdaptationController::FecSetting LinkAdaptationController::find_cheapest_fec(double packet_loss) const {
+  // For a given mcs index the airtime is proportional to (100+fec_percentage),
+  // so the cheapest setting is the smallest percentage that reaches the target.
+  // On a tie, the block length listed first wins (put the low latency ones first).
+  for(int fec_percentage=m_options.min_fec_percentage;fec_percentage<=m_options.max_fec_percentage;fec_percentage+=m_options.fec_percentage_step){
+    for(const auto block_length:m_options.fec_block_lengths){
+      const int k=block_length==0 ? m_options.assumed_variable_block_length : block_length;
+      const int m=(k*fec_percentage+99)/100;
+      if(link_adaptation::probability_block_lost(k,m,packet_loss)<=m_options.target_block_loss){
+        return FecSetting{fec_percentage,block_length,true};
+      }
+    }
+  }
+  return FecSetting{m_options.max_fec_percentage,m_options.fec_block_lengths.front(),false};
+}
+
+std::optional<LinkAdaptationDecision> LinkAdaptationController::on_feedback(const link_feedback::LinkFeedbackMessage& message,
+                                                                            std::chrono::steady_clock::time_point now) {
+  m_last_feedback_time=now;
+  m_timed_out= false;
+  if(!m_last_message.has_value() || message.n_packets_received<m_last_message->n_packets_received){
+    // first report, or the ground unit restarted - nothing to calculate deltas from yet
+    m_last_message=message;
+    return std::nullopt;
+  }
+  if(message.sequence<=m_last_message->sequence){
+    // duplicate / reordered report
+    return std::nullopt;
+  }
+  const auto& last=m_last_message.value();
+  const auto d_received=message.n_packets_received-last.n_packets_received;
+  const auto d_lost=message.n_packets_lost-last.n_packets_lost;
+  const auto d_blocks_total=message.n_blocks_total-last.n_blocks_total;
+  const auto d_blocks_lost=message.n_blocks_lost-last.n_blocks_lost;
+  m_last_message=message;
+  m_last_rssi=message.rssi_dbm<0 ? message.rssi_dbm : 0;
+  if(d_received+d_lost>0){
+    const double packet_loss=static_cast<double>(d_lost)/static_cast<double>(d_received+d_lost);
+    m_packet_loss_estimate=0.7*m_packet_loss_estimate+0.3*packet_loss;
+  }
+  if(d_blocks_total>0){
+    // This is what closes the loop - the independent loss model is optimistic for bursty loss
+    const double block_loss=static_cast<double>(d_blocks_lost)/static_cast<double>(d_blocks_total);
+    if(block_loss>m_options.target_block_loss){
+      m_safety_factor=std::min(m_safety_factor*1.5,8.0);
+    }else{
+      m_safety_factor=std::max(m_safety_factor*0.95,1.0);
+    }
+  }
+  double effective_loss=std::min(0.5,m_packet_loss_estimate*m_safety_factor);
+  auto fec=find_cheapest_fec(effective_loss);
+  int mcs_index=std::clamp(m_current.mcs_index,m_options.min_mcs_index,m_options.max_mcs_index);
+  // A valid rssi is negative, 0 means the ground unit didn't have one (e.g. the card doesn't report it) - then the
+  // rssi doesn't force a mcs change, and the loss alone decides whether to probe the next higher one.
+  const bool rssi_valid=message.rssi_dbm<0;
+  const int rssi_mcs=rssi_valid ? get_mcs_index_for_rssi(message.rssi_dbm) : m_options.max_mcs_index;
+  if(rssi_mcs<mcs_index){
+    mcs_index=rssi_mcs;
+    m_n_good_reports=0;
+  }else if(!fec.reaches_target){
+    // target cannot be reached even with max FEC at this mcs
+    mcs_index=std::max(m_options.min_mcs_index,mcs_index-1);
+    m_n_good_reports=0;
+  }else if(rssi_mcs>mcs_index && effective_loss<0.05){
+    m_n_good_reports++;
+    if(m_n_good_reports>=m_options.n_good_reports_before_mcs_increase){
+      mcs_index++;
+      m_n_good_reports=0;
+      // We only measured the loss at the lower mcs index, be pessimistic until we have new reports
+      m_packet_loss_estimate=m_packet_loss_estimate*2+0.02;
+      effective_loss=std::min(0.5,m_packet_loss_estimate*m_safety_factor);
+      fec=find_cheapest_fec(effective_loss);
+    }
+  }else{
+    m_n_good_reports=0;
+  }
+  const LinkAdaptationDecision decision{mcs_index,fec.fec_percentage,fec.fec_block_length};
+  if(decision==m_current){
+    return std::nullopt;
+  }
+  m_current=decision;
+  m_n_decisions++;
+  return decision;
+}
+
+std::optional<LinkAdaptationDecision> LinkAdaptationController::check_timeout(std::chrono::steady_clock::time_point now) {
+  if(m_timed_out || now-m_last_feedback_time<m_options.feedback_timeout){
+    return std::nullopt;
+  }
+  m_timed_out= true;
+  // The ground unit might have lost us because of a too aggressive setting - go back to the configured settings
+  m_last_message=std::nullopt;
+  m_n_good_reports=0;
+  const LinkAdaptationDecision fallback{m_options.fallback_mcs_index.value_or(m_configured.mcs_index),
+                                        m_options.fallback_fec_percentage.value_or(m_configured.fec_percentage),
+                                        m_configured.fec_block_length};
+  if(fallback==m_current){
+    return std::nullopt;
+  }
+  m_current=fallback;
+  m_n_decisions++;
+  return fallback;
+}
+
+LinkAdaptationDecision LinkAdaptationController::get_current() const {
+  return m_current;
+}
+
+void LinkAdaptationController::set_configured(const LinkAdaptationDecision& configured) {
+  m_configured=configured;
+  m_current=configured;
+  m_n_good_reports=0;
+}
+
+std::string LinkAdaptationController::createDebug() const {
+  std::stringstream ss;
+  ss<<"LinkAdaptation: mcs:"<<m_current.mcs_index<<" fec:"<<m_current.fec_percentage<<"% k:"<<m_current.fec_block_length
+     <<" est. loss:"<<m_packet_loss_estimate*100<<"% safety:"<<m_safety_factor<<" rssi:"<<(m_last_rssi<0 ? std::to_string(m_last_rssi) : "?")
+     <<" decisions:"<<m_n_decisions<<(m_timed_out ? " (no feedback)" : "");
+  return ss.str();
+}
@@ -0,0 +1,98 @@
+#include "memory_budget.hpp"
+
+#include <sstream>
+
+// Share of the total budget per stage, in percent (same order as MemoryBudget::Stage).
+// The raw frames are by far the biggest (3MB per 1080p frame), encoded frames are ~100x smaller.
+static constexpr std::array<int,MemoryBudget::N_STAGES> STAGE_SHARES_PERCENT{
+    40, // GST_QUEUES
+    30, // RAW_FRAMES
+    5,  // FRAME_ASSEMBLY
+    20, // TX_QUEUE
+    5,  // BLOCK_POOL
+};
+
+MemoryBudget::MemoryBudget(std::size_t total_bytes)
+: m_total_limit(total_bytes){
+  for(int i=0;i<N_STAGES;i++){
+    m_stages[i].limit=total_bytes/100*STAGE_SHARES_PERCENT[i];
+  }
+}
+
+std::size_t MemoryBudget::get_stage_limit(Stage stage) const {
+  return get_account(stage).limit;
+}
+
+bool MemoryBudget::try_acquire(Stage stage,std::size_t n_bytes) {
+  auto& account=get_account(stage);
+  std::size_t held=account.held.load(std::memory_order_relaxed);
+  do{
+    if(held+n_bytes>account.limit){
+      account.n_rejected.fetch_add(1,std::memory_order_relaxed);
+      return false;
+    }
+  }while (!account.held.compare_exchange_weak(held,held+n_bytes,std::memory_order_relaxed));
+  const auto total=m_total_held.fetch_add(n_bytes,std::memory_order_relaxed)+n_bytes;
+  if(total>m_total_limit){
+    // only possible if a stage that is bounded elsewhere went over its share
+    m_total_held.fetch_sub(n_bytes,std::memory_order_relaxed);
+    account.held.fetch_sub(n_bytes,std::memory_order_relaxed);
+    account.n_rejected.fetch_add(1,std::memory_order_relaxed);
+    return false;
+  }
+  update_peak(account,held+n_bytes);
+  return true;
+}
+
+void MemoryBudget::acquire(Stage stage,std::size_t n_bytes) {
+  auto& account=get_account(stage);
+  const auto held=account.held.fetch_add(n_bytes,std::memory_order_relaxed)+n_bytes;
+  m_total_held.fetch_add(n_bytes,std::memory_order_relaxed);
+  update_peak(account,held);
+}
+
+void MemoryBudget::release(Stage stage,std::size_t n_bytes) {
+  get_account(stage).held.fetch_sub(n_bytes,std::memory_order_relaxed);
+  m_total_held.fetch_sub(n_bytes,std::memory_order_relaxed);
+}
+
+std::size_t MemoryBudget::get_held(Stage stage) const {
+  return get_account(stage).held.load(std::memory_order_relaxed);
+}
+
+void MemoryBudget::update_peak(StageAccount& account,std::size_t held) {
+  std::size_t peak=account.peak.load(std::memory_order_relaxed);
+  while (held>peak && !account.peak.compare_exchange_weak(peak,held,std::memory_order_relaxed)){}
+}
+
+std::string MemoryBudget::stage_to_string(Stage stage) {
+  switch (stage) {
+    case Stage::GST_QUEUES:return "gst_queues";
+    case Stage::RAW_FRAMES:return "raw_frames";
+    case Stage::FRAME_ASSEMBLY:return "frame_assembly";
+    case Stage::TX_QUEUE:return "tx_queue";
+    case Stage::BLOCK_POOL:return "block_pool";
+  }
+  return "unknown";
+}
+
+static double to_mb(std::size_t n_bytes){
+  return static_cast<double>(n_bytes)/(1024*1024);
+}
+
+std::string MemoryBudget::createDebug() {
+  std::stringstream ss;
+  ss.precision(1);
+  ss<<std::fixed<<"MemoryBudget: "<<to_mb(get_total_held())<<"/"<<to_mb(m_total_limit)<<"MB";
+  for(int i=0;i<N_STAGES;i++){
+    auto& account=m_stages[i];
+    const auto held=account.held.load(std::memory_order_relaxed);
+    ss<<" "<<stage_to_string(static_cast<Stage>(i))<<":"<<to_mb(held)<<"/"<<to_mb(account.limit)
+       <<"MB peak:"<<to_mb(account.peak.exchange(held,std::memory_order_relaxed))<<"MB";
+    const auto n_rejected=account.n_rejected.exchange(0,std::memory_order_relaxed);
+    if(n_rejected>0){
+      ss<<" rejected:"<<n_rejected;
+    }
+  }
+  return ss.str();
+}
@@ -0,0 +1,243 @@
+#include "nv12_convert.hpp"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace nv12convert{
+
+namespace {
+
+// Row kernels. n is the number of chroma pairs (UV) resp. pixels (Y).
+// Every kernel handles the bulk vectorized and the remainder with the scalar code below.
+
+inline uint8_t avg(uint8_t a,uint8_t b){
+  // same rounding as pavgb / vrhadd
+  return static_cast<uint8_t>((a+b+1)>>1);
+}
+
+void interleave_row_scalar(uint8_t* dst,const uint8_t* u,const uint8_t* v,int begin,int n){
+  for(int i=begin;i<n;i++){
+    dst[2*i]=u[i];
+    dst[2*i+1]=v[i];
+  }
+}
+
+void interleave_avg_row_scalar(uint8_t* dst,const uint8_t* u0,const uint8_t* u1,const uint8_t* v0,const uint8_t* v1,int begin,int n){
+  for(int i=begin;i<n;i++){
+    dst[2*i]=avg(u0[i],u1[i]);
+    dst[2*i+1]=avg(v0[i],v1[i]);
+  }
+}
+
+void yuy2_y_row_scalar(uint8_t* dst,const uint8_t* src,int begin,int width){
+  for(int i=begin;i<width;i++){
+    dst[i]=src[2*i];
+  }
+}
+
+// UV of YUY2 are the odd bytes, already in NV12 order (U0 V0 U1 V1 ...)
+void yuy2_uv_row_scalar(uint8_t* dst,const uint8_t* src0,const uint8_t* src1,int begin,int width){
+  for(int i=begin;i<width;i++){
+    dst[i]=avg(src0[2*i+1],src1[2*i+1]);
+  }
+}
+
+void interleave_row(uint8_t* dst,const uint8_t* u,const uint8_t* v,int n){
+  int i=0;
+#if defined(__AVX2__)
+  for(;i+32<=n;i+=32){
+    // unpack works within 128 bit lanes - reorder the 64 bit quads first, such that the output is in order
+    const __m256i uu=_mm256_permute4x64_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(u+i)),0xD8);
+    const __m256i vv=_mm256_permute4x64_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(v+i)),0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst+2*i),_mm256_unpacklo_epi8(uu,vv));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst+2*i+32),_mm256_unpackhi_epi8(uu,vv));
+  }
+#endif
+#if defined(__SSE2__)
+  for(;i+16<=n;i+=16){
+    const __m128i uu=_mm_loadu_si128(reinterpret_cast<const __m128i*>(u+i));
+    const __m128i vv=_mm_loadu_si128(reinterpret_cast<const __m128i*>(v+i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+2*i),_mm_unpacklo_epi8(uu,vv));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+2*i+16),_mm_unpackhi_epi8(uu,vv));
+  }
+#elif defined(__ARM_NEON)
+  for(;i+16<=n;i+=16){
+    const uint8x16x2_t uv={vld1q_u8(u+i),vld1q_u8(v+i)};
+    vst2q_u8(dst+2*i,uv);
+  }
+#endif
+  interleave_row_scalar(dst,u,v,i,n);
+}
+
+void interleave_avg_row(uint8_t* dst,const uint8_t* u0,const uint8_t* u1,const uint8_t* v0,const uint8_t* v1,int n){
+  int i=0;
+#if defined(__SSE2__)
+  for(;i+16<=n;i+=16){
+    const __m128i uu=_mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u0+i)),
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(u1+i)));
+    const __m128i vv=_mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v0+i)),
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(v1+i)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+2*i),_mm_unpacklo_epi8(uu,vv));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+2*i+16),_mm_unpackhi_epi8(uu,vv));
+  }
+#elif defined(__ARM_NEON)
+  for(;i+16<=n;i+=16){
+    const uint8x16x2_t uv={vrhaddq_u8(vld1q_u8(u0+i),vld1q_u8(u1+i)),vrhaddq_u8(vld1q_u8(v0+i),vld1q_u8(v1+i))};
+    vst2q_u8(dst+2*i,uv);
+  }
+#endif
+  interleave_avg_row_scalar(dst,u0,u1,v0,v1,i,n);
+}
+
+void yuy2_y_row(uint8_t* dst,const uint8_t* src,int width){
+  int i=0;
+#if defined(__SSE2__)
+  const __m128i mask=_mm_set1_epi16(0x00FF);
+  for(;i+16<=width;i+=16){
+    const __m128i a=_mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src+2*i)),mask);
+    const __m128i b=_mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src+2*i+16)),mask);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i),_mm_packus_epi16(a,b));
+  }
+#elif defined(__ARM_NEON)
+  for(;i+16<=width;i+=16){
+    vst1q_u8(dst+i,vld2q_u8(src+2*i).val[0]);
+  }
+#endif
+  yuy2_y_row_scalar(dst,src,i,width);
+}
+
+void yuy2_uv_row(uint8_t* dst,const uint8_t* src0,const uint8_t* src1,int width){
+  int i=0;
+#if defined(__SSE2__)
+  for(;i+16<=width;i+=16){
+    const __m128i a=_mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src0+2*i)),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1+2*i)));
+    const __m128i b=_mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src0+2*i+16)),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1+2*i+16)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i),_mm_packus_epi16(_mm_srli_epi16(a,8),_mm_srli_epi16(b,8)));
+  }
+#elif defined(__ARM_NEON)
+  for(;i+16<=width;i+=16){
+    vst1q_u8(dst+i,vrhaddq_u8(vld2q_u8(src0+2*i).val[1],vld2q_u8(src1+2*i).val[1]));
+  }
+#endif
+  yuy2_uv_row_scalar(dst,src0,src1,i,width);
+}
+
+void copy_y_plane(const uint8_t* src_y,int src_y_stride,const Nv12Image& dst){
+  for(int row=0;row<dst.height;row++){
+    std::memcpy(dst.y+row*dst.y_stride,src_y+row*src_y_stride,dst.width);
+  }
+}
+
+inline int n_chroma_pairs(const Nv12Image& dst){
+  return (dst.width+1)/2;
+}
+
+inline int n_chroma_rows(const Nv12Image& dst){
+  return (dst.height+1)/2;
+}
+
+// Both implementations share the plane / row logic, only the row kernels differ
+template<class INTERLEAVE>
+void i420_to_nv12_impl(const uint8_t* src_y,int src_y_stride,const uint8_t* src_u,int src_u_stride,
+                       const uint8_t* src_v,int src_v_stride,const Nv12Image& dst,INTERLEAVE interleave){
+  copy_y_plane(src_y,src_y_stride,dst);
+  for(int row=0;row<n_chroma_rows(dst);row++){
+    interleave(dst.uv+row*dst.uv_stride,src_u+row*src_u_stride,src_v+row*src_v_stride,n_chroma_pairs(dst));
+  }
+}
+
+template<class INTERLEAVE_AVG>
+void y42b_to_nv12_impl(const uint8_t* src_y,int src_y_stride,const uint8_t* src_u,int src_u_stride,
+                       const uint8_t* src_v,int src_v_stride,const Nv12Image& dst,INTERLEAVE_AVG interleave_avg){
+  copy_y_plane(src_y,src_y_stride,dst);
+  for(int row=0;row<n_chroma_rows(dst);row++){
+    const int row0=2*row;
+    // odd height - the last chroma row has no partner
+    const int row1=row0+1<dst.height ? row0+1 : row0;
+    interleave_avg(dst.uv+row*dst.uv_stride,src_u+row0*src_u_stride,src_u+row1*src_u_stride,
+                   src_v+row0*src_v_stride,src_v+row1*src_v_stride,n_chroma_pairs(dst));
+  }
+}
+
+template<class Y_ROW,class UV_ROW>
+void yuy2_to_nv12_impl(const uint8_t* src,int src_stride,const Nv12Image& dst,Y_ROW y_row,UV_ROW uv_row){
+  for(int row=0;row<dst.height;row++){
+    y_row(dst.y+row*dst.y_stride,src+row*src_stride,dst.width);
+  }
+  for(int row=0;row<n_chroma_rows(dst);row++){
+    const int row0=2*row;
+    const int row1=row0+1<dst.height ? row0+1 : row0;
+    // one U and one V byte per 2 pixels -> width bytes per UV row
+    uv_row(dst.uv+row*dst.uv_stride,src+row0*src_stride,src+row1*src_stride,dst.width);
+  }
+}
+
+}
+
+void fill_padding_rows(const Nv12Image& dst,int padded_height) {
+  for(int row=dst.height;row<padded_height;row++){
+    std::memset(dst.y+row*dst.y_stride,16,dst.width);
+  }
+  for(int row=n_chroma_rows(dst);row<(padded_height+1)/2;row++){
+    std::memset(dst.uv+row*dst.uv_stride,128,2*n_chroma_pairs(dst));
+  }
+}
+
+void i420_to_nv12(const uint8_t* src_y,int src_y_stride,const uint8_t* src_u,int src_u_stride,
+                  const uint8_t* src_v,int src_v_stride,const Nv12Image& dst) {
+  i420_to_nv12_impl(src_y,src_y_stride,src_u,src_u_stride,src_v,src_v_stride,dst,interleave_row);
+}
+
+void y42b_to_nv12(const uint8_t* src_y,int src_y_stride,const uint8_t* src_u,int src_u_stride,
+                  const uint8_t* src_v,int src_v_stride,const Nv12Image& dst) {
+  y42b_to_nv12_impl(src_y,src_y_stride,src_u,src_u_stride,src_v,src_v_stride,dst,interleave_avg_row);
+}
+
+void yuy2_to_nv12(const uint8_t* src,int src_stride,const Nv12Image& dst) {
+  yuy2_to_nv12_impl(src,src_stride,dst,yuy2_y_row,yuy2_uv_row);
+}
+
+const char* simd_name() {
+#if defined(__AVX2__)
+  return "avx2";
+#elif defined(__SSE2__)
+  return "sse2";
+#elif defined(__ARM_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+namespace scalar{
+
+void i420_to_nv12(const uint8_t* src_y,int src_y_stride,const uint8_t* src_u,int src_u_stride,
+                  const uint8_t* src_v,int src_v_stride,const Nv12Image& dst) {
+  i420_to_nv12_impl(src_y,src_y_stride,src_u,src_u_stride,src_v,src_v_stride,dst,
+                    [](uint8_t* d,const uint8_t* u,const uint8_t* v,int n){interleave_row_scalar(d,u,v,0,n);});
+}
+
+void y42b_to_nv12(const uint8_t* src_y,int src_y_stride,const uint8_t* src_u,int src_u_stride,
+                  const uint8_t* src_v,int src_v_stride,const Nv12Image& dst) {
+  y42b_to_nv12_impl(src_y,src_y_stride,src_u,src_u_stride,src_v,src_v_stride,dst,
+                    [](uint8_t* d,const uint8_t* u0,const uint8_t* u1,const uint8_t* v0,const uint8_t* v1,int n){
+                      interleave_avg_row_scalar(d,u0,u1,v0,v1,0,n);
+                    });
+}
+
+void yuy2_to_nv12(const uint8_t* src,int src_stride,const Nv12Image& dst) {
+  yuy2_to_nv12_impl(src,src_stride,dst,
+                    [](uint8_t* d,const uint8_t* s,int width){yuy2_y_row_scalar(d,s,0,width);},
+                    [](uint8_t* d,const uint8_t* s0,const uint8_t* s1,int width){yuy2_uv_row_scalar(d,s0,s1,0,width);});
+}
+
+}
+
+}
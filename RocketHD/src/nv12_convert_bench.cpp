@@ -0,0 +1,206 @@
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/gst.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "nv12_convert.hpp"
+
+// Benchmark of the decoder -> encoder conversion on the air unit:
+// the gstreamer chain rocket used before ("videoconvert ! video/x-raw,format=YUY2 ! videobox") against
+// Nv12ConvertStage's conversion (vectorized and scalar), for each decoder output format, on synthetic frames.
+// Run it on the air unit itself, the numbers from a desktop cpu don't mean much.
+
+// A decoded frame in the default gstreamer layout of its format
+struct RawFrame{
+  std::string format;
+  int width;
+  int height;
+  std::vector<uint8_t> data;
+  int strides[3];
+  std::size_t offsets[3];
+};
+
+static RawFrame create_raw_frame(const std::string& format,int width,int height){
+  RawFrame frame{format,width,height,{},{0,0,0},{0,0,0}};
+  std::size_t size;
+  if(format=="I420"){
+    frame.strides[0]=GST_ROUND_UP_4(width);
+    frame.strides[1]=frame.strides[2]=GST_ROUND_UP_4(GST_ROUND_UP_2(width)/2);
+    frame.offsets[1]=static_cast<std::size_t>(frame.strides[0])*GST_ROUND_UP_2(height);
+    frame.offsets[2]=frame.offsets[1]+static_cast<std::size_t>(frame.strides[1])*(GST_ROUND_UP_2(height)/2);
+    size=frame.offsets[2]+static_cast<std::size_t>(frame.strides[2])*(GST_ROUND_UP_2(height)/2);
+  }else if(format=="Y42B"){
+    frame.strides[0]=GST_ROUND_UP_4(width);
+    frame.strides[1]=frame.strides[2]=GST_ROUND_UP_8(width)/2;
+    frame.offsets[1]=static_cast<std::size_t>(frame.strides[0])*height;
+    frame.offsets[2]=frame.offsets[1]+static_cast<std::size_t>(frame.strides[1])*height;
+    size=frame.offsets[2]+static_cast<std::size_t>(frame.strides[2])*height;
+  }else{
+    frame.strides[0]=GST_ROUND_UP_4(width*2);
+    size=static_cast<std::size_t>(frame.strides[0])*height;
+  }
+  frame.data.resize(size);
+  // something that looks a bit like a picture, pure noise would be unrealistic for the gstreamer elements
+  std::mt19937 rng{static_cast<uint32_t>(size)};
+  for(std::size_t i=0;i<size;i++){
+    frame.data[i]=static_cast<uint8_t>((i%251)+(rng()%5));
+  }
+  return frame;
+}
+
+using CONVERT_FUNCTION=std::function<void(const RawFrame& frame,const nv12convert::Nv12Image& dst)>;
+
+static CONVERT_FUNCTION get_convert_function(const std::string& format,bool vectorized){
+  if(format=="I420"){
+    auto fn=vectorized ? nv12convert::i420_to_nv12 : nv12convert::scalar::i420_to_nv12;
+    return [fn](const RawFrame& f,const nv12convert::Nv12Image& dst){
+      fn(f.data.data(),f.strides[0],f.data.data()+f.offsets[1],f.strides[1],f.data.data()+f.offsets[2],f.strides[2],dst);
+    };
+  }
+  if(format=="Y42B"){
+    auto fn=vectorized ? nv12convert::y42b_to_nv12 : nv12convert::scalar::y42b_to_nv12;
+    return [fn](const RawFrame& f,const nv12convert::Nv12Image& dst){
+      fn(f.data.data(),f.strides[0],f.data.data()+f.offsets[1],f.strides[1],f.data.data()+f.offsets[2],f.strides[2],dst);
+    };
+  }
+  auto fn=vectorized ? nv12convert::yuy2_to_nv12 : nv12convert::scalar::yuy2_to_nv12;
+  return [fn](const RawFrame& f,const nv12convert::Nv12Image& dst){
+    fn(f.data.data(),f.strides[0],dst);
+  };
+}
+
+// Returns the conversion time per frame in ms, output is the last converted frame (NV12, padded)
+static double bench_convert(const RawFrame& frame,int padded_height,const CONVERT_FUNCTION& convert,int n_frames,std::vector<uint8_t>& output){
+  const int stride=GST_ROUND_UP_4(frame.width);
+  output.assign(static_cast<std::size_t>(stride)*padded_height*3/2,0);
+  const nv12convert::Nv12Image dst{output.data(),stride,output.data()+static_cast<std::size_t>(stride)*padded_height,stride,
+                                   frame.width,frame.height};
+  // like the pooled buffers of Nv12ConvertStage, the padding is written once
+  nv12convert::fill_padding_rows(dst,padded_height);
+  const auto begin=std::chrono::steady_clock::now();
+  for(int i=0;i<n_frames;i++){
+    convert(frame,dst);
+  }
+  const auto elapsed=std::chrono::steady_clock::now()-begin;
+  return std::chrono::duration<double,std::milli>(elapsed).count()/n_frames;
+}
+
+// Returns the time per frame in ms through the gstreamer elements, or a negative value on error
+static double bench_gst_chain(const RawFrame& frame,int padding,int n_frames){
+  std::stringstream ss;
+  ss << "appsrc name=src format=time caps=video/x-raw,format=" << frame.format << ",width=" << frame.width
+     << ",height=" << frame.height << ",framerate=30/1 ! videoconvert ! video/x-raw,format=YUY2 ! ";
+  if(padding>0){
+    ss << "videobox bottom=-" << padding << " ! ";
+  }
+  ss << "appsink name=sink sync=false";
+  const auto pipeline_content=ss.str();
+  GError *error = nullptr;
+  GstElement* pipeline = gst_parse_launch(pipeline_content.c_str(), &error);
+  if (error) {
+    fprintf(stderr,"Failed to create pipeline: %s\n",error->message);
+    g_error_free(error);
+    if(pipeline)gst_object_unref(pipeline);
+    return -1;
+  }
+  GstElement* src=gst_bin_get_by_name(GST_BIN(pipeline),"src");
+  GstElement* sink=gst_bin_get_by_name(GST_BIN(pipeline),"sink");
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  const auto frame_duration=GST_SECOND/30;
+  // the first frames include caps negotiation / allocation, they are not measured
+  static constexpr int N_WARMUP_FRAMES=5;
+  std::chrono::steady_clock::time_point begin;
+  int n_received=0;
+  for(int i=0;i<N_WARMUP_FRAMES+n_frames;i++){
+    if(i==N_WARMUP_FRAMES){
+      begin=std::chrono::steady_clock::now();
+    }
+    auto* data=const_cast<uint8_t*>(frame.data.data());
+    GstBuffer* buffer=gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,data,frame.data.size(),0,frame.data.size(),nullptr,nullptr);
+    GST_BUFFER_PTS(buffer)=i*frame_duration;
+    gst_app_src_push_buffer(GST_APP_SRC(src),buffer);
+    // one frame at a time, such that we measure the processing time and not some queue
+    GstSample* sample=gst_app_sink_try_pull_sample(GST_APP_SINK(sink),GST_SECOND);
+    if(sample){
+      n_received++;
+      gst_sample_unref(sample);
+    }
+  }
+  const auto elapsed=std::chrono::steady_clock::now()-begin;
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(src);
+  gst_object_unref(sink);
+  gst_object_unref(pipeline);
+  if(n_received!=N_WARMUP_FRAMES+n_frames){
+    fprintf(stderr,"gst chain: only got %d of %d frames\n",n_received,N_WARMUP_FRAMES+n_frames);
+    return -1;
+  }
+  return std::chrono::duration<double,std::milli>(elapsed).count()/n_frames;
+}
+
+int main(int argc, char *const *argv) {
+  int opt;
+  int width=1920;
+  int height=1080;
+  int n_frames=300;
+  std::vector<std::string> formats{"I420","Y42B","YUY2"};
+  bool bench_gst=true;
+  while ((opt = getopt(argc, argv, "w:h:n:f:G")) != -1) {
+    switch (opt) {
+      case 'w':width = std::stoi(optarg);
+        break;
+      case 'h':height = std::stoi(optarg);
+        break;
+      case 'n':n_frames = std::stoi(optarg);
+        break;
+      case 'f':formats = {optarg};
+        break;
+      case 'G':bench_gst = false;
+        break;
+      default: /* '?' */
+        fprintf(stderr,
+                "Usage: %s [-w width] [-h height] [-n n_frames] [-f I420|Y42B|YUY2] [-G skip the gstreamer chain]\n",
+                argv[0]);
+        exit(1);
+    }
+  }
+  if(bench_gst && !gst_init_check(nullptr, nullptr, nullptr)){
+    fprintf(stderr,"gst_init_check() failed\n");
+    return 1;
+  }
+  const int padding=(16-height%16)%16;
+  fprintf(stdout,"%dx%d (padded to %d), %d frames, conversion using %s\n",width,height,height+padding,n_frames,nv12convert::simd_name());
+  int ret=0;
+  for(const auto& format:formats){
+    if(format!="I420" && format!="Y42B" && format!="YUY2"){
+      fprintf(stderr,"Unsupported format %s\n",format.c_str());
+      return 1;
+    }
+    const auto frame=create_raw_frame(format,width,height);
+    std::vector<uint8_t> vectorized_output;
+    std::vector<uint8_t> scalar_output;
+    const double vectorized_ms=bench_convert(frame,height+padding,get_convert_function(format,true),n_frames,vectorized_output);
+    const double scalar_ms=bench_convert(frame,height+padding,get_convert_function(format,false),n_frames,scalar_output);
+    const bool identical=vectorized_output==scalar_output;
+    if(!identical){
+      ret=1;
+    }
+    fprintf(stdout,"%s: %s %.3fms/frame, scalar %.3fms/frame%s\n",format.c_str(),nv12convert::simd_name(),vectorized_ms,scalar_ms,
+            identical ? "" : " OUTPUT MISMATCH");
+    if(bench_gst){
+      const double gst_ms=bench_gst_chain(frame,padding,n_frames);
+      if(gst_ms>0){
+        fprintf(stdout,"%s: videoconvert+videobox %.3fms/frame (%.1fx)\n",format.c_str(),gst_ms,gst_ms/vectorized_ms);
+      }
+    }
+  }
+  return ret;
+}
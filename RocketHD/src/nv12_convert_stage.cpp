@@ -0,0 +1,277 @@
+#include "nv12_convert_stage.hpp"
+#include "flight_recorder.hpp"
+#include "thread_stats.hpp"
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+// Pool of NV12 buffers (with padding rows) that are handed to gstreamer wrapped in a GstBuffer.
+// Once gstreamer (the encoder) is done with a buffer, the memory goes back into the pool - buffers might be released
+// after the stage (and the pool) are gone, in which case the memory is just freed.
+class Nv12BufferPool : public std::enable_shared_from_this<Nv12BufferPool>{
+ public:
+  Nv12BufferPool(int width,int height,int padded_height,std::shared_ptr<MemoryBudget> memory_budget)
+      : m_memory_budget(std::move(memory_budget)),
+        m_width(width),
+        m_height(height),
+        m_padded_height(padded_height),
+        // same layout as gstreamer uses for NV12 without video meta
+        m_stride(GST_ROUND_UP_4(width)),
+        m_uv_offset(static_cast<std::size_t>(m_stride)*padded_height),
+        m_size(m_uv_offset+static_cast<std::size_t>(m_stride)*(padded_height/2)){
+  }
+  ~Nv12BufferPool(){
+    for(auto* entry:m_free){
+      free_entry(entry);
+    }
+  }
+  // The returned buffer is owned by the caller, image points into it.
+  // nullptr if there is no free buffer and the memory budget doesn't allow a new one.
+  GstBuffer* acquire(nv12convert::Nv12Image& image){
+    Entry* entry=nullptr;
+    {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      if(!m_free.empty()){
+        entry=m_free.back();
+        m_free.pop_back();
+      }
+    }
+    if(entry==nullptr){
+      if(m_memory_budget && !m_memory_budget->try_acquire(MemoryBudget::Stage::RAW_FRAMES,get_allocation_size())){
+        return nullptr;
+      }
+      entry=new Entry{weak_from_this(),m_memory_budget,get_allocation_size(),allocate()};
+    }
+    image=get_image(entry->data);
+    return gst_buffer_new_wrapped_full(static_cast<GstMemoryFlags>(0),entry->data,m_size,0,m_size,entry,&Nv12BufferPool::on_buffer_released);
+  }
+ private:
+  struct Entry{
+    std::weak_ptr<Nv12BufferPool> pool;
+    // released once the memory is freed, which might be after the pool is gone
+    std::shared_ptr<MemoryBudget> memory_budget;
+    std::size_t allocation_size;
+    uint8_t* data;
+  };
+  // cache line aligned, the conversion uses unaligned loads / stores but they are faster on aligned memory
+  static constexpr std::size_t ALIGNMENT=64;
+  std::size_t get_allocation_size()const{
+    return (m_size+ALIGNMENT-1)/ALIGNMENT*ALIGNMENT;
+  }
+  static void on_buffer_released(gpointer user_data){
+    auto* entry=static_cast<Entry*>(user_data);
+    auto pool=entry->pool.lock();
+    if(pool){
+      std::lock_guard<std::mutex> guard(pool->m_mutex);
+      pool->m_free.push_back(entry);
+      return;
+    }
+    free_entry(entry);
+  }
+  static void free_entry(Entry* entry){
+    if(entry->memory_budget){
+      entry->memory_budget->release(MemoryBudget::Stage::RAW_FRAMES,entry->allocation_size);
+    }
+    std::free(entry->data);
+    delete entry;
+  }
+  nv12convert::Nv12Image get_image(uint8_t* data)const{
+    return nv12convert::Nv12Image{data,m_stride,data+m_uv_offset,m_stride,m_width,m_height};
+  }
+  uint8_t* allocate(){
+    auto* data=static_cast<uint8_t*>(std::aligned_alloc(ALIGNMENT,get_allocation_size()));
+    if(data==nullptr){
+      throw std::bad_alloc();
+    }
+    nv12convert::fill_padding_rows(get_image(data),m_padded_height);
+    return data;
+  }
+ private:
+  const std::shared_ptr<MemoryBudget> m_memory_budget;
+  const int m_width;
+  const int m_height;
+  const int m_padded_height;
+  const int m_stride;
+  const std::size_t m_uv_offset;
+  const std::size_t m_size;
+  std::mutex m_mutex;
+  std::vector<Entry*> m_free;
+};
+
+Nv12ConvertStage::Nv12ConvertStage(std::shared_ptr<spdlog::logger> console,GstElement* raw_sink,GstElement* nv12_src,
+                                   int width,int height,int padded_height,std::shared_ptr<MemoryBudget> memory_budget)
+    : m_console(std::move(console)),
+      m_raw_sink(raw_sink),
+      m_nv12_src(nv12_src),
+      m_width(width),
+      m_height(height),
+      m_padded_height(padded_height),
+      m_pool(std::make_shared<Nv12BufferPool>(width,height,padded_height,std::move(memory_budget))){
+  assert(m_raw_sink);
+  assert(m_nv12_src);
+  m_console->debug("Nv12ConvertStage {}x{} (padded to {}) using {}",width,height,padded_height,nv12convert::simd_name());
+}
+
+Nv12ConvertStage::~Nv12ConvertStage() {
+  stop();
+  gst_object_unref(m_raw_sink);
+  gst_object_unref(m_nv12_src);
+}
+
+void Nv12ConvertStage::start() {
+  if(m_thread){
+    return;
+  }
+  m_run= true;
+  m_thread=std::make_unique<std::thread>(&Nv12ConvertStage::loop_convert, this);
+}
+
+void Nv12ConvertStage::stop() {
+  m_run= false;
+  if(m_thread && m_thread->joinable()){
+    m_thread->join();
+  }
+  m_thread= nullptr;
+}
+
+std::string Nv12ConvertStage::createDebug() {
+  std::lock_guard<std::mutex> guard(m_stats_mutex);
+  std::stringstream ss;
+  const auto avg_us=m_n_frames>0 ? std::chrono::duration_cast<std::chrono::microseconds>(m_convert_time_sum).count()/m_n_frames : 0;
+  ss << "Nv12Convert(" << nv12convert::simd_name() << ") frames:" << m_n_frames << " dropped:" << m_n_dropped_frames
+     << " avg:" << avg_us << "us max:" << std::chrono::duration_cast<std::chrono::microseconds>(m_convert_time_max).count() << "us";
+  m_n_frames=0;
+  m_n_dropped_frames=0;
+  m_convert_time_sum=std::chrono::nanoseconds(0);
+  m_convert_time_max=std::chrono::nanoseconds(0);
+  return ss.str();
+}
+
+void Nv12ConvertStage::loop_convert() {
+  thread_stats::set_current_thread_name("nv12_convert");
+  const uint64_t timeout_ns=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::milliseconds(100)).count();
+  while (m_run){
+    GstSample* sample = gst_app_sink_try_pull_sample(GST_APP_SINK(m_raw_sink),timeout_ns);
+    if (sample) {
+      convert_and_push(sample);
+      gst_sample_unref(sample);
+    }
+  }
+}
+
+void Nv12ConvertStage::convert_and_push(GstSample* sample) {
+  GstBuffer* buffer = gst_sample_get_buffer(sample);
+  GstCaps* caps = gst_sample_get_caps(sample);
+  if(buffer==nullptr || caps==nullptr){
+    return;
+  }
+  const GstStructure* structure=gst_caps_get_structure(caps,0);
+  const gchar* format=gst_structure_get_string(structure,"format");
+  int width=0;
+  int height=0;
+  gst_structure_get_int(structure,"width",&width);
+  gst_structure_get_int(structure,"height",&height);
+  if(format==nullptr || width!=m_width || height!=m_height){
+    warn_once(fmt::format("Unexpected decoder output {} {}x{}, dropping frames",format ? format : "?",width,height));
+    flight_recorder::record(flight_recorder::EventType::RAW_FRAME_DROPPED,0,flight_recorder::to_u32(flight_recorder::DropReason::UNSUPPORTED_FORMAT));
+    std::lock_guard<std::mutex> guard(m_stats_mutex);
+    m_n_dropped_frames++;
+    return;
+  }
+  GstMapInfo map;
+  if(!gst_buffer_map(buffer, &map, GST_MAP_READ)){
+    return;
+  }
+  nv12convert::Nv12Image dst{};
+  GstBuffer* out_buffer=m_pool->acquire(dst);
+  if(out_buffer==nullptr){
+    // over the memory budget, the encoder doesn't keep up
+    gst_buffer_unmap(buffer, &map);
+    flight_recorder::record(flight_recorder::EventType::RAW_FRAME_DROPPED,0,flight_recorder::to_u32(flight_recorder::DropReason::MEMORY_BUDGET));
+    std::lock_guard<std::mutex> guard(m_stats_mutex);
+    m_n_dropped_frames++;
+    return;
+  }
+  const auto begin=std::chrono::steady_clock::now();
+  const bool success=convert(format,map.data,map.size,dst);
+  const auto convert_time=std::chrono::steady_clock::now()-begin;
+  gst_buffer_unmap(buffer, &map);
+  {
+    std::lock_guard<std::mutex> guard(m_stats_mutex);
+    if(success){
+      m_n_frames++;
+      m_convert_time_sum+=convert_time;
+      m_convert_time_max=std::max(m_convert_time_max,std::chrono::duration_cast<std::chrono::nanoseconds>(convert_time));
+    }else{
+      m_n_dropped_frames++;
+    }
+  }
+  if(!success){
+    flight_recorder::record(flight_recorder::EventType::RAW_FRAME_DROPPED,0,flight_recorder::to_u32(flight_recorder::DropReason::UNSUPPORTED_FORMAT));
+    gst_buffer_unref(out_buffer);
+    return;
+  }
+  flight_recorder::record(flight_recorder::EventType::RAW_FRAME_CONVERTED,0,
+                          std::chrono::duration_cast<std::chrono::microseconds>(convert_time).count());
+  GST_BUFFER_PTS(out_buffer)=GST_BUFFER_PTS(buffer);
+  GST_BUFFER_DTS(out_buffer)=GST_BUFFER_DTS(buffer);
+  // takes ownership of the buffer
+  gst_app_src_push_buffer(GST_APP_SRC(m_nv12_src),out_buffer);
+}
+
+bool Nv12ConvertStage::convert(const std::string& format,const uint8_t* data,std::size_t size,const nv12convert::Nv12Image& dst) {
+  // The decoder output has the default gstreamer layout for the format (appsink doesn't support video meta,
+  // so there are no custom strides)
+  const int w=m_width;
+  const int h=m_height;
+  if(format=="I420"){
+    const int y_stride=GST_ROUND_UP_4(w);
+    const int uv_stride=GST_ROUND_UP_4(GST_ROUND_UP_2(w)/2);
+    const std::size_t u_offset=static_cast<std::size_t>(y_stride)*GST_ROUND_UP_2(h);
+    const std::size_t v_offset=u_offset+static_cast<std::size_t>(uv_stride)*(GST_ROUND_UP_2(h)/2);
+    if(size<v_offset+static_cast<std::size_t>(uv_stride)*(GST_ROUND_UP_2(h)/2)){
+      warn_once(fmt::format("I420 buffer too small: {}",size));
+      return false;
+    }
+    nv12convert::i420_to_nv12(data,y_stride,data+u_offset,uv_stride,data+v_offset,uv_stride,dst);
+    return true;
+  }
+  if(format=="Y42B"){
+    const int y_stride=GST_ROUND_UP_4(w);
+    const int uv_stride=GST_ROUND_UP_8(w)/2;
+    const std::size_t u_offset=static_cast<std::size_t>(y_stride)*h;
+    const std::size_t v_offset=u_offset+static_cast<std::size_t>(uv_stride)*h;
+    if(size<v_offset+static_cast<std::size_t>(uv_stride)*h){
+      warn_once(fmt::format("Y42B buffer too small: {}",size));
+      return false;
+    }
+    nv12convert::y42b_to_nv12(data,y_stride,data+u_offset,uv_stride,data+v_offset,uv_stride,dst);
+    return true;
+  }
+  if(format=="YUY2"){
+    const int stride=GST_ROUND_UP_4(w*2);
+    if(size<static_cast<std::size_t>(stride)*h){
+      warn_once(fmt::format("YUY2 buffer too small: {}",size));
+      return false;
+    }
+    nv12convert::yuy2_to_nv12(data,stride,dst);
+    return true;
+  }
+  warn_once("Unsupported decoder output format "+format);
+  return false;
+}
+
+void Nv12ConvertStage::warn_once(const std::string& message) {
+  // called for every frame otherwise
+  if(m_warned){
+    return;
+  }
+  m_warned= true;
+  m_console->warn(message);
+}
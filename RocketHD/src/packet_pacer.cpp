@@ -0,0 +1,150 @@
+#include "packet_pacer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+
+#include "wifi_phy_rates.hpp"
+
+PacketPacer::PacketPacer(PacketPacerOptions options,RadiotapHeader::UserSelectableParams radiotap_params,int fec_percentage,int fec_block_length)
+: m_options(options),
+  m_radiotap_params(radiotap_params),
+  m_fec_percentage(fec_percentage),
+  m_fec_block_length(fec_block_length),
+  m_tokens_us(static_cast<double>(options.bucket_depth.count())),
+  m_last_refill(std::chrono::steady_clock::now()),
+  m_airtime_busy_until(m_last_refill)
+{
+  assert(m_options.max_airtime_utilization>0 && m_options.max_airtime_utilization<=1);
+  assert(m_options.min_fragments_per_release>0);
+}
+
+void PacketPacer::update_radiotap_params(RadiotapHeader::UserSelectableParams radiotap_params) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_radiotap_params=radiotap_params;
+}
+
+void PacketPacer::update_fec_percentage(int fec_percentage) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_fec_percentage=fec_percentage;
+}
+
+void PacketPacer::update_fec_block_length(int fec_block_length) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_fec_block_length=fec_block_length;
+}
+
+uint32_t PacketPacer::get_fragment_airtime_us(std::size_t size) const {
+  return wifi::phyrates::get_airtime_us(size,m_radiotap_params.mcs_index,m_radiotap_params.bandwidth,m_radiotap_params.short_gi);
+}
+
+uint32_t PacketPacer::get_airtime_us(const FrameBlock& block,std::size_t begin,std::size_t end) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  uint32_t ret=0;
+  std::size_t max_fragment_size=0;
+  for(std::size_t i=begin;i<end;i++){
+    const auto size=block.get_fragment(i).size;
+    ret+=get_fragment_airtime_us(size);
+    max_fragment_size=std::max(max_fragment_size,size);
+  }
+  // FEC packets have the size of the biggest fragment in the block
+  const auto n_fec_packets=((end-begin)*m_fec_percentage+99)/100;
+  ret+=n_fec_packets*get_fragment_airtime_us(max_fragment_size);
+  return ret;
+}
+
+std::size_t PacketPacer::get_release_size(const FrameBlock& block,std::size_t begin) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  const auto n_remaining=block.n_fragments()-begin;
+  // fragments (with their share of FEC) that fit into a full bucket
+  const auto bucket_depth_us=static_cast<double>(m_options.bucket_depth.count());
+  double airtime_us=0;
+  std::size_t n_fitting=0;
+  while (n_fitting<n_remaining){
+    airtime_us+=get_fragment_airtime_us(block.get_fragment(begin+n_fitting).size)*(100+m_fec_percentage)/100.0;
+    if(airtime_us>bucket_depth_us){
+      break;
+    }
+    n_fitting++;
+  }
+  std::size_t ret;
+  if(m_fec_block_length>0){
+    const auto fec_block_length=static_cast<std::size_t>(m_fec_block_length);
+    ret=std::max(fec_block_length,n_fitting/fec_block_length*fec_block_length);
+  }else{
+    const auto min_size=static_cast<std::size_t>(m_options.min_fragments_per_release);
+    ret=std::max(min_size,n_fitting);
+    if(n_remaining<ret+min_size){
+      // a short remainder goes along, on its own it would be a weak FEC block
+      ret=n_remaining;
+    }
+  }
+  return std::min(ret,n_remaining);
+}
+
+void PacketPacer::refill(std::chrono::steady_clock::time_point now) {
+  const auto elapsed_us=std::chrono::duration_cast<std::chrono::microseconds>(now-m_last_refill).count();
+  if(elapsed_us<=0){
+    return;
+  }
+  m_last_refill=now;
+  m_tokens_us=std::min(m_tokens_us+elapsed_us*m_options.max_airtime_utilization,static_cast<double>(m_options.bucket_depth.count()));
+}
+
+std::chrono::steady_clock::time_point PacketPacer::get_release_time(uint32_t airtime_us,
+                                                                   std::chrono::steady_clock::time_point block_enqueue_time,
+                                                                   std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  refill(now);
+  if(m_tokens_us>=airtime_us){
+    return now;
+  }
+  const auto wait_us=static_cast<int64_t>((airtime_us-m_tokens_us)/m_options.max_airtime_utilization);
+  const auto release=now+std::chrono::microseconds(wait_us);
+  const auto deadline=block_enqueue_time+m_options.max_added_delay;
+  if(release<=deadline){
+    return std::max(now,release);
+  }
+  // line rate, with at most one bucket of airtime waiting in the driver
+  return std::max({now,deadline,m_airtime_busy_until-m_options.bucket_depth});
+}
+
+void PacketPacer::on_block_sent(uint32_t airtime_us,std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  refill(now);
+  // Can go negative if a part was released because of max_added_delay, or is bigger than the bucket - limit the
+  // debt to one bucket
+  m_tokens_us=std::max(m_tokens_us-airtime_us,-static_cast<double>(m_options.bucket_depth.count()));
+  m_airtime_busy_until=std::max(m_airtime_busy_until,now)+std::chrono::microseconds(airtime_us);
+}
+
+BurstinessMeter::BurstinessMeter(std::chrono::microseconds window_size)
+: m_window_size(window_size){
+}
+
+void BurstinessMeter::add(std::size_t bytes,std::chrono::steady_clock::time_point now) {
+  if(now-m_window_start>=m_window_size){
+    m_max_window_bytes=std::max(m_max_window_bytes,m_curr_window_bytes);
+    m_curr_window_bytes=0;
+    m_window_start=now;
+  }
+  m_curr_window_bytes+=bytes;
+  m_total_bytes+=bytes;
+}
+
+std::string BurstinessMeter::get_summary_and_reset(std::chrono::steady_clock::time_point now) {
+  m_max_window_bytes=std::max(m_max_window_bytes,m_curr_window_bytes);
+  const double interval_s=std::chrono::duration_cast<std::chrono::microseconds>(now-m_interval_start).count()/1000000.0;
+  const double window_s=m_window_size.count()/1000000.0;
+  const double mean_mbits=interval_s>0 ? m_total_bytes*8/interval_s/1000000.0 : 0;
+  const double peak_mbits=m_max_window_bytes*8/window_s/1000000.0;
+  std::stringstream ss;
+  ss.precision(3);
+  ss<<"peak:"<<peak_mbits<<"Mbit/s mean:"<<mean_mbits<<"Mbit/s ratio:"<<(mean_mbits>0 ? peak_mbits/mean_mbits : 0);
+  m_interval_start=now;
+  m_window_start=now;
+  m_curr_window_bytes=0;
+  m_max_window_bytes=0;
+  m_total_bytes=0;
+  return ss.str();
+}
@@ -0,0 +1,57 @@
+#include "parameter_set_cache.hpp"
+#include "rtp_eof_helper.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static constexpr std::size_t RTP_HEADER_SIZE=12;
+// first NALU type of the parameter sets (VPS), the others follow (SPS, PPS)
+static constexpr uint8_t NALU_TYPE_VPS=32;
+
+int H265ParameterSetCache::on_rtp_packet(const uint8_t* payload,std::size_t payloadSize) {
+  return rtp_eof_helper::h265_for_each_parameter_set(payload,payloadSize,[this](uint8_t nalu_type,const uint8_t *nalu,std::size_t nalu_size){
+    auto& parameter_set=m_parameter_sets[nalu_type-NALU_TYPE_VPS];
+    if(parameter_set.size()==nalu_size && std::equal(parameter_set.begin(),parameter_set.end(),nalu)){
+      return;
+    }
+    parameter_set.assign(nalu,nalu+nalu_size);
+    m_n_updates++;
+  });
+}
+
+bool H265ParameterSetCache::is_complete()const {
+  return std::none_of(m_parameter_sets.begin(),m_parameter_sets.end(),[](const auto& parameter_set){return parameter_set.empty();});
+}
+
+std::optional<std::vector<uint8_t>> H265ParameterSetCache::create_rtp_packet(const uint8_t* rtp_packet,std::size_t rtp_packet_size,
+                                                                             uint16_t seq,std::size_t max_size)const {
+  if(!is_complete() || rtp_packet_size<RTP_HEADER_SIZE){
+    return std::nullopt;
+  }
+  std::size_t size=RTP_HEADER_SIZE+2;
+  for(const auto& parameter_set:m_parameter_sets){
+    size+=2+parameter_set.size();
+  }
+  if(size>max_size){
+    return std::nullopt;
+  }
+  std::vector<uint8_t> ret(size);
+  std::memcpy(ret.data(),rtp_packet,RTP_HEADER_SIZE);
+  // version 2, no padding / extension / csrc
+  ret[0]=0x80;
+  // clear the marker bit, keep the payload type
+  ret[1]&=0x7f;
+  ret[2]=static_cast<uint8_t>(seq>>8);
+  ret[3]=static_cast<uint8_t>(seq & 0xff);
+  // aggregation packet header: type 48, layer 0, tid 1 (like the parameter sets)
+  ret[RTP_HEADER_SIZE]=48<<1;
+  ret[RTP_HEADER_SIZE+1]=1;
+  std::size_t offset=RTP_HEADER_SIZE+2;
+  for(const auto& parameter_set:m_parameter_sets){
+    ret[offset]=static_cast<uint8_t>(parameter_set.size()>>8);
+    ret[offset+1]=static_cast<uint8_t>(parameter_set.size() & 0xff);
+    std::memcpy(&ret[offset+2],parameter_set.data(),parameter_set.size());
+    offset+=2+parameter_set.size();
+  }
+  return ret;
+}
@@ -10,38 +10,194 @@
 #include <cstdio>
 #include <ctime>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include "../lib/wifibroadcast/src/HelperSources/SchedulingHelper.hpp"
 #include "../lib/wifibroadcast/src/WBTransmitter.h"
+#include "control_socket.hpp"
+#include "flight_recorder.hpp"
 #include "gstreamerstream.hpp"
+#include "rocket_config.hpp"
+#include "rocket_log.hpp"
+#include "thread_stats.hpp"
+
+// State the control socket works on - the config is always what is applied (or will be applied after a restart)
+struct RocketControl{
+  std::mutex mutex;
+  RocketConfig config;
+  // where "save" writes to, empty if rocket was started without a config file
+  std::string config_path;
+  std::shared_ptr<WBLink> wb_link;
+  GStreamerStream* gstreamerstream;
+  // the last periodic summary (link, camera, per thread cpu)
+  std::string last_stats;
+};
+
+// Apply what changed between before and after to the running link / camera. Keys that need a restart are ignored here.
+static void apply_config_changes(RocketControl& control,const RocketConfig& before,const RocketConfig& after){
+  if(after.radiotap_params.mcs_index!=before.radiotap_params.mcs_index){
+    control.wb_link->update_mcs_index(after.radiotap_params.mcs_index);
+  }
+  if(after.options.tx_fec_options.overhead_percentage!=before.options.tx_fec_options.overhead_percentage){
+    control.wb_link->update_video_fec_percentage(after.options.tx_fec_options.overhead_percentage);
+  }
+  if(after.options.tx_fec_options.fixed_k!=before.options.tx_fec_options.fixed_k){
+    control.wb_link->update_video_fec_block_length(after.options.tx_fec_options.fixed_k);
+  }
+  // The stream decides itself if the encoder can take them live or a new pipeline is needed
+  if(camera_settings_require_restart(before.camera,after.camera) || camera_settings_changed_live(before.camera,after.camera)){
+    control.gstreamerstream->update_settings(after.camera);
+  }
+}
+
+// Requests: "get <key>", "set <key> <value>", "keys", "dump", "save", "stats"
+static std::string handle_control_request(RocketControl& control,const std::string& request){
+  std::stringstream ss(request);
+  std::string command;
+  std::string key;
+  ss>>command>>key;
+  std::string value;
+  std::getline(ss>>std::ws,value);
+  std::lock_guard<std::mutex> guard(control.mutex);
+  try{
+    if(command=="get"){
+      return rocket_config::get_value(control.config,key);
+    }
+    if(command=="set"){
+      const auto mode=rocket_config::get_apply_mode(key);
+      if(!mode.has_value()){
+        return "error: unknown key "+key;
+      }
+      auto config=control.config;
+      rocket_config::set_value(config,key,value);
+      const auto before=control.config;
+      control.config=config;
+      if(mode!=rocket_config::ApplyMode::RESTART){
+        apply_config_changes(control,before,config);
+      }
+      std::string ret="ok "+rocket_config::apply_mode_to_string(mode.value());
+      if(config.enable_link_adaptation && (key=="mcs_index" || key=="fec_percentage" || key=="fec_block_length")){
+        ret+=" (link adaptation continues from it, and falls back to it without feedback)";
+      }
+      return ret;
+    }
+    if(command=="keys"){
+      std::stringstream ret;
+      for(const auto& k:rocket_config::get_keys()){
+        ret<<k<<" "<<rocket_config::apply_mode_to_string(rocket_config::get_apply_mode(k).value())<<"\n";
+      }
+      return ret.str();
+    }
+    if(command=="dump"){
+      return rocket_config::to_string(control.config);
+    }
+    if(command=="save"){
+      if(control.config_path.empty()){
+        return "error: rocket was started without a config file (-c)";
+      }
+      rocket_config::save_file(control.config,control.config_path);
+      return "ok";
+    }
+    if(command=="stats"){
+      return control.last_stats;
+    }
+  }catch (std::runtime_error& e){
+    return std::string("error: ")+e.what();
+  }
+  return "error: unknown command, use get <key> | set <key> <value> | keys | dump | save | stats";
+}
 
 int main(int argc, char *const *argv) {
   int opt;
-  TOptions options{};
-
-  RadiotapHeader::UserSelectableParams wifiParams{20, false, 0, false, 3};
+  std::string config_path;
+  std::string control_socket_path="/tmp/rocket.sock";
+  std::string flight_recorder_prefix="/tmp/rocket_flight";
+  while ((opt = getopt(argc, argv, "c:s:f:")) != -1) {
+    switch (opt) {
+      case 'c':config_path = optarg;
+        break;
+      case 's':control_socket_path = optarg;
+        break;
+      case 'f':flight_recorder_prefix = optarg;
+        break;
+      default: /* '?' */
+        fprintf(stderr,
+                "Usage: %s [-c config_file] [-s control_socket_path] [-f flight_recorder_dump_prefix]\n"
+                "Without a config file, the defaults are used. Print them with: echo dump | nc -U %s\n"
+                "kill -USR1 dumps the flight recorder, decode the dump with rocket_fr_decode\n",
+                argv[0],control_socket_path.c_str());
+        exit(1);
+    }
+  }
   SchedulingHelper::setThreadParamsMaxRealtime();
 
   try {
-    options.wlan = "usb-ac56-1";
-    options.use_block_queue = true;
-    options.radio_port = 60;
-    options.tx_fec_options.overhead_percentage = 50;
-    options.tx_fec_options.fixed_k = 0;
-    std::shared_ptr<WBLink> wb_link  = std::make_shared<WBLink>(wifiParams, options);
-    GStreamerStream gstreamerstream = GStreamerStream(wb_link);
+    // also dumps when the camera watchdog restarts the pipeline
+    FlightRecorderDumper flight_recorder_dumper{flight_recorder_prefix};
+    RocketControl control{};
+    control.config=config_path.empty() ? rocket_config::create_default() : rocket_config::load_file(config_path);
+    control.config_path=config_path;
+    const auto& config=control.config;
+    std::cout << "Config:\n" << rocket_config::to_string(config);
+    std::optional<TelemetryOptions> telemetry_options;
+    if(config.enable_telemetry){
+      telemetry_options=TelemetryOptions{};
+    }
+    // shared by the tx queue and the camera pipeline
+    auto memory_budget=std::make_shared<MemoryBudget>(static_cast<std::size_t>(config.memory_budget_mb)*1024*1024);
+    std::shared_ptr<WBLink> wb_link  = std::make_shared<WBLink>(config.radiotap_params, config.options, telemetry_options,
+                                                                memory_budget);
+    if(config.enable_link_adaptation){
+      // FEC and MCS start at the configured values, then follow the feedback from the ground (rocket_rx -F)
+      wb_link->enable_link_adaptation(LinkAdaptationOptions{});
+    }
+    if(config.enable_latency_probes){
+      // the ground echoes them if it sends link feedback (rocket_rx -F)
+      wb_link->enable_latency_probes(LatencyProbeOptions{});
+    }
+    GStreamerStream gstreamerstream = GStreamerStream(wb_link,config.camera,memory_budget);
+    // Only has an effect while the camera pipeline has the second (simulcast) stream, which can be enabled at run time
+    wb_link->enable_simulcast(SimulcastSelectorOptions{},[&gstreamerstream](int stream_index){
+      gstreamerstream.request_keyframe(stream_index);
+    });
+    if(config.enable_recovery_requests){
+      // with a long gop, a ground unit that lost sync doesn't have to wait for the next regular keyframe
+      wb_link->enable_recovery_requests(RecoveryRequestOptions{},[&gstreamerstream](int stream_index,bool keyframe,bool parameter_sets){
+        if(parameter_sets){
+          gstreamerstream.request_parameter_sets(stream_index);
+        }
+        if(keyframe){
+          gstreamerstream.request_keyframe(stream_index);
+        }
+      });
+    }
     gstreamerstream.setup();
     gstreamerstream.start();
+    control.wb_link=wb_link;
+    control.gstreamerstream=&gstreamerstream;
+    ControlSocket control_socket{control_socket_path,[&control](const std::string& request){
+      return handle_control_request(control,request);
+    }};
+    control_socket.runInBackground();
+    // cycles / cache misses only if perf events are permitted, the rest always works
+    ThreadStatsSampler thread_stats_sampler{};
+    auto stats_console=rocket_log::create_or_get("stats");
     while (true){
       std::this_thread::sleep_for(std::chrono::seconds(1));
-      std::cout << wb_link->createDebug() << std::endl;
-      std::cout << gstreamerstream.createDebug() << std::endl;
+      std::stringstream stats;
+      stats << wb_link->createDebug() << "\n" << gstreamerstream.createDebug() << "\n" << thread_stats_sampler.createDebug();
+      stats_console->info("\n{}",stats.str());
+      std::lock_guard<std::mutex> guard(control.mutex);
+      control.last_stats=stats.str();
     }
   } catch (std::runtime_error &e) {
     fprintf(stderr, "Error: %s\n", e.what());
+    // the async loggers might still have the messages that led to the error queued
+    rocket_log::shutdown();
     exit(1);
   }
   return 0;
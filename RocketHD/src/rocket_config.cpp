@@ -0,0 +1,270 @@
+#include "rocket_config.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+namespace rocket_config{
+
+namespace {
+
+struct Key{
+  const char* name;
+  ApplyMode mode;
+  std::function<std::string(const RocketConfig& config)> get;
+  std::function<void(RocketConfig& config,const std::string& value)> set;
+};
+
+int parse_int(const std::string& value,int min,int max){
+  std::size_t n_parsed=0;
+  int ret;
+  try{
+    ret=std::stoi(value,&n_parsed);
+  }catch (std::exception&){
+    throw std::runtime_error("not a number: "+value);
+  }
+  if(n_parsed!=value.size()){
+    throw std::runtime_error("not a number: "+value);
+  }
+  if(ret<min || ret>max){
+    throw std::runtime_error(value+" out of range ["+std::to_string(min)+","+std::to_string(max)+"]");
+  }
+  return ret;
+}
+
+int parse_int_one_of(const std::string& value,const std::vector<int>& allowed){
+  const int ret=parse_int(value,*std::min_element(allowed.begin(),allowed.end()),*std::max_element(allowed.begin(),allowed.end()));
+  if(std::find(allowed.begin(),allowed.end(),ret)==allowed.end()){
+    std::stringstream ss;
+    ss<<value<<" not one of";
+    for(const auto v:allowed){
+      ss<<" "<<v;
+    }
+    throw std::runtime_error(ss.str());
+  }
+  return ret;
+}
+
+bool parse_bool(const std::string& value){
+  if(value=="true" || value=="1")return true;
+  if(value=="false" || value=="0")return false;
+  throw std::runtime_error("not a bool (true / false): "+value);
+}
+
+std::string bool_to_string(bool value){
+  return value ? "true" : "false";
+}
+
+// For the common case, int / bool fields. field is a generic lambda returning a reference to the member
+template<class F>
+Key int_key(const char* name,ApplyMode mode,int min,int max,F field){
+  return Key{name,mode,
+             [field](const RocketConfig& config){return std::to_string(field(config));},
+             [field,min,max](RocketConfig& config,const std::string& value){field(config)=parse_int(value,min,max);}};
+}
+template<class F>
+Key bool_key(const char* name,ApplyMode mode,F field){
+  return Key{name,mode,
+             [field](const RocketConfig& config){return bool_to_string(field(config));},
+             [field](RocketConfig& config,const std::string& value){field(config)=parse_bool(value);}};
+}
+
+const std::vector<Key>& get_key_table(){
+  static const std::vector<Key> keys{
+      // wifibroadcast link
+      Key{"wlan",ApplyMode::RESTART,
+          [](const RocketConfig& config){return config.options.wlan;},
+          [](RocketConfig& config,const std::string& value){config.options.wlan=value;}},
+      Key{"radio_port",ApplyMode::RESTART,
+          [](const RocketConfig& config){return std::to_string(config.options.radio_port);},
+          [](RocketConfig& config,const std::string& value){config.options.radio_port=parse_int(value,0,255);}},
+      // empty means no keypair
+      Key{"keypair",ApplyMode::RESTART,
+          [](const RocketConfig& config){return config.options.keypair.value_or("");},
+          [](RocketConfig& config,const std::string& value){
+            if(value.empty()){
+              config.options.keypair=std::nullopt;
+            }else{
+              config.options.keypair=value;
+            }
+          }},
+      bool_key("use_block_queue",ApplyMode::RESTART,[](auto& c)->auto&{return c.options.use_block_queue;}),
+      int_key("fec_percentage",ApplyMode::HOT,0,400,[](auto& c)->auto&{return c.options.tx_fec_options.overhead_percentage;}),
+      // 0 means variable (one block per frame)
+      int_key("fec_block_length",ApplyMode::HOT,0,128,[](auto& c)->auto&{return c.options.tx_fec_options.fixed_k;}),
+      // single spatial stream (see wifi_phy_rates.hpp)
+      int_key("mcs_index",ApplyMode::HOT,0,7,[](auto& c)->auto&{return c.radiotap_params.mcs_index;}),
+      // MHz
+      Key{"bandwidth",ApplyMode::RESTART,
+          [](const RocketConfig& config){return std::to_string(config.radiotap_params.bandwidth);},
+          [](RocketConfig& config,const std::string& value){config.radiotap_params.bandwidth=parse_int_one_of(value,{20,40});}},
+      bool_key("short_gi",ApplyMode::RESTART,[](auto& c)->auto&{return c.radiotap_params.short_gi;}),
+      int_key("stbc",ApplyMode::RESTART,0,3,[](auto& c)->auto&{return c.radiotap_params.stbc;}),
+      bool_key("ldpc",ApplyMode::RESTART,[](auto& c)->auto&{return c.radiotap_params.ldpc;}),
+      bool_key("telemetry",ApplyMode::RESTART,[](auto& c)->auto&{return c.enable_telemetry;}),
+      bool_key("link_adaptation",ApplyMode::RESTART,[](auto& c)->auto&{return c.enable_link_adaptation;}),
+      bool_key("latency_probes",ApplyMode::RESTART,[](auto& c)->auto&{return c.enable_latency_probes;}),
+      bool_key("recovery_requests",ApplyMode::RESTART,[](auto& c)->auto&{return c.enable_recovery_requests;}),
+      int_key("memory_budget_mb",ApplyMode::RESTART,16,4096,[](auto& c)->auto&{return c.memory_budget_mb;}),
+      // camera / encoder
+      Key{"source",ApplyMode::PIPELINE_SWAP,
+          [](const RocketConfig& config){return camera_source_to_string(config.camera.source);},
+          [](RocketConfig& config,const std::string& value){config.camera.source=camera_source_from_string(value);}},
+      Key{"test_pattern",ApplyMode::PIPELINE_SWAP,
+          [](const RocketConfig& config){return config.camera.test_pattern;},
+          [](RocketConfig& config,const std::string& value){config.camera.test_pattern=value;}},
+      Key{"file_path",ApplyMode::PIPELINE_SWAP,
+          [](const RocketConfig& config){return config.camera.file_path;},
+          [](RocketConfig& config,const std::string& value){config.camera.file_path=value;}},
+      Key{"encoder",ApplyMode::PIPELINE_SWAP,
+          [](const RocketConfig& config){return video_encoder_to_string(config.camera.encoder);},
+          [](RocketConfig& config,const std::string& value){config.camera.encoder=video_encoder_from_string(value);}},
+      Key{"camera_device",ApplyMode::PIPELINE_SWAP,
+          [](const RocketConfig& config){return config.camera.device;},
+          [](RocketConfig& config,const std::string& value){config.camera.device=value;}},
+      int_key("width",ApplyMode::PIPELINE_SWAP,16,7680,[](auto& c)->auto&{return c.camera.width;}),
+      int_key("height",ApplyMode::PIPELINE_SWAP,16,4320,[](auto& c)->auto&{return c.camera.height;}),
+      int_key("fps",ApplyMode::PIPELINE_SWAP,1,240,[](auto& c)->auto&{return c.camera.fps;}),
+      int_key("rtp_mtu",ApplyMode::HOT,256,static_cast<int>(FEC_MAX_PAYLOAD_SIZE),[](auto& c)->auto&{return c.camera.rtp_mtu;}),
+      // 0 means only with keyframes
+      int_key("parameter_set_interval_ms",ApplyMode::HOT,0,60000,[](auto& c)->auto&{return c.camera.parameter_set_interval_ms;}),
+      int_key("bitrate_kbits",ApplyMode::HOT,100,100000,[](auto& c)->auto&{return c.camera.bitrate_kbits;}),
+      // with the x265 encoder, a change needs a new pipeline
+      int_key("gop_size",ApplyMode::HOT,1,1000,[](auto& c)->auto&{return c.camera.gop_size;}),
+      // false: use videoconvert / videobox instead of Nv12ConvertStage
+      bool_key("simd_convert",ApplyMode::PIPELINE_SWAP,[](auto& c)->auto&{return c.camera.simd_convert;}),
+      // second, low rate encoder (see SimulcastSelector)
+      bool_key("simulcast",ApplyMode::PIPELINE_SWAP,[](auto& c)->auto&{return c.camera.simulcast_enable;}),
+      int_key("simulcast_width",ApplyMode::PIPELINE_SWAP,16,7680,[](auto& c)->auto&{return c.camera.simulcast_width;}),
+      int_key("simulcast_height",ApplyMode::PIPELINE_SWAP,16,4320,[](auto& c)->auto&{return c.camera.simulcast_height;}),
+      int_key("simulcast_bitrate_kbits",ApplyMode::HOT,100,100000,[](auto& c)->auto&{return c.camera.simulcast_bitrate_kbits;}),
+  };
+  return keys;
+}
+
+const Key& find_key_or_throw(const std::string& key){
+  const auto& keys=get_key_table();
+  const auto it=std::find_if(keys.begin(),keys.end(),[&key](const Key& k){return key==k.name;});
+  if(it==keys.end()){
+    throw std::runtime_error("unknown key: "+key);
+  }
+  return *it;
+}
+
+std::string trim(const std::string& s){
+  const auto begin=s.find_first_not_of(" \t\r");
+  if(begin==std::string::npos){
+    return "";
+  }
+  const auto end=s.find_last_not_of(" \t\r");
+  return s.substr(begin,end-begin+1);
+}
+
+}
+
+std::string apply_mode_to_string(ApplyMode mode) {
+  switch (mode) {
+    case ApplyMode::HOT:return "hot";
+    case ApplyMode::PIPELINE_SWAP:return "pipeline-swap";
+    case ApplyMode::RESTART:return "restart-required";
+  }
+  return "unknown";
+}
+
+RocketConfig create_default() {
+  RocketConfig config{};
+  config.options.wlan = "usb-ac56-1";
+  config.options.use_block_queue = true;
+  config.options.radio_port = 60;
+  config.options.tx_fec_options.overhead_percentage = 50;
+  config.options.tx_fec_options.fixed_k = 0;
+  config.radiotap_params=RadiotapHeader::UserSelectableParams{20, false, 0, false, 3};
+  return config;
+}
+
+RocketConfig load_file(const std::string& path) {
+  std::ifstream file(path);
+  if(!file.is_open()){
+    throw std::runtime_error("Cannot open config file "+path);
+  }
+  auto config=create_default();
+  std::string line;
+  int line_number=0;
+  while (std::getline(file,line)){
+    line_number++;
+    const auto comment=line.find('#');
+    if(comment!=std::string::npos){
+      line.resize(comment);
+    }
+    line=trim(line);
+    if(line.empty()){
+      continue;
+    }
+    const auto separator=line.find('=');
+    if(separator==std::string::npos){
+      throw std::runtime_error(path+":"+std::to_string(line_number)+": expected key=value");
+    }
+    try{
+      set_value(config,trim(line.substr(0,separator)),trim(line.substr(separator+1)));
+    }catch (std::runtime_error& e){
+      throw std::runtime_error(path+":"+std::to_string(line_number)+": "+e.what());
+    }
+  }
+  return config;
+}
+
+void save_file(const RocketConfig& config,const std::string& path) {
+  // write to a temporary file first, such that a crash never leaves a half written config behind
+  const auto tmp_path=path+".tmp";
+  {
+    std::ofstream file(tmp_path,std::ios::trunc);
+    if(!file.is_open()){
+      throw std::runtime_error("Cannot write config file "+tmp_path);
+    }
+    file<<to_string(config);
+    if(!file.good()){
+      throw std::runtime_error("Cannot write config file "+tmp_path);
+    }
+  }
+  if(std::rename(tmp_path.c_str(),path.c_str())!=0){
+    throw std::runtime_error("Cannot replace config file "+path);
+  }
+}
+
+std::string to_string(const RocketConfig& config) {
+  std::stringstream ss;
+  for(const auto& key:get_key_table()){
+    ss<<key.name<<"="<<key.get(config)<<"  # "<<apply_mode_to_string(key.mode)<<"\n";
+  }
+  return ss.str();
+}
+
+std::optional<ApplyMode> get_apply_mode(const std::string& key) {
+  const auto& keys=get_key_table();
+  const auto it=std::find_if(keys.begin(),keys.end(),[&key](const Key& k){return key==k.name;});
+  if(it==keys.end()){
+    return std::nullopt;
+  }
+  return it->mode;
+}
+
+std::vector<std::string> get_keys() {
+  std::vector<std::string> ret;
+  for(const auto& key:get_key_table()){
+    ret.emplace_back(key.name);
+  }
+  return ret;
+}
+
+void set_value(RocketConfig& config,const std::string& key,const std::string& value) {
+  find_key_or_throw(key).set(config,value);
+}
+
+std::string get_value(const RocketConfig& config,const std::string& key) {
+  return find_key_or_throw(key).get(config);
+}
+
+}
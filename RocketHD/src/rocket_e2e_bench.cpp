@@ -0,0 +1,257 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../lib/wifibroadcast/src/HelperSources/SocketHelper.hpp"
+#include "gstreamerstream.hpp"
+#include "latency_probe.hpp"
+#include "rocket_log.hpp"
+#include "thread_stats.hpp"
+#include "wb_link.hpp"
+
+// End to end benchmark of the air unit video path without the air unit hardware:
+// source (test pattern / file / camera) -> decoder -> conversion -> encoder -> rtp -> appsink -> frame assembly
+// -> WBLink (simulcast selection, tx scheduler, pacer) in loopback mode, which sends the video as udp to localhost
+// instead of injecting it. The bench receives that, and (-u) forwards the rtp packets to another port, e.g. to look
+// at the stream with
+// gst-launch-1.0 udpsrc port=5600 ! application/x-rtp,encoding-name=H265 ! rtph265depay ! avdec_h265 ! autovideosink
+// Every transmitted frame carries a latency probe, which gives the latency per stage: capture -> frame closed,
+// frame closed -> handed to the transmitter (tx queue, pacing), transmitter -> received.
+// Also reports sustained fps, Mbit/s, the conversion time and the cpu usage of each thread
+// (the gstreamer streaming threads are named after their source pad, e.g. queue0:src).
+
+// What arrives at the end of the pipeline, for one stream
+struct OutputStats{
+  int n_frames=0;
+  int n_keyframes=0;
+  uint64_t n_bytes=0;
+  // capture -> frame out, only frames with a capture time
+  std::vector<int64_t> latencies_us;
+  void add(const OutputStats& other){
+    n_frames+=other.n_frames;
+    n_keyframes+=other.n_keyframes;
+    n_bytes+=other.n_bytes;
+    latencies_us.insert(latencies_us.end(),other.latencies_us.begin(),other.latencies_us.end());
+  }
+};
+
+// What arrives from the WBLink, the latencies are taken from the probes
+struct LinkStats{
+  int n_probes=0;
+  uint64_t n_packets=0;
+  uint64_t n_bytes=0;
+  // capture -> frame closed, only frames with a capture time
+  std::vector<int64_t> capture_to_close_us;
+  // frame closed -> handed to the transmitter
+  std::vector<int64_t> close_to_tx_us;
+  // handed to the transmitter -> received by the bench
+  std::vector<int64_t> tx_to_receive_us;
+  void add(const LinkStats& other){
+    n_probes+=other.n_probes;
+    n_packets+=other.n_packets;
+    n_bytes+=other.n_bytes;
+    capture_to_close_us.insert(capture_to_close_us.end(),other.capture_to_close_us.begin(),other.capture_to_close_us.end());
+    close_to_tx_us.insert(close_to_tx_us.end(),other.close_to_tx_us.begin(),other.close_to_tx_us.end());
+    tx_to_receive_us.insert(tx_to_receive_us.end(),other.tx_to_receive_us.begin(),other.tx_to_receive_us.end());
+  }
+};
+
+static double percentile_ms(std::vector<int64_t>& values_us,double p){
+  if(values_us.empty())return 0.0;
+  std::sort(values_us.begin(),values_us.end());
+  const auto index=std::min(values_us.size()-1,static_cast<std::size_t>(p*static_cast<double>(values_us.size())));
+  return static_cast<double>(values_us[index])/1000.0;
+}
+
+static std::string latencies_to_string(std::vector<int64_t> values_us){
+  return fmt::format("median:{:.1f}ms p99:{:.1f}ms max:{:.1f}ms",percentile_ms(values_us,0.5),percentile_ms(values_us,0.99),
+                     percentile_ms(values_us,1.0));
+}
+
+static std::string output_stats_to_string(OutputStats stats,double elapsed_s){
+  return fmt::format("fps:{:.1f} Mbit/s:{:.2f} keyframes:{} latency capture->out {}",
+                     stats.n_frames/elapsed_s,static_cast<double>(stats.n_bytes)*8/1e6/elapsed_s,stats.n_keyframes,
+                     latencies_to_string(stats.latencies_us));
+}
+
+static std::string link_stats_to_string(LinkStats stats,double elapsed_s){
+  std::stringstream ss;
+  ss << fmt::format("Link fps:{:.1f} Mbit/s:{:.2f} packets:{}\n",stats.n_probes/elapsed_s,
+                    static_cast<double>(stats.n_bytes)*8/1e6/elapsed_s,stats.n_packets);
+  ss << "  capture->close " << latencies_to_string(stats.capture_to_close_us) << "\n";
+  ss << "  close->tx      " << latencies_to_string(stats.close_to_tx_us) << "\n";
+  ss << "  tx->receive    " << latencies_to_string(stats.tx_to_receive_us);
+  return ss.str();
+}
+
+int main(int argc, char *const *argv) {
+  int opt;
+  CameraSettings settings{};
+  std::string source="test";
+  std::string encoder="x265";
+  int duration_s=10;
+  int udp_port=-1;
+  int loopback_udp_port=5610;
+  while ((opt = getopt(argc, argv, "s:p:i:e:w:h:f:b:g:t:u:l:nS")) != -1) {
+    switch (opt) {
+      case 's':source = optarg;
+        break;
+      case 'p':settings.test_pattern = optarg;
+        break;
+      case 'i':settings.file_path = optarg;
+        break;
+      case 'e':encoder = optarg;
+        break;
+      case 'w':settings.width = std::stoi(optarg);
+        break;
+      case 'h':settings.height = std::stoi(optarg);
+        break;
+      case 'f':settings.fps = std::stoi(optarg);
+        break;
+      case 'b':settings.bitrate_kbits = std::stoi(optarg);
+        break;
+      case 'g':settings.gop_size = std::stoi(optarg);
+        break;
+      case 't':duration_s = std::stoi(optarg);
+        break;
+      case 'u':udp_port = std::stoi(optarg);
+        break;
+      case 'l':loopback_udp_port = std::stoi(optarg);
+        break;
+      case 'n':settings.simd_convert = false;
+        break;
+      case 'S':settings.simulcast_enable = true;
+        break;
+      default: /* '?' */
+        fprintf(stderr,
+                "Usage: %s [-s v4l2|test|file_mjpeg|file_h265] [-p test_pattern] [-i file] [-e mpp|x265]\n"
+                "[-w width] [-h height] [-f fps] [-b bitrate_kbits] [-g gop_size] [-t duration_s]\n"
+                "[-u forward the rtp stream to this udp port on localhost] [-l loopback_udp_port] [-n no simd_convert] [-S simulcast]\n"
+                "Defaults: test pattern, x265, 1920x1080@30, 10s, loopback on udp port 5610 (and the feedback port 5611)\n",
+                argv[0]);
+        exit(1);
+    }
+  }
+  auto console=rocket_log::create_or_get("e2e_bench");
+  std::unique_ptr<SocketHelper::UDPForwarder> forwarder;
+  if(udp_port>0){
+    forwarder=std::make_unique<SocketHelper::UDPForwarder>(SocketHelper::ADDRESS_LOCALHOST,udp_port);
+  }
+  std::mutex stats_mutex;
+  std::array<OutputStats,GStreamerStream::MAX_N_STREAMS> interval_stats{};
+  LinkStats interval_link_stats{};
+  // what the WBLink transmits, the same receive path as rocket_rx -l (without the reassembly)
+  SocketHelper::UDPReceiver loopback_receiver{SocketHelper::ADDRESS_LOCALHOST,loopback_udp_port,
+      [&](const uint8_t *payload,const std::size_t payloadSize){
+        const auto now_us=LatencyEstimator::get_steady_us();
+        const auto probe=latency_probe::parse(payload,payloadSize);
+        if(!probe.has_value() && forwarder){
+          forwarder->forwardPacketViaUDP(payload,payloadSize);
+        }
+        std::lock_guard<std::mutex> guard(stats_mutex);
+        interval_link_stats.n_packets++;
+        interval_link_stats.n_bytes+=payloadSize;
+        if(!probe.has_value() || probe->type!=latency_probe::Type::PROBE){
+          return;
+        }
+        interval_link_stats.n_probes++;
+        // all stages run in this process, on the same clock
+        if(probe->air_capture_us>0){
+          interval_link_stats.capture_to_close_us.push_back(static_cast<int64_t>(probe->air_send_us)-static_cast<int64_t>(probe->air_capture_us));
+        }
+        interval_link_stats.close_to_tx_us.push_back(static_cast<int64_t>(probe->air_tx_us)-static_cast<int64_t>(probe->air_send_us));
+        interval_link_stats.tx_to_receive_us.push_back(static_cast<int64_t>(now_us)-static_cast<int64_t>(probe->air_tx_us));
+      }};
+  loopback_receiver.runInBackground();
+  try {
+    settings.source=camera_source_from_string(source);
+    settings.encoder=video_encoder_from_string(encoder);
+    auto memory_budget=std::make_shared<MemoryBudget>();
+    TOptions options{};
+    auto wb_link=std::make_shared<WBLink>(RadiotapHeader::UserSelectableParams{},options,loopback_udp_port,memory_budget);
+    // a probe with every transmitted frame. Nobody echoes them, the bench reads them directly.
+    LatencyProbeOptions probe_options{};
+    probe_options.probe_interval=std::chrono::milliseconds(0);
+    probe_options.feedback_udp_port=loopback_udp_port+1;
+    wb_link->enable_latency_probes(probe_options);
+    GStreamerStream stream{wb_link,settings,memory_budget};
+    stream.set_frame_output_cb([&](const FrameBlock& frame,int stream_index,bool is_keyframe,uint64_t capture_time_us){
+      const auto now_us=std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+      std::lock_guard<std::mutex> guard(stats_mutex);
+      auto& stats=interval_stats[stream_index];
+      stats.n_frames++;
+      stats.n_keyframes+=is_keyframe ? 1 : 0;
+      stats.n_bytes+=frame.n_bytes();
+      if(capture_time_us>0){
+        stats.latencies_us.push_back(static_cast<int64_t>(now_us)-static_cast<int64_t>(capture_time_us));
+      }
+    });
+    stream.setup();
+    stream.start();
+    ThreadStatsSampler thread_stats_sampler{};
+    // the first second includes plugin loading / encoder startup
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    thread_stats_sampler.sample();
+    {
+      std::lock_guard<std::mutex> guard(stats_mutex);
+      interval_stats={};
+      interval_link_stats={};
+    }
+    std::array<OutputStats,GStreamerStream::MAX_N_STREAMS> total_stats{};
+    LinkStats total_link_stats{};
+    double total_cpu_percent=0;
+    const auto begin=std::chrono::steady_clock::now();
+    for(int i=0;i<duration_s;i++){
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      std::array<OutputStats,GStreamerStream::MAX_N_STREAMS> stats{};
+      LinkStats link_stats{};
+      {
+        std::lock_guard<std::mutex> guard(stats_mutex);
+        std::swap(stats,interval_stats);
+        std::swap(link_stats,interval_link_stats);
+      }
+      std::stringstream ss;
+      for(int stream_index=0;stream_index<(settings.simulcast_enable ? 2 : 1);stream_index++){
+        ss << "Stream " << stream_index << " " << output_stats_to_string(stats[stream_index],1.0) << "\n";
+        total_stats[stream_index].add(stats[stream_index]);
+      }
+      ss << link_stats_to_string(link_stats,1.0) << "\n";
+      total_link_stats.add(link_stats);
+      ss << stream.createDebug() << "\n";
+      ss << wb_link->createDebug();
+      const auto threads=thread_stats_sampler.sample();
+      for(const auto& thread:threads){
+        total_cpu_percent+=thread.cpu_percent;
+      }
+      ss << thread_stats_sampler.to_string(threads);
+      console->info("\n{}",ss.str());
+    }
+    const double elapsed_s=std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+    stream.stop();
+    stream.cleanup_pipe();
+    fprintf(stdout,"%s %s %dx%d@%d %dkbit/s, %.1fs:\n",camera_source_to_string(settings.source).c_str(),
+            video_encoder_to_string(settings.encoder).c_str(),settings.width,settings.height,settings.fps,settings.bitrate_kbits,elapsed_s);
+    for(int stream_index=0;stream_index<(settings.simulcast_enable ? 2 : 1);stream_index++){
+      fprintf(stdout,"Stream %d %s\n",stream_index,output_stats_to_string(total_stats[stream_index],elapsed_s).c_str());
+    }
+    fprintf(stdout,"%s\n",link_stats_to_string(total_link_stats,elapsed_s).c_str());
+    fprintf(stdout,"cpu (all threads, 100%% = one core): %.1f%%\n",total_cpu_percent/std::max(duration_s,1));
+  } catch (std::runtime_error &e) {
+    fprintf(stderr, "Error: %s\n", e.what());
+    loopback_receiver.stopBackground();
+    rocket_log::shutdown();
+    exit(1);
+  }
+  loopback_receiver.stopBackground();
+  rocket_log::shutdown();
+  return 0;
+}
@@ -0,0 +1,52 @@
+#include "rocket_log.hpp"
+
+#include <spdlog/async.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include <cstdlib>
+#include <mutex>
+
+namespace rocket_log{
+
+// messages, not bytes - a burst bigger than that overwrites the oldest messages
+static constexpr std::size_t ASYNC_QUEUE_SIZE=8192;
+
+spdlog::level::level_enum get_default_level() {
+  const char* env=std::getenv("ROCKET_LOG_LEVEL");
+  if(env!=nullptr){
+    const auto level=spdlog::level::from_str(env);
+    // from_str returns off for anything it doesn't know
+    if(level!=spdlog::level::off || std::string(env)=="off"){
+      return level;
+    }
+  }
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+  return spdlog::level::debug;
+#else
+  return spdlog::level::info;
+#endif
+}
+
+std::shared_ptr<spdlog::logger> create_or_get(const std::string& name) {
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> guard(mutex);
+  auto ret=spdlog::get(name);
+  if(ret){
+    return ret;
+  }
+  static std::once_flag thread_pool_once;
+  std::call_once(thread_pool_once,[](){
+    spdlog::init_thread_pool(ASYNC_QUEUE_SIZE,1);
+  });
+  ret=spdlog::create_async_nb<spdlog::sinks::stdout_color_sink_mt>(name);
+  ret->set_level(get_default_level());
+  // errors are written out right away (still by the background thread)
+  ret->flush_on(spdlog::level::err);
+  return ret;
+}
+
+void shutdown() {
+  spdlog::shutdown();
+}
+
+}
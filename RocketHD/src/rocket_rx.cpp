@@ -0,0 +1,395 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../lib/wifibroadcast/src/HelperSources/SchedulingHelper.hpp"
+#include "../lib/wifibroadcast/src/HelperSources/SocketHelper.hpp"
+#include "../lib/wifibroadcast/src/UdpWBReceiver.hpp"
+#include "frame_reassembler.hpp"
+#include "latency_probe.hpp"
+#include "link_adaptation.hpp"
+#include "link_feedback.hpp"
+#include "rocket_log.hpp"
+#include "rtp_eof_helper.hpp"
+#include "shm_frame_ring.hpp"
+#include "telemetry_options.hpp"
+
+// Ground side counterpart of rocket / wfb_tx:
+// receive (wifibroadcast, FEC decoded by the WBReceiver) -> reassemble frames -> forward to the decoder (udp or shm)
+// With -l the wifi cards are replaced by a udp port, to test end to end against wfb_tx -l (see UDPLoopbackTransmitter,
+// no FEC). hwsim_loopback.sh runs both with the real wifibroadcast path on two virtual radios instead.
+// Latency probes in the video stream (see latency_probe.hpp) are not forwarded, but echoed back over the feedback path.
+// Until the decoder can decode (it has the parameter sets and got a keyframe after the last lost reference frame),
+// the air unit is asked for a keyframe / the parameter sets over the feedback path, such that the GOP can be long.
+
+// The first request goes out right away, then it is repeated with a doubling interval until the decoder can decode
+// again - a keyframe that doesn't make it (e.g. on a bad link, where it is the biggest frame) must not turn into a
+// keyframe storm that eats the bitrate of all following frames. Back to the min. interval once a keyframe arrived.
+static constexpr auto RECOVERY_REQUEST_MIN_INTERVAL=std::chrono::milliseconds(200);
+static constexpr auto RECOVERY_REQUEST_MAX_INTERVAL=std::chrono::milliseconds(3200);
+// A lost non-reference frame doesn't need a keyframe (nothing is predicted from it), unless this many frames in a row
+// are lost / incomplete
+static constexpr int MAX_CONSECUTIVE_INCOMPLETE_FRAMES=2;
+
+// False only if the packets that arrived of the frame show a non-reference picture - if none of its slices arrived,
+// it might have been anything. A frame that is lost as a whole shows up as packets missing before the next frame, that
+// one's slice type says nothing about the lost one (see FrameTimestampTracker).
+static bool is_reference_frame(const FrameReassembler::FRAME_FRAGMENTS& frame_fragments){
+  for(const auto& fragment:frame_fragments){
+    const auto type=rtp_eof_helper::h265_get_slice_nalu_type(fragment->data(),fragment->size());
+    if(type.has_value()){
+      return !rtp_eof_helper::h265_is_non_reference_nalu_type(type.value());
+    }
+  }
+  return true;
+}
+
+// Follows the rtp timestamps of the frames that come out of the reassembler (in order, complete or not), to tell
+// packets lost within a frame from frames lost as a whole.
+class FrameTimestampTracker{
+ public:
+  // Returns true if the frame starts a new stream (SSRC changed, e.g. the air unit was restarted)
+  bool on_frame(const FrameReassembler::FRAME_FRAGMENTS& frame_fragments,bool complete){
+    const auto& packet=*frame_fragments.front();
+    const uint32_t ssrc=read_u32(packet.data()+8);
+    const uint32_t timestamp=read_u32(packet.data()+4);
+    const bool new_stream=m_ssrc.has_value() && ssrc!=m_ssrc.value();
+    m_frames_skipped=true;
+    if(!m_ssrc.has_value() || new_stream){
+      m_frame_interval=0;
+    }else{
+      const uint32_t delta=timestamp-m_timestamp;
+      if(complete){
+        // nothing missing in between (all sequence numbers since the previous frame arrived)
+        m_frame_interval=delta;
+      }
+      m_frames_skipped=m_frame_interval==0 || delta>m_frame_interval+m_frame_interval/2;
+    }
+    m_ssrc=ssrc;
+    m_timestamp=timestamp;
+    return new_stream;
+  }
+  // If whole frames were lost between the previous and the last frame. True if unknown (no frame interval yet).
+  [[nodiscard]] bool frames_skipped()const{return m_frames_skipped;}
+ private:
+  std::optional<uint32_t> m_ssrc;
+  uint32_t m_timestamp=0;
+  // rtp timestamp difference of two consecutive frames, 0 if unknown
+  uint32_t m_frame_interval=0;
+  bool m_frames_skipped=false;
+  static uint32_t read_u32(const uint8_t* data){
+    return (static_cast<uint32_t>(data[0])<<24) | (static_cast<uint32_t>(data[1])<<16) | (static_cast<uint32_t>(data[2])<<8) | data[3];
+  }
+};
+
+static std::string wb_rx_block_stats(WBReceiver& wb_receiver){
+  std::stringstream ss;
+  const auto stats=wb_receiver.get_latest_stats();
+  ss<<"WBRx: packets:"<<stats.wb_rx_stats.count_p_all<<" lost:"<<stats.wb_rx_stats.count_p_lost
+     <<" rssi:"<<static_cast<int>(stats.rssi_for_wifi_card[0].last_rssi);
+  if(stats.fec_rx_stats.has_value()){
+    const auto& fec_stats=stats.fec_rx_stats.value();
+    ss<<" blocks:"<<fec_stats.count_blocks_total<<" lost:"<<fec_stats.count_blocks_lost
+       <<" recovered:"<<fec_stats.count_blocks_recovered<<" fragments recovered:"<<fec_stats.count_fragments_recovered;
+  }
+  return ss.str();
+}
+
+// Cumulative counters for the air unit (see LinkAdaptationController). In loopback mode, there are no wb stats -
+// the rtp packet loss is reported as the raw loss.
+static link_feedback::LinkFeedbackMessage create_link_feedback(WBReceiver* wb_receiver,FrameReassembler& reassembler,uint32_t sequence){
+  link_feedback::LinkFeedbackMessage message{};
+  message.sequence=sequence;
+  message.timestamp_us=std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  const auto reassembler_stats=reassembler.get_stats();
+  message.n_residual_packets=reassembler_stats.n_packets;
+  message.n_residual_packets_lost=reassembler_stats.n_packets_lost;
+  if(wb_receiver){
+    const auto stats=wb_receiver->get_latest_stats();
+    message.rssi_dbm=stats.rssi_for_wifi_card[0].last_rssi;
+    message.n_packets_received=stats.wb_rx_stats.count_p_all;
+    message.n_packets_lost=stats.wb_rx_stats.count_p_lost;
+    if(stats.fec_rx_stats.has_value()){
+      const auto& fec_stats=stats.fec_rx_stats.value();
+      message.n_blocks_total=fec_stats.count_blocks_total;
+      message.n_blocks_lost=fec_stats.count_blocks_lost;
+      message.n_blocks_recovered=fec_stats.count_blocks_recovered;
+      message.n_fragments_recovered=fec_stats.count_fragments_recovered;
+    }
+  }else{
+    message.n_packets_received=reassembler_stats.n_packets;
+    message.n_packets_lost=reassembler_stats.n_packets_lost;
+  }
+  return message;
+}
+
+int main(int argc, char *const *argv) {
+  int opt;
+  ROptions options{};
+  options.radio_port = 60;
+  // output UDP port (decoder)
+  int udp_port = 5600;
+  // if set, frames are written into the shared memory frame ring with this name instead of udp
+  std::string shm_name;
+  // if set, input is read from this UDP port instead of the wifi card(s)
+  int loopback_udp_port = -1;
+  FrameReassemblerOptions reassembler_options{};
+  // link feedback for the air unit - via udp (localhost) to this port, or via wifibroadcast on the feedback radio port
+  int feedback_udp_port = -1;
+  bool feedback_via_wb = false;
+  const int feedback_radio_port = LinkAdaptationOptions{}.feedback_radio_port;
+  // ground side of the bidirectional telemetry link (needs a wifi card)
+  bool enable_telemetry = false;
+  // keyframe / parameter set requests, if there is a feedback path
+  bool enable_recovery_requests = true;
+
+  while ((opt = getopt(argc, argv, "K:r:u:s:l:w:df:FTk")) != -1) {
+    switch (opt) {
+      case 'K':options.keypair = optarg;
+        break;
+      case 'r':options.radio_port = std::stoi(optarg);
+        break;
+      case 'u':udp_port = std::stoi(optarg);
+        break;
+      case 's':shm_name = optarg;
+        break;
+      case 'l':loopback_udp_port = std::stoi(optarg);
+        break;
+      case 'w':reassembler_options.reorder_window = std::chrono::milliseconds(std::stoi(optarg));
+        break;
+      case 'd':reassembler_options.forward_incomplete_frames = false;
+        break;
+      case 'f':feedback_udp_port = std::stoi(optarg);
+        break;
+      case 'F':feedback_via_wb = true;
+        break;
+      case 'T':enable_telemetry = true;
+        break;
+      case 'k':enable_recovery_requests = false;
+        break;
+      default: /* '?' */
+      show_usage:
+        fprintf(stderr,
+                "Usage: %s [-K rx_key] [-r radio_port] [-u udp_port] [-s shm_name] [-l loopback_udp_port] [-w reorder_window_ms] [-d drop incomplete frames] [-f feedback_udp_port] [-F feedback via wb] [-T telemetry] [-k no keyframe requests] interface1 [interface2] ...\n",
+                argv[0]);
+        exit(1);
+    }
+  }
+  if (loopback_udp_port>=0 && (feedback_via_wb || enable_telemetry)) {
+    fprintf(stderr, "Error: -F and -T need a wifi card, in loopback mode (-l) use -f for the feedback\n");
+    exit(1);
+  }
+  if (loopback_udp_port<0) {
+    if(optind >= argc){
+      goto show_usage;
+    }
+    for(int i=optind;i<argc;i++){
+      options.rxInterfaces.emplace_back(argv[i]);
+    }
+  }
+  SchedulingHelper::setThreadParamsMaxRealtime();
+
+  try {
+    std::unique_ptr<SocketHelper::UDPForwarder> udp_forwarder;
+    std::unique_ptr<ShmFrameRingProducer> shm_producer;
+    if(!shm_name.empty()){
+      shm_producer=std::make_unique<ShmFrameRingProducer>(shm_name);
+    }else{
+      udp_forwarder=std::make_unique<SocketHelper::UDPForwarder>(SocketHelper::ADDRESS_LOCALHOST,udp_port);
+    }
+    // what the decoder is missing, written by the reassembler callback
+    std::atomic<bool> need_keyframe{true};
+    std::atomic<bool> have_parameter_sets{false};
+    // the reassembler callbacks are never called concurrently
+    int n_consecutive_incomplete_frames=0;
+    std::atomic<uint64_t> n_non_reference_losses{0};
+    FrameTimestampTracker timestamp_tracker;
+    // The parameter sets of the old stream don't apply to a new one (air unit restarted)
+    auto on_frame=[&](const FrameReassembler::FRAME_FRAGMENTS& frame_fragments,bool complete){
+      if(timestamp_tracker.on_frame(frame_fragments,complete)){
+        have_parameter_sets=false;
+      }
+    };
+    auto on_frame_loss=[&](const FrameReassembler::FRAME_FRAGMENTS& frame_fragments){
+      n_consecutive_incomplete_frames++;
+      if(timestamp_tracker.frames_skipped() || is_reference_frame(frame_fragments) ||
+         n_consecutive_incomplete_frames>=MAX_CONSECUTIVE_INCOMPLETE_FRAMES){
+        // the decoder shows errors until the next keyframe
+        need_keyframe=true;
+      }else{
+        n_non_reference_losses++;
+      }
+    };
+    auto on_frame_dropped=[&](const FrameReassembler::FRAME_FRAGMENTS& frame_fragments){
+      on_frame(frame_fragments,false);
+      on_frame_loss(frame_fragments);
+    };
+    FrameReassembler reassembler{reassembler_options,[&](const FrameReassembler::FRAME_FRAGMENTS& frame_fragments,bool complete){
+      on_frame(frame_fragments,complete);
+      bool is_keyframe=false;
+      bool has_parameter_sets=false;
+      for(const auto& fragment:frame_fragments){
+        // in front of the slices
+        if(rtp_eof_helper::h265_for_each_parameter_set(fragment->data(),fragment->size(),[](uint8_t,const uint8_t*,std::size_t){})>0){
+          has_parameter_sets=true;
+        }
+        if(rtp_eof_helper::h265_is_keyframe(fragment->data(),fragment->size())){
+          is_keyframe=true;
+          break;
+        }
+      }
+      if(has_parameter_sets){
+        have_parameter_sets=true;
+      }else if(is_keyframe){
+        // The air unit sends them with every keyframe (config-interval=-1) - they were lost, and after a swap (new
+        // resolution, simulcast switch) the decoder doesn't have the ones of the new stream
+        have_parameter_sets=false;
+      }
+      if(!complete){
+        // lost packets (of this or a previous frame)
+        on_frame_loss(frame_fragments);
+      }else{
+        n_consecutive_incomplete_frames=0;
+        if(is_keyframe){
+          need_keyframe=false;
+        }
+      }
+      for(std::size_t i=0;i<frame_fragments.size();i++){
+        const auto& fragment=frame_fragments[i];
+        if(shm_producer){
+          shm_producer->write_fragment(fragment->data(),fragment->size(),i==frame_fragments.size()-1);
+        }else{
+          udp_forwarder->forwardPacketViaUDP(fragment->data(),fragment->size());
+        }
+      }
+    },on_frame_dropped};
+    std::unique_ptr<SocketHelper::UDPForwarder> feedback_udp_tx;
+    std::unique_ptr<WBTransmitter> feedback_wb_tx;
+    if(feedback_udp_port>=0){
+      feedback_udp_tx=std::make_unique<SocketHelper::UDPForwarder>(SocketHelper::ADDRESS_LOCALHOST,feedback_udp_port);
+    }else if(feedback_via_wb && !options.rxInterfaces.empty()){
+      TOptions feedback_options{};
+      feedback_options.radio_port=feedback_radio_port;
+      feedback_options.keypair=options.keypair;
+      feedback_options.wlan=options.rxInterfaces[0];
+      feedback_options.enable_fec= false;
+      // most robust mcs, the reports are tiny
+      feedback_wb_tx=std::make_unique<WBTransmitter>(RadiotapHeader::UserSelectableParams{20, false, 0, false, 0},feedback_options);
+    }
+    auto send_feedback=[&feedback_udp_tx,&feedback_wb_tx](const std::vector<uint8_t>& message){
+      if(feedback_udp_tx){
+        feedback_udp_tx->forwardPacketViaUDP(message.data(),message.size());
+      }else if(feedback_wb_tx){
+        feedback_wb_tx->try_enqueue_packet(std::make_shared<std::vector<uint8_t>>(message));
+      }
+    };
+    std::atomic<uint64_t> n_latency_probes{0};
+    auto on_packet=[&reassembler,&send_feedback,&n_latency_probes](const uint8_t *payload,const std::size_t payloadSize){
+      auto probe=latency_probe::parse(payload,payloadSize);
+      if(probe.has_value()){
+        if(probe->type!=latency_probe::Type::PROBE){
+          return;
+        }
+        probe->ground_receive_us=std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        probe->type=latency_probe::Type::ECHO;
+        n_latency_probes++;
+        // echoed right away, the time in between is subtracted from the round trip time anyway
+        probe->ground_send_us=std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        send_feedback(latency_probe::serialize(probe.value()));
+        return;
+      }
+      reassembler.on_new_packet(payload,payloadSize);
+    };
+    std::unique_ptr<SocketHelper::UDPReceiver> loopback_receiver;
+    std::unique_ptr<WBReceiver> wb_receiver;
+    std::unique_ptr<std::thread> wb_receiver_thread;
+    if(loopback_udp_port>=0){
+      loopback_receiver=std::make_unique<SocketHelper::UDPReceiver>(SocketHelper::ADDRESS_LOCALHOST,loopback_udp_port,on_packet);
+      loopback_receiver->runInBackground();
+    }else{
+      wb_receiver=std::make_unique<WBReceiver>(options,on_packet);
+      wb_receiver_thread=std::make_unique<std::thread>([&wb_receiver](){
+        wb_receiver->loop();
+      });
+    }
+    // Telemetry, mirrored compared to the air unit: udp in -> ground to air radio port, air to ground radio port -> udp out.
+    // The UDP ports are swapped compared to the air unit, such that received telemetry goes to the default GCS port (14550).
+    std::unique_ptr<WBTransmitter> telemetry_wb_tx;
+    std::unique_ptr<WBReceiver> telemetry_wb_rx;
+    std::unique_ptr<std::thread> telemetry_wb_rx_thread;
+    std::unique_ptr<SocketHelper::UDPReceiver> telemetry_udp_in;
+    std::unique_ptr<SocketHelper::UDPForwarder> telemetry_udp_out;
+    if(enable_telemetry && !options.rxInterfaces.empty()){
+      const TelemetryOptions telemetry_options{};
+      TOptions tx_options{};
+      tx_options.wlan=options.rxInterfaces[0];
+      tx_options.keypair=options.keypair;
+      tx_options.radio_port=telemetry_options.ground_to_air_radio_port;
+      tx_options.enable_fec= false;
+      telemetry_wb_tx=std::make_unique<WBTransmitter>(RadiotapHeader::UserSelectableParams{20, false, 0, false, 1},tx_options);
+      ROptions rx_options=options;
+      rx_options.radio_port=telemetry_options.air_to_ground_radio_port;
+      rx_options.enable_fec= false;
+      telemetry_udp_out=std::make_unique<SocketHelper::UDPForwarder>(SocketHelper::ADDRESS_LOCALHOST,telemetry_options.udp_in_port);
+      telemetry_wb_rx=std::make_unique<WBReceiver>(rx_options,[&telemetry_udp_out](const uint8_t *payload,const std::size_t payloadSize){
+        telemetry_udp_out->forwardPacketViaUDP(payload,payloadSize);
+      });
+      telemetry_wb_rx_thread=std::make_unique<std::thread>([&telemetry_wb_rx](){
+        telemetry_wb_rx->loop();
+      });
+      telemetry_udp_in=std::make_unique<SocketHelper::UDPReceiver>(SocketHelper::ADDRESS_LOCALHOST,telemetry_options.udp_out_port,
+          [&telemetry_wb_tx](const uint8_t *payload,const std::size_t payloadSize){
+            telemetry_wb_tx->try_enqueue_packet(std::make_shared<std::vector<uint8_t>>(payload,payload+payloadSize));
+          });
+      telemetry_udp_in->runInBackground();
+    }
+    uint32_t feedback_sequence=0;
+    auto last_feedback=std::chrono::steady_clock::now();
+    uint32_t recovery_sequence=0;
+    std::chrono::steady_clock::time_point last_recovery_request{};
+    auto recovery_request_interval=RECOVERY_REQUEST_MIN_INTERVAL;
+    auto last_debug=std::chrono::steady_clock::now();
+    auto stats_console=rocket_log::create_or_get("stats");
+    while (true){
+      // release frames whose reorder window expired even if no new packets come in
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      reassembler.check_timeouts();
+      if((feedback_udp_tx || feedback_wb_tx) && std::chrono::steady_clock::now()-last_feedback>=std::chrono::milliseconds(100)){
+        last_feedback=std::chrono::steady_clock::now();
+        send_feedback(link_feedback::serialize(create_link_feedback(wb_receiver.get(),reassembler,feedback_sequence++)));
+      }
+      if(!need_keyframe && have_parameter_sets){
+        recovery_request_interval=RECOVERY_REQUEST_MIN_INTERVAL;
+      }else if(enable_recovery_requests && (feedback_udp_tx || feedback_wb_tx) &&
+          std::chrono::steady_clock::now()-last_recovery_request>=recovery_request_interval){
+        last_recovery_request=std::chrono::steady_clock::now();
+        recovery_request_interval=std::min(recovery_request_interval*2,RECOVERY_REQUEST_MAX_INTERVAL);
+        link_feedback::RecoveryRequestMessage request{};
+        request.sequence=recovery_sequence++;
+        request.flags=(need_keyframe ? link_feedback::RECOVERY_FLAG_KEYFRAME : 0) |
+            (have_parameter_sets ? 0 : link_feedback::RECOVERY_FLAG_PARAMETER_SETS);
+        send_feedback(link_feedback::serialize(request));
+      }
+      if(std::chrono::steady_clock::now()-last_debug>=std::chrono::seconds(1)){
+        last_debug=std::chrono::steady_clock::now();
+        stats_console->info("\n{}{} latency probes:{} recovery requests:{} non-reference frames lost:{}",
+                            wb_receiver ? wb_rx_block_stats(*wb_receiver)+"\n" : "",reassembler.createDebug(),
+                            n_latency_probes.load(),recovery_sequence,n_non_reference_losses.load());
+      }
+    }
+  } catch (std::runtime_error &e) {
+    fprintf(stderr, "Error: %s\n", e.what());
+    // the async loggers might still have the messages that led to the error queued
+    rocket_log::shutdown();
+    exit(1);
+  }
+  return 0;
+}
@@ -5,13 +5,21 @@
 #include "rtp_eof_helper.hpp"
 
 #include <vector>
-#include <iostream>
 #include <cassert>
 #include <functional>
 
+#include "rocket_log.hpp"
+
 // Look here for more details (or just look into the rtp rfc:
 // https://github.com/Consti10/LiveVideo10ms/tree/99e2c4ca31dd8c446952cd409ed51f798e29a137/VideoCore/src/main/cpp/Parser
 static constexpr auto RTP_HEADER_SIZE = 12;
+
+// Called for every packet on the pull thread - a burst of malformed packets must not turn into a burst of writes
+static std::shared_ptr<spdlog::logger> get_logger(){
+  static const auto logger=rocket_log::create_or_get("rtp_eof");
+  return logger;
+}
+static constexpr auto LOG_INTERVAL=std::chrono::seconds(1);
 namespace H264 {
 struct nalu_header_t {
   uint8_t type : 5;
@@ -44,13 +52,13 @@ static_assert(sizeof(fu_header_h265_t) == 1);
 bool rtp_eof_helper::h264_end_block(const uint8_t *payload,
                                        const std::size_t payloadSize) {
   if (payloadSize < RTP_HEADER_SIZE + sizeof(H264::nalu_header_t)) {
-    std::cerr << "Got packet that cannot be rtp h264\n";
+    ROCKET_LOG_RATE_LIMITED(get_logger(),spdlog::level::warn,LOG_INTERVAL,"Got packet that cannot be rtp h264, size:{}",payloadSize);
     return false;
   }
   const H264::nalu_header_t &naluHeader = *(H264::nalu_header_t *) (&payload[RTP_HEADER_SIZE]);
   if (naluHeader.type == 28) {// fragmented nalu
     if (payloadSize < RTP_HEADER_SIZE + sizeof(H264::nalu_header_t) + sizeof(H264::fu_header_t)) {
-      std::cerr << "Got invalid h264 rtp fu packet\n";
+      ROCKET_LOG_RATE_LIMITED(get_logger(),spdlog::level::warn,LOG_INTERVAL,"Got invalid h264 rtp fu packet, size:{}",payloadSize);
       return false;
     }
     //std::cout<<"Got fragmented NALU\n";
@@ -78,13 +86,13 @@ bool rtp_eof_helper::h264_end_block(const uint8_t *payload,
 bool rtp_eof_helper::h265_end_block(const uint8_t *payload,
                                        const std::size_t payloadSize) {
   if (payloadSize < RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t)) {
-    std::cerr << "Got packet that cannot be rtp h265\n";
+    ROCKET_LOG_RATE_LIMITED(get_logger(),spdlog::level::warn,LOG_INTERVAL,"Got packet that cannot be rtp h265, size:{}",payloadSize);
     return false;
   }
   const H265::nal_unit_header_h265_t &naluHeader = *(H265::nal_unit_header_h265_t *) (&payload[RTP_HEADER_SIZE]);
   if (naluHeader.type == 49) {
     if (payloadSize < RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t) + sizeof(H265::fu_header_h265_t)) {
-      std::cerr << "Got invalid h265 rtp fu packet\n";
+      ROCKET_LOG_RATE_LIMITED(get_logger(),spdlog::level::warn,LOG_INTERVAL,"Got invalid h265 rtp fu packet, size:{}",payloadSize);
       return false;
     }
     const H265::fu_header_h265_t
@@ -104,6 +112,125 @@ bool rtp_eof_helper::h265_end_block(const uint8_t *payload,
   return false;
 }
 
+static bool h265_is_irap_nalu_type(const uint8_t type){
+  return type>=16 && type<=21;
+}
+
+bool rtp_eof_helper::h265_is_keyframe(const uint8_t *payload,
+                                      const std::size_t payloadSize) {
+  if (payloadSize < RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t)) {
+    return false;
+  }
+  const H265::nal_unit_header_h265_t &naluHeader = *(H265::nal_unit_header_h265_t *) (&payload[RTP_HEADER_SIZE]);
+  if (naluHeader.type == 49) {
+    // fragmentation unit - the NALU type is in the FU header
+    if (payloadSize < RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t) + sizeof(H265::fu_header_h265_t)) {
+      return false;
+    }
+    const H265::fu_header_h265_t
+        &fuHeader = *(H265::fu_header_h265_t *) &payload[RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t)];
+    return fuHeader.s && h265_is_irap_nalu_type(fuHeader.fuType);
+  }
+  if (naluHeader.type == 48) {
+    // aggregation packet - 2 bytes NALU size, then the first NALU header
+    const auto offset=RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t) + 2;
+    if (payloadSize < offset + sizeof(H265::nal_unit_header_h265_t)) {
+      return false;
+    }
+    const H265::nal_unit_header_h265_t &first = *(H265::nal_unit_header_h265_t *) (&payload[offset]);
+    return h265_is_irap_nalu_type(first.type);
+  }
+  return h265_is_irap_nalu_type(naluHeader.type);
+}
+
+static bool h265_is_parameter_set_nalu_type(const uint8_t type){
+  // VPS, SPS, PPS
+  return type>=32 && type<=34;
+}
+
+int rtp_eof_helper::h265_for_each_parameter_set(const uint8_t *payload,const std::size_t payloadSize,
+                                                const std::function<void(uint8_t nalu_type,const uint8_t *nalu,std::size_t nalu_size)>& cb) {
+  if (payloadSize < RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t)) {
+    return 0;
+  }
+  const H265::nal_unit_header_h265_t &naluHeader = *(H265::nal_unit_header_h265_t *) (&payload[RTP_HEADER_SIZE]);
+  if (h265_is_parameter_set_nalu_type(naluHeader.type)) {
+    cb(naluHeader.type,&payload[RTP_HEADER_SIZE],payloadSize-RTP_HEADER_SIZE);
+    return 1;
+  }
+  if (naluHeader.type != 48) {
+    return 0;
+  }
+  // aggregation packet - each NALU is prefixed with its size (2 bytes, big endian)
+  int n_parameter_sets=0;
+  std::size_t offset=RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t);
+  while (offset+2<=payloadSize){
+    const std::size_t nalu_size=(payload[offset]<<8) | payload[offset+1];
+    offset+=2;
+    if(nalu_size<sizeof(H265::nal_unit_header_h265_t) || offset+nalu_size>payloadSize){
+      ROCKET_LOG_RATE_LIMITED(get_logger(),spdlog::level::warn,LOG_INTERVAL,"Got invalid h265 rtp aggregation packet, size:{}",payloadSize);
+      break;
+    }
+    const H265::nal_unit_header_h265_t &nalu = *(H265::nal_unit_header_h265_t *) (&payload[offset]);
+    if (h265_is_parameter_set_nalu_type(nalu.type)) {
+      cb(nalu.type,&payload[offset],nalu_size);
+      n_parameter_sets++;
+    }
+    offset+=nalu_size;
+  }
+  return n_parameter_sets;
+}
+
+static bool h265_is_slice_nalu_type(const uint8_t type){
+  // VCL NALU types
+  return type<32;
+}
+
+std::optional<uint8_t> rtp_eof_helper::h265_get_slice_nalu_type(const uint8_t *payload,const std::size_t payloadSize) {
+  if (payloadSize < RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t)) {
+    return std::nullopt;
+  }
+  const H265::nal_unit_header_h265_t &naluHeader = *(H265::nal_unit_header_h265_t *) (&payload[RTP_HEADER_SIZE]);
+  if (naluHeader.type == 49) {
+    // fragmentation unit - every fragment has the NALU type in its FU header
+    if (payloadSize < RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t) + sizeof(H265::fu_header_h265_t)) {
+      return std::nullopt;
+    }
+    const H265::fu_header_h265_t
+        &fuHeader = *(H265::fu_header_h265_t *) &payload[RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t)];
+    if (!h265_is_slice_nalu_type(fuHeader.fuType)) {
+      return std::nullopt;
+    }
+    return fuHeader.fuType;
+  }
+  if (naluHeader.type == 48) {
+    // aggregation packet - each NALU is prefixed with its size (2 bytes, big endian)
+    std::size_t offset=RTP_HEADER_SIZE + sizeof(H265::nal_unit_header_h265_t);
+    while (offset+2<=payloadSize){
+      const std::size_t nalu_size=(payload[offset]<<8) | payload[offset+1];
+      offset+=2;
+      if(nalu_size<sizeof(H265::nal_unit_header_h265_t) || offset+nalu_size>payloadSize){
+        ROCKET_LOG_RATE_LIMITED(get_logger(),spdlog::level::warn,LOG_INTERVAL,"Got invalid h265 rtp aggregation packet, size:{}",payloadSize);
+        break;
+      }
+      const H265::nal_unit_header_h265_t &nalu = *(H265::nal_unit_header_h265_t *) (&payload[offset]);
+      if (h265_is_slice_nalu_type(nalu.type)) {
+        return nalu.type;
+      }
+      offset+=nalu_size;
+    }
+    return std::nullopt;
+  }
+  if (!h265_is_slice_nalu_type(naluHeader.type)) {
+    return std::nullopt;
+  }
+  return naluHeader.type;
+}
+
+bool rtp_eof_helper::h265_is_non_reference_nalu_type(const uint8_t type) {
+  return type<16 && type%2==0;
+}
+
 bool rtp_eof_helper::mjpeg_end_block(const uint8_t *payload,
                                         const std::size_t payloadSize) {
   // TODO not yet supported
@@ -0,0 +1,62 @@
+#include "rtp_stream_rewriter.hpp"
+
+#include <algorithm>
+
+static constexpr std::size_t RTP_HEADER_SIZE=12;
+// video rtp clock
+static constexpr uint64_t RTP_CLOCK_RATE=90000;
+
+static uint32_t read_u32(const uint8_t* data){
+  return (static_cast<uint32_t>(data[0])<<24) | (static_cast<uint32_t>(data[1])<<16) | (static_cast<uint32_t>(data[2])<<8) | data[3];
+}
+
+static void write_u32(uint8_t* data,uint32_t value){
+  data[0]=static_cast<uint8_t>(value>>24);
+  data[1]=static_cast<uint8_t>(value>>16);
+  data[2]=static_cast<uint8_t>(value>>8);
+  data[3]=static_cast<uint8_t>(value);
+}
+
+RtpStreamRewriter::RtpStreamRewriter(uint32_t ssrc)
+: m_ssrc(ssrc){
+}
+
+void RtpStreamRewriter::rewrite_frame(FrameBlock& frame,std::chrono::steady_clock::time_point now) {
+  for(std::size_t i=0;i<frame.n_fragments();i++){
+    rewrite_packet(frame.get_fragment_data(i),frame.get_fragment(i).size,now);
+  }
+}
+
+bool RtpStreamRewriter::rewrite_packet(uint8_t* packet,std::size_t size,std::chrono::steady_clock::time_point now) {
+  if(size<RTP_HEADER_SIZE || (packet[0]>>6)!=2){
+    return false;
+  }
+  const uint16_t seq=static_cast<uint16_t>((packet[2]<<8) | packet[3]);
+  const uint32_t timestamp=read_u32(&packet[4]);
+  const uint32_t source_ssrc=read_u32(&packet[8]);
+  if(!m_source_ssrc.has_value() || m_source_ssrc.value()!=source_ssrc){
+    if(m_last_seq.has_value()){
+      // continue right after the last packet, such that the ground sees neither a gap nor a jump
+      m_seq_offset=static_cast<uint16_t>(m_last_seq.value()+1-seq);
+      const auto elapsed_us=std::chrono::duration_cast<std::chrono::microseconds>(now-m_last_packet_time).count();
+      const uint64_t elapsed_ticks=std::max<uint64_t>(1,static_cast<uint64_t>(std::max<int64_t>(0,elapsed_us))*RTP_CLOCK_RATE/1000000);
+      m_timestamp_offset=static_cast<uint32_t>(m_last_timestamp+elapsed_ticks-timestamp);
+      m_n_source_changes++;
+    }
+    m_source_ssrc=source_ssrc;
+  }
+  const uint16_t out_seq=static_cast<uint16_t>(seq+m_seq_offset);
+  const uint32_t out_timestamp=timestamp+m_timestamp_offset;
+  packet[2]=static_cast<uint8_t>(out_seq>>8);
+  packet[3]=static_cast<uint8_t>(out_seq & 0xff);
+  write_u32(&packet[4],out_timestamp);
+  write_u32(&packet[8],m_ssrc);
+  m_last_seq=out_seq;
+  m_last_timestamp=out_timestamp;
+  m_last_packet_time=now;
+  return true;
+}
+
+void RtpStreamRewriter::reset() {
+  m_source_ssrc=std::nullopt;
+}
@@ -0,0 +1,250 @@
+#include "shm_frame_ring.hpp"
+#include "thread_stats.hpp"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+using namespace shm_frame_ring;
+
+static std::string shm_name_with_slash(const std::string& name){
+  if(!name.empty() && name[0]=='/')return name;
+  return "/"+name;
+}
+
+static int futex_wait(std::atomic<uint32_t>* addr,uint32_t expected,const struct timespec* timeout){
+  // NOTE: not FUTEX_PRIVATE_FLAG, the futex is shared between processes
+  return static_cast<int>(syscall(SYS_futex,reinterpret_cast<uint32_t*>(addr),FUTEX_WAIT,expected,timeout,nullptr,0));
+}
+
+static int futex_wake(std::atomic<uint32_t>* addr){
+  return static_cast<int>(syscall(SYS_futex,reinterpret_cast<uint32_t*>(addr),FUTEX_WAKE,1,nullptr,nullptr,0));
+}
+
+static SlotHeader* get_slot(uint8_t* slots,uint32_t slot_payload_size,uint64_t index,uint32_t n_slots){
+  return reinterpret_cast<SlotHeader*>(slots+(index%n_slots)*slot_stride(slot_payload_size));
+}
+
+ShmFrameRingProducer::ShmFrameRingProducer(const std::string& name) {
+  const auto shm_name=shm_name_with_slash(name);
+  const int fd=shm_open(shm_name.c_str(),O_RDWR,0);
+  if(fd<0){
+    throw std::runtime_error("shm_open "+shm_name+" failed: "+strerror(errno));
+  }
+  struct stat st{};
+  if(fstat(fd,&st)!=0 || static_cast<std::size_t>(st.st_size)<sizeof(RingHeader)){
+    close(fd);
+    throw std::runtime_error("shm "+shm_name+" has invalid size");
+  }
+  m_mapped_size=st.st_size;
+  void* mapped=mmap(nullptr,m_mapped_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  close(fd);
+  if(mapped==MAP_FAILED){
+    throw std::runtime_error("mmap "+shm_name+" failed: "+strerror(errno));
+  }
+  m_header=static_cast<RingHeader*>(mapped);
+  if(m_header->magic!=MAGIC || m_header->version!=VERSION ||
+      total_size(m_header->n_slots,m_header->slot_payload_size)>m_mapped_size){
+    munmap(mapped,m_mapped_size);
+    throw std::runtime_error("shm "+shm_name+" is not a (compatible) frame ring");
+  }
+  m_slots=static_cast<uint8_t*>(mapped)+sizeof(RingHeader);
+}
+
+ShmFrameRingProducer::~ShmFrameRingProducer() {
+  if(m_header){
+    munmap(m_header,m_mapped_size);
+  }
+}
+
+uint8_t* ShmFrameRingProducer::begin_fragment() {
+  if(m_dropping_curr_frame){
+    return nullptr;
+  }
+  const auto write_index=m_header->write_index.load(std::memory_order_relaxed);
+  const auto read_index=m_header->read_index.load(std::memory_order_acquire);
+  if(write_index-read_index>=m_header->n_slots){
+    // consumer cannot keep up, drop the rest of this frame
+    m_dropping_curr_frame= true;
+    return nullptr;
+  }
+  auto* slot=get_slot(m_slots,m_header->slot_payload_size,write_index,m_header->n_slots);
+  return reinterpret_cast<uint8_t*>(slot)+sizeof(SlotHeader);
+}
+
+void ShmFrameRingProducer::commit_fragment(std::size_t size,bool end_of_frame) {
+  if(size>m_header->slot_payload_size){
+    // the consumer would drop it anyways
+    m_dropping_curr_frame= true;
+  }
+  if(m_dropping_curr_frame){
+    m_header->count_dropped_fragments.fetch_add(1,std::memory_order_relaxed);
+  }else{
+    const auto write_index=m_header->write_index.load(std::memory_order_relaxed);
+    auto* slot=get_slot(m_slots,m_header->slot_payload_size,write_index,m_header->n_slots);
+    slot->size=static_cast<uint32_t>(size);
+    slot->flags=end_of_frame ? FLAG_FRAME_END : 0;
+    slot->frame_id=m_curr_frame_id;
+    m_header->write_index.store(write_index+1,std::memory_order_release);
+    // the consumer hands the fragments on as they come - if it only woke up at the end of a frame, a frame that
+    // doesn't fit into the ring could never complete
+    wake_consumer();
+  }
+  if(end_of_frame){
+    m_curr_frame_id++;
+    m_dropping_curr_frame= false;
+  }
+}
+
+bool ShmFrameRingProducer::write_fragment(const uint8_t* data,std::size_t size,bool end_of_frame) {
+  if(size>max_fragment_size()){
+    m_dropping_curr_frame= true;
+    commit_fragment(0,end_of_frame);
+    return false;
+  }
+  uint8_t* dest=begin_fragment();
+  if(dest){
+    std::memcpy(dest,data,size);
+  }
+  commit_fragment(size,end_of_frame);
+  return dest!=nullptr;
+}
+
+std::size_t ShmFrameRingProducer::max_fragment_size() const {
+  return m_header->slot_payload_size;
+}
+
+uint64_t ShmFrameRingProducer::get_n_dropped_fragments() const {
+  return m_header->count_dropped_fragments.load(std::memory_order_relaxed);
+}
+
+void ShmFrameRingProducer::wake_consumer() {
+  m_header->futex_word.fetch_add(1,std::memory_order_seq_cst);
+  if(m_header->consumer_waiting.load(std::memory_order_seq_cst)){
+    futex_wake(&m_header->futex_word);
+  }
+}
+
+ShmFrameRingConsumer::ShmFrameRingConsumer(const std::string& name,FRAGMENT_CALLBACK cb,uint32_t n_slots,uint32_t slot_payload_size)
+:m_name(shm_name_with_slash(name)),m_cb(std::move(cb)),m_n_slots(n_slots),m_slot_payload_size(slot_payload_size){
+  assert(m_cb);
+  if(n_slots==0){
+    throw std::runtime_error("shm frame ring needs at least one slot");
+  }
+  // Remove stale leftovers (e.g. from a crashed instance), the producer(s) need to re-open anyways
+  shm_unlink(m_name.c_str());
+  // owner / group only - whoever can write the ring can inject into the link
+  const int fd=shm_open(m_name.c_str(),O_CREAT|O_EXCL|O_RDWR,0660);
+  if(fd<0){
+    throw std::runtime_error("shm_open "+m_name+" failed: "+strerror(errno));
+  }
+  m_mapped_size=total_size(n_slots,slot_payload_size);
+  if(ftruncate(fd,static_cast<off_t>(m_mapped_size))!=0){
+    close(fd);
+    shm_unlink(m_name.c_str());
+    throw std::runtime_error("ftruncate "+m_name+" failed: "+strerror(errno));
+  }
+  void* mapped=mmap(nullptr,m_mapped_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  close(fd);
+  if(mapped==MAP_FAILED){
+    shm_unlink(m_name.c_str());
+    throw std::runtime_error("mmap "+m_name+" failed: "+strerror(errno));
+  }
+  m_header=new (mapped) RingHeader();
+  m_header->n_slots=n_slots;
+  m_header->slot_payload_size=slot_payload_size;
+  m_header->version=VERSION;
+  m_header->write_index=0;
+  m_header->read_index=0;
+  m_header->count_dropped_fragments=0;
+  m_header->futex_word=0;
+  m_header->consumer_waiting=0;
+  m_slots=static_cast<uint8_t*>(mapped)+sizeof(RingHeader);
+  // Written last, a producer checks the magic before using the ring
+  std::atomic_thread_fence(std::memory_order_release);
+  m_header->magic=MAGIC;
+}
+
+ShmFrameRingConsumer::~ShmFrameRingConsumer() {
+  stopBackground();
+  munmap(m_header,m_mapped_size);
+  shm_unlink(m_name.c_str());
+}
+
+void ShmFrameRingConsumer::wait_for_data() {
+  m_header->consumer_waiting.store(1,std::memory_order_seq_cst);
+  const auto curr_futex_value=m_header->futex_word.load(std::memory_order_acquire);
+  // re-check after announcing we are waiting, otherwise we might miss a wakeup
+  if(m_header->read_index.load(std::memory_order_relaxed)==m_header->write_index.load(std::memory_order_acquire)){
+    // timeout such that we can check m_keep_looping regularly
+    const struct timespec timeout{0,100*1000*1000};
+    futex_wait(&m_header->futex_word,curr_futex_value,&timeout);
+  }
+  m_header->consumer_waiting.store(0,std::memory_order_relaxed);
+}
+
+void ShmFrameRingConsumer::loopUntilStopped() {
+  while (m_keep_looping){
+    const auto write_index=m_header->write_index.load(std::memory_order_acquire);
+    auto read_index=m_header->read_index.load(std::memory_order_relaxed);
+    if(read_index==write_index){
+      wait_for_data();
+      continue;
+    }
+    if(write_index-read_index>m_n_slots){
+      // the producer wrote more than fits into the ring - nothing in it can be trusted, skip all of it
+      m_n_invalid_fragments.fetch_add(write_index-read_index,std::memory_order_relaxed);
+      m_header->read_index.store(write_index,std::memory_order_release);
+      continue;
+    }
+    for(;read_index!=write_index;read_index++){
+      const auto* slot=get_slot(m_slots,m_slot_payload_size,read_index,m_n_slots);
+      const auto* payload=reinterpret_cast<const uint8_t*>(slot)+sizeof(SlotHeader);
+      // read once, the producer could change it while we use it
+      const uint32_t size=slot->size;
+      if(size<=m_slot_payload_size){
+        m_cb(payload,size,(slot->flags & FLAG_FRAME_END)!=0,slot->frame_id);
+      }else{
+        m_n_invalid_fragments.fetch_add(1,std::memory_order_relaxed);
+      }
+      // give the slot back after the callback has consumed it (in place)
+      m_header->read_index.store(read_index+1,std::memory_order_release);
+    }
+  }
+}
+
+void ShmFrameRingConsumer::runInBackground() {
+  if(m_background_thread){
+    return;
+  }
+  m_keep_looping= true;
+  m_background_thread=std::make_unique<std::thread>([this](){
+    thread_stats::set_current_thread_name("shm_rx");
+    loopUntilStopped();
+  });
+}
+
+void ShmFrameRingConsumer::stopBackground() {
+  m_keep_looping= false;
+  if(m_background_thread){
+    if(m_background_thread->joinable())m_background_thread->join();
+    m_background_thread=nullptr;
+  }
+}
+
+uint64_t ShmFrameRingConsumer::get_n_dropped_fragments() const {
+  return m_header->count_dropped_fragments.load(std::memory_order_relaxed);
+}
+
+uint64_t ShmFrameRingConsumer::get_n_invalid_fragments() const {
+  return m_n_invalid_fragments.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,54 @@
+#include "simulcast_selector.hpp"
+
+#include <sstream>
+
+SimulcastSelector::SimulcastSelector(SimulcastSelectorOptions options)
+: m_options(options){
+}
+
+int SimulcastSelector::on_link_state(const SimulcastLinkState& state,std::chrono::steady_clock::time_point now) {
+  const bool blocks_dropped=state.n_video_blocks_dropped>m_last_n_video_blocks_dropped;
+  m_last_n_video_blocks_dropped=state.n_video_blocks_dropped;
+  m_last_state=state;
+  const bool congested=blocks_dropped || state.video_queue_delay>m_options.max_queue_delay;
+  if(m_selected==STREAM_HIGH){
+    if(congested || state.high_stream_airtime_fraction>m_options.max_airtime_utilization){
+      m_selected=STREAM_LOW;
+      m_good_since=std::nullopt;
+      m_n_switches++;
+    }
+    return m_selected;
+  }
+  const bool high_fits=state.high_stream_airtime_fraction<=m_options.max_airtime_utilization*m_options.switch_up_margin;
+  if(congested || !high_fits){
+    m_good_since=std::nullopt;
+    return m_selected;
+  }
+  if(!m_good_since.has_value()){
+    m_good_since=now;
+  }
+  if(now-m_good_since.value()>=m_options.min_good_duration_before_switch_up){
+    m_selected=STREAM_HIGH;
+    m_good_since=std::nullopt;
+    m_n_switches++;
+  }
+  return m_selected;
+}
+
+int SimulcastSelector::get_selected() const {
+  return m_selected;
+}
+
+const SimulcastSelectorOptions& SimulcastSelector::get_options() const {
+  return m_options;
+}
+
+std::string SimulcastSelector::createDebug() const {
+  std::stringstream ss;
+  ss.precision(3);
+  ss<<"Simulcast: selected:"<<(m_selected==STREAM_HIGH ? "high" : "low")
+     <<" high airtime:"<<m_last_state.high_stream_airtime_fraction
+     <<" queue delay:"<<std::chrono::duration_cast<std::chrono::milliseconds>(m_last_state.video_queue_delay).count()<<"ms"
+     <<" switches:"<<m_n_switches;
+  return ss.str();
+}
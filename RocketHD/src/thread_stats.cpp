@@ -0,0 +1,230 @@
+#include "thread_stats.hpp"
+
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+void thread_stats::set_current_thread_name(const std::string& name) {
+  pthread_setname_np(pthread_self(),name.substr(0,15).c_str());
+}
+
+static std::string get_task_path(uint32_t tid,const std::string& file){
+  return "/proc/self/task/"+std::to_string(tid)+"/"+file;
+}
+
+static std::vector<uint32_t> list_tids(){
+  std::vector<uint32_t> ret;
+  DIR* dir=opendir("/proc/self/task");
+  if(dir==nullptr){
+    return ret;
+  }
+  while (auto* entry=readdir(dir)){
+    if(entry->d_name[0]>='0' && entry->d_name[0]<='9'){
+      ret.push_back(static_cast<uint32_t>(std::stoul(entry->d_name)));
+    }
+  }
+  closedir(dir);
+  return ret;
+}
+
+static std::string read_name(uint32_t tid){
+  std::ifstream file(get_task_path(tid,"comm"));
+  std::string ret;
+  std::getline(file,ret);
+  return ret;
+}
+
+// Time the thread has been running, in ns. schedstat has ns resolution, stat only clock ticks (usually 10ms -
+// 1% resolution at a 1s sample interval)
+static std::optional<uint64_t> read_cpu_ns(uint32_t tid){
+  {
+    std::ifstream file(get_task_path(tid,"schedstat"));
+    uint64_t run_time_ns;
+    if(file >> run_time_ns){
+      return run_time_ns;
+    }
+  }
+  std::ifstream file(get_task_path(tid,"stat"));
+  std::string line;
+  if(!std::getline(file,line)){
+    return std::nullopt;
+  }
+  // the name (field 2) might contain spaces, the fields after it start after the last ')'
+  const auto name_end=line.rfind(')');
+  if(name_end==std::string::npos){
+    return std::nullopt;
+  }
+  std::stringstream ss(line.substr(name_end+1));
+  std::string field;
+  // state is field 3, utime 14, stime 15
+  for(int i=3;i<14;i++){
+    ss>>field;
+  }
+  uint64_t utime_ticks=0;
+  uint64_t stime_ticks=0;
+  if(!(ss>>utime_ticks>>stime_ticks)){
+    return std::nullopt;
+  }
+  static const auto ticks_per_second=static_cast<uint64_t>(sysconf(_SC_CLK_TCK));
+  return (utime_ticks+stime_ticks)*(1000000000ULL/ticks_per_second);
+}
+
+static void read_context_switches(uint32_t tid,uint64_t& n_voluntary,uint64_t& n_involuntary){
+  std::ifstream file(get_task_path(tid,"status"));
+  std::string line;
+  while (std::getline(file,line)){
+    if(line.rfind("voluntary_ctxt_switches:",0)==0){
+      n_voluntary=std::stoull(line.substr(line.find(':')+1));
+    }else if(line.rfind("nonvoluntary_ctxt_switches:",0)==0){
+      n_involuntary=std::stoull(line.substr(line.find(':')+1));
+    }
+  }
+}
+
+static int open_perf_counter(uint32_t tid,uint64_t config){
+  perf_event_attr attr{};
+  attr.type=PERF_TYPE_HARDWARE;
+  attr.size=sizeof(attr);
+  attr.config=config;
+  // user space only, that is allowed for the own threads with the default perf_event_paranoid (2)
+  attr.exclude_kernel=1;
+  attr.exclude_hv=1;
+  return static_cast<int>(syscall(SYS_perf_event_open,&attr,static_cast<pid_t>(tid),-1,-1,PERF_FLAG_FD_CLOEXEC));
+}
+
+static uint64_t read_perf_counter(int fd){
+  uint64_t value=0;
+  if(fd<0 || read(fd,&value,sizeof(value))!=sizeof(value)){
+    return 0;
+  }
+  return value;
+}
+
+ThreadStatsSampler::ThreadStatsSampler(bool enable_perf)
+: m_perf_enabled(enable_perf),
+  m_last_sample_time(std::chrono::steady_clock::now())
+{
+  if(!enable_perf){
+    m_perf_error="disabled";
+  }
+}
+
+ThreadStatsSampler::~ThreadStatsSampler() {
+  for(auto& [tid,state]:m_threads){
+    close_perf_counters(state);
+  }
+}
+
+void ThreadStatsSampler::open_perf_counters(uint32_t tid,ThreadState& state) {
+  state.perf_cycles_fd=open_perf_counter(tid,PERF_COUNT_HW_CPU_CYCLES);
+  if(state.perf_cycles_fd<0){
+    // not permitted / no pmu (e.g. in a vm) - no reason to try again for the other threads
+    m_perf_enabled=false;
+    m_perf_error=std::strerror(errno);
+    return;
+  }
+  state.perf_cache_misses_fd=open_perf_counter(tid,PERF_COUNT_HW_CACHE_MISSES);
+}
+
+void ThreadStatsSampler::close_perf_counters(ThreadState& state) {
+  if(state.perf_cycles_fd>=0)close(state.perf_cycles_fd);
+  if(state.perf_cache_misses_fd>=0)close(state.perf_cache_misses_fd);
+  state.perf_cycles_fd=-1;
+  state.perf_cache_misses_fd=-1;
+}
+
+std::vector<ThreadCpuStats> ThreadStatsSampler::sample() {
+  const auto now=std::chrono::steady_clock::now();
+  const auto elapsed_ns=static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(now-m_last_sample_time).count());
+  m_last_sample_time=now;
+  std::vector<ThreadCpuStats> ret;
+  std::map<uint32_t,ThreadState> threads;
+  for(const auto tid:list_tids()){
+    const auto cpu_ns=read_cpu_ns(tid);
+    if(!cpu_ns.has_value()){
+      // exited in the meantime
+      continue;
+    }
+    ThreadState state{};
+    state.cpu_ns=cpu_ns.value();
+    read_context_switches(tid,state.n_voluntary_switches,state.n_involuntary_switches);
+    auto previous_it=m_threads.find(tid);
+    const bool is_new=previous_it==m_threads.end();
+    ThreadState previous=is_new ? state : previous_it->second;
+    if(is_new){
+      if(m_perf_enabled){
+        open_perf_counters(tid,state);
+      }
+    }else{
+      state.perf_cycles_fd=previous.perf_cycles_fd;
+      state.perf_cache_misses_fd=previous.perf_cache_misses_fd;
+      m_threads.erase(previous_it);
+    }
+    state.cycles=read_perf_counter(state.perf_cycles_fd);
+    state.cache_misses=read_perf_counter(state.perf_cache_misses_fd);
+    ThreadCpuStats stats{};
+    stats.tid=tid;
+    stats.name=read_name(tid);
+    if(!is_new && elapsed_ns>0){
+      stats.cpu_percent=static_cast<double>(state.cpu_ns-previous.cpu_ns)*100.0/elapsed_ns;
+      stats.n_voluntary_switches=state.n_voluntary_switches-previous.n_voluntary_switches;
+      stats.n_involuntary_switches=state.n_involuntary_switches-previous.n_involuntary_switches;
+    }
+    if(state.perf_cycles_fd>=0){
+      stats.cycles=is_new ? 0 : state.cycles-previous.cycles;
+    }
+    if(state.perf_cache_misses_fd>=0){
+      stats.cache_misses=is_new ? 0 : state.cache_misses-previous.cache_misses;
+    }
+    threads.emplace(tid,state);
+    ret.push_back(std::move(stats));
+  }
+  // the ones that are left have exited
+  for(auto& [tid,state]:m_threads){
+    close_perf_counters(state);
+  }
+  m_threads=std::move(threads);
+  std::sort(ret.begin(),ret.end(),[](const ThreadCpuStats& lhs,const ThreadCpuStats& rhs){
+    return lhs.cpu_percent>rhs.cpu_percent;
+  });
+  return ret;
+}
+
+std::string ThreadStatsSampler::createDebug() {
+  return to_string(sample());
+}
+
+std::string ThreadStatsSampler::to_string(const std::vector<ThreadCpuStats>& stats) const {
+  double total_cpu_percent=0;
+  for(const auto& thread:stats){
+    total_cpu_percent+=thread.cpu_percent;
+  }
+  std::stringstream ss;
+  ss<<std::fixed<<std::setprecision(1);
+  ss<<"Threads:"<<stats.size()<<" cpu:"<<total_cpu_percent<<"%";
+  if(!m_perf_error.empty()){
+    ss<<" (no perf events: "<<m_perf_error<<")";
+  }
+  for(const auto& thread:stats){
+    ss<<"\n  "<<std::left<<std::setw(15)<<thread.name<<std::right<<" "<<std::setw(7)<<thread.tid
+       <<" cpu:"<<std::setw(5)<<thread.cpu_percent<<"%"
+       <<" ctx vol:"<<thread.n_voluntary_switches<<" invol:"<<thread.n_involuntary_switches;
+    if(thread.cycles.has_value()){
+      ss<<" Mcycles:"<<static_cast<double>(thread.cycles.value())/1e6;
+    }
+    if(thread.cache_misses.has_value()){
+      ss<<" cache misses:"<<thread.cache_misses.value();
+    }
+  }
+  return ss.str();
+}
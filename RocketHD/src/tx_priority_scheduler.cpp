@@ -0,0 +1,377 @@
+#include "tx_priority_scheduler.hpp"
+#include "flight_recorder.hpp"
+#include "thread_stats.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+#include <utility>
+
+TxPriorityScheduler::TxPriorityScheduler(TxPrioritySchedulerOptions options,TELEMETRY_CALLBACK telemetry_cb,VIDEO_CALLBACK video_cb,
+                                         std::shared_ptr<PacketPacer> pacer,std::shared_ptr<MemoryBudget> memory_budget,
+                                         INJECTION_COUNTERS_CALLBACK telemetry_counters_cb,INJECTION_COUNTERS_CALLBACK video_counters_cb)
+: m_options(options),m_telemetry_cb(std::move(telemetry_cb)),m_video_cb(std::move(video_cb)),
+  m_telemetry_counters_cb(std::move(telemetry_counters_cb)),m_video_counters_cb(std::move(video_counters_cb)),
+  m_pacer(std::move(pacer)),m_memory_budget(memory_budget),m_poll_interval(options.injection_poll_interval),
+  m_video_block_pool(8,std::move(memory_budget))
+{
+  assert(m_telemetry_cb);
+  assert(m_video_cb);
+  m_thread=std::make_unique<std::thread>(&TxPriorityScheduler::loop_dispatch, this);
+}
+
+TxPriorityScheduler::~TxPriorityScheduler() {
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_run= false;
+  }
+  m_cv.notify_all();
+  if(m_thread->joinable())m_thread->join();
+  for(const auto& item:m_video_queue){
+    release_from_budget(item.data);
+  }
+}
+
+void TxPriorityScheduler::enqueue_telemetry(TELEMETRY_PACKET packet) {
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if(static_cast<int>(m_telemetry_queue.size())>=m_options.max_telemetry_queue_size){
+      m_telemetry_queue.pop_front();
+      m_stats.n_telemetry_packets_dropped++;
+    }
+    m_telemetry_queue.push_back({std::move(packet),std::chrono::steady_clock::now()});
+  }
+  m_cv.notify_one();
+}
+
+using flight_recorder::EventType;
+using flight_recorder::DropReason;
+
+static void record_dropped(const FrameBlock& block,DropReason reason){
+  flight_recorder::record(EventType::TX_BLOCK_DROPPED,static_cast<uint32_t>(block.n_fragments()),flight_recorder::to_u32(reason));
+}
+
+void TxPriorityScheduler::enqueue_video(FrameBlock&& block) {
+  const auto now=std::chrono::steady_clock::now();
+  std::vector<FrameBlock> dropped;
+  bool enqueued=false;
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_video_in_burstiness.add(block.n_bytes(),now);
+    if(static_cast<int>(m_video_queue.size())>=m_options.max_video_queue_size){
+      // the oldest one is dropped, the block that is being injected (if any) is not in the queue anymore
+      drop_oldest_video_block(DropReason::QUEUE_FULL,dropped);
+    }
+    if(make_room_in_budget(block.n_bytes(),dropped)){
+      flight_recorder::record(EventType::TX_BLOCK_ENQUEUED,static_cast<uint32_t>(block.n_fragments()),block.n_bytes());
+      m_video_queue.push_back({std::move(block),now});
+      enqueued=true;
+    }else{
+      m_stats.n_video_blocks_dropped++;
+      const bool too_big=m_memory_budget && block.n_bytes()>m_memory_budget->get_stage_limit(MemoryBudget::Stage::TX_QUEUE);
+      record_dropped(block,too_big ? DropReason::TOO_BIG : DropReason::MEMORY_BUDGET);
+    }
+  }
+  if(enqueued){
+    m_cv.notify_one();
+  }else{
+    dropped.push_back(std::move(block));
+  }
+  for(auto& dropped_block:dropped){
+    m_video_block_pool.release(std::move(dropped_block));
+  }
+}
+
+bool TxPriorityScheduler::drop_oldest_video_block(DropReason reason,std::vector<FrameBlock>& dropped) {
+  // the rest of a partially handed over block has to follow, otherwise the frame is lost anyways
+  const std::size_t index=m_video_head_n_dispatched>0 ? 1 : 0;
+  if(m_video_queue.size()<=index){
+    return false;
+  }
+  const auto it=m_video_queue.begin()+static_cast<std::ptrdiff_t>(index);
+  release_from_budget(it->data);
+  record_dropped(it->data,reason);
+  dropped.push_back(std::move(it->data));
+  m_video_queue.erase(it);
+  m_stats.n_video_blocks_dropped++;
+  return true;
+}
+
+bool TxPriorityScheduler::make_room_in_budget(std::size_t n_bytes,std::vector<FrameBlock>& dropped) {
+  if(!m_memory_budget){
+    return true;
+  }
+  if(n_bytes>m_memory_budget->get_stage_limit(MemoryBudget::Stage::TX_QUEUE)){
+    // doesn't fit even into an empty queue, no reason to drop the others
+    return false;
+  }
+  while (!m_memory_budget->try_acquire(MemoryBudget::Stage::TX_QUEUE,n_bytes)){
+    if(!drop_oldest_video_block(DropReason::MEMORY_BUDGET,dropped)){
+      return false;
+    }
+  }
+  return true;
+}
+
+void TxPriorityScheduler::release_from_budget(const FrameBlock& block) {
+  if(m_memory_budget){
+    m_memory_budget->release(MemoryBudget::Stage::TX_QUEUE,block.n_bytes());
+  }
+}
+
+FrameBlock TxPriorityScheduler::acquire_video_block() {
+  return m_video_block_pool.acquire();
+}
+
+void TxPriorityScheduler::recycle_video_block(FrameBlock&& block) {
+  m_video_block_pool.release(std::move(block));
+}
+
+TxVideoQueueState TxPriorityScheduler::get_video_queue_state() {
+  const auto now=std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> guard(m_mutex);
+  TxVideoQueueState ret{};
+  // a partially handed over block is still in the queue
+  ret.n_queued_blocks=m_video_queue.size()+(m_video_injection.has_value() && m_video_head_n_dispatched==0 ? 1 : 0);
+  if(m_video_injection.has_value()){
+    ret.head_delay=now-m_video_injection->enqueue_time;
+  }else if(!m_video_queue.empty()){
+    ret.head_delay=now-m_video_queue.front().enqueue_time;
+  }
+  ret.n_dropped_blocks=m_stats.n_video_blocks_dropped;
+  return ret;
+}
+
+bool TxPriorityScheduler::can_dispatch_video() const {
+  // the next video block only once the previous one has been injected
+  return !m_video_injection.has_value() && !m_video_queue.empty();
+}
+
+void TxPriorityScheduler::loop_dispatch() {
+  thread_stats::set_current_thread_name("tx_sched");
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true){
+    const auto has_work=[this](){
+      return !m_run || !m_telemetry_queue.empty() || can_dispatch_video();
+    };
+    if(!m_telemetry_injections.empty() || m_video_injection.has_value()){
+      m_cv.wait_for(lock,m_poll_interval,has_work);
+    }else{
+      m_cv.wait(lock,has_work);
+    }
+    if(!m_run){
+      return;
+    }
+    poll_injections(lock);
+    // strict priority - only if there is no telemetry, the next video block is dispatched
+    if(!m_telemetry_queue.empty()){
+      dispatch_telemetry(lock);
+    }else if(can_dispatch_video()){
+      dispatch_video(lock);
+    }
+  }
+}
+
+void TxPriorityScheduler::poll_injections(std::unique_lock<std::mutex>& lock) {
+  const bool poll_telemetry=!m_telemetry_injections.empty();
+  const bool poll_video=m_video_injection.has_value();
+  if(!poll_telemetry && !poll_video){
+    return;
+  }
+  lock.unlock();
+  const auto telemetry_counters=poll_telemetry ? m_telemetry_counters_cb() : TxInjectionCounters{};
+  const auto video_counters=poll_video ? m_video_counters_cb() : TxInjectionCounters{};
+  const auto now=std::chrono::steady_clock::now();
+  lock.lock();
+  bool progress=false;
+  if(poll_video && video_counters.n_packets>m_last_video_injected_packets){
+    const auto n_packets=video_counters.n_packets-m_last_video_injected_packets;
+    const auto us_per_packet=std::chrono::duration<double,std::micro>(now-m_last_video_poll_time).count()/static_cast<double>(n_packets);
+    m_video_us_per_packet=m_video_us_per_packet>0 ? 0.8*m_video_us_per_packet+0.2*us_per_packet : us_per_packet;
+    progress=true;
+  }
+  if(poll_video){
+    m_last_video_injected_packets=video_counters.n_packets;
+    m_last_video_poll_time=now;
+  }
+  while (!m_telemetry_injections.empty()){
+    const auto& injection=m_telemetry_injections.front();
+    if(telemetry_counters.n_packets>=injection.n_packets_target){
+      on_telemetry_done(now-injection.enqueue_time);
+    }else if(now-injection.dispatch_time>=m_options.max_injection_wait){
+      m_stats.n_injection_timeouts++;
+    }else{
+      break;
+    }
+    m_telemetry_injections.pop_front();
+  }
+  if(m_video_injection.has_value()){
+    // what actually went out (including FEC), at the resolution of the poll interval
+    if(m_last_video_injected_bytes.has_value() && video_counters.n_bytes>m_last_video_injected_bytes.value()){
+      m_video_out_burstiness.add(video_counters.n_bytes-m_last_video_injected_bytes.value(),now);
+    }
+    m_last_video_injected_bytes=video_counters.n_bytes;
+    const auto& injection=m_video_injection.value();
+    const bool injected=video_counters.n_packets>=injection.n_packets_target;
+    if(injected || now-injection.dispatch_time>=m_options.max_injection_wait){
+      if(!injected){
+        m_stats.n_injection_timeouts++;
+      }
+      if(injection.end_of_block){
+        on_video_block_done(now-injection.enqueue_time);
+      }
+      m_video_injection.reset();
+    }
+  }
+  if(m_video_injection.has_value() && progress){
+    m_poll_interval=get_expected_video_injection_time(video_counters.n_packets);
+  }else if(m_video_injection.has_value() || !m_telemetry_injections.empty()){
+    // nothing moved (or only telemetry is pending, which takes a single packet) - back off
+    m_poll_interval=progress ? m_options.injection_poll_interval :
+                    std::min(m_poll_interval*2,m_options.max_injection_poll_interval);
+  }else{
+    m_poll_interval=m_options.injection_poll_interval;
+  }
+}
+
+std::chrono::microseconds TxPriorityScheduler::get_expected_video_injection_time(uint64_t n_packets_injected) const {
+  if(!m_video_injection.has_value() || m_video_us_per_packet<=0){
+    return m_options.injection_poll_interval;
+  }
+  const auto n_remaining=m_video_injection->n_packets_target>n_packets_injected ? m_video_injection->n_packets_target-n_packets_injected : 0;
+  const auto expected=std::chrono::microseconds(static_cast<int64_t>(static_cast<double>(n_remaining)*m_video_us_per_packet));
+  return std::clamp(expected,m_options.injection_poll_interval,m_options.max_injection_poll_interval);
+}
+
+void TxPriorityScheduler::on_telemetry_done(std::chrono::nanoseconds latency) {
+  m_stats.n_telemetry_packets++;
+  m_telemetry_latency_sum+=latency;
+  m_stats.telemetry_latency_max=std::max(m_stats.telemetry_latency_max,latency);
+}
+
+void TxPriorityScheduler::on_video_block_done(std::chrono::nanoseconds latency) {
+  m_stats.n_video_blocks++;
+  m_video_latency_sum+=latency;
+  m_stats.video_latency_max=std::max(m_stats.video_latency_max,latency);
+  flight_recorder::record(EventType::TX_BLOCK_DONE,0,std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+}
+
+void TxPriorityScheduler::dispatch_telemetry(std::unique_lock<std::mutex>& lock) {
+  auto item=std::move(m_telemetry_queue.front());
+  m_telemetry_queue.pop_front();
+  // Earlier packets might not be injected yet - they are not in the counter, but come first
+  std::optional<uint64_t> last_target;
+  if(!m_telemetry_injections.empty()){
+    last_target=m_telemetry_injections.back().n_packets_target;
+  }
+  lock.unlock();
+  std::optional<uint64_t> n_packets_before;
+  if(m_telemetry_counters_cb){
+    n_packets_before=std::max(m_telemetry_counters_cb().n_packets,last_target.value_or(0));
+  }
+  const auto now=std::chrono::steady_clock::now();
+  m_telemetry_cb(std::move(item.data));
+  lock.lock();
+  if(n_packets_before.has_value()){
+    m_telemetry_injections.push_back({n_packets_before.value()+1,item.enqueue_time,now});
+  }else{
+    on_telemetry_done(now-item.enqueue_time);
+  }
+}
+
+void TxPriorityScheduler::dispatch_video(std::unique_lock<std::mutex>& lock) {
+  const auto now=std::chrono::steady_clock::now();
+  auto& head=m_video_queue.front();
+  const auto begin=m_video_head_n_dispatched;
+  auto end=head.data.n_fragments();
+  if(m_pacer){
+    // Parts of whole FEC blocks - the transmitter injects the packets of a FEC block back to back, and releasing
+    // shorter parts would shorten the FEC blocks.
+    end=begin+m_pacer->get_release_size(head.data,begin);
+    const auto airtime_us=m_pacer->get_airtime_us(head.data,begin,end);
+    const auto release_time=m_pacer->get_release_time(airtime_us,head.enqueue_time,now);
+    if(release_time>now){
+      m_cv.wait_until(lock,release_time,[this](){
+        return !m_run || !m_telemetry_queue.empty();
+      });
+      return;
+    }
+    m_pacer->on_block_sent(airtime_us,now);
+    flight_recorder::record(EventType::TX_BLOCK_RELEASED,static_cast<uint32_t>(end-begin),airtime_us);
+  }
+  const bool end_of_block=end==head.data.n_fragments();
+  const auto enqueue_time=head.enqueue_time;
+  // The fragments are handed on as they are (no copy)
+  auto fragments=head.data.to_shared_fragments(begin,end);
+  std::optional<FrameBlock> done_block;
+  if(end_of_block){
+    done_block=std::move(head.data);
+    m_video_queue.pop_front();
+    m_video_head_n_dispatched=0;
+  }else{
+    m_video_head_n_dispatched=end;
+  }
+  if(!m_video_counters_cb){
+    // without injection counters, the hand over is the closest we get to the air
+    std::size_t n_bytes=0;
+    for(const auto& fragment:fragments){
+      n_bytes+=fragment->size();
+    }
+    m_video_out_burstiness.add(n_bytes,now);
+  }
+  lock.unlock();
+  std::optional<uint64_t> n_packets_before;
+  if(m_video_counters_cb){
+    n_packets_before=m_video_counters_cb().n_packets;
+  }
+  std::size_t n_packets=0;
+  if(!fragments.empty()){
+    n_packets=m_video_cb(fragments);
+  }
+  if(done_block.has_value()){
+    release_from_budget(done_block.value());
+    m_video_block_pool.release(std::move(done_block.value()));
+  }
+  lock.lock();
+  if(n_packets_before.has_value() && n_packets>0){
+    m_video_injection=PendingInjection{n_packets_before.value()+n_packets,enqueue_time,now,end_of_block};
+    m_last_video_injected_packets=n_packets_before.value();
+    m_last_video_poll_time=now;
+    // first poll once the block should be out
+    m_poll_interval=get_expected_video_injection_time(n_packets_before.value());
+  }else if(end_of_block){
+    on_video_block_done(now-enqueue_time);
+  }
+}
+
+TxPrioritySchedulerStats TxPriorityScheduler::get_stats_and_reset_max() {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  auto ret=m_stats;
+  if(m_stats.n_telemetry_packets>0){
+    ret.telemetry_latency_avg=m_telemetry_latency_sum/m_stats.n_telemetry_packets;
+  }
+  if(m_stats.n_video_blocks>0){
+    ret.video_latency_avg=m_video_latency_sum/m_stats.n_video_blocks;
+  }
+  m_stats.telemetry_latency_max=std::chrono::nanoseconds(0);
+  m_stats.video_latency_max=std::chrono::nanoseconds(0);
+  return ret;
+}
+
+static int64_t to_us(std::chrono::nanoseconds ns){
+  return std::chrono::duration_cast<std::chrono::microseconds>(ns).count();
+}
+
+std::string TxPriorityScheduler::createDebug() {
+  const auto stats=get_stats_and_reset_max();
+  std::stringstream ss;
+  ss<<"TxScheduler: tele:"<<stats.n_telemetry_packets<<" dropped:"<<stats.n_telemetry_packets_dropped
+     <<" latency avg:"<<to_us(stats.telemetry_latency_avg)<<"us max:"<<to_us(stats.telemetry_latency_max)<<"us"
+     <<" video:"<<stats.n_video_blocks<<" dropped:"<<stats.n_video_blocks_dropped
+     <<" latency avg:"<<to_us(stats.video_latency_avg)<<"us max:"<<to_us(stats.video_latency_max)<<"us"
+     <<" injection timeouts:"<<stats.n_injection_timeouts;
+  std::lock_guard<std::mutex> guard(m_mutex);
+  ss<<"\nVideo burstiness in: "<<m_video_in_burstiness.get_summary_and_reset()
+     <<" out: "<<m_video_out_burstiness.get_summary_and_reset();
+  return ss.str();
+}
@@ -1,26 +1,76 @@
 #include "wb_link.hpp"
+#include "flight_recorder.hpp"
+#include "latency_probe.hpp"
+#include "rocket_log.hpp"
+#include "thread_stats.hpp"
 #include "wifi_command_helper.hpp"
 
+#include <random>
+#include <stdexcept>
 #include <utility>
 
-WBLink::WBLink(RadiotapHeader::UserSelectableParams radioTapHeaderParams, TOptions options)
+WBLink::WBLink(RadiotapHeader::UserSelectableParams radioTapHeaderParams, TOptions options,
+               std::optional<TelemetryOptions> telemetry_options,std::shared_ptr<MemoryBudget> memory_budget)
     : m_options(std::move(options)),
-      m_radioTapHeaderParams(radioTapHeaderParams)
+      m_radioTapHeaderParams(radioTapHeaderParams),
+      m_memory_budget(std::move(memory_budget)),
+      m_video_fec_percentage(m_options.tx_fec_options.overhead_percentage),
+      m_rtp_rewriter(std::random_device{}())
 {
-  m_console=spdlog::stdout_color_mt("wblink");
-  m_console->set_level(spdlog::level::debug);
+  m_console=rocket_log::create_or_get("wblink");
   assert(m_console);
   m_console->info("Broadcast card:{}",m_options.wlan);
   takeover_cards_monitor_mode();
   configure_cards();
   configure_video();
+  if(telemetry_options.has_value()){
+    configure_telemetry(telemetry_options.value());
+  }
+}
+
+WBLink::WBLink(RadiotapHeader::UserSelectableParams radioTapHeaderParams, TOptions options,int loopback_udp_port,
+               std::shared_ptr<MemoryBudget> memory_budget)
+    : m_options(std::move(options)),
+      m_radioTapHeaderParams(radioTapHeaderParams),
+      m_memory_budget(std::move(memory_budget)),
+      m_video_fec_percentage(m_options.tx_fec_options.overhead_percentage),
+      m_rtp_rewriter(std::random_device{}())
+{
+  m_console=rocket_log::create_or_get("wblink");
+  assert(m_console);
+  m_console->info("Loopback, video to udp port:{}",loopback_udp_port);
+  m_video_loopback_out=std::make_unique<SocketHelper::UDPForwarder>(SocketHelper::ADDRESS_LOCALHOST,loopback_udp_port);
+  configure_video();
 }
 
 WBLink::~WBLink() {
   m_console->debug("WBLink::~WBLink() begin");
+  m_link_adaptation_run= false;
+  if(m_link_adaptation_timeout_thread && m_link_adaptation_timeout_thread->joinable()){
+    m_link_adaptation_timeout_thread->join();
+  }
+  if(m_link_feedback_udp_rx){
+    m_link_feedback_udp_rx->stopBackground();
+  }
+  if(m_link_feedback_wb_rx){
+    m_link_feedback_wb_rx->stop_looping();
+    if(m_link_feedback_wb_rx_thread->joinable())m_link_feedback_wb_rx_thread->join();
+  }
+  if(m_tele_udp_in){
+    m_tele_udp_in->stopBackground();
+  }
+  if(m_wb_tele_rx){
+    m_wb_tele_rx->stop_looping();
+    if(m_wb_tele_rx_thread->joinable())m_wb_tele_rx_thread->join();
+  }
+  // stop the scheduler first, it uses the transmitter(s)
+  m_tx_scheduler.reset();
+  m_wb_tele_tx.reset();
   m_wb_video_tx.reset();
-  // give the monitor mode cards back to network manager
-  wifi::commandhelper::nmcli_set_device_managed_status(m_options.wlan, true);
+  if(!m_video_loopback_out){
+    // give the monitor mode cards back to network manager
+    wifi::commandhelper::nmcli_set_device_managed_status(m_options.wlan, true);
+  }
   m_console->debug("WBLink::~WBLink() end");
 }
 
@@ -55,7 +105,94 @@ void WBLink::configure_cards() {
 
 void WBLink::configure_video() {
   // Video is unidirectional, aka always goes from air pi to ground pi
-  m_wb_video_tx = create_wb_tx();
+  if(!m_video_loopback_out){
+    m_wb_video_tx = create_wb_tx();
+  }
+  m_video_pacer = std::make_shared<PacketPacer>(PacketPacerOptions{},m_radioTapHeaderParams,m_options.tx_fec_options.overhead_percentage,
+                                                m_options.tx_fec_options.fixed_k);
+  m_tx_scheduler = std::make_unique<TxPriorityScheduler>(TxPrioritySchedulerOptions{},
+      [this](TxPriorityScheduler::TELEMETRY_PACKET packet){
+        // only called if telemetry is configured
+        m_wb_tele_tx->try_enqueue_packet(std::move(packet));
+      },
+      [this](TxPriorityScheduler::VIDEO_FRAGMENTS& fragments)->std::size_t{
+        // a probe is always the last fragment of its frame (with pacing, the frame might be handed over in parts -
+        // stamp_tx_time() ignores everything that isn't a probe)
+        if(!fragments.empty()){
+          latency_probe::stamp_tx_time(*fragments.back(),LatencyEstimator::get_steady_us());
+        }
+        const auto n_fragments=fragments.size();
+        if(m_video_loopback_out){
+          for(const auto& fragment:fragments){
+            m_video_loopback_out->forwardPacketViaUDP(fragment->data(),fragment->size());
+            m_video_loopback_n_packets.fetch_add(1,std::memory_order_relaxed);
+            m_video_loopback_n_bytes.fetch_add(fragment->size(),std::memory_order_relaxed);
+          }
+          return n_fragments;
+        }
+        if(!m_wb_video_tx->try_enqueue_block(fragments, 100)){
+          return 0;
+        }
+        return get_n_video_packets(n_fragments);
+      },m_video_pacer,m_memory_budget,
+      [this](){
+        return m_wb_tele_tx ? get_injection_counters(*m_wb_tele_tx) : TxInjectionCounters{};
+      },
+      [this](){
+        if(m_video_loopback_out){
+          return TxInjectionCounters{m_video_loopback_n_packets.load(std::memory_order_relaxed),
+                                     m_video_loopback_n_bytes.load(std::memory_order_relaxed)};
+        }
+        return get_injection_counters(*m_wb_video_tx);
+      });
+}
+
+TxInjectionCounters WBLink::get_injection_counters(WBTransmitter& wb_tx) {
+  const auto stats=wb_tx.get_latest_stats();
+  return {static_cast<uint64_t>(stats.n_injected_packets),static_cast<uint64_t>(stats.n_injected_bytes)};
+}
+
+std::size_t WBLink::get_n_video_packets(std::size_t n_fragments) const {
+  if(!m_options.enable_fec || m_video_loopback_out){
+    return n_fragments;
+  }
+  // Estimate - with a fixed block length, the last (partial) block might get a different n of FEC packets. If the
+  // estimate is too high, the scheduler waits for the injection a bit longer (at most max_injection_wait).
+  return n_fragments+(n_fragments*m_video_fec_percentage+99)/100;
+}
+
+void WBLink::configure_telemetry(const TelemetryOptions& telemetry_options) {
+  m_console->debug("configure_telemetry in:{} out:{}",telemetry_options.udp_in_port,telemetry_options.udp_out_port);
+  // Telemetry packets are small and latency sensitive - no FEC blocks (which would need to be filled up first)
+  TOptions tx_options{};
+  tx_options.wlan=m_options.wlan;
+  tx_options.keypair=m_options.keypair;
+  tx_options.radio_port=telemetry_options.air_to_ground_radio_port;
+  tx_options.enable_fec= false;
+  tx_options.packet_data_queue_size=telemetry_options.max_queue_size;
+  m_wb_tele_tx=std::make_unique<WBTransmitter>(m_radioTapHeaderParams, tx_options);
+  ROptions rx_options{};
+  rx_options.rxInterfaces={m_options.wlan};
+  rx_options.keypair=m_options.keypair;
+  rx_options.radio_port=telemetry_options.ground_to_air_radio_port;
+  rx_options.enable_fec= false;
+  m_tele_udp_out=std::make_unique<SocketHelper::UDPForwarder>(SocketHelper::ADDRESS_LOCALHOST,telemetry_options.udp_out_port);
+  m_wb_tele_rx=std::make_unique<WBReceiver>(rx_options,[this](const uint8_t *payload,const std::size_t payloadSize){
+    m_tele_udp_out->forwardPacketViaUDP(payload,payloadSize);
+  });
+  m_wb_tele_rx_thread=std::make_unique<std::thread>([this](){
+    thread_stats::set_current_thread_name("tele_rx");
+    m_wb_tele_rx->loop();
+  });
+  m_tele_udp_in=std::make_unique<SocketHelper::UDPReceiver>(SocketHelper::ADDRESS_LOCALHOST,telemetry_options.udp_in_port,
+      [this](const uint8_t *payload,const std::size_t payloadSize){
+        on_telemetry_tx_packet(payload,payloadSize);
+      });
+  m_tele_udp_in->runInBackground();
+}
+
+void WBLink::on_telemetry_tx_packet(const uint8_t *payload,std::size_t payloadSize) {
+  m_tx_scheduler->enqueue_telemetry(std::make_shared<std::vector<uint8_t>>(payload,payload+payloadSize));
 }
 
 std::unique_ptr<WBTransmitter> WBLink::create_wb_tx() {
@@ -64,10 +201,218 @@ std::unique_ptr<WBTransmitter> WBLink::create_wb_tx() {
 
 std::string WBLink::createDebug()const{
   std::stringstream ss;
-  ss<<"VidTx: "<<m_wb_video_tx->createDebugState();
+  if(m_wb_video_tx){
+    ss<<"VidTx: "<<m_wb_video_tx->createDebugState();
+  }else{
+    ss<<"VidTx: loopback packets:"<<m_video_loopback_n_packets.load(std::memory_order_relaxed)<<"\n";
+  }
+  if(m_wb_tele_tx){
+    ss<<"TeleTx: "<<m_wb_tele_tx->createDebugState();
+  }
+  ss<<m_tx_scheduler->createDebug()<<"\n";
+  {
+    std::lock_guard<std::mutex> latency_guard(m_latency_mutex);
+    if(m_latency_estimator){
+      ss<<m_latency_estimator->createDebug()<<"\n";
+    }
+  }
+  {
+    std::lock_guard<std::mutex> recovery_guard(m_recovery_mutex);
+    if(m_recovery_options.has_value()){
+      ss<<"Recovery requests:"<<m_n_recovery_requests<<" keyframes:"<<m_n_recovery_keyframes<<"\n";
+    }
+  }
+  std::lock_guard<std::mutex> guard(m_link_adaptation_mutex);
+  if(m_link_adaptation){
+    ss<<m_link_adaptation->createDebug()<<"\n";
+  }
+  std::lock_guard<std::mutex> simulcast_guard(m_simulcast_mutex);
+  if(m_simulcast_selector){
+    ss<<m_simulcast_selector->createDebug()<<" active:"<<m_active_video_stream<<"\n";
+  }
   return ss.str();
 }
 
+void WBLink::enable_link_adaptation(LinkAdaptationOptions options) {
+  m_console->debug("enable_link_adaptation feedback radio port:{} udp port:{}",options.feedback_radio_port,options.feedback_udp_port);
+  const LinkAdaptationDecision initial{m_radioTapHeaderParams.mcs_index,
+                                       m_options.tx_fec_options.overhead_percentage,
+                                       m_options.tx_fec_options.fixed_k};
+  {
+    std::lock_guard<std::mutex> guard(m_link_adaptation_mutex);
+    m_link_adaptation=std::make_unique<LinkAdaptationController>(options,initial,m_radioTapHeaderParams.bandwidth);
+  }
+  start_feedback_rx(options.feedback_radio_port,options.feedback_udp_port);
+  m_link_adaptation_run= true;
+  m_link_adaptation_timeout_thread=std::make_unique<std::thread>(&WBLink::loop_link_adaptation_timeout, this);
+}
+
+void WBLink::enable_latency_probes(LatencyProbeOptions options) {
+  m_console->debug("enable_latency_probes interval:{}ms",options.probe_interval.count());
+  {
+    std::lock_guard<std::mutex> guard(m_latency_mutex);
+    m_latency_estimator=std::make_unique<LatencyEstimator>(options);
+  }
+  start_feedback_rx(options.feedback_radio_port,options.feedback_udp_port);
+}
+
+void WBLink::enable_recovery_requests(RecoveryRequestOptions options,RECOVERY_CB recovery_cb) {
+  m_console->debug("enable_recovery_requests min keyframe interval:{}ms",options.min_keyframe_interval.count());
+  {
+    std::lock_guard<std::mutex> guard(m_recovery_mutex);
+    m_recovery_options=options;
+    m_recovery_cb=std::move(recovery_cb);
+  }
+  start_feedback_rx(options.feedback_radio_port,options.feedback_udp_port);
+}
+
+void WBLink::start_feedback_rx(int feedback_radio_port,int feedback_udp_port) {
+  std::lock_guard<std::mutex> guard(m_feedback_rx_mutex);
+  if(m_link_feedback_udp_rx || m_link_feedback_wb_rx){
+    return;
+  }
+  auto cb=[this](const uint8_t *payload,const std::size_t payloadSize){
+    on_link_feedback_packet(payload,payloadSize);
+  };
+  if(feedback_udp_port>=0){
+    m_link_feedback_udp_rx=std::make_unique<SocketHelper::UDPReceiver>(SocketHelper::ADDRESS_LOCALHOST,feedback_udp_port,cb);
+    m_link_feedback_udp_rx->runInBackground();
+  }else{
+    if(m_video_loopback_out){
+      throw std::runtime_error("In loopback mode, the link feedback needs a udp port");
+    }
+    ROptions feedback_options{};
+    feedback_options.radio_port=feedback_radio_port;
+    feedback_options.keypair=m_options.keypair;
+    feedback_options.rxInterfaces={m_options.wlan};
+    // reports are single packets, FEC would only add latency
+    feedback_options.enable_fec= false;
+    m_link_feedback_wb_rx=std::make_unique<WBReceiver>(feedback_options,cb);
+    m_link_feedback_wb_rx_thread=std::make_unique<std::thread>([this](){
+      thread_stats::set_current_thread_name("feedback_rx");
+      m_link_feedback_wb_rx->loop();
+    });
+  }
+}
+
+void WBLink::on_link_feedback_packet(const uint8_t *payload,std::size_t payloadSize) {
+  const auto echo=latency_probe::parse(payload,payloadSize);
+  if(echo.has_value()){
+    const auto now_us=LatencyEstimator::get_steady_us();
+    std::lock_guard<std::mutex> guard(m_latency_mutex);
+    if(m_latency_estimator){
+      m_latency_estimator->on_echo(echo.value(),now_us);
+    }
+    return;
+  }
+  const auto recovery_request=link_feedback::parse_recovery_request(payload,payloadSize);
+  if(recovery_request.has_value()){
+    on_recovery_request(recovery_request.value());
+    return;
+  }
+  const auto message=link_feedback::parse(payload,payloadSize);
+  if(!message.has_value()){
+    ROCKET_LOG_RATE_LIMITED(m_console,spdlog::level::debug,std::chrono::seconds(1),"Got invalid link feedback packet, size:{}",payloadSize);
+    return;
+  }
+  std::lock_guard<std::mutex> guard(m_link_adaptation_mutex);
+  if(!m_link_adaptation){
+    // only the latency probes use the feedback path
+    return;
+  }
+  const auto decision=m_link_adaptation->on_feedback(message.value());
+  if(decision.has_value()){
+    apply_link_adaptation_decision(decision.value());
+  }
+}
+
+void WBLink::on_recovery_request(const link_feedback::RecoveryRequestMessage& request) {
+  int stream_index;
+  {
+    std::lock_guard<std::mutex> guard(m_simulcast_mutex);
+    stream_index=m_active_video_stream;
+  }
+  std::lock_guard<std::mutex> guard(m_recovery_mutex);
+  if(!m_recovery_options.has_value()){
+    return;
+  }
+  m_n_recovery_requests++;
+  const auto now=std::chrono::steady_clock::now();
+  bool keyframe=false;
+  if((request.flags & link_feedback::RECOVERY_FLAG_KEYFRAME) && now-m_last_recovery_keyframe>=m_recovery_options->min_keyframe_interval){
+    m_last_recovery_keyframe=now;
+    m_n_recovery_keyframes++;
+    keyframe=true;
+  }
+  const bool parameter_sets=(request.flags & link_feedback::RECOVERY_FLAG_PARAMETER_SETS)!=0;
+  if(!keyframe && !parameter_sets){
+    return;
+  }
+  ROCKET_LOG_RATE_LIMITED(m_console,spdlog::level::debug,std::chrono::seconds(1),"Recovery request {} stream:{} keyframe:{} parameter sets:{}",
+                          request.sequence,stream_index,keyframe,parameter_sets);
+  m_recovery_cb(stream_index,keyframe,parameter_sets);
+}
+
+void WBLink::loop_link_adaptation_timeout() {
+  thread_stats::set_current_thread_name("la_timeout");
+  while (m_link_adaptation_run){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::lock_guard<std::mutex> guard(m_link_adaptation_mutex);
+    const auto decision=m_link_adaptation->check_timeout();
+    if(decision.has_value()){
+      m_console->warn("No link feedback, falling back to mcs:{} fec:{}%",decision->mcs_index,decision->fec_percentage);
+      apply_link_adaptation_decision(decision.value());
+    }
+  }
+}
+
+void WBLink::update_mcs_index(int mcs_index) {
+  std::lock_guard<std::mutex> guard(m_link_adaptation_mutex);
+  if(set_mcs_index(mcs_index)){
+    m_radioTapHeaderParams.mcs_index=mcs_index;
+  }
+  if(m_link_adaptation){
+    auto configured=m_link_adaptation->get_current();
+    configured.mcs_index=m_radioTapHeaderParams.mcs_index;
+    m_link_adaptation->set_configured(configured);
+  }
+}
+
+void WBLink::update_video_fec_percentage(int fec_percentage) {
+  std::lock_guard<std::mutex> guard(m_link_adaptation_mutex);
+  set_video_fec_percentage(fec_percentage);
+  if(m_link_adaptation){
+    auto configured=m_link_adaptation->get_current();
+    configured.fec_percentage=fec_percentage;
+    m_link_adaptation->set_configured(configured);
+  }
+}
+
+void WBLink::update_video_fec_block_length(int block_length) {
+  std::lock_guard<std::mutex> guard(m_link_adaptation_mutex);
+  set_video_fec_block_length(block_length);
+  if(m_link_adaptation){
+    auto configured=m_link_adaptation->get_current();
+    configured.fec_block_length=block_length;
+    m_link_adaptation->set_configured(configured);
+  }
+}
+
+// Needs to be called with m_link_adaptation_mutex locked
+void WBLink::apply_link_adaptation_decision(const LinkAdaptationDecision& decision) {
+  m_console->debug("Link adaptation mcs:{} fec:{}% k:{}",decision.mcs_index,decision.fec_percentage,decision.fec_block_length);
+  flight_recorder::record(flight_recorder::EventType::LINK_ADAPTATION,decision.mcs_index,
+                          (static_cast<uint64_t>(decision.fec_percentage)<<32) | static_cast<uint32_t>(decision.fec_block_length));
+  if(decision.mcs_index!=m_radioTapHeaderParams.mcs_index){
+    if(set_mcs_index(decision.mcs_index)){
+      m_radioTapHeaderParams.mcs_index=decision.mcs_index;
+    }
+  }
+  // cheap, the WBTransmitter only applies them on the next block
+  set_video_fec_percentage(decision.fec_percentage);
+  set_video_fec_block_length(decision.fec_block_length);
+}
+
 void WBLink::apply_txpower() {
   const auto before=std::chrono::steady_clock::now();
   // requires corresponding driver workaround for dynamic tx power
@@ -86,19 +431,34 @@ bool WBLink::set_tx_power_rtl8812au(int tx_power_index_override){
 
 bool WBLink::set_mcs_index(int mcs_index) {
   m_console->debug("set_mcs_index {}",mcs_index);
-  m_wb_video_tx->update_mcs_index(mcs_index);
+  if(m_wb_video_tx){
+    m_wb_video_tx->update_mcs_index(mcs_index);
+  }
+  if(m_wb_tele_tx){
+    m_wb_tele_tx->update_mcs_index(mcs_index);
+  }
+  auto radiotap_params=m_radioTapHeaderParams;
+  radiotap_params.mcs_index=mcs_index;
+  m_video_pacer->update_radiotap_params(radiotap_params);
   return true;
 }
 
 bool WBLink::set_video_fec_block_length(const int block_length) {
   m_console->debug("set_video_fec_block_length {}",block_length);
-  m_wb_video_tx->update_fec_k(block_length);
+  if(m_wb_video_tx){
+    m_wb_video_tx->update_fec_k(block_length);
+  }
+  m_video_pacer->update_fec_block_length(block_length);
   return true;
 }
 
 bool WBLink::set_video_fec_percentage(int fec_percentage) {
   m_console->debug("set_video_fec_percentage {}",fec_percentage);
-  m_wb_video_tx->update_fec_percentage(fec_percentage);
+  if(m_wb_video_tx){
+    m_wb_video_tx->update_fec_percentage(fec_percentage);
+  }
+  m_video_pacer->update_fec_percentage(fec_percentage);
+  m_video_fec_percentage=fec_percentage;
   return true;
 }
 
@@ -106,6 +466,101 @@ static uint32_t get_micros(std::chrono::nanoseconds ns){
   return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(ns).count());
 }
 
-void WBLink::transmit_video_data(std::vector<std::shared_ptr<std::vector<uint8_t>>> frame_fragments){
-  m_wb_video_tx->try_enqueue_block(frame_fragments, 100);
+void WBLink::transmit_video_data(FrameBlock&& frame,int stream_index,bool is_keyframe,uint64_t capture_time_us){
+  std::optional<int> request_keyframe;
+  bool transmit;
+  {
+    std::lock_guard<std::mutex> guard(m_simulcast_mutex);
+    if(m_simulcast_selector){
+      request_keyframe=update_simulcast_selection(frame,stream_index);
+      if(stream_index!=m_active_video_stream && stream_index==m_wanted_video_stream && is_keyframe){
+        m_console->info("Simulcast switching to stream {}",stream_index);
+        m_active_video_stream=stream_index;
+        flight_recorder::record(flight_recorder::EventType::SIMULCAST_SWITCH,stream_index);
+      }
+    }
+    transmit=stream_index==m_active_video_stream;
+    if(transmit){
+      // before the probe is appended, it is not rtp
+      m_rtp_rewriter.rewrite_frame(frame);
+    }
+  }
+  flight_recorder::record(flight_recorder::EventType::FRAME_TO_TX,stream_index,transmit ? 1 : 0);
+  if(request_keyframe.has_value() && m_request_keyframe_cb){
+    m_request_keyframe_cb(request_keyframe.value());
+  }
+  if(!transmit){
+    m_tx_scheduler->recycle_video_block(std::move(frame));
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(m_latency_mutex);
+    if(m_latency_estimator){
+      const auto probe=m_latency_estimator->create_probe(stream_index,capture_time_us);
+      if(probe.has_value()){
+        const auto packet=latency_probe::serialize(probe.value());
+        frame.append_fragment(packet.data(),packet.size());
+      }
+    }
+  }
+  m_tx_scheduler->enqueue_video(std::move(frame));
+}
+
+void WBLink::reset_video_stream() {
+  std::optional<int> request_keyframe;
+  {
+    std::lock_guard<std::mutex> guard(m_simulcast_mutex);
+    m_active_video_stream=0;
+    // the new pipeline might reuse the SSRC, but its sequence numbers / timestamps start anywhere
+    m_rtp_rewriter.reset();
+    if(m_wanted_video_stream!=m_active_video_stream){
+      request_keyframe=m_wanted_video_stream;
+    }
+  }
+  if(request_keyframe.has_value() && m_request_keyframe_cb){
+    m_request_keyframe_cb(request_keyframe.value());
+  }
+}
+
+void WBLink::enable_simulcast(SimulcastSelectorOptions options,std::function<void(int stream_index)> request_keyframe_cb) {
+  m_console->debug("enable_simulcast");
+  std::lock_guard<std::mutex> guard(m_simulcast_mutex);
+  m_simulcast_selector=std::make_unique<SimulcastSelector>(options);
+  m_request_keyframe_cb=std::move(request_keyframe_cb);
+  m_last_simulcast_check=std::chrono::steady_clock::now();
+  m_high_stream_airtime_us=0;
+}
+
+std::optional<int> WBLink::update_simulcast_selection(const FrameBlock& frame,int stream_index) {
+  const auto now=std::chrono::steady_clock::now();
+  if(stream_index==SimulcastSelector::STREAM_HIGH){
+    // the pacer knows the current mcs / fec, the airtime includes the FEC packets
+    m_high_stream_airtime_us+=m_video_pacer->get_airtime_us(frame,0,frame.n_fragments());
+  }
+  const auto elapsed=now-m_last_simulcast_check;
+  if(elapsed<m_simulcast_selector->get_options().check_interval){
+    return std::nullopt;
+  }
+  m_last_simulcast_check=now;
+  const auto queue_state=m_tx_scheduler->get_video_queue_state();
+  SimulcastLinkState state{};
+  state.high_stream_airtime_fraction=static_cast<double>(m_high_stream_airtime_us)/
+      static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  state.video_queue_delay=queue_state.head_delay;
+  state.n_video_blocks_dropped=queue_state.n_dropped_blocks;
+  m_high_stream_airtime_us=0;
+  const int selected=m_simulcast_selector->on_link_state(state,now);
+  if(selected==m_wanted_video_stream){
+    return std::nullopt;
+  }
+  m_console->debug("Simulcast wants stream {} ({})",selected,m_simulcast_selector->createDebug());
+  m_wanted_video_stream=selected;
+  if(selected==m_active_video_stream){
+    return std::nullopt;
+  }
+  return selected;
+}
+
+FrameBlock WBLink::acquire_frame_block() {
+  return m_tx_scheduler->acquire_video_block();
 }
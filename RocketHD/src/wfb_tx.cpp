@@ -16,20 +16,31 @@
 
 #include "../lib/wifibroadcast/src/HelperSources/SchedulingHelper.hpp"
 #include "../lib/wifibroadcast/src/HelperSources/SocketHelper.hpp"
+#include "ShmBlockedWBTransmitter.hpp"
 #include "UdpBlockedWBTransmitter.hpp"
+#include "UdpLoopbackTransmitter.hpp"
+#include "rocket_log.hpp"
+#include "thread_stats.hpp"
 
 int main(int argc, char *const *argv) {
   int opt;
   TOptions options{};
   // input UDP port
   int udp_port = 5600;
+  // if set, input is read from the shared memory frame ring with this name instead of udp
+  std::string shm_name;
+  // if set, no card is used - blocks are forwarded to this (localhost) UDP port instead, e.g. for rocket_rx -l
+  // (no FEC on this path, see hwsim_loopback.sh for the real wifibroadcast path without cards)
+  int loopback_udp_port = -1;
+  int simulated_loss_percentage = 0;
+  int simulated_reorder_percentage = 0;
 
   RadiotapHeader::UserSelectableParams wifiParams{20, false, 0, false, 1};
 
   std::cout << "MAX_PAYLOAD_SIZE:" << FEC_MAX_PAYLOAD_SIZE << "\n";
   print_optimization_method();
 
-  while ((opt = getopt(argc, argv, "K:k:p:u:r:B:G:S:L:M:n:")) != -1) {
+  while ((opt = getopt(argc, argv, "K:k:p:u:s:l:x:o:r:B:G:S:L:M:n:")) != -1) {
     switch (opt) {
       case 'K':options.keypair = optarg;
         break;
@@ -45,6 +56,14 @@ int main(int argc, char *const *argv) {
         break;
       case 'u':udp_port = std::stoi(optarg);
         break;
+      case 's':shm_name = optarg;
+        break;
+      case 'l':loopback_udp_port = std::stoi(optarg);
+        break;
+      case 'x':simulated_loss_percentage = std::stoi(optarg);
+        break;
+      case 'o':simulated_reorder_percentage = std::stoi(optarg);
+        break;
       case 'r':options.radio_port = std::stoi(optarg);
         break;
       case 'B':wifiParams.bandwidth = std::stoi(optarg);
@@ -63,7 +82,7 @@ int main(int argc, char *const *argv) {
       default: /* '?' */
       show_usage:
         fprintf(stderr,
-                "Usage: %s [-K tx_key] [-k FEC_K or 0 for variable fec] [-p FEC_PERCENTAGE] [-u udp_port] [-r radio_port] [-B bandwidth] [-G guard_interval] [-S stbc] [-L ldpc] [-M mcs_index] interface \n",
+                "Usage: %s [-K tx_key] [-k FEC_K or 0 for variable fec] [-p FEC_PERCENTAGE] [-u udp_port] [-s shm_name] [-l loopback_udp_port] [-x simulated_loss_percentage] [-o simulated_reorder_percentage] [-r radio_port] [-B bandwidth] [-G guard_interval] [-S stbc] [-L ldpc] [-M mcs_index] interface \n",
                 argv[0]);
         fprintf(stderr, "Radio MTU: %lu\n", (unsigned long)FEC_MAX_PAYLOAD_SIZE);
         fprintf(stderr, "WFB version "
@@ -72,6 +91,16 @@ int main(int argc, char *const *argv) {
         exit(1);
     }
   }
+  if (loopback_udp_port>=0) {
+    UDPLoopbackTransmitter loopbackTransmitter{SocketHelper::ADDRESS_LOCALHOST, udp_port, loopback_udp_port, simulated_loss_percentage, simulated_reorder_percentage};
+    loopbackTransmitter.runInBackground();
+    ThreadStatsSampler thread_stats_sampler{};
+    auto stats_console=rocket_log::create_or_get("stats");
+    while (true){
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      stats_console->info("\n{}{}",loopbackTransmitter.createDebugState(),thread_stats_sampler.createDebug());
+    }
+  }
   if (optind >= argc) {
     goto show_usage;
   }
@@ -83,11 +112,25 @@ int main(int argc, char *const *argv) {
   SchedulingHelper::setThreadParamsMaxRealtime();
 
   try {
+    if(!shm_name.empty()){
+      ShmBlockedWBTransmitter shmwbTransmitter{wifiParams, options, shm_name};
+      shmwbTransmitter.runInBackground();
+      ThreadStatsSampler thread_stats_sampler{};
+      auto stats_console=rocket_log::create_or_get("stats");
+      while (true){
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        const auto& shm_consumer=shmwbTransmitter.get_shm_consumer();
+        stats_console->info("\n{}Shm dropped fragments:{} invalid:{}\n{}",shmwbTransmitter.get_wb_tx().createDebugState(),
+                            shm_consumer.get_n_dropped_fragments(),shm_consumer.get_n_invalid_fragments(),thread_stats_sampler.createDebug());
+      }
+    }
     UDPBlockedWBTransmitter udpwbTransmitter{wifiParams, options, SocketHelper::ADDRESS_LOCALHOST, udp_port};
     udpwbTransmitter.runInBackground();
+    ThreadStatsSampler thread_stats_sampler{};
+    auto stats_console=rocket_log::create_or_get("stats");
     while (true){
-      std::cout << udpwbTransmitter.get_wb_tx().createDebugState();
       std::this_thread::sleep_for(std::chrono::seconds(1));
+      stats_console->info("\n{}{}",udpwbTransmitter.get_wb_tx().createDebugState(),thread_stats_sampler.createDebug());
     }
   } catch (std::runtime_error &e) {
     fprintf(stderr, "Error: %s\n", e.what());
@@ -4,12 +4,12 @@
 
 #include "wifi_command_helper.hpp"
 
-#include "../lib/wifibroadcast/src/wifibroadcast-spdlog.h"
+#include "rocket_log.hpp"
 
 #include <sstream>
 
 static std::shared_ptr<spdlog::logger> get_logger(){
-  return wifibroadcast::log::create_or_get("w_helper");
+  return rocket_log::create_or_get("w_helper");
 }
 
 
@@ -0,0 +1,131 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "frame_reassembler.hpp"
+#include "test_helper.hpp"
+
+using test_helper::create_rtp_packet;
+
+// What the reassembler released, in order
+struct Released{
+  std::vector<FrameReassembler::FRAME_FRAGMENTS> frames;
+  std::vector<bool> complete;
+  FrameReassembler::FRAME_CALLBACK create_cb(){
+    return [this](const FrameReassembler::FRAME_FRAGMENTS& frame_fragments,bool frame_complete){
+      frames.push_back(frame_fragments);
+      complete.push_back(frame_complete);
+    };
+  }
+};
+
+static void feed(FrameReassembler& reassembler,const std::vector<uint8_t>& packet){
+  reassembler.on_new_packet(packet.data(),packet.size());
+}
+
+static void test_complete_frames_in_order(){
+  Released released;
+  FrameReassembler reassembler{FrameReassemblerOptions{},released.create_cb()};
+  for(int frame=0;frame<3;frame++){
+    for(int i=0;i<3;i++){
+      feed(reassembler,create_rtp_packet(1000+frame*3+i,frame*3000,1,i==2));
+    }
+  }
+  CHECK(released.frames.size()==3);
+  for(std::size_t i=0;i<released.frames.size();i++){
+    CHECK(released.complete[i]);
+    CHECK(released.frames[i].size()==3);
+  }
+  const auto stats=reassembler.get_stats();
+  CHECK(stats.n_packets_lost==0 && stats.n_packets_late==0 && stats.n_frames_complete==3);
+}
+
+// The sequence number wraps around in the middle of a frame and between frames
+static void test_seq_unwrap(){
+  Released released;
+  FrameReassembler reassembler{FrameReassemblerOptions{},released.create_cb()};
+  uint16_t seq=65530;
+  for(int frame=0;frame<4;frame++){
+    for(int i=0;i<3;i++){
+      feed(reassembler,create_rtp_packet(seq++,frame*3000,1,i==2));
+    }
+  }
+  CHECK(released.frames.size()==4);
+  for(const auto complete:released.complete){
+    CHECK(complete);
+  }
+  // packets within a frame stay in sequence number order across the wrap
+  CHECK(test_helper::get_seq(*released.frames[1][0])==65533);
+  CHECK(test_helper::get_seq(*released.frames[1][2])==65535);
+  CHECK(test_helper::get_seq(*released.frames[2][0])==0);
+  const auto stats=reassembler.get_stats();
+  CHECK(stats.n_packets_lost==0 && stats.n_packets_late==0 && stats.n_packets_reordered==0);
+}
+
+// Reordered across the wrap - the frame is complete once the missing packet arrived
+static void test_reorder_across_wrap(){
+  Released released;
+  FrameReassembler reassembler{FrameReassemblerOptions{},released.create_cb()};
+  feed(reassembler,create_rtp_packet(65534,0,1,true));
+  CHECK(released.frames.size()==1);
+  feed(reassembler,create_rtp_packet(0,3000,1,false));
+  feed(reassembler,create_rtp_packet(1,3000,1,true));
+  // 65535 is still missing
+  CHECK(released.frames.size()==1);
+  feed(reassembler,create_rtp_packet(65535,3000,1,false));
+  CHECK(released.frames.size()==2);
+  CHECK(released.complete[1]);
+  CHECK(released.frames[1].size()==3);
+  CHECK(test_helper::get_seq(*released.frames[1][0])==65535);
+  const auto stats=reassembler.get_stats();
+  CHECK(stats.n_packets_reordered==1 && stats.n_packets_lost==0);
+}
+
+// A lost packet - the frame is released incomplete once the reorder window expired
+static void test_lost_packet(){
+  Released released;
+  FrameReassemblerOptions options{};
+  options.reorder_window=std::chrono::milliseconds(5);
+  FrameReassembler reassembler{options,released.create_cb()};
+  feed(reassembler,create_rtp_packet(10,0,1,true));
+  feed(reassembler,create_rtp_packet(11,3000,1,false));
+  feed(reassembler,create_rtp_packet(13,3000,1,true));
+  CHECK(released.frames.size()==1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  reassembler.check_timeouts();
+  CHECK(released.frames.size()==2);
+  CHECK(!released.complete[1]);
+  CHECK(reassembler.get_stats().n_packets_lost==1);
+  // a packet of a released frame is late
+  feed(reassembler,create_rtp_packet(12,3000,1,false));
+  CHECK(reassembler.get_stats().n_packets_late==1);
+}
+
+// Without forward_incomplete_frames, the packets that arrived of the incomplete frame go to the dropped callback
+static void test_dropped_incomplete_frame(){
+  Released released;
+  FrameReassemblerOptions options{};
+  options.reorder_window=std::chrono::milliseconds(5);
+  options.forward_incomplete_frames=false;
+  int n_dropped_cb=0;
+  FrameReassembler reassembler{options,released.create_cb(),[&n_dropped_cb](const FrameReassembler::FRAME_FRAGMENTS& frame_fragments){
+    CHECK(frame_fragments.size()==1);
+    n_dropped_cb++;
+  }};
+  feed(reassembler,create_rtp_packet(10,0,1,true));
+  feed(reassembler,create_rtp_packet(12,3000,1,true));
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  reassembler.check_timeouts();
+  CHECK(released.frames.size()==1);
+  CHECK(n_dropped_cb==1);
+  CHECK(reassembler.get_stats().n_frames_dropped==1);
+}
+
+int main(){
+  test_complete_frames_in_order();
+  test_seq_unwrap();
+  test_reorder_across_wrap();
+  test_lost_packet();
+  test_dropped_incomplete_frame();
+  return 0;
+}
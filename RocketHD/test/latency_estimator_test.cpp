@@ -0,0 +1,91 @@
+#include <chrono>
+
+#include "latency_estimator.hpp"
+#include "test_helper.hpp"
+
+// The ground clock is this far ahead of the air clock
+static constexpr int64_t CLOCK_OFFSET_US=1000000;
+
+// Echo of the probe as the ground unit sends it, uplink_us / downlink_us: time on the link in each direction
+static latency_probe::LatencyProbeMessage create_echo(latency_probe::LatencyProbeMessage probe,uint64_t tx_us,int64_t uplink_us){
+  probe.type=latency_probe::Type::ECHO;
+  probe.air_tx_us=tx_us;
+  probe.ground_receive_us=tx_us+uplink_us+CLOCK_OFFSET_US;
+  probe.ground_send_us=probe.ground_receive_us+50;
+  return probe;
+}
+
+static void test_probe_interval(){
+  LatencyProbeOptions options{};
+  options.probe_interval=std::chrono::milliseconds(50);
+  LatencyEstimator estimator{options};
+  CHECK(estimator.create_probe(0,0,1000000).has_value());
+  CHECK(!estimator.create_probe(0,0,1000000+49999).has_value());
+  const auto probe=estimator.create_probe(1,900000,1000000+50000);
+  CHECK(probe.has_value());
+  CHECK(probe->sequence==1 && probe->stream_index==1 && probe->air_capture_us==900000 && probe->air_send_us==1050000);
+  // 0: every frame
+  options.probe_interval=std::chrono::milliseconds(0);
+  LatencyEstimator every_frame{options};
+  CHECK(every_frame.create_probe(0,0,1000).has_value());
+  CHECK(every_frame.create_probe(0,0,1000).has_value());
+}
+
+static void test_offset_and_latency(){
+  LatencyProbeOptions options{};
+  options.probe_interval=std::chrono::milliseconds(0);
+  LatencyEstimator estimator{options};
+  uint64_t now=10000000;
+  // symmetric link, 2ms each way - the offset is exact
+  for(int i=0;i<5;i++){
+    const auto probe=estimator.create_probe(0,now-20000,now);
+    CHECK(probe.has_value());
+    // 1ms in the tx queue
+    const auto tx_us=now+1000;
+    const auto echo=create_echo(probe.value(),tx_us,2000);
+    estimator.on_echo(echo,tx_us+2000+50+2000);
+    now+=33333;
+  }
+  const auto stats=estimator.get_stats_and_reset();
+  CHECK(stats.n_probes==5 && stats.n_echoes==5);
+  CHECK(stats.clock_offset_us.has_value() && stats.clock_offset_us.value()==CLOCK_OFFSET_US);
+  CHECK(stats.clock_offset_error_us==2000);
+  CHECK(stats.rtt_avg_us==4000 && stats.rtt_min_us==4000);
+  // close -> receive: 1ms queue + 2ms link, capture 20ms before close
+  CHECK(stats.close_to_receive_avg_us==3000 && stats.close_to_receive_max_us==3000);
+  CHECK(stats.capture_to_receive_avg_us==23000);
+  CHECK(stats.jitter_us==0);
+}
+
+// The offset comes from the echo with the smallest round trip time (the one that waited the least)
+static void test_offset_from_min_rtt(){
+  LatencyEstimator estimator{LatencyProbeOptions{}};
+  const uint64_t now=10000000;
+  const auto probe=estimator.create_probe(0,0,now);
+  // asymmetric: 20ms up (queued somewhere), 2ms down
+  estimator.on_echo(create_echo(probe.value(),now,20000),now+20000+50+2000);
+  const auto slow=estimator.get_stats_and_reset();
+  CHECK(slow.clock_offset_us.value()!=CLOCK_OFFSET_US);
+  estimator.on_echo(create_echo(probe.value(),now,2000),now+2000+50+2000);
+  const auto fast=estimator.get_stats_and_reset();
+  CHECK(fast.clock_offset_us.value()==CLOCK_OFFSET_US);
+}
+
+static void test_invalid_echoes_ignored(){
+  LatencyEstimator estimator{LatencyProbeOptions{}};
+  const uint64_t now=10000000;
+  const auto probe=estimator.create_probe(0,0,now);
+  // not an echo
+  estimator.on_echo(probe.value(),now+5000);
+  // received before it was sent
+  estimator.on_echo(create_echo(probe.value(),now,2000),now-1);
+  CHECK(estimator.get_stats_and_reset().n_echoes==0);
+}
+
+int main(){
+  test_probe_interval();
+  test_offset_and_latency();
+  test_offset_from_min_rtt();
+  test_invalid_echoes_ignored();
+  return 0;
+}
@@ -0,0 +1,160 @@
+#include <chrono>
+#include <cmath>
+
+#include "link_adaptation.hpp"
+#include "test_helper.hpp"
+
+using namespace std::chrono_literals;
+
+// Creates the cumulative reports the ground unit sends
+class FeedbackGenerator{
+ public:
+  link_feedback::LinkFeedbackMessage next(int n_received,int n_lost,int n_blocks,int n_blocks_lost,int8_t rssi_dbm){
+    m_message.sequence++;
+    m_message.rssi_dbm=rssi_dbm;
+    m_message.n_packets_received+=n_received;
+    m_message.n_packets_lost+=n_lost;
+    m_message.n_blocks_total+=n_blocks;
+    m_message.n_blocks_lost+=n_blocks_lost;
+    return m_message;
+  }
+ private:
+  link_feedback::LinkFeedbackMessage m_message{};
+};
+
+static void test_probability_block_lost(){
+  CHECK(link_adaptation::probability_block_lost(8,2,0)==0);
+  CHECK(link_adaptation::probability_block_lost(8,2,1)==1);
+  // no FEC, one fragment
+  CHECK(std::abs(link_adaptation::probability_block_lost(1,0,0.1)-0.1)<1e-9);
+  // 1 of 3 may be lost: 1-(0.5^3+3*0.5^3)
+  CHECK(std::abs(link_adaptation::probability_block_lost(2,1,0.5)-0.5)<1e-9);
+  // more FEC is never worse
+  for(int m=0;m<16;m++){
+    CHECK(link_adaptation::probability_block_lost(32,m+1,0.05)<=link_adaptation::probability_block_lost(32,m,0.05));
+  }
+}
+
+// A clean link with good rssi: the FEC overhead goes down to the minimum, the mcs index goes up one step at a time,
+// but not above the max
+static void test_clean_link(){
+  const LinkAdaptationOptions options{};
+  LinkAdaptationController controller{options,LinkAdaptationDecision{1,50,0},20};
+  FeedbackGenerator generator;
+  const auto now=std::chrono::steady_clock::now();
+  // the first report is only the reference for the next one
+  CHECK(!controller.on_feedback(generator.next(1000,0,30,0,-30),now).has_value());
+  int last_mcs=controller.get_current().mcs_index;
+  for(int i=0;i<200;i++){
+    controller.on_feedback(generator.next(1000,0,30,0,-30),now);
+    const auto current=controller.get_current();
+    CHECK(current.mcs_index==last_mcs || current.mcs_index==last_mcs+1);
+    last_mcs=current.mcs_index;
+  }
+  CHECK(controller.get_current().mcs_index==options.max_mcs_index);
+  CHECK(controller.get_current().fec_percentage==options.min_fec_percentage);
+}
+
+// Without rssi the loss alone decides: down on heavy loss, and back up one step at a time once the link is clean
+static void test_unknown_rssi(){
+  const LinkAdaptationOptions options{};
+  LinkAdaptationController controller{options,LinkAdaptationDecision{3,50,0},20};
+  FeedbackGenerator generator;
+  const auto now=std::chrono::steady_clock::now();
+  controller.on_feedback(generator.next(1000,0,30,0,0),now);
+  for(int i=0;i<20;i++){
+    controller.on_feedback(generator.next(600,400,30,15,0),now);
+  }
+  const int lowered_mcs=controller.get_current().mcs_index;
+  CHECK(lowered_mcs<3);
+  int last_mcs=lowered_mcs;
+  for(int i=0;i<200;i++){
+    controller.on_feedback(generator.next(1000,0,30,0,0),now);
+    const auto current=controller.get_current();
+    CHECK(current.mcs_index==last_mcs || current.mcs_index==last_mcs+1);
+    last_mcs=current.mcs_index;
+  }
+  CHECK(controller.get_current().mcs_index==options.max_mcs_index);
+}
+
+static void test_weak_rssi_and_loss(){
+  const LinkAdaptationOptions options{};
+  {
+    // weak signal - down to the min mcs index right away
+    LinkAdaptationController controller{options,LinkAdaptationDecision{4,20,0},20};
+    FeedbackGenerator generator;
+    const auto now=std::chrono::steady_clock::now();
+    controller.on_feedback(generator.next(1000,0,30,0,-30),now);
+    const auto decision=controller.on_feedback(generator.next(1000,0,30,0,-95),now);
+    CHECK(decision.has_value() && decision->mcs_index==options.min_mcs_index);
+  }
+  {
+    // heavy loss - more FEC, then a lower mcs index once the max FEC overhead is not enough
+    LinkAdaptationController controller{options,LinkAdaptationDecision{4,20,0},20};
+    FeedbackGenerator generator;
+    const auto now=std::chrono::steady_clock::now();
+    controller.on_feedback(generator.next(1000,0,30,0,-30),now);
+    controller.on_feedback(generator.next(800,200,30,5,-30),now);
+    CHECK(controller.get_current().fec_percentage>20);
+    for(int i=0;i<20;i++){
+      controller.on_feedback(generator.next(600,400,30,15,-30),now);
+    }
+    CHECK(controller.get_current().mcs_index<4);
+    CHECK(controller.get_current().fec_percentage==options.max_fec_percentage);
+  }
+}
+
+// Duplicate reports and a restarted ground unit (counters going back) don't produce decisions
+static void test_duplicate_and_restart(){
+  LinkAdaptationController controller{LinkAdaptationOptions{},LinkAdaptationDecision{4,20,0},20};
+  FeedbackGenerator generator;
+  const auto now=std::chrono::steady_clock::now();
+  controller.on_feedback(generator.next(1000,0,30,0,-30),now);
+  const auto lossy=generator.next(500,500,30,15,-30);
+  CHECK(controller.on_feedback(lossy,now).has_value());
+  const auto current=controller.get_current();
+  CHECK(!controller.on_feedback(lossy,now).has_value());
+  FeedbackGenerator restarted;
+  CHECK(!controller.on_feedback(restarted.next(10,0,1,0,-30),now).has_value());
+  CHECK(controller.get_current()==current);
+}
+
+static void test_timeout(){
+  LinkAdaptationOptions options{};
+  const auto start=std::chrono::steady_clock::now();
+  {
+    LinkAdaptationController controller{options,LinkAdaptationDecision{3,20,0},20};
+    FeedbackGenerator generator;
+    controller.on_feedback(generator.next(1000,0,30,0,-30),start);
+    controller.on_feedback(generator.next(500,500,30,15,-30),start);
+    CHECK(controller.get_current()!=(LinkAdaptationDecision{3,20,0}));
+    CHECK(!controller.check_timeout(start+options.feedback_timeout-1ms).has_value());
+    // back to the configured settings, once
+    const auto fallback=controller.check_timeout(start+options.feedback_timeout);
+    CHECK(fallback.has_value() && fallback.value()==(LinkAdaptationDecision{3,20,0}));
+    CHECK(!controller.check_timeout(start+options.feedback_timeout+1s).has_value());
+    // manually set settings become the fallback
+    controller.set_configured(LinkAdaptationDecision{2,40,8});
+    CHECK(controller.get_current()==(LinkAdaptationDecision{2,40,8}));
+    const auto later=start+10s;
+    controller.on_feedback(generator.next(1000,0,30,0,-30),later);
+    controller.on_feedback(generator.next(500,500,30,15,-30),later);
+    CHECK(controller.check_timeout(later+options.feedback_timeout).value()==(LinkAdaptationDecision{2,40,8}));
+  }
+  {
+    options.fallback_mcs_index=0;
+    options.fallback_fec_percentage=100;
+    LinkAdaptationController controller{options,LinkAdaptationDecision{3,20,0},20};
+    CHECK(controller.check_timeout(std::chrono::steady_clock::now()+options.feedback_timeout+1s).value()==(LinkAdaptationDecision{0,100,0}));
+  }
+}
+
+int main(){
+  test_probability_block_lost();
+  test_clean_link();
+  test_unknown_rssi();
+  test_weak_rssi_and_loss();
+  test_duplicate_and_restart();
+  test_timeout();
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include "memory_budget.hpp"
+#include "test_helper.hpp"
+
+static constexpr std::size_t TOTAL=100*1024*1024;
+
+static void test_stage_limits(){
+  MemoryBudget budget{TOTAL};
+  std::size_t sum=0;
+  for(int i=0;i<MemoryBudget::N_STAGES;i++){
+    const auto limit=budget.get_stage_limit(static_cast<MemoryBudget::Stage>(i));
+    CHECK(limit>0);
+    sum+=limit;
+  }
+  CHECK(sum<=budget.get_total_limit());
+}
+
+static void test_try_acquire_release(){
+  MemoryBudget budget{TOTAL};
+  const auto stage=MemoryBudget::Stage::TX_QUEUE;
+  const auto limit=budget.get_stage_limit(stage);
+  CHECK(budget.try_acquire(stage,limit-10));
+  CHECK(budget.get_held(stage)==limit-10);
+  CHECK(budget.get_total_held()==limit-10);
+  // over the stage limit - rejected, nothing accounted
+  CHECK(!budget.try_acquire(stage,11));
+  CHECK(budget.get_held(stage)==limit-10);
+  CHECK(budget.try_acquire(stage,10));
+  budget.release(stage,limit);
+  CHECK(budget.get_held(stage)==0);
+  CHECK(budget.get_total_held()==0);
+  // the other stages are independent
+  CHECK(budget.try_acquire(MemoryBudget::Stage::FRAME_ASSEMBLY,1));
+  CHECK(budget.get_held(stage)==0);
+}
+
+// Stages that only report what they hold can go over their share, the total still bounds the others
+static void test_total_limit(){
+  MemoryBudget budget{TOTAL};
+  budget.acquire(MemoryBudget::Stage::GST_QUEUES,TOTAL);
+  CHECK(budget.get_total_held()==TOTAL);
+  CHECK(!budget.try_acquire(MemoryBudget::Stage::TX_QUEUE,1));
+  CHECK(budget.get_held(MemoryBudget::Stage::TX_QUEUE)==0);
+  budget.release(MemoryBudget::Stage::GST_QUEUES,TOTAL);
+  CHECK(budget.try_acquire(MemoryBudget::Stage::TX_QUEUE,1));
+}
+
+static void test_debug_counts_rejections(){
+  MemoryBudget budget{TOTAL};
+  CHECK(!budget.try_acquire(MemoryBudget::Stage::BLOCK_POOL,TOTAL));
+  const auto debug=budget.createDebug();
+  CHECK(debug.find(MemoryBudget::stage_to_string(MemoryBudget::Stage::BLOCK_POOL))!=std::string::npos);
+}
+
+int main(){
+  test_stage_limits();
+  test_try_acquire_release();
+  test_total_limit();
+  test_debug_counts_rejections();
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "nv12_convert.hpp"
+#include "test_helper.hpp"
+
+// NV12 destination with the given padding rows and stride, filled with a marker value
+struct Nv12Buffer{
+  std::vector<uint8_t> y;
+  std::vector<uint8_t> uv;
+  nv12convert::Nv12Image image{};
+  Nv12Buffer(int width,int height,int padded_height,int stride)
+  : y(static_cast<std::size_t>(stride)*padded_height,0x55),
+    uv(static_cast<std::size_t>(stride)*padded_height/2,0x55){
+    image=nv12convert::Nv12Image{y.data(),stride,uv.data(),stride,width,height};
+  }
+};
+
+static std::vector<uint8_t> create_random_plane(std::size_t size,std::mt19937& rng){
+  std::vector<uint8_t> ret(size);
+  for(auto& value:ret){
+    value=static_cast<uint8_t>(rng());
+  }
+  return ret;
+}
+
+// Known values - the chroma planes are interleaved, 4:2:2 chroma rows are averaged (rounded)
+static void test_known_values(){
+  const int width=4;
+  const int height=2;
+  const std::vector<uint8_t> y{1,2,3,4,5,6,7,8};
+  {
+    const std::vector<uint8_t> u{10,20};
+    const std::vector<uint8_t> v{30,40};
+    Nv12Buffer dst{width,height,height,width};
+    nv12convert::i420_to_nv12(y.data(),width,u.data(),width/2,v.data(),width/2,dst.image);
+    CHECK(dst.y==y);
+    CHECK((dst.uv==std::vector<uint8_t>{10,30,20,40}));
+  }
+  {
+    // 4:2:2 - one chroma row per luma row
+    const std::vector<uint8_t> u{10,20,11,21};
+    const std::vector<uint8_t> v{30,40,30,41};
+    Nv12Buffer dst{width,height,height,width};
+    nv12convert::y42b_to_nv12(y.data(),width,u.data(),width/2,v.data(),width/2,dst.image);
+    CHECK(dst.y==y);
+    CHECK((dst.uv==std::vector<uint8_t>{11,30,21,41}));
+  }
+  {
+    // Y0 U Y1 V
+    const std::vector<uint8_t> yuy2{1,10,2,30,3,20,4,40, 5,11,6,30,7,21,8,41};
+    Nv12Buffer dst{width,height,height,width};
+    nv12convert::yuy2_to_nv12(yuy2.data(),width*2,dst.image);
+    CHECK(dst.y==y);
+    CHECK((dst.uv==std::vector<uint8_t>{11,30,21,41}));
+  }
+}
+
+// The vectorized kernels give the same result as the scalar reference, for widths that aren't a multiple of the
+// vector size and strides with padding bytes (which must not be touched)
+static void test_simd_matches_scalar(){
+  std::mt19937 rng{42};
+  for(const int width:{2,16,30,64,126,1920}){
+    const int height=6;
+    const int src_stride=width+7;
+    const int dst_stride=width+9;
+    const auto src_y=create_random_plane(static_cast<std::size_t>(src_stride)*height,rng);
+    const auto src_u=create_random_plane(static_cast<std::size_t>(src_stride)*height,rng);
+    const auto src_v=create_random_plane(static_cast<std::size_t>(src_stride)*height,rng);
+    const auto src_yuy2=create_random_plane(static_cast<std::size_t>(src_stride)*2*height,rng);
+    {
+      Nv12Buffer simd{width,height,height,dst_stride};
+      Nv12Buffer scalar{width,height,height,dst_stride};
+      nv12convert::i420_to_nv12(src_y.data(),src_stride,src_u.data(),src_stride,src_v.data(),src_stride,simd.image);
+      nv12convert::scalar::i420_to_nv12(src_y.data(),src_stride,src_u.data(),src_stride,src_v.data(),src_stride,scalar.image);
+      CHECK(simd.y==scalar.y && simd.uv==scalar.uv);
+    }
+    {
+      Nv12Buffer simd{width,height,height,dst_stride};
+      Nv12Buffer scalar{width,height,height,dst_stride};
+      nv12convert::y42b_to_nv12(src_y.data(),src_stride,src_u.data(),src_stride,src_v.data(),src_stride,simd.image);
+      nv12convert::scalar::y42b_to_nv12(src_y.data(),src_stride,src_u.data(),src_stride,src_v.data(),src_stride,scalar.image);
+      CHECK(simd.y==scalar.y && simd.uv==scalar.uv);
+    }
+    {
+      Nv12Buffer simd{width,height,height,dst_stride};
+      Nv12Buffer scalar{width,height,height,dst_stride};
+      nv12convert::yuy2_to_nv12(src_yuy2.data(),src_stride*2,simd.image);
+      nv12convert::scalar::yuy2_to_nv12(src_yuy2.data(),src_stride*2,scalar.image);
+      CHECK(simd.y==scalar.y && simd.uv==scalar.uv);
+    }
+  }
+}
+
+static void test_padding_rows(){
+  const int width=8;
+  const int height=4;
+  const int padded_height=8;
+  Nv12Buffer dst{width,height,padded_height,width};
+  nv12convert::fill_padding_rows(dst.image,padded_height);
+  for(int row=0;row<padded_height;row++){
+    for(int x=0;x<width;x++){
+      const auto luma=dst.y[row*width+x];
+      CHECK(row<height ? luma==0x55 : luma==16);
+    }
+  }
+  for(int row=0;row<padded_height/2;row++){
+    for(int x=0;x<width;x++){
+      const auto chroma=dst.uv[row*width+x];
+      CHECK(row<height/2 ? chroma==0x55 : chroma==128);
+    }
+  }
+}
+
+int main(){
+  test_known_values();
+  test_simd_matches_scalar();
+  test_padding_rows();
+  return 0;
+}
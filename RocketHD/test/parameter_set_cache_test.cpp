@@ -0,0 +1,99 @@
+#include <vector>
+
+#include "parameter_set_cache.hpp"
+#include "rtp_eof_helper.hpp"
+#include "test_helper.hpp"
+
+using test_helper::create_rtp_packet;
+
+// h265 NALU: 2 byte header (type, layer 0, tid 1) and some payload
+static std::vector<uint8_t> create_nalu(uint8_t type,uint8_t fill,std::size_t payload_size=6){
+  std::vector<uint8_t> ret{static_cast<uint8_t>(type<<1),1};
+  ret.insert(ret.end(),payload_size,fill);
+  return ret;
+}
+
+// rtp aggregation packet with the given NALUs
+static std::vector<uint8_t> create_ap_packet(uint16_t seq,const std::vector<std::vector<uint8_t>>& nalus){
+  std::vector<uint8_t> payload{48<<1,1};
+  for(const auto& nalu:nalus){
+    payload.push_back(static_cast<uint8_t>(nalu.size()>>8));
+    payload.push_back(static_cast<uint8_t>(nalu.size()));
+    payload.insert(payload.end(),nalu.begin(),nalu.end());
+  }
+  return create_rtp_packet(seq,3000,5,false,payload);
+}
+
+static void test_single_nalu_packets(){
+  H265ParameterSetCache cache;
+  const auto slice=create_rtp_packet(1,3000,5,true,create_nalu(1,0x11));
+  CHECK(cache.on_rtp_packet(slice.data(),slice.size())==0);
+  CHECK(!cache.create_rtp_packet(slice.data(),slice.size(),7,1500).has_value());
+  for(uint8_t type=32;type<=34;type++){
+    CHECK(!cache.is_complete());
+    const auto packet=create_rtp_packet(type,3000,5,false,create_nalu(type,type));
+    CHECK(cache.on_rtp_packet(packet.data(),packet.size())==1);
+  }
+  CHECK(cache.is_complete());
+  CHECK(cache.get_n_updates()==3);
+  // the same again is no update
+  const auto sps=create_rtp_packet(9,6000,5,false,create_nalu(33,33));
+  cache.on_rtp_packet(sps.data(),sps.size());
+  CHECK(cache.get_n_updates()==3);
+  const auto new_sps=create_rtp_packet(10,6000,5,false,create_nalu(33,0x99));
+  cache.on_rtp_packet(new_sps.data(),new_sps.size());
+  CHECK(cache.get_n_updates()==4);
+}
+
+// The packet created by the cache is an AP the cache (and the keyframe / parameter set helpers) parse again
+static void test_create_rtp_packet_round_trip(){
+  H265ParameterSetCache cache;
+  const std::vector<std::vector<uint8_t>> parameter_sets{create_nalu(32,0xA0),create_nalu(33,0xA1,20),create_nalu(34,0xA2,3)};
+  const auto ap=create_ap_packet(1,parameter_sets);
+  CHECK(cache.on_rtp_packet(ap.data(),ap.size())==3);
+  CHECK(cache.is_complete());
+  const auto frame_packet=create_rtp_packet(500,123456,0xCAFE,true,create_nalu(1,0x11));
+  const auto packet=cache.create_rtp_packet(frame_packet.data(),frame_packet.size(),499,1500);
+  CHECK(packet.has_value());
+  // header of the frame, given seq, no marker
+  CHECK(test_helper::get_seq(packet.value())==499);
+  CHECK(test_helper::get_timestamp(packet.value())==123456);
+  CHECK(test_helper::get_ssrc(packet.value())==0xCAFE);
+  CHECK((packet.value()[1] & 0x80)==0);
+  CHECK(packet->size()==ap.size());
+  std::vector<std::vector<uint8_t>> parsed;
+  CHECK(rtp_eof_helper::h265_for_each_parameter_set(packet->data(),packet->size(),[&parsed](uint8_t,const uint8_t* nalu,std::size_t nalu_size){
+    parsed.emplace_back(nalu,nalu+nalu_size);
+  })==3);
+  CHECK(parsed==parameter_sets);
+  // doesn't carry a slice, it is not a keyframe on its own
+  CHECK(!rtp_eof_helper::h265_is_keyframe(packet->data(),packet->size()));
+  CHECK(!rtp_eof_helper::h265_get_slice_nalu_type(packet->data(),packet->size()).has_value());
+  // too big for the mtu
+  CHECK(!cache.create_rtp_packet(frame_packet.data(),frame_packet.size(),499,packet->size()-1).has_value());
+}
+
+static void test_slice_nalu_types(){
+  const auto trail_r=create_rtp_packet(1,0,5,true,create_nalu(1,0));
+  CHECK(rtp_eof_helper::h265_get_slice_nalu_type(trail_r.data(),trail_r.size()).value()==1);
+  CHECK(!rtp_eof_helper::h265_is_non_reference_nalu_type(1));
+  CHECK(rtp_eof_helper::h265_is_non_reference_nalu_type(0));
+  // fragmentation unit, middle fragment of an IDR_W_RADL
+  const auto fu=create_rtp_packet(2,0,5,false,{49<<1,1,19,0xAA,0xBB});
+  CHECK(rtp_eof_helper::h265_get_slice_nalu_type(fu.data(),fu.size()).value()==19);
+  CHECK(!rtp_eof_helper::h265_is_keyframe(fu.data(),fu.size()));
+  // start fragment
+  const auto fu_start=create_rtp_packet(3,0,5,false,{49<<1,1,0x80 | 19,0xAA,0xBB});
+  CHECK(rtp_eof_helper::h265_is_keyframe(fu_start.data(),fu_start.size()));
+  CHECK(!rtp_eof_helper::h265_is_non_reference_nalu_type(19));
+  // parameter sets and a TRAIL_N slice in one AP
+  const auto ap=create_ap_packet(4,{create_nalu(32,0),create_nalu(0,0)});
+  CHECK(rtp_eof_helper::h265_get_slice_nalu_type(ap.data(),ap.size()).value()==0);
+}
+
+int main(){
+  test_single_nalu_packets();
+  test_create_rtp_packet_round_trip();
+  test_slice_nalu_types();
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "camera_settings.hpp"
+#include "rocket_config.hpp"
+#include "test_helper.hpp"
+
+static std::string write_temp_file(const std::string& content){
+  char path[]="/tmp/rocket_config_testXXXXXX";
+  const int fd=mkstemp(path);
+  CHECK(fd>=0);
+  close(fd);
+  std::ofstream file(path);
+  file<<content;
+  return path;
+}
+
+static void test_set_get_value(){
+  auto config=rocket_config::create_default();
+  rocket_config::set_value(config,"mcs_index","7");
+  CHECK(config.radiotap_params.mcs_index==7);
+  CHECK(rocket_config::get_value(config,"mcs_index")=="7");
+  rocket_config::set_value(config,"bandwidth","40");
+  CHECK(config.radiotap_params.bandwidth==40);
+  rocket_config::set_value(config,"simulcast","true");
+  CHECK(config.camera.simulcast_enable);
+  rocket_config::set_value(config,"keypair","");
+  CHECK(!config.options.keypair.has_value());
+}
+
+static void test_invalid_values(){
+  auto config=rocket_config::create_default();
+  const auto before=rocket_config::to_string(config);
+  CHECK_THROWS(rocket_config::set_value(config,"no_such_key","1"),std::runtime_error);
+  // single spatial stream only
+  CHECK_THROWS(rocket_config::set_value(config,"mcs_index","8"),std::runtime_error);
+  CHECK_THROWS(rocket_config::set_value(config,"mcs_index","-1"),std::runtime_error);
+  CHECK_THROWS(rocket_config::set_value(config,"bandwidth","30"),std::runtime_error);
+  CHECK_THROWS(rocket_config::set_value(config,"bandwidth","80"),std::runtime_error);
+  CHECK_THROWS(rocket_config::set_value(config,"fps","abc"),std::runtime_error);
+  CHECK_THROWS(rocket_config::set_value(config,"fps","30abc"),std::runtime_error);
+  CHECK_THROWS(rocket_config::set_value(config,"simulcast","yes please"),std::runtime_error);
+  CHECK_THROWS(rocket_config::set_value(config,"encoder","h264"),std::runtime_error);
+  // nothing changed
+  CHECK(rocket_config::to_string(config)==before);
+}
+
+static void test_apply_modes(){
+  CHECK(rocket_config::get_apply_mode("mcs_index").value()==rocket_config::ApplyMode::HOT);
+  CHECK(rocket_config::get_apply_mode("rtp_mtu").value()==rocket_config::ApplyMode::HOT);
+  CHECK(rocket_config::get_apply_mode("width").value()==rocket_config::ApplyMode::PIPELINE_SWAP);
+  CHECK(rocket_config::get_apply_mode("bandwidth").value()==rocket_config::ApplyMode::RESTART);
+  CHECK(!rocket_config::get_apply_mode("no_such_key").has_value());
+  for(const auto& key:rocket_config::get_keys()){
+    CHECK(rocket_config::get_apply_mode(key).has_value());
+  }
+}
+
+// A hot camera key has to reach the running stream (rocket calls GStreamerStream::update_settings for these)
+static void test_hot_camera_keys_change_the_stream(){
+  const std::vector<std::pair<std::string,std::string>> camera_keys{
+      {"bitrate_kbits","4000"},{"gop_size","60"},{"simulcast_bitrate_kbits","1000"},{"rtp_mtu","1200"},
+      {"parameter_set_interval_ms","500"}};
+  for(const auto& [key,value]:camera_keys){
+    CHECK(rocket_config::get_apply_mode(key).value()==rocket_config::ApplyMode::HOT);
+    const auto before=rocket_config::create_default();
+    auto after=before;
+    rocket_config::set_value(after,key,value);
+    CHECK(camera_settings_changed_live(before.camera,after.camera));
+    CHECK(!camera_settings_require_restart(before.camera,after.camera));
+  }
+  const auto config=rocket_config::create_default();
+  CHECK(!camera_settings_changed_live(config.camera,config.camera));
+}
+
+// to_string / save_file write what load_file reads
+static void test_file_round_trip(){
+  auto config=rocket_config::create_default();
+  rocket_config::set_value(config,"mcs_index","2");
+  rocket_config::set_value(config,"fps","60");
+  rocket_config::set_value(config,"test_pattern","ball");
+  const auto path=write_temp_file("");
+  rocket_config::save_file(config,path);
+  const auto loaded=rocket_config::load_file(path);
+  CHECK(rocket_config::to_string(loaded)==rocket_config::to_string(config));
+  std::remove(path.c_str());
+}
+
+static void test_load_file_errors(){
+  {
+    // comments, blank lines and whitespace are fine
+    const auto path=write_temp_file("# comment\n\n  fps = 25  # trailing comment\n");
+    CHECK(rocket_config::load_file(path).camera.fps==25);
+    std::remove(path.c_str());
+  }
+  {
+    const auto path=write_temp_file("fps=25\nmcs_index=9\n");
+    try{
+      rocket_config::load_file(path);
+      CHECK(false);
+    }catch (const std::runtime_error& e){
+      // with the line number
+      CHECK(std::string(e.what()).find(path+":2:")==0);
+    }
+    std::remove(path.c_str());
+  }
+  {
+    const auto path=write_temp_file("fps\n");
+    CHECK_THROWS(rocket_config::load_file(path),std::runtime_error);
+    std::remove(path.c_str());
+  }
+  CHECK_THROWS(rocket_config::load_file("/nonexistent/rocket.conf"),std::runtime_error);
+}
+
+int main(){
+  test_set_get_value();
+  test_invalid_values();
+  test_apply_modes();
+  test_hot_camera_keys_change_the_stream();
+  test_file_round_trip();
+  test_load_file_errors();
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <chrono>
+#include <vector>
+
+#include "frame_reassembler.hpp"
+#include "rtp_stream_rewriter.hpp"
+#include "test_helper.hpp"
+
+using test_helper::create_rtp_packet;
+
+// What the reassembler released, in order
+struct Released{
+  std::vector<FrameReassembler::FRAME_FRAGMENTS> frames;
+  std::vector<bool> complete;
+  FrameReassembler::FRAME_CALLBACK create_cb(){
+    return [this](const FrameReassembler::FRAME_FRAGMENTS& frame_fragments,bool frame_complete){
+      frames.push_back(frame_fragments);
+      complete.push_back(frame_complete);
+    };
+  }
+};
+
+static void feed(FrameReassembler& reassembler,const std::vector<uint8_t>& packet){
+  reassembler.on_new_packet(packet.data(),packet.size());
+}
+
+// Simulcast switch (or pipeline swap): the new source has its own SSRC, sequence numbers and timestamps.
+// Without the rewriter the ground would drop all of its packets as late, with it the stream just continues.
+static void test_simulcast_switch(){
+  for(const bool rewrite:{false,true}){
+    Released released;
+    FrameReassembler reassembler{FrameReassemblerOptions{},released.create_cb()};
+    RtpStreamRewriter rewriter{0x1234};
+    auto now=std::chrono::steady_clock::now();
+    auto send=[&](std::vector<uint8_t> packet){
+      if(rewrite){
+        CHECK(rewriter.rewrite_packet(packet.data(),packet.size(),now));
+      }
+      feed(reassembler,packet);
+    };
+    // high stream
+    for(int frame=0;frame<2;frame++){
+      send(create_rtp_packet(100+frame*2,frame*3000,1,false));
+      send(create_rtp_packet(101+frame*2,frame*3000,1,true));
+    }
+    CHECK(released.frames.size()==2);
+    now+=std::chrono::milliseconds(33);
+    // low stream, starting with its keyframe - its sequence numbers are "in the past" of the high stream
+    for(int frame=0;frame<2;frame++){
+      send(create_rtp_packet(60000+frame*2,500000+frame*3000,2,false));
+      send(create_rtp_packet(60001+frame*2,500000+frame*3000,2,true));
+      now+=std::chrono::milliseconds(33);
+    }
+    const auto stats=reassembler.get_stats();
+    if(!rewrite){
+      CHECK(released.frames.size()==2);
+      CHECK(stats.n_packets_late==4);
+      continue;
+    }
+    CHECK(released.frames.size()==4);
+    for(const auto complete:released.complete){
+      CHECK(complete);
+    }
+    CHECK(stats.n_packets_late==0 && stats.n_packets_lost==0);
+    // one stream: same SSRC, the sequence numbers continue, the timestamp advanced by the elapsed time (90kHz)
+    const auto& last_high=*released.frames[1].back();
+    const auto& first_low=*released.frames[2].front();
+    CHECK(test_helper::get_ssrc(last_high)==0x1234 && test_helper::get_ssrc(first_low)==0x1234);
+    CHECK(test_helper::get_seq(first_low)==test_helper::get_seq(last_high)+1);
+    CHECK(test_helper::get_timestamp(first_low)==test_helper::get_timestamp(last_high)+33*90);
+    CHECK(rewriter.get_n_source_changes()==1);
+  }
+}
+
+// After reset() (new pipeline) the same SSRC starts a new source, too
+static void test_rewriter_reset(){
+  RtpStreamRewriter rewriter{7};
+  const auto now=std::chrono::steady_clock::now();
+  auto a=create_rtp_packet(500,1000,1,true);
+  rewriter.rewrite_packet(a.data(),a.size(),now);
+  rewriter.reset();
+  auto b=create_rtp_packet(20000,90000,1,true);
+  rewriter.rewrite_packet(b.data(),b.size(),now);
+  CHECK(test_helper::get_seq(b)==test_helper::get_seq(a)+1);
+  // no time elapsed, the timestamp still advances
+  CHECK(test_helper::get_timestamp(b)==test_helper::get_timestamp(a)+1);
+  // within a source, gaps are kept
+  auto c=create_rtp_packet(20002,93000,1,true);
+  rewriter.rewrite_packet(c.data(),c.size(),now);
+  CHECK(test_helper::get_seq(c)==test_helper::get_seq(b)+2);
+  CHECK(test_helper::get_timestamp(c)==test_helper::get_timestamp(b)+3000);
+  // not rtp
+  std::vector<uint8_t> probe(52,0x50);
+  CHECK(!rewriter.rewrite_packet(probe.data(),probe.size(),now));
+  CHECK(probe[0]==0x50);
+}
+
+int main(){
+  test_simulcast_switch();
+  test_rewriter_reset();
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include <chrono>
+
+#include "simulcast_selector.hpp"
+#include "test_helper.hpp"
+
+static SimulcastLinkState create_state(double high_stream_airtime_fraction,int queue_delay_ms=0,uint64_t n_video_blocks_dropped=0){
+  SimulcastLinkState state{};
+  state.high_stream_airtime_fraction=high_stream_airtime_fraction;
+  state.video_queue_delay=std::chrono::milliseconds(queue_delay_ms);
+  state.n_video_blocks_dropped=n_video_blocks_dropped;
+  return state;
+}
+
+static void test_switch_down_on_airtime(){
+  SimulcastSelector selector{SimulcastSelectorOptions{}};
+  const auto now=std::chrono::steady_clock::now();
+  CHECK(selector.on_link_state(create_state(0.5),now)==SimulcastSelector::STREAM_HIGH);
+  CHECK(selector.on_link_state(create_state(0.61),now)==SimulcastSelector::STREAM_LOW);
+  CHECK(selector.get_selected()==SimulcastSelector::STREAM_LOW);
+}
+
+static void test_switch_down_on_congestion(){
+  {
+    SimulcastSelector selector{SimulcastSelectorOptions{}};
+    CHECK(selector.on_link_state(create_state(0.1,31))==SimulcastSelector::STREAM_LOW);
+  }
+  {
+    // only new drops count
+    SimulcastSelector selector{SimulcastSelectorOptions{}};
+    const auto now=std::chrono::steady_clock::now();
+    CHECK(selector.on_link_state(create_state(0.1,0,0),now)==SimulcastSelector::STREAM_HIGH);
+    CHECK(selector.on_link_state(create_state(0.1,0,1),now)==SimulcastSelector::STREAM_LOW);
+  }
+}
+
+// Back to the high stream only after the link was good (with margin) for min_good_duration_before_switch_up
+static void test_switch_up_hysteresis(){
+  SimulcastSelectorOptions options{};
+  SimulcastSelector selector{options};
+  auto now=std::chrono::steady_clock::now();
+  CHECK(selector.on_link_state(create_state(0.7),now)==SimulcastSelector::STREAM_LOW);
+  // fits, but not with the margin (0.6*0.8)
+  now+=std::chrono::seconds(10);
+  CHECK(selector.on_link_state(create_state(0.5),now)==SimulcastSelector::STREAM_LOW);
+  CHECK(selector.on_link_state(create_state(0.4),now)==SimulcastSelector::STREAM_LOW);
+  now+=options.min_good_duration_before_switch_up-std::chrono::milliseconds(1);
+  CHECK(selector.on_link_state(create_state(0.4),now)==SimulcastSelector::STREAM_LOW);
+  // congestion in between starts the good period again
+  CHECK(selector.on_link_state(create_state(0.4,100),now)==SimulcastSelector::STREAM_LOW);
+  CHECK(selector.on_link_state(create_state(0.4),now)==SimulcastSelector::STREAM_LOW);
+  now+=options.min_good_duration_before_switch_up;
+  CHECK(selector.on_link_state(create_state(0.4),now)==SimulcastSelector::STREAM_HIGH);
+}
+
+int main(){
+  test_switch_down_on_airtime();
+  test_switch_down_on_congestion();
+  test_switch_up_hysteresis();
+  return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef TEST_HELPER_H_
+#define TEST_HELPER_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Unit tests: one executable per module (see CMakeLists.txt, run with ctest), each test is a function called from
+// main. A failing CHECK prints where it failed and ends the executable with 1.
+
+#define CHECK(condition) do{ \
+    if(!(condition)){ \
+      fprintf(stderr,"%s:%d: CHECK(%s) failed\n",__FILE__,__LINE__,#condition); \
+      exit(1); \
+    } \
+  }while(0)
+
+// exception_type has to be thrown by the statement
+#define CHECK_THROWS(statement,exception_type) do{ \
+    bool thrown=false; \
+    try{ statement; }catch (const exception_type&){ thrown=true; } \
+    if(!thrown){ \
+      fprintf(stderr,"%s:%d: %s didn't throw %s\n",__FILE__,__LINE__,#statement,#exception_type); \
+      exit(1); \
+    } \
+  }while(0)
+
+namespace test_helper{
+
+// rtp packet (version 2, payload type 96) with the given payload after the 12 byte header
+inline std::vector<uint8_t> create_rtp_packet(uint16_t seq,uint32_t timestamp,uint32_t ssrc,bool marker,
+                                              const std::vector<uint8_t>& payload={0xAA,0xBB}){
+  std::vector<uint8_t> ret{
+      0x80,static_cast<uint8_t>(96 | (marker ? 0x80 : 0)),
+      static_cast<uint8_t>(seq>>8),static_cast<uint8_t>(seq),
+      static_cast<uint8_t>(timestamp>>24),static_cast<uint8_t>(timestamp>>16),static_cast<uint8_t>(timestamp>>8),static_cast<uint8_t>(timestamp),
+      static_cast<uint8_t>(ssrc>>24),static_cast<uint8_t>(ssrc>>16),static_cast<uint8_t>(ssrc>>8),static_cast<uint8_t>(ssrc)};
+  ret.insert(ret.end(),payload.begin(),payload.end());
+  return ret;
+}
+
+inline uint16_t get_seq(const std::vector<uint8_t>& packet){
+  return static_cast<uint16_t>((packet[2]<<8) | packet[3]);
+}
+
+inline uint32_t get_timestamp(const std::vector<uint8_t>& packet){
+  return (static_cast<uint32_t>(packet[4])<<24) | (static_cast<uint32_t>(packet[5])<<16) | (static_cast<uint32_t>(packet[6])<<8) | packet[7];
+}
+
+inline uint32_t get_ssrc(const std::vector<uint8_t>& packet){
+  return (static_cast<uint32_t>(packet[8])<<24) | (static_cast<uint32_t>(packet[9])<<16) | (static_cast<uint32_t>(packet[10])<<8) | packet[11];
+}
+
+}
+
+#endif  // TEST_HELPER_H_